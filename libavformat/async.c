@@ -27,16 +27,25 @@
  *      support work with concatdec, hls
  */
 
+#include "libavutil/application.h"
 #include "libavutil/avassert.h"
 #include "libavutil/avstring.h"
 #include "libavutil/error.h"
-#include "libavutil/fifo.h"
 #include "libavutil/log.h"
+#include "libavutil/mathematics.h"
+#include "libavutil/mem.h"
 #include "libavutil/opt.h"
 #include "libavutil/thread.h"
+#include "libavutil/time.h"
+#include "libavutil/tree.h"
+#include "os_support.h"
 #include "url.h"
+#include <stdatomic.h>
 #include <stdint.h>
 
+#if HAVE_IO_H
+#include <io.h>
+#endif
 #if HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -44,99 +53,254 @@
 #define BUFFER_CAPACITY         (4 * 1024 * 1024)
 #define READ_BACK_CAPACITY      (4 * 1024 * 1024)
 #define SHORT_SEEK_THRESHOLD    (256 * 1024)
+#define READ_CHUNK_SIZE         (4 * 1024)
+#define MAX_READ_CHUNK_SIZE     (256 * 1024)
+
+/* adaptive mode: chunk size is re-evaluated over windows of this length and
+ * sized for roughly ADAPTIVE_READS_PER_SEC reads per second */
+#define ADAPTIVE_WINDOW_US      (200 * 1000)
+#define ADAPTIVE_READS_PER_SEC  100
+/* adaptive mode: ring capacity is 1/ADAPTIVE_MEM_DIVISOR of physical memory */
+#define ADAPTIVE_MEM_DIVISOR    512
+#define ADAPTIVE_MIN_CAPACITY   (512 * 1024)
+
+#define STATISTIC_INTERVAL      200
+
+#define SPILL_MAX_SIZE          (512 * 1024 * 1024)
 
+/*
+ * Single-producer/single-consumer ring.
+ *
+ * All positions are free-running byte counters, the byte at position p lives
+ * at buffer[p % size]. write_pos and evict_pos are only advanced by the
+ * background thread, read_pos and drain_pos are only advanced by the reading
+ * thread, so neither side needs the mutex to move data. [drain_pos, read_pos)
+ * is the read-back window kept for short backward seeks, [evict_pos,
+ * drain_pos) has been released by the reader but not been handed to evict()
+ * yet, the writer does not reuse it before.
+ */
 typedef struct RingBuffer
 {
-    AVFifoBuffer *fifo;
+    uint8_t      *buffer;
+    int           size;
     int           read_back_capacity;
 
-    int           read_pos;
+    atomic_int_least64_t write_pos;
+    atomic_int_least64_t drain_pos;
+    int64_t       read_pos;
+    int64_t       evict_pos;
+
+    /* called by the background thread with data about to be dropped */
+    void        (*evict)(void *opaque, const uint8_t *buf, int size, int64_t pos);
+    void         *evict_opaque;
 } RingBuffer;
 
+/*
+ * Second tier behind the ring: data dropped from the ring is appended to a
+ * temp file used as a circular log of max_size bytes, so the oldest data is
+ * recycled once it is full. SpillEntry ranges, indexed by logical position
+ * in the tree and kept in write order in the queue, record what the file
+ * holds; they never overlap. The background thread writes, the reading
+ * thread looks up and reads, both under the spill mutex.
+ */
+typedef struct SpillEntry {
+    int64_t logical_pos;
+    int64_t size;
+    int64_t file_pos;   /**< log position of logical_pos */
+} SpillEntry;
+
+typedef struct SpillFile {
+    int                fd;
+    struct AVTreeNode *root;
+    SpillEntry       **queue;
+    int                nb_queue;
+    int64_t            write_pos;   /**< bytes appended to the log so far */
+    int64_t            size;
+    int64_t            max_size;
+    int64_t            hit;
+    pthread_mutex_t    mutex;
+} SpillFile;
+
 typedef struct Context {
     AVClass        *class;
     URLContext     *inner;
 
-    int             seek_request;
+    atomic_int      seek_request;
     int64_t         seek_pos;
     int             seek_whence;
     int             seek_completed;
     int64_t         seek_ret;
 
-    int             inner_io_error;
     int             io_error;
     int             io_eof_reached;
 
     int64_t         logical_pos;
     int64_t         logical_size;
     RingBuffer      ring;
+    /* logical position of ring position 0 */
+    int64_t         ring_base;
+
+    SpillFile       spill;
+    /* while logical_pos < spill_read_end data comes from the spill file and
+     * the ring cursor waits at spill_read_end */
+    int64_t         spill_read_end;
+
+    /* set while a side is blocked on its condition, see async_wakeup_*() */
+    atomic_int      main_waiting;
+    atomic_int      background_waiting;
+    int64_t         wakeup_count;
 
     pthread_cond_t  cond_wakeup_main;
     pthread_cond_t  cond_wakeup_background;
     pthread_mutex_t mutex;
     pthread_t       async_buffer_thread;
 
-    int             abort_request;
+    atomic_int      abort_request;
     AVIOInterruptCB interrupt_callback;
+
+    /* background thread only */
+    int             chunk_size;
+    int64_t         window_start;
+    int64_t         window_bytes;
+
+    /* read speed reported by the background thread */
+    int64_t         speed_window_start;
+    int64_t         speed_window_bytes;
+    int             speed_throttled;
+
+    /* buffer statistic reported by the reading thread */
+    int64_t         last_statistic_time;
+
+    AVApplicationContext *app_ctx;
+
+    /* options */
+    int             buffer_capacity;
+    int             read_back_capacity;
+    int             short_seek_threshold;
+    int             read_chunk_size;
+    int             max_read_chunk_size;
+    int             adaptive;
+    int             statistic_interval;
+    int64_t         app_ctx_intptr;
+    int             spill_enabled;
+    int64_t         spill_max_size;
 } Context;
 
 static int ring_init(RingBuffer *ring, unsigned int capacity, int read_back_capacity)
 {
     memset(ring, 0, sizeof(RingBuffer));
-    ring->fifo = av_fifo_alloc(capacity + read_back_capacity);
-    if (!ring->fifo)
+    ring->buffer = av_malloc(capacity + read_back_capacity);
+    if (!ring->buffer)
         return AVERROR(ENOMEM);
 
+    ring->size               = capacity + read_back_capacity;
     ring->read_back_capacity = read_back_capacity;
+    atomic_init(&ring->write_pos, 0);
+    atomic_init(&ring->drain_pos, 0);
+    ring->evict_pos = 0;
     return 0;
 }
 
 static void ring_destroy(RingBuffer *ring)
 {
-    av_fifo_freep(&ring->fifo);
+    av_freep(&ring->buffer);
+}
+
+static void ring_evict(RingBuffer *ring, int64_t from, int64_t to)
+{
+    while (from < to) {
+        int offset = (int)(from % ring->size);
+        int len    = (int)FFMIN(to - from, ring->size - offset);
+        ring->evict(ring->evict_opaque, ring->buffer + offset, len, from);
+        from += len;
+    }
 }
 
+/* writer side, hands the data released by the reader to evict() */
+static void ring_flush_evicted(RingBuffer *ring)
+{
+    int64_t drain_pos = atomic_load(&ring->drain_pos);
+
+    if (ring->evict)
+        ring_evict(ring, ring->evict_pos, drain_pos);
+    ring->evict_pos = drain_pos;
+}
+
+/* only valid while the reading thread is parked, e.g. waiting for a seek */
 static void ring_reset(RingBuffer *ring)
 {
-    av_fifo_reset(ring->fifo);
-    ring->read_pos = 0;
+    if (ring->evict)
+        ring_evict(ring, ring->evict_pos, atomic_load(&ring->write_pos));
+    atomic_store(&ring->write_pos, 0);
+    atomic_store(&ring->drain_pos, 0);
+    ring->read_pos  = 0;
+    ring->evict_pos = 0;
 }
 
+/* reader side */
 static int ring_size(RingBuffer *ring)
 {
-    return av_fifo_size(ring->fifo) - ring->read_pos;
+    return (int)(atomic_load_explicit(&ring->write_pos, memory_order_acquire) - ring->read_pos);
 }
 
+/* writer side, space freed since the last ring_flush_evicted() is not counted */
 static int ring_space(RingBuffer *ring)
 {
-    return av_fifo_space(ring->fifo);
+    int64_t used = atomic_load_explicit(&ring->write_pos, memory_order_relaxed) -
+                   ring->evict_pos;
+    return ring->size - (int)used;
 }
 
-static int ring_generic_read(RingBuffer *ring, void *dest, int buf_size, void (*func)(void*, void*, int))
+/* writer side, whether the reader released data since the last flush */
+static int ring_released(RingBuffer *ring)
 {
-    int ret;
+    return atomic_load(&ring->drain_pos) != ring->evict_pos;
+}
+
+/* reader side, returns the number of bytes released to the writer */
+static int ring_read(RingBuffer *ring, void *dest, int buf_size)
+{
+    int64_t drain_pos = atomic_load_explicit(&ring->drain_pos, memory_order_relaxed);
+    int64_t pos       = ring->read_pos;
+    int     left      = buf_size;
 
     av_assert2(buf_size <= ring_size(ring));
-    ret = av_fifo_generic_peek_at(ring->fifo, dest, ring->read_pos, buf_size, func);
+    while (dest && left > 0) {
+        int offset = (int)(pos % ring->size);
+        int len    = FFMIN(left, ring->size - offset);
+        memcpy(dest, ring->buffer + offset, len);
+        dest  = (uint8_t *)dest + len;
+        pos  += len;
+        left -= len;
+    }
     ring->read_pos += buf_size;
 
-    if (ring->read_pos > ring->read_back_capacity) {
-        av_fifo_drain(ring->fifo, ring->read_pos - ring->read_back_capacity);
-        ring->read_pos = ring->read_back_capacity;
+    if (ring->read_pos - drain_pos > ring->read_back_capacity) {
+        atomic_store(&ring->drain_pos, ring->read_pos - ring->read_back_capacity);
+        return (int)(ring->read_pos - ring->read_back_capacity - drain_pos);
     }
 
-    return ret;
+    return 0;
+}
+
+/* writer side, contiguous free span starting at write_pos */
+static uint8_t *ring_write_span(RingBuffer *ring, int *size)
+{
+    int64_t write_pos = atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+    int     offset    = (int)(write_pos % ring->size);
+
+    *size = FFMIN(ring_space(ring), ring->size - offset);
+    return ring->buffer + offset;
 }
 
-static int ring_generic_write(RingBuffer *ring, void *src, int size, int (*func)(void*, void*, int))
+static void ring_commit(RingBuffer *ring, int size)
 {
-    av_assert2(size <= ring_space(ring));
-    return av_fifo_generic_write(ring->fifo, src, size, func);
+    atomic_fetch_add(&ring->write_pos, size);
 }
 
 static int ring_size_of_read_back(RingBuffer *ring)
 {
-    return ring->read_pos;
+    return (int)(ring->read_pos - atomic_load_explicit(&ring->drain_pos, memory_order_relaxed));
 }
 
 static int ring_drain(RingBuffer *ring, int offset)
@@ -147,30 +311,366 @@ static int ring_drain(RingBuffer *ring, int offset)
     return 0;
 }
 
+static int spill_cmp(const void *key, const void *node)
+{
+    return FFDIFFSIGN(*(const int64_t *)key, ((const SpillEntry *) node)->logical_pos);
+}
+
+static int spill_init(URLContext *h, SpillFile *spill, int64_t max_size)
+{
+    char *filename;
+
+    spill->max_size = max_size;
+    spill->fd = avpriv_tempfile("ffasync", &filename, 0, h);
+    if (spill->fd < 0) {
+        av_log(h, AV_LOG_ERROR, "Failed to create spill file\n");
+        return spill->fd;
+    }
+
+    if (unlink(filename) < 0)
+        av_log(h, AV_LOG_WARNING, "Could not delete %s.\n", filename);
+    av_free(filename);
+    return 0;
+}
+
+static int spill_free_entry(void *opaque, void *elem)
+{
+    av_free(elem);
+    return 0;
+}
+
+static void spill_destroy(SpillFile *spill)
+{
+    if (spill->fd >= 0)
+        close(spill->fd);
+    spill->fd = -1;
+    av_tree_enumerate(spill->root, NULL, NULL, spill_free_entry);
+    av_tree_destroy(spill->root);
+    spill->root = NULL;
+    av_freep(&spill->queue);
+    spill->nb_queue = 0;
+}
+
+/* returns the range holding pos, if any, and in *following the first range
+ * past pos */
+static SpillEntry *spill_find(SpillFile *spill, int64_t pos, SpillEntry **following)
+{
+    SpillEntry *entry, *next[2] = {NULL, NULL};
+
+    entry = av_tree_find(spill->root, &pos, spill_cmp, (void **)next);
+    if (following)
+        *following = next[1];
+    if (!entry)
+        entry = next[0];
+    if (entry && pos < entry->logical_pos + entry->size)
+        return entry;
+    return NULL;
+}
+
+static void spill_tree_remove(SpillFile *spill, SpillEntry *entry)
+{
+    struct AVTreeNode *node = NULL;
+
+    av_tree_insert(&spill->root, entry, spill_cmp, &node);
+    av_free(node);
+}
+
+static int spill_tree_add(SpillFile *spill, SpillEntry *entry)
+{
+    struct AVTreeNode *node = av_tree_node_alloc();
+
+    if (!node)
+        return AVERROR(ENOMEM);
+    av_tree_insert(&spill->root, entry, spill_cmp, &node);
+    av_free(node);
+    return 0;
+}
+
+/* forget everything written before log position end, it is overwritten next */
+static void spill_recycle(SpillFile *spill, int64_t end)
+{
+    while (spill->nb_queue && spill->queue[0]->file_pos < end) {
+        SpillEntry *entry = spill->queue[0];
+        int64_t     cut   = FFMIN(end - entry->file_pos, entry->size);
+
+        spill_tree_remove(spill, entry);
+        entry->logical_pos += cut;
+        entry->file_pos    += cut;
+        entry->size        -= cut;
+        spill->size        -= cut;
+        if (entry->size > 0 && spill_tree_add(spill, entry) >= 0)
+            break;
+
+        spill->size -= entry->size;
+        av_free(entry);
+        memmove(spill->queue, spill->queue + 1, --spill->nb_queue * sizeof(*spill->queue));
+    }
+}
+
+/* append a range the spill does not hold yet */
+static int spill_append(URLContext *h, SpillFile *spill, const uint8_t *buf, int size, int64_t pos)
+{
+    while (size > 0) {
+        SpillEntry *last;
+        int64_t     offset = spill->write_pos % spill->max_size;
+        int         len    = (int)FFMIN(size, spill->max_size - offset);
+        int         ret, done;
+
+        spill_recycle(spill, spill->write_pos + len - spill->max_size);
+        last = spill->nb_queue ? spill->queue[spill->nb_queue - 1] : NULL;
+
+        if (lseek(spill->fd, offset, SEEK_SET) < 0) {
+            av_log(h, AV_LOG_ERROR, "seek in spill file failed\n");
+            return AVERROR(errno);
+        }
+        for (done = 0; done < len; done += ret) {
+            ret = write(spill->fd, buf + done, len - done);
+            if (ret <= 0) {
+                av_log(h, AV_LOG_ERROR, "write in spill file failed\n");
+                return ret < 0 ? AVERROR(errno) : AVERROR(EIO);
+            }
+        }
+
+        if (last && last->logical_pos + last->size == pos &&
+            last->file_pos + last->size == spill->write_pos) {
+            last->size += len;
+        } else {
+            SpillEntry *entry = av_malloc(sizeof(*entry));
+            if (!entry)
+                return AVERROR(ENOMEM);
+            entry->logical_pos = pos;
+            entry->size        = len;
+            entry->file_pos    = spill->write_pos;
+            if ((ret = av_dynarray_add_nofree(&spill->queue, &spill->nb_queue, entry)) < 0) {
+                av_free(entry);
+                return ret;
+            }
+            if ((ret = spill_tree_add(spill, entry)) < 0) {
+                spill->nb_queue--;
+                av_free(entry);
+                return ret;
+            }
+        }
+
+        spill->write_pos += len;
+        spill->size      += len;
+        buf  += len;
+        pos  += len;
+        size -= len;
+    }
+    return 0;
+}
+
+/* ring eviction callback, runs on the background thread */
+static void spill_write(void *opaque, const uint8_t *buf, int size, int64_t ring_pos)
+{
+    URLContext *h     = opaque;
+    Context    *c     = h->priv_data;
+    SpillFile  *spill = &c->spill;
+    int64_t     pos   = c->ring_base + ring_pos;
+
+    if (spill->fd < 0)
+        return;
+
+    pthread_mutex_lock(&spill->mutex);
+    while (size > 0) {
+        SpillEntry *following;
+        SpillEntry *entry = spill_find(spill, pos, &following);
+        int         len;
+
+        if (entry) {
+            /* already held, the content is the same */
+            len = (int)FFMIN(size, entry->logical_pos + entry->size - pos);
+        } else {
+            len = following ? (int)FFMIN(size, following->logical_pos - pos) : size;
+            if (spill_append(h, spill, buf, len, pos) < 0)
+                break;
+        }
+        buf  += len;
+        pos  += len;
+        size -= len;
+    }
+    pthread_mutex_unlock(&spill->mutex);
+}
+
+/* returns AVERROR(EAGAIN) if the data has been recycled since the seek */
+static int spill_read(URLContext *h, unsigned char *buf, int size)
+{
+    Context    *c     = h->priv_data;
+    SpillFile  *spill = &c->spill;
+    SpillEntry *entry;
+    int64_t     offset;
+    int         ret;
+
+    pthread_mutex_lock(&spill->mutex);
+    entry = spill_find(spill, c->logical_pos, NULL);
+    if (!entry) {
+        pthread_mutex_unlock(&spill->mutex);
+        return AVERROR(EAGAIN);
+    }
+
+    offset = (entry->file_pos + c->logical_pos - entry->logical_pos) % spill->max_size;
+    size   = (int)FFMIN(size, c->spill_read_end - c->logical_pos);
+    size   = (int)FFMIN(size, entry->logical_pos + entry->size - c->logical_pos);
+    size   = (int)FFMIN(size, spill->max_size - offset);
+    if (lseek(spill->fd, offset, SEEK_SET) < 0)
+        ret = AVERROR(errno);
+    else if ((ret = read(spill->fd, buf, size)) < 0)
+        ret = AVERROR(errno);
+    else if (ret == 0)
+        ret = AVERROR(EIO);
+    pthread_mutex_unlock(&spill->mutex);
+
+    if (ret > 0)
+        c->logical_pos += ret;
+    return ret;
+}
+
 static int async_check_interrupt(void *arg)
 {
     URLContext *h   = arg;
     Context    *c   = h->priv_data;
 
-    if (c->abort_request)
+    if (atomic_load(&c->abort_request))
         return 1;
 
     if (ff_check_interrupt(&c->interrupt_callback))
-        c->abort_request = 1;
+        atomic_store(&c->abort_request, 1);
 
-    return c->abort_request;
+    return atomic_load(&c->abort_request);
 }
 
-static int wrapped_url_read(void *src, void *dst, int size)
+/*
+ * The *_waiting flag is raised under the mutex before the waiter re-checks
+ * the ring, and the other side publishes its position before looking at the
+ * flag, so the signal can only be skipped when the waiter is going to see
+ * the new position anyway.
+ */
+static void async_wakeup_main(Context *c)
 {
-    URLContext *h   = src;
-    Context    *c   = h->priv_data;
-    int         ret;
+    if (!atomic_load(&c->main_waiting))
+        return;
 
-    ret = ffurl_read(c->inner, dst, size);
-    c->inner_io_error = ret < 0 ? ret : 0;
+    pthread_mutex_lock(&c->mutex);
+    pthread_cond_signal(&c->cond_wakeup_main);
+    pthread_mutex_unlock(&c->mutex);
+}
 
-    return ret;
+static void async_wakeup_background(Context *c)
+{
+    if (!atomic_load(&c->background_waiting))
+        return;
+
+    pthread_mutex_lock(&c->mutex);
+    pthread_cond_signal(&c->cond_wakeup_background);
+    pthread_mutex_unlock(&c->mutex);
+}
+
+static void async_report_statistic(URLContext *h)
+{
+    Context             *c    = h->priv_data;
+    RingBuffer          *ring = &c->ring;
+    AVAppAsyncStatistic  statistic = {0};
+    int64_t              now;
+
+    if (!c->app_ctx || c->statistic_interval <= 0)
+        return;
+
+    now = av_gettime_relative();
+    if (now - c->last_statistic_time < c->statistic_interval * 1000LL)
+        return;
+    c->last_statistic_time = now;
+
+    statistic.size          = sizeof(statistic);
+    statistic.buf_backwards = ring_size_of_read_back(ring);
+    statistic.buf_forwards  = ring_size(ring);
+    statistic.buf_capacity  = ring->size - ring->read_back_capacity;
+    av_application_on_async_statistic(c->app_ctx, &statistic);
+}
+
+/* is_full_speed is cleared when the ring filled up during the window, the
+ * speed is then limited by the reader rather than by the inner protocol */
+static void async_report_read_speed(URLContext *h, int bytes)
+{
+    Context             *c     = h->priv_data;
+    AVAppAsyncReadSpeed  speed = {0};
+    int64_t              now, elapsed;
+
+    if (!c->app_ctx || c->statistic_interval <= 0)
+        return;
+
+    c->speed_window_bytes += bytes;
+    now     = av_gettime_relative();
+    elapsed = now - c->speed_window_start;
+    if (elapsed < c->statistic_interval * 1000LL)
+        return;
+
+    speed.size          = sizeof(speed);
+    speed.is_full_speed = !c->speed_throttled;
+    speed.io_bytes      = c->speed_window_bytes;
+    speed.elapsed_milli = elapsed / 1000;
+    av_application_on_async_read_speed(c->app_ctx, &speed);
+
+    c->speed_window_start = now;
+    c->speed_window_bytes = 0;
+    c->speed_throttled    = 0;
+}
+
+static int64_t get_physical_memory(void)
+{
+#if HAVE_SYSCONF && defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+    long pages     = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && page_size > 0)
+        return (int64_t)pages * page_size;
+#endif
+    return 0;
+}
+
+/* scale the ring down on devices which can not spare the configured size */
+static void async_adapt_capacity(URLContext *h)
+{
+    Context *c        = h->priv_data;
+    int64_t  mem      = get_physical_memory();
+    int64_t  capacity = FFMAX(mem / ADAPTIVE_MEM_DIVISOR, ADAPTIVE_MIN_CAPACITY);
+
+    if (mem <= 0 || capacity >= c->buffer_capacity)
+        return;
+
+    av_log(h, AV_LOG_VERBOSE, "async: %"PRId64" MiB memory, buffer %d -> %"PRId64"\n",
+           mem >> 20, c->buffer_capacity, capacity);
+    c->read_back_capacity = av_rescale(c->read_back_capacity, capacity, c->buffer_capacity);
+    c->buffer_capacity    = capacity;
+}
+
+/* grow the chunk on fast links to save syscalls, shrink it on slow ones to
+ * keep the reader fed in small steps */
+static void async_adapt_chunk_size(URLContext *h, int bytes)
+{
+    Context *c   = h->priv_data;
+    int64_t  now = av_gettime_relative();
+    int64_t  elapsed, speed;
+    int      chunk_size;
+
+    c->window_bytes += bytes;
+    elapsed = now - c->window_start;
+    if (elapsed < ADAPTIVE_WINDOW_US)
+        return;
+
+    speed      = av_rescale(c->window_bytes, 1000000, elapsed);
+    chunk_size = c->read_chunk_size;
+    while (chunk_size < c->max_read_chunk_size &&
+           chunk_size * (int64_t)ADAPTIVE_READS_PER_SEC < speed)
+        chunk_size *= 2;
+    chunk_size = FFMIN(chunk_size, c->max_read_chunk_size);
+
+    if (chunk_size != c->chunk_size)
+        av_log(h, AV_LOG_DEBUG, "async: %"PRId64" bytes/s, read chunk %d -> %d\n",
+               speed, c->chunk_size, chunk_size);
+
+    c->chunk_size   = chunk_size;
+    c->window_start = now;
+    c->window_bytes = 0;
 }
 
 static void *async_buffer_task(void *arg)
@@ -181,11 +681,16 @@ static void *async_buffer_task(void *arg)
     int           ret  = 0;
     int64_t       seek_ret;
 
+    c->chunk_size         = c->read_chunk_size;
+    c->window_start       = av_gettime_relative();
+    c->speed_window_start = c->window_start;
+
     while (1) {
         int fifo_space, to_copy;
+        uint8_t *dst;
 
-        pthread_mutex_lock(&c->mutex);
         if (async_check_interrupt(h)) {
+            pthread_mutex_lock(&c->mutex);
             c->io_eof_reached = 1;
             c->io_error       = AVERROR_EXIT;
             pthread_cond_signal(&c->cond_wakeup_main);
@@ -193,45 +698,70 @@ static void *async_buffer_task(void *arg)
             break;
         }
 
-        if (c->seek_request) {
+        if (atomic_load(&c->seek_request)) {
+            pthread_mutex_lock(&c->mutex);
+            if (atomic_load(&c->abort_request)) {
+                pthread_mutex_unlock(&c->mutex);
+                continue;
+            }
             seek_ret = ffurl_seek(c->inner, c->seek_pos, c->seek_whence);
             if (seek_ret >= 0) {
                 c->io_eof_reached = 0;
                 c->io_error       = 0;
                 ring_reset(ring);
+                c->ring_base      = seek_ret;
             }
+            c->speed_window_start = av_gettime_relative();
+            c->speed_window_bytes = 0;
+            c->speed_throttled    = 0;
 
             c->seek_completed = 1;
             c->seek_ret       = seek_ret;
-            c->seek_request   = 0;
-
+            atomic_store(&c->seek_request, 0);
 
             pthread_cond_signal(&c->cond_wakeup_main);
             pthread_mutex_unlock(&c->mutex);
             continue;
         }
 
+        ring_flush_evicted(ring);
         fifo_space = ring_space(ring);
         if (c->io_eof_reached || fifo_space <= 0) {
-            pthread_cond_signal(&c->cond_wakeup_main);
-            pthread_cond_wait(&c->cond_wakeup_background, &c->mutex);
+            pthread_mutex_lock(&c->mutex);
+            /* at eof only a seek or close can wake us up, both signal anyway */
+            if (!c->io_eof_reached) {
+                atomic_store(&c->background_waiting, 1);
+                c->speed_throttled = 1;
+            }
+            if (!atomic_load(&c->seek_request) && !atomic_load(&c->abort_request) &&
+                (c->io_eof_reached || (ring_space(ring) <= 0 && !ring_released(ring)))) {
+                c->wakeup_count++;
+                pthread_cond_wait(&c->cond_wakeup_background, &c->mutex);
+            }
+            atomic_store(&c->background_waiting, 0);
             pthread_mutex_unlock(&c->mutex);
             continue;
         }
-        pthread_mutex_unlock(&c->mutex);
-
-        to_copy = FFMIN(4096, fifo_space);
-        ret = ring_generic_write(ring, (void *)h, to_copy, wrapped_url_read);
 
-        pthread_mutex_lock(&c->mutex);
-        if (ret <= 0) {
+        dst = ring_write_span(ring, &to_copy);
+        to_copy = FFMIN(c->chunk_size, to_copy);
+        ret = ffurl_read(c->inner, dst, to_copy);
+        if (ret > 0) {
+            ring_commit(ring, ret);
+            if (c->adaptive)
+                async_adapt_chunk_size(h, ret);
+            async_report_read_speed(h, ret);
+        } else {
+            pthread_mutex_lock(&c->mutex);
             c->io_eof_reached = 1;
-            if (c->inner_io_error < 0)
-                c->io_error = c->inner_io_error;
+            if (ret < 0)
+                c->io_error = ret;
+            pthread_cond_signal(&c->cond_wakeup_main);
+            pthread_mutex_unlock(&c->mutex);
+            continue;
         }
 
-        pthread_cond_signal(&c->cond_wakeup_main);
-        pthread_mutex_unlock(&c->mutex);
+        async_wakeup_main(c);
     }
 
     return NULL;
@@ -244,8 +774,22 @@ static int async_open(URLContext *h, const char *arg, int flags, AVDictionary **
     AVIOInterruptCB  interrupt_callback = {.callback = async_check_interrupt, .opaque = h};
 
     av_strstart(arg, "async:", &arg);
+    c->spill.fd = -1;
+    ret = pthread_mutex_init(&c->spill.mutex, NULL);
+    if (ret != 0) {
+        av_log(h, AV_LOG_ERROR, "pthread_mutex_init failed : %s\n", av_err2str(ret));
+        return AVERROR(ret);
+    }
+
+    c->app_ctx = (AVApplicationContext *)(intptr_t)c->app_ctx_intptr;
+    if (c->app_ctx)
+        av_dict_set_int(options, "ijkapplication", c->app_ctx_intptr, 0);
+
+    c->max_read_chunk_size = FFMAX(c->max_read_chunk_size, c->read_chunk_size);
+    if (c->adaptive)
+        async_adapt_capacity(h);
 
-    ret = ring_init(&c->ring, BUFFER_CAPACITY, READ_BACK_CAPACITY);
+    ret = ring_init(&c->ring, c->buffer_capacity, c->read_back_capacity);
     if (ret < 0)
         goto fifo_fail;
 
@@ -260,6 +804,13 @@ static int async_open(URLContext *h, const char *arg, int flags, AVDictionary **
     c->logical_size = ffurl_size(c->inner);
     h->is_streamed  = c->inner->is_streamed;
 
+    if (c->spill_enabled && c->spill_max_size > 0 && !h->is_streamed) {
+        if (spill_init(h, &c->spill, c->spill_max_size) >= 0) {
+            c->ring.evict        = spill_write;
+            c->ring.evict_opaque = h;
+        }
+    }
+
     ret = pthread_mutex_init(&c->mutex, NULL);
     if (ret != 0) {
         av_log(h, AV_LOG_ERROR, "pthread_mutex_init failed : %s\n", av_err2str(ret));
@@ -293,10 +844,12 @@ cond_wakeup_background_fail:
 cond_wakeup_main_fail:
     pthread_mutex_destroy(&c->mutex);
 mutex_fail:
+    spill_destroy(&c->spill);
     ffurl_closep(&c->inner);
 url_fail:
     ring_destroy(&c->ring);
 fifo_fail:
+    pthread_mutex_destroy(&c->spill.mutex);
     return ret;
 }
 
@@ -306,7 +859,7 @@ static int async_close(URLContext *h)
     int      ret;
 
     pthread_mutex_lock(&c->mutex);
-    c->abort_request = 1;
+    atomic_store(&c->abort_request, 1);
     pthread_cond_signal(&c->cond_wakeup_background);
     pthread_mutex_unlock(&c->mutex);
 
@@ -317,24 +870,27 @@ static int async_close(URLContext *h)
     pthread_cond_destroy(&c->cond_wakeup_background);
     pthread_cond_destroy(&c->cond_wakeup_main);
     pthread_mutex_destroy(&c->mutex);
+    if (c->spill.hit)
+        av_log(h, AV_LOG_VERBOSE, "Statistics, spill hits:%"PRId64" spilled bytes:%"PRId64"\n",
+               c->spill.hit, c->spill.size);
+    spill_destroy(&c->spill);
+    pthread_mutex_destroy(&c->spill.mutex);
     ffurl_closep(&c->inner);
     ring_destroy(&c->ring);
 
     return 0;
 }
 
-static int async_read_internal(URLContext *h, void *dest, int size, int read_complete,
-                               void (*func)(void*, void*, int))
+/* dest may be NULL to skip data, e.g. for fast forward seeks */
+static int async_read_internal(URLContext *h, void *dest, int size, int read_complete)
 {
     Context      *c       = h->priv_data;
     RingBuffer   *ring    = &c->ring;
     int           to_read = size;
     int           ret     = 0;
 
-    pthread_mutex_lock(&c->mutex);
-
     while (to_read > 0) {
-        int fifo_size, to_copy;
+        int fifo_size, to_copy, io_eof_reached, io_error;
         if (async_check_interrupt(h)) {
             ret = AVERROR_EXIT;
             break;
@@ -342,8 +898,9 @@ static int async_read_internal(URLContext *h, void *dest, int size, int read_com
         fifo_size = ring_size(ring);
         to_copy   = FFMIN(to_read, fifo_size);
         if (to_copy > 0) {
-            ring_generic_read(ring, dest, to_copy, func);
-            if (!func)
+            if (ring_read(ring, dest, to_copy) > 0)
+                async_wakeup_background(c);
+            if (dest)
                 dest = (uint8_t *)dest + to_copy;
             c->logical_pos += to_copy;
             to_read        -= to_copy;
@@ -351,20 +908,62 @@ static int async_read_internal(URLContext *h, void *dest, int size, int read_com
 
             if (to_read <= 0 || !read_complete)
                 break;
-        } else if (c->io_eof_reached) {
+            continue;
+        }
+
+        pthread_mutex_lock(&c->mutex);
+        atomic_store(&c->main_waiting, 1);
+        if (!c->io_eof_reached && ring_size(ring) <= 0 && !atomic_load(&c->abort_request)) {
+            c->wakeup_count++;
+            pthread_cond_wait(&c->cond_wakeup_main, &c->mutex);
+        }
+        atomic_store(&c->main_waiting, 0);
+        io_eof_reached = c->io_eof_reached;
+        io_error       = c->io_error;
+        pthread_mutex_unlock(&c->mutex);
+
+        /* eof is raised after the last commit, so an empty ring is final */
+        if (io_eof_reached && ring_size(ring) <= 0) {
             if (ret <= 0) {
-                if (c->io_error)
-                    ret = c->io_error;
+                if (io_error)
+                    ret = io_error;
                 else
                     ret = AVERROR_EOF;
             }
             break;
         }
+    }
+
+    return ret;
+}
+
+/* restart the inner protocol at pos and wait for the ring to be reset */
+static int64_t async_seek_inner(URLContext *h, int64_t pos)
+{
+    Context *c = h->priv_data;
+    int64_t  ret;
+
+    pthread_mutex_lock(&c->mutex);
+
+    c->seek_pos       = pos;
+    c->seek_whence    = SEEK_SET;
+    c->seek_completed = 0;
+    c->seek_ret       = 0;
+    atomic_store(&c->seek_request, 1);
+
+    while (1) {
+        if (async_check_interrupt(h)) {
+            ret = AVERROR_EXIT;
+            break;
+        }
+        if (c->seek_completed) {
+            ret = c->seek_ret;
+            break;
+        }
         pthread_cond_signal(&c->cond_wakeup_background);
         pthread_cond_wait(&c->cond_wakeup_main, &c->mutex);
     }
 
-    pthread_cond_signal(&c->cond_wakeup_background);
     pthread_mutex_unlock(&c->mutex);
 
     return ret;
@@ -372,19 +971,35 @@ static int async_read_internal(URLContext *h, void *dest, int size, int read_com
 
 static int async_read(URLContext *h, unsigned char *buf, int size)
 {
-    return async_read_internal(h, buf, size, 0, NULL);
-}
+    Context *c = h->priv_data;
+    int64_t  pos;
+    int      ret;
 
-static void fifo_do_not_copy_func(void* dest, void* src, int size) {
-    // do not copy
+    if (c->logical_pos < c->spill_read_end) {
+        ret = spill_read(h, buf, size);
+        if (ret != AVERROR(EAGAIN))
+            goto done;
+        /* recycled meanwhile, go back to the inner protocol */
+        pos = async_seek_inner(h, c->logical_pos);
+        if (pos < 0)
+            return pos;
+        c->spill_read_end = 0;
+    }
+    ret = async_read_internal(h, buf, size, 0);
+
+done:
+    async_report_statistic(h);
+    return ret;
 }
 
 static int64_t async_seek(URLContext *h, int64_t pos, int whence)
 {
     Context      *c    = h->priv_data;
     RingBuffer   *ring = &c->ring;
+    SpillEntry   *entry;
     int64_t       ret;
     int64_t       new_logical_pos;
+    int64_t       ring_pos, ring_start, spill_end;
     int fifo_size;
     int fifo_size_of_read_back;
 
@@ -403,22 +1018,27 @@ static int64_t async_seek(URLContext *h, int64_t pos, int whence)
     if (new_logical_pos < 0)
         return AVERROR(EINVAL);
 
-    fifo_size = ring_size(ring);
+    /* the ring cursor is not at logical_pos while reading from the spill file */
+    ring_pos   = c->ring_base + ring->read_pos;
+    fifo_size  = ring_size(ring);
     fifo_size_of_read_back = ring_size_of_read_back(ring);
+    ring_start = ring_pos - fifo_size_of_read_back;
     if (new_logical_pos == c->logical_pos) {
         /* current position */
         return c->logical_pos;
-    } else if ((new_logical_pos >= (c->logical_pos - fifo_size_of_read_back)) &&
-               (new_logical_pos < (c->logical_pos + fifo_size + SHORT_SEEK_THRESHOLD))) {
-        int pos_delta = (int)(new_logical_pos - c->logical_pos);
+    } else if ((new_logical_pos >= ring_start) &&
+               (new_logical_pos < (ring_pos + fifo_size + c->short_seek_threshold))) {
+        int pos_delta = (int)(new_logical_pos - ring_pos);
         /* fast seek */
         av_log(h, AV_LOG_TRACE, "async_seek: fask_seek %"PRId64" from %d dist:%d/%d\n",
                 new_logical_pos, (int)c->logical_pos,
                 (int)(new_logical_pos - c->logical_pos), fifo_size);
 
+        c->spill_read_end = 0;
+        c->logical_pos    = ring_pos;
         if (pos_delta > 0) {
             // fast seek forwards
-            async_read_internal(h, NULL, pos_delta, 1, fifo_do_not_copy_func);
+            async_read_internal(h, NULL, pos_delta, 1);
         } else {
             // fast seek backwards
             ring_drain(ring, pos_delta);
@@ -434,30 +1054,40 @@ static int64_t async_seek(URLContext *h, int64_t pos, int whence)
         return AVERROR(EINVAL);
     }
 
-    pthread_mutex_lock(&c->mutex);
-
-    c->seek_request   = 1;
-    c->seek_pos       = new_logical_pos;
-    c->seek_whence    = SEEK_SET;
-    c->seek_completed = 0;
-    c->seek_ret       = 0;
+    pthread_mutex_lock(&c->spill.mutex);
+    entry = spill_find(&c->spill, new_logical_pos, NULL);
+    spill_end = entry ? entry->logical_pos + entry->size : -1;
+    pthread_mutex_unlock(&c->spill.mutex);
+
+    if (spill_end >= ring_start && new_logical_pos < ring_start) {
+        /* spilled data runs into the ring, no need to touch the inner protocol */
+        av_log(h, AV_LOG_TRACE, "async_seek: spill hit %"PRId64", ring at %"PRId64"\n",
+               new_logical_pos, ring_start);
+        ring_drain(ring, -fifo_size_of_read_back);
+        c->spill_read_end = ring_start;
+        c->logical_pos    = new_logical_pos;
+        c->spill.hit++;
+        return c->logical_pos;
+    }
 
-    while (1) {
-        if (async_check_interrupt(h)) {
-            ret = AVERROR_EXIT;
-            break;
-        }
-        if (c->seek_completed) {
-            if (c->seek_ret >= 0)
-                c->logical_pos  = c->seek_ret;
-            ret = c->seek_ret;
-            break;
-        }
-        pthread_cond_signal(&c->cond_wakeup_background);
-        pthread_cond_wait(&c->cond_wakeup_main, &c->mutex);
+    if (spill_end > new_logical_pos) {
+        /* serve the spilled range locally, refill the ring from its end */
+        av_log(h, AV_LOG_TRACE, "async_seek: spill hit %"PRId64", refill from %"PRId64"\n",
+               new_logical_pos, spill_end);
+        ret = async_seek_inner(h, spill_end);
+        if (ret < 0)
+            return ret;
+        c->spill_read_end = ret;
+        c->logical_pos    = new_logical_pos;
+        c->spill.hit++;
+        return c->logical_pos;
     }
 
-    pthread_mutex_unlock(&c->mutex);
+    ret = async_seek_inner(h, new_logical_pos);
+    if (ret >= 0) {
+        c->spill_read_end = 0;
+        c->logical_pos    = ret;
+    }
 
     return ret;
 }
@@ -466,6 +1096,28 @@ static int64_t async_seek(URLContext *h, int64_t pos, int whence)
 #define D AV_OPT_FLAG_DECODING_PARAM
 
 static const AVOption options[] = {
+    { "async_buffer_size", "size of the forward buffer (in bytes)",
+        OFFSET(buffer_capacity), AV_OPT_TYPE_INT, { .i64 = BUFFER_CAPACITY }, 64 * 1024, INT_MAX / 2, .flags = D },
+    { "async_read_back_size", "size of the window kept for backward seeks (in bytes)",
+        OFFSET(read_back_capacity), AV_OPT_TYPE_INT, { .i64 = READ_BACK_CAPACITY }, 0, INT_MAX / 2, .flags = D },
+    { "async_short_seek_size", "forward seeks within this distance past the buffer are served by reading (in bytes)",
+        OFFSET(short_seek_threshold), AV_OPT_TYPE_INT, { .i64 = SHORT_SEEK_THRESHOLD }, 0, INT_MAX / 2, .flags = D },
+    { "async_read_size", "size of each read from the inner protocol, the minimum in adaptive mode (in bytes)",
+        OFFSET(read_chunk_size), AV_OPT_TYPE_INT, { .i64 = READ_CHUNK_SIZE }, 512, 16 * 1024 * 1024, .flags = D },
+    { "async_max_read_size", "largest read from the inner protocol in adaptive mode (in bytes)",
+        OFFSET(max_read_chunk_size), AV_OPT_TYPE_INT, { .i64 = MAX_READ_CHUNK_SIZE }, 512, 16 * 1024 * 1024, .flags = D },
+    { "async_adaptive", "adapt the read size to the throughput and the buffer size to the device memory",
+        OFFSET(adaptive), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, .flags = D },
+    { "async_statistic_interval", "interval of buffer and read speed reports to the application (in milliseconds, 0 to disable)",
+        OFFSET(statistic_interval), AV_OPT_TYPE_INT, { .i64 = STATISTIC_INTERVAL }, 0, INT_MAX / 1000, .flags = D },
+    { "ijkapplication", "AVApplicationContext",
+        OFFSET(app_ctx_intptr), AV_OPT_TYPE_INT64, { .i64 = 0 }, INT64_MIN, INT64_MAX, .flags = D },
+    { "async_spill", "keep data dropped from the buffer in a temp file to serve later seeks",
+        OFFSET(spill_enabled), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, .flags = D },
+    { "async_spill_size", "maximum amount of data kept in the spill file (in bytes)",
+        OFFSET(spill_max_size), AV_OPT_TYPE_INT64, { .i64 = SPILL_MAX_SIZE }, 0, INT64_MAX, .flags = D },
+    { "wakeup_count", "number of times a reader or the buffering thread had to block",
+        OFFSET(wakeup_count), AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT64_MAX, .flags = D | AV_OPT_FLAG_READONLY | AV_OPT_FLAG_EXPORT },
     {NULL},
 };
 
@@ -23,52 +23,523 @@
 
 /**
  * @TODO
- *      support keeping files
  *      support filling with a background thread
  */
 
 #include "libavutil/avassert.h"
 #include "libavutil/avstring.h"
 #include "libavutil/internal.h"
+#include "libavutil/md5.h"
+#include "libavutil/mem.h"
 #include "libavutil/opt.h"
-#include "libavutil/tree.h"
 #include "avformat.h"
 #include <fcntl.h>
+#if HAVE_DIRENT_H
+#include <dirent.h>
+#endif
 #if HAVE_IO_H
 #include <io.h>
 #endif
 #if HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#if HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#if HAVE_FLOCK
+#include <sys/file.h>
+#endif
 #include <sys/stat.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include "os_support.h"
 #include "url.h"
 
+/* cache hits are copied out of fixed windows of the cache file, mapped on
+ * first use and kept until close so every page is faulted in only once.
+ * Past the last window, or on 32-bit address spaces past the first few,
+ * the file is read() instead. */
+#define MAP_WINDOW_SIZE (64 * 1024 * 1024)
+#define MAX_MAP_WINDOWS 64
+#define MAX_MAP_WINDOWS_32BIT 4
+
+#define INDEX_MAGIC "FFCACHE 1"
+
+/**
+ * A contiguous run of the input stored contiguously in the cache file.
+ * Extents are kept sorted by logical_pos in a single array, sequential
+ * reads grow the last touched extent instead of adding new ones.
+ */
 typedef struct CacheEntry {
     int64_t logical_pos;
     int64_t physical_pos;
-    int size;
+    int64_t size;
 } CacheEntry;
 
 typedef struct Context {
     AVClass *class;
     int fd;
     char *filename;
-    struct AVTreeNode *root;
+    CacheEntry *entries;
+    int nb_entries;
+    unsigned int entries_allocated;
+    int last_entry;
     int64_t logical_pos;
     int64_t cache_pos;
+    int64_t cache_end;
     int64_t inner_pos;
     int64_t end;
     int is_true_eof;
     URLContext *inner;
     int64_t cache_hit, cache_miss;
     int read_ahead_limit;
+    uint8_t *maps[MAX_MAP_WINDOWS];
+
+    /* persistent mode: the data file is sparse, physical_pos == logical_pos */
+    int persistent;
+    char *url;
+    char *data_path;
+    char *index_path;
+    char *etag;
+    char *last_modified;
+
+    /* options */
+    char *cache_dir;
+    int64_t cache_max_size;
 } Context;
 
-static int cmp(const void *key, const void *node)
+/**
+ * @return index of the last extent starting at or before pos, -1 if none
+ */
+static int find_entry(Context *c, int64_t pos)
+{
+    int a = 0, b = c->nb_entries - 1;
+    int i = c->last_entry;
+
+    /* sequential access stays in the same or the following extent */
+    if (i >= 0 && i < c->nb_entries && c->entries[i].logical_pos <= pos) {
+        if (i + 1 == c->nb_entries || c->entries[i + 1].logical_pos > pos)
+            return i;
+        if (i + 2 == c->nb_entries || c->entries[i + 2].logical_pos > pos)
+            return c->last_entry = i + 1;
+    }
+
+    if (b < 0 || c->entries[0].logical_pos > pos)
+        return -1;
+
+    while (a < b) {
+        int m = (a + b + 1) >> 1;
+        if (c->entries[m].logical_pos <= pos)
+            a = m;
+        else
+            b = m - 1;
+    }
+    return c->last_entry = a;
+}
+
+static int insert_extent(Context *c, int i, int64_t logical_pos, int64_t physical_pos, int64_t size)
+{
+    CacheEntry *entries = av_fast_realloc(c->entries, &c->entries_allocated,
+                                          (c->nb_entries + 1) * sizeof(*c->entries));
+    if (!entries)
+        return AVERROR(ENOMEM);
+    c->entries = entries;
+
+    memmove(&c->entries[i + 1], &c->entries[i], (c->nb_entries - i) * sizeof(*c->entries));
+    c->entries[i].logical_pos  = logical_pos;
+    c->entries[i].physical_pos = physical_pos;
+    c->entries[i].size         = size;
+    c->nb_entries++;
+    c->last_entry = i;
+    return 0;
+}
+
+/* in persistent mode extents can grow into the following ones */
+static void merge_following_extents(Context *c, int i)
+{
+    CacheEntry *entry = &c->entries[i];
+
+    while (i + 1 < c->nb_entries) {
+        CacheEntry *next = &c->entries[i + 1];
+        if (next->logical_pos > entry->logical_pos + entry->size ||
+            next->physical_pos - next->logical_pos != entry->physical_pos - entry->logical_pos)
+            break;
+        entry->size = FFMAX(entry->logical_pos + entry->size,
+                            next->logical_pos  + next->size) - entry->logical_pos;
+        memmove(next, next + 1, (c->nb_entries - i - 2) * sizeof(*c->entries));
+        c->nb_entries--;
+    }
+    c->last_entry = i;
+}
+
+/* lower case scheme and host, drop the fragment */
+static char *normalize_url(const char *url)
+{
+    char *norm = av_strdup(url);
+    char *p, *end;
+
+    if (!norm)
+        return NULL;
+    if ((p = strchr(norm, '#')))
+        *p = 0;
+
+    p = strstr(norm, "://");
+    if (!p)
+        return norm;
+    end = p + 3 + strcspn(p + 3, "/?");
+    for (p = norm; p < end; p++)
+        *p = av_tolower(*p);
+    return norm;
+}
+
+static char *make_cache_path(const char *dir, const char *key, const char *ext)
+{
+    uint8_t md5[16];
+    char hex[33];
+    int i;
+
+    av_md5_sum(md5, key, strlen(key));
+    for (i = 0; i < 16; i++)
+        snprintf(hex + 2 * i, 3, "%02x", md5[i]);
+    return av_asprintf("%s/%s%s", dir, hex, ext);
+}
+
+static int get_validator(URLContext *inner, const char *name, char **value)
+{
+    uint8_t *str = NULL;
+
+    if (av_opt_get(inner, name, AV_OPT_SEARCH_CHILDREN, &str) < 0 || !str || !*str) {
+        av_freep(&str);
+        return 0;
+    }
+    *value = str;
+    return 1;
+}
+
+static void strip_line(char *line)
+{
+    line[strcspn(line, "\r\n")] = 0;
+}
+
+/**
+ * Load the extents saved by a previous session, if they were saved for the
+ * same url and the validators still match.
+ *
+ * @return 1 if the data file can be reused, 0 otherwise
+ */
+static int read_index(URLContext *h)
+{
+    Context *c = h->priv_data;
+    char line[4096];
+    int64_t end = 0, pos, size;
+    int is_true_eof = 0, valid = 0;
+    FILE *f;
+    int fd;
+
+    fd = avpriv_open(c->index_path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    f = fdopen(fd, "r");
+    if (!f) {
+        close(fd);
+        return 0;
+    }
+
+    if (!fgets(line, sizeof(line), f) || strncmp(line, INDEX_MAGIC, strlen(INDEX_MAGIC)))
+        goto done;
+
+    while (fgets(line, sizeof(line), f)) {
+        strip_line(line);
+        if (av_strstart(line, "url ", NULL)) {
+            if (strcmp(line + 4, c->url))
+                goto done;
+            valid |= 1;
+        } else if (av_strstart(line, "etag ", NULL)) {
+            if (!c->etag || strcmp(line + 5, c->etag))
+                goto done;
+            valid |= 2;
+        } else if (av_strstart(line, "last_modified ", NULL)) {
+            if (!c->last_modified || strcmp(line + 14, c->last_modified))
+                goto done;
+            valid |= 4;
+        } else if (sscanf(line, "end %"SCNd64" %d", &end, &is_true_eof) == 2) {
+        } else if (sscanf(line, "extent %"SCNd64" %"SCNd64, &pos, &size) == 2) {
+            if (pos < 0 || size <= 0 ||
+                (c->nb_entries && pos < c->entries[c->nb_entries - 1].logical_pos) ||
+                insert_extent(c, c->nb_entries, pos, pos, size) < 0)
+                goto done;
+            merge_following_extents(c, FFMAX(c->nb_entries - 2, 0));
+            c->cache_end = FFMAX(c->cache_end, pos + size);
+        }
+    }
+
+    /* every validator we got now must have been saved too */
+    if ((valid & 1) && (valid & 2) == (c->etag ? 2 : 0) &&
+        (valid & 4) == (c->last_modified ? 4 : 0)) {
+        c->end         = end;
+        c->is_true_eof = is_true_eof;
+        fclose(f);
+        return 1;
+    }
+
+done:
+    fclose(f);
+    c->nb_entries = 0;
+    c->cache_end  = 0;
+    return 0;
+}
+
+static int write_index(URLContext *h)
+{
+    Context *c = h->priv_data;
+    char *tmp_path = av_asprintf("%s.tmp", c->index_path);
+    FILE *f = NULL;
+    int fd, i, ret = 0;
+
+    if (!tmp_path)
+        return AVERROR(ENOMEM);
+
+    fd = avpriv_open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || !(f = fdopen(fd, "w"))) {
+        ret = AVERROR(errno);
+        if (fd >= 0)
+            close(fd);
+        goto fail;
+    }
+
+    fprintf(f, "%s\nurl %s\n", INDEX_MAGIC, c->url);
+    if (c->etag)
+        fprintf(f, "etag %s\n", c->etag);
+    if (c->last_modified)
+        fprintf(f, "last_modified %s\n", c->last_modified);
+    fprintf(f, "end %"PRId64" %d\n", c->end, c->is_true_eof);
+    for (i = 0; i < c->nb_entries; i++)
+        fprintf(f, "extent %"PRId64" %"PRId64"\n", c->entries[i].logical_pos, c->entries[i].size);
+
+    if (ferror(f))
+        ret = AVERROR(EIO);
+    if (fclose(f) && !ret)
+        ret = AVERROR(errno);
+    if (!ret && rename(tmp_path, c->index_path) < 0)
+        ret = AVERROR(errno);
+
+fail:
+    if (ret < 0) {
+        av_log(h, AV_LOG_ERROR, "Could not write cache index %s\n", c->index_path);
+        unlink(tmp_path);
+    }
+    av_free(tmp_path);
+    return ret;
+}
+
+#if HAVE_DIRENT_H
+/* seconds after its last write a data file without index may be removed */
+#define CACHE_ORPHAN_AGE 60
+
+typedef struct CacheFile {
+    char   *name;
+    time_t  mtime;
+    int64_t size;
+} CacheFile;
+
+static int cmp_cache_file(const void *a, const void *b)
+{
+    const CacheFile *fa = a, *fb = b;
+    return FFDIFFSIGN(fa->mtime, fb->mtime);
+}
+
+/**
+ * Remove a data file left without its index by a session that did not close,
+ * unless it is recent or locked by a session using it.
+ */
+static void remove_orphan_data(URLContext *h, const char *name, size_t len)
+{
+    Context *c = h->priv_data;
+    char *data_path, *index_path;
+    struct stat st;
+    int fd;
+
+    data_path  = av_asprintf("%s/%s", c->cache_dir, name);
+    index_path = av_asprintf("%s/%.*s.idx", c->cache_dir, (int)(len - 5), name);
+    if (!data_path || !index_path)
+        goto end;
+    if (stat(index_path, &st) == 0 || stat(data_path, &st) < 0 ||
+        time(NULL) - st.st_mtime < CACHE_ORPHAN_AGE)
+        goto end;
+
+    fd = avpriv_open(data_path, O_RDONLY);
+    if (fd < 0)
+        goto end;
+#if HAVE_FLOCK
+    /* the index may have been written by the session that just unlocked it */
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0 && stat(index_path, &st) < 0) {
+        av_log(h, AV_LOG_VERBOSE, "Removing orphaned %s\n", data_path);
+        unlink(data_path);
+    }
+#endif
+    close(fd);
+
+end:
+    av_free(data_path);
+    av_free(index_path);
+}
+
+/* drop least recently used entries until the directory fits in
+ * cache_max_size. The index is rewritten on every close and removed while
+ * the entry is open, so its mtime is the last use and entries in use are
+ * not listed at all. Data files without an index are either in use or were
+ * orphaned by a crash, the latter are removed. */
+static void evict_cache_files(URLContext *h)
+{
+    Context *c = h->priv_data;
+    CacheFile *files = NULL, *tmp;
+    unsigned int files_allocated = 0;
+    int nb_files = 0, i, ret;
+    int64_t total = 0;
+    struct dirent *dent;
+    DIR *dir;
+
+    dir = opendir(c->cache_dir);
+    if (!dir)
+        return;
+
+    while ((dent = readdir(dir))) {
+        size_t len = strlen(dent->d_name);
+        struct stat st, index_st;
+        char *path;
+
+        if (len > 5 && !strcmp(dent->d_name + len - 5, ".data")) {
+            remove_orphan_data(h, dent->d_name, len);
+            continue;
+        }
+        if (len <= 4 || strcmp(dent->d_name + len - 4, ".idx"))
+            continue;
+        path = av_asprintf("%s/%s", c->cache_dir, dent->d_name);
+        if (!path)
+            break;
+        ret = stat(path, &index_st);
+        av_free(path);
+        if (ret < 0)
+            continue;
+        path = av_asprintf("%s/%.*s.data", c->cache_dir, (int)(len - 4), dent->d_name);
+        if (!path)
+            break;
+        if (stat(path, &st) < 0 ||
+            !(tmp = av_fast_realloc(files, &files_allocated, (nb_files + 1) * sizeof(*files)))) {
+            av_free(path);
+            continue;
+        }
+        files = tmp;
+        files[nb_files].name  = path;
+        files[nb_files].mtime = index_st.st_mtime;
+        files[nb_files].size  = st.st_size;
+        total += files[nb_files++].size;
+    }
+    closedir(dir);
+
+    qsort(files, nb_files, sizeof(*files), cmp_cache_file);
+    for (i = 0; i < nb_files && total > c->cache_max_size; i++) {
+        size_t len = strlen(files[i].name);
+        if (!strcmp(files[i].name, c->data_path))
+            continue;
+        av_log(h, AV_LOG_VERBOSE, "Evicting %s\n", files[i].name);
+        unlink(files[i].name);
+        memcpy(files[i].name + len - 5, ".idx", 5);
+        unlink(files[i].name);
+        total -= files[i].size;
+    }
+
+    for (i = 0; i < nb_files; i++)
+        av_free(files[i].name);
+    av_free(files);
+}
+#endif
+
+/* an index is only trusted if the data file still holds all of it */
+static int check_index(Context *c, int fd)
 {
-    return FFDIFFSIGN(*(const int64_t *)key, ((const CacheEntry *) node)->logical_pos);
+    struct stat st;
+
+    if (fstat(fd, &st) < 0)
+        return 0;
+    return !c->nb_entries || c->cache_end <= st.st_size;
+}
+
+/**
+ * Switch to a data file in cache_dir named after the url, reusing what a
+ * previous session stored if the validators reported by the inner protocol
+ * still match. Without validators, or while another session holds the same
+ * url, the cache stays temporary.
+ */
+static int open_persistent(URLContext *h, const char *url)
+{
+    Context *c = h->priv_data;
+    int has_etag, has_last_modified, reuse, fd;
+
+    /* without locking two sessions could corrupt each other's data */
+    if (!HAVE_FLOCK) {
+        av_log(h, AV_LOG_WARNING, "cache_dir is not supported on this platform\n");
+        return 0;
+    }
+
+    has_etag          = get_validator(c->inner, "etag", &c->etag);
+    has_last_modified = get_validator(c->inner, "last_modified", &c->last_modified);
+    if (!has_etag && !has_last_modified) {
+        av_log(h, AV_LOG_VERBOSE, "No validators for %s, not keeping it\n", url);
+        return 0;
+    }
+
+    c->url        = normalize_url(url);
+    c->data_path  = c->url ? make_cache_path(c->cache_dir, c->url, ".data") : NULL;
+    c->index_path = c->url ? make_cache_path(c->cache_dir, c->url, ".idx")  : NULL;
+    if (!c->data_path || !c->index_path)
+        return AVERROR(ENOMEM);
+
+    fd = avpriv_open(c->data_path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        av_log(h, AV_LOG_WARNING, "Could not open %s, not keeping %s\n", c->data_path, url);
+        return 0;
+    }
+#if HAVE_FLOCK
+    /* the lock is held until close, after the index has been written */
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0) {
+        av_log(h, AV_LOG_VERBOSE, "%s is in use, not keeping %s\n", c->data_path, url);
+        close(fd);
+        return 0;
+    }
+#endif
+
+    reuse = read_index(h);
+    if (reuse && !check_index(c, fd)) {
+        av_log(h, AV_LOG_WARNING, "%s is shorter than its index, discarding it\n", c->data_path);
+        reuse = 0;
+    }
+    if (!reuse) {
+        c->nb_entries  = 0;
+        c->cache_end   = 0;
+        c->end         = 0;
+        c->is_true_eof = 0;
+#if HAVE_FLOCK
+        if (ftruncate(fd, 0) < 0) {
+            av_log(h, AV_LOG_WARNING, "Could not truncate %s, not keeping %s\n", c->data_path, url);
+            close(fd);
+            return 0;
+        }
+#endif
+    }
+    /* drop the index first, a crash must not leave it describing data we
+     * are about to change */
+    unlink(c->index_path);
+
+    av_log(h, AV_LOG_VERBOSE, "%s %s, %d extents\n", reuse ? "Reusing" : "Creating",
+           c->data_path, c->nb_entries);
+
+    close(c->fd);
+    c->fd         = fd;
+    c->cache_pos  = 0;
+    c->persistent = 1;
+    return 0;
 }
 
 static int cache_open(URLContext *h, const char *arg, int flags, AVDictionary **options)
@@ -92,25 +563,28 @@ static int cache_open(URLContext *h, const char *arg, int flags, AVDictionary **
     else
         c->filename = buffername;
 
-    return ffurl_open_whitelist(&c->inner, arg, flags, &h->interrupt_callback,
-                                options, h->protocol_whitelist, h->protocol_blacklist, h);
+    ret = ffurl_open_whitelist(&c->inner, arg, flags, &h->interrupt_callback,
+                               options, h->protocol_whitelist, h->protocol_blacklist, h);
+    if (ret < 0 || !c->cache_dir || !*c->cache_dir)
+        return ret;
+
+    return open_persistent(h, arg);
 }
 
 static int add_entry(URLContext *h, const unsigned char *buf, int size)
 {
     Context *c= h->priv_data;
-    int64_t pos = -1;
-    int ret;
-    CacheEntry *entry = NULL, *next[2] = {NULL, NULL};
-    CacheEntry *entry_ret;
-    struct AVTreeNode *node = NULL;
-
-    //FIXME avoid lseek
-    pos = lseek(c->fd, 0, SEEK_END);
-    if (pos < 0) {
-        ret = AVERROR(errno);
-        av_log(h, AV_LOG_ERROR, "seek in cache failed\n");
-        goto fail;
+    int64_t pos = c->persistent ? c->logical_pos : c->cache_end;
+    int ret, i;
+    CacheEntry *entry;
+
+    if (c->cache_pos != pos) {
+        pos = lseek(c->fd, pos, SEEK_SET);
+        if (pos < 0) {
+            ret = AVERROR(errno);
+            av_log(h, AV_LOG_ERROR, "seek in cache failed\n");
+            return ret;
+        }
     }
     c->cache_pos = pos;
 
@@ -118,64 +592,96 @@ static int add_entry(URLContext *h, const unsigned char *buf, int size)
     if (ret < 0) {
         ret = AVERROR(errno);
         av_log(h, AV_LOG_ERROR, "write in cache failed\n");
-        goto fail;
+        return ret;
     }
     c->cache_pos += ret;
-
-    entry = av_tree_find(c->root, &c->logical_pos, cmp, (void**)next);
-
-    if (!entry)
-        entry = next[0];
-
-    if (!entry ||
-        entry->logical_pos  + entry->size != c->logical_pos ||
-        entry->physical_pos + entry->size != pos
-    ) {
-        entry = av_malloc(sizeof(*entry));
-        node = av_tree_node_alloc();
-        if (!entry || !node) {
-            ret = AVERROR(ENOMEM);
-            goto fail;
+    c->cache_end  = FFMAX(c->cache_end, c->cache_pos);
+
+    i = find_entry(c, c->logical_pos);
+    if (i >= 0) {
+        entry = &c->entries[i];
+        if (entry->logical_pos  + entry->size >= c->logical_pos &&
+            entry->physical_pos - entry->logical_pos == pos - c->logical_pos) {
+            entry->size = FFMAX(entry->size, c->logical_pos + ret - entry->logical_pos);
+            if (c->persistent)
+                merge_following_extents(c, i);
+            return 0;
         }
-        entry->logical_pos = c->logical_pos;
-        entry->physical_pos = pos;
-        entry->size = ret;
-
-        entry_ret = av_tree_insert(&c->root, entry, cmp, &node);
-        if (entry_ret && entry_ret != entry) {
-            ret = -1;
-            av_log(h, AV_LOG_ERROR, "av_tree_insert failed\n");
-            goto fail;
+        if (entry->logical_pos == c->logical_pos) {
+            /* the old copy could not be read back, replace it */
+            entry->physical_pos = pos;
+            entry->size         = ret;
+            if (c->persistent)
+                merge_following_extents(c, i);
+            return 0;
         }
-    } else
-        entry->size += ret;
+    }
 
-    return 0;
-fail:
-    //we could truncate the file to pos here if pos >=0 but ftruncate isn't available in VS so
-    //for simplicty we just leave the file a bit larger
-    av_free(entry);
-    av_free(node);
+    ret = insert_extent(c, i + 1, c->logical_pos, pos, ret);
+    if (ret >= 0 && c->persistent)
+        merge_following_extents(c, i + 1);
     return ret;
 }
 
+/**
+ * Copy from the cache file through the mapped window holding physical_pos,
+ * mapping it first if needed.
+ *
+ * @return number of bytes copied, negative if the window could not be mapped
+ */
+static int read_mapped(Context *c, int64_t physical_pos, unsigned char *buf, int size)
+{
+#if HAVE_MMAP
+    int64_t window = physical_pos / MAP_WINDOW_SIZE;
+    int64_t offset = physical_pos % MAP_WINDOW_SIZE;
+    int max_windows = sizeof(void *) > 4 ? MAX_MAP_WINDOWS : MAX_MAP_WINDOWS_32BIT;
+
+    if (window >= max_windows)
+        return AVERROR(ENOMEM);
+
+    if (!c->maps[window]) {
+        /* the window may reach past the end of the file, which keeps
+         * growing, pages past cache_end are never touched */
+        void *map = mmap(NULL, MAP_WINDOW_SIZE, PROT_READ, MAP_SHARED,
+                         c->fd, window * MAP_WINDOW_SIZE);
+        if (map == MAP_FAILED)
+            return AVERROR(errno);
+        c->maps[window] = map;
+    }
+
+    size = FFMIN(size, MAP_WINDOW_SIZE - offset);
+    size = FFMIN(size, c->cache_end - physical_pos);
+    memcpy(buf, c->maps[window] + offset, size);
+    return size;
+#else
+    return AVERROR(ENOSYS);
+#endif
+}
+
 static int cache_read(URLContext *h, unsigned char *buf, int size)
 {
     Context *c= h->priv_data;
-    CacheEntry *entry, *next[2] = {NULL, NULL};
+    CacheEntry *entry;
     int64_t r;
+    int i;
 
-    entry = av_tree_find(c->root, &c->logical_pos, cmp, (void**)next);
-
-    if (!entry)
-        entry = next[0];
+    i = find_entry(c, c->logical_pos);
 
-    if (entry) {
-        int64_t in_block_pos = c->logical_pos - entry->logical_pos;
+    if (i >= 0) {
+        int64_t in_block_pos;
+        entry = &c->entries[i];
+        in_block_pos = c->logical_pos - entry->logical_pos;
         av_assert0(entry->logical_pos <= c->logical_pos);
         if (in_block_pos < entry->size) {
             int64_t physical_target = entry->physical_pos + in_block_pos;
 
+            r = read_mapped(c, physical_target, buf, FFMIN(size, entry->size - in_block_pos));
+            if (r > 0) {
+                c->logical_pos += r;
+                c->cache_hit ++;
+                return r;
+            }
+
             if (c->cache_pos != physical_target) {
                 r = lseek(c->fd, physical_target, SEEK_SET);
             } else
@@ -289,21 +795,29 @@ resolve_eof:
     return ret;
 }
 
-static int enu_free(void *opaque, void *elem)
-{
-    av_free(elem);
-    return 0;
-}
-
 static int cache_close(URLContext *h)
 {
     Context *c= h->priv_data;
-    int ret;
+    int ret, i;
 
-    av_log(h, AV_LOG_INFO, "Statistics, cache hits:%"PRId64" cache misses:%"PRId64"\n",
-           c->cache_hit, c->cache_miss);
+    av_log(h, AV_LOG_INFO, "Statistics, cache hits:%"PRId64" cache misses:%"PRId64" extents:%d\n",
+           c->cache_hit, c->cache_miss, c->nb_entries);
 
+#if HAVE_MMAP
+    for (i = 0; i < MAX_MAP_WINDOWS; i++)
+        if (c->maps[i])
+            munmap(c->maps[i], MAP_WINDOW_SIZE);
+#endif
+    /* the index is written while the data file is still locked */
+    if (c->persistent)
+        write_index(h);
     close(c->fd);
+    if (c->persistent) {
+#if HAVE_DIRENT_H
+        if (c->cache_max_size > 0)
+            evict_cache_files(h);
+#endif
+    }
     if (c->filename) {
         ret = unlink(c->filename);
         if (ret < 0)
@@ -311,8 +825,12 @@ static int cache_close(URLContext *h)
         av_freep(&c->filename);
     }
     ffurl_closep(&c->inner);
-    av_tree_enumerate(c->root, NULL, NULL, enu_free);
-    av_tree_destroy(c->root);
+    av_freep(&c->entries);
+    av_freep(&c->url);
+    av_freep(&c->data_path);
+    av_freep(&c->index_path);
+    av_freep(&c->etag);
+    av_freep(&c->last_modified);
 
     return 0;
 }
@@ -322,6 +840,11 @@ static int cache_close(URLContext *h)
 
 static const AVOption options[] = {
     { "read_ahead_limit", "Amount in bytes that may be read ahead when seeking isn't supported, -1 for unlimited", OFFSET(read_ahead_limit), AV_OPT_TYPE_INT, { .i64 = 65536 }, -1, INT_MAX, D },
+    { "cache_dir", "keep the cache in this directory across sessions, keyed by url, ETag and Last-Modified", OFFSET(cache_dir), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, D },
+    { "cache_max_size", "size the cache directory is trimmed to on close, least recently used first", OFFSET(cache_max_size), AV_OPT_TYPE_INT64, { .i64 = 1024 * 1024 * 1024 }, 0, INT64_MAX, D },
+    { "cache_hits",    "number of reads served from the cache",  OFFSET(cache_hit),  AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT64_MAX, D | AV_OPT_FLAG_READONLY | AV_OPT_FLAG_EXPORT },
+    { "cache_misses",  "number of reads from the inner protocol", OFFSET(cache_miss), AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT64_MAX, D | AV_OPT_FLAG_READONLY | AV_OPT_FLAG_EXPORT },
+    { "cache_extents", "number of contiguous ranges in the cache", OFFSET(nb_entries), AV_OPT_TYPE_INT,   { .i64 = 0 }, 0, INT_MAX,   D | AV_OPT_FLAG_READONLY | AV_OPT_FLAG_EXPORT },
     {NULL},
 };
 
@@ -26,15 +26,15 @@
 #include "internal.h"
 #include "url.h"
 
-// encourage reads of 4096 bytes - 1 block is always retained.
-#define MAX_BUFFER_BLOCKS 257
+// encourage reads of 64 KiB - 1 block is always retained.
+#define MAX_BUFFER_BLOCKS 4097
 #define BLOCKSIZE 16
 
 typedef struct CryptoContext {
     const AVClass *class;
     URLContext *hd;
-    uint8_t inbuffer [BLOCKSIZE*MAX_BUFFER_BLOCKS],
-            outbuffer[BLOCKSIZE*MAX_BUFFER_BLOCKS];
+    // ciphertext is decrypted in place, outptr points into this buffer
+    uint8_t buffer[BLOCKSIZE*MAX_BUFFER_BLOCKS];
     uint8_t *outptr;
     int indata, indata_used, outdata;
     int64_t position;  // position in file - used in seek
@@ -193,13 +193,21 @@ retry:
         c->position = c->position + size;
         return size;
     }
+    // All decrypted data has been consumed, so the ciphertext left over
+    // can be moved to the front to make room for the next read.
+    if (c->indata_used >= sizeof(c->buffer)/2) {
+        memmove(c->buffer, c->buffer + c->indata_used,
+                c->indata - c->indata_used);
+        c->indata     -= c->indata_used;
+        c->indata_used = 0;
+    }
     // We avoid using the last block until we've found EOF,
     // since we'll remove PKCS7 padding at the end. So make
     // sure we've got at least 2 blocks, so we can decrypt
     // at least one.
     while (c->indata - c->indata_used < 2*BLOCKSIZE) {
-        int n = ffurl_read(c->hd, c->inbuffer + c->indata,
-                           sizeof(c->inbuffer) - c->indata);
+        int n = ffurl_read(c->hd, c->buffer + c->indata,
+                           sizeof(c->buffer) - c->indata);
         if (n <= 0) {
             c->eof = 1;
             break;
@@ -211,20 +219,14 @@ retry:
         return AVERROR_EOF;
     if (!c->eof)
         blocks--;
-    av_aes_crypt(c->aes_decrypt, c->outbuffer, c->inbuffer + c->indata_used,
+    c->outptr       = c->buffer + c->indata_used;
+    av_aes_crypt(c->aes_decrypt, c->outptr, c->outptr,
                  blocks, c->decrypt_iv, 1);
     c->outdata      = BLOCKSIZE * blocks;
-    c->outptr       = c->outbuffer;
     c->indata_used += BLOCKSIZE * blocks;
-    if (c->indata_used >= sizeof(c->inbuffer)/2) {
-        memmove(c->inbuffer, c->inbuffer + c->indata_used,
-                c->indata - c->indata_used);
-        c->indata     -= c->indata_used;
-        c->indata_used = 0;
-    }
     if (c->eof) {
         // Remove PKCS7 padding at the end
-        int padding = c->outbuffer[c->outdata - 1];
+        int padding = c->outptr[c->outdata - 1];
         c->outdata -= padding;
     }
     goto retry;
@@ -276,7 +278,7 @@ static int64_t crypto_seek(URLContext *h, int64_t pos, int whence)
     c->outdata = 0;
     c->indata = 0;
     c->indata_used = 0;
-    c->outptr = c->outbuffer;
+    c->outptr = c->buffer;
 
     // identify the block containing the IV for the
     // next block we will decrypt
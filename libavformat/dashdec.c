@@ -19,9 +19,12 @@
  * License along with FFmpeg; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
+#include <stdatomic.h>
+
 #include <libxml/parser.h>
 #include "libavutil/intreadwrite.h"
 #include "libavutil/opt.h"
+#include "libavutil/thread.h"
 #include "libavutil/time.h"
 #include "libavutil/parseutils.h"
 #include "internal.h"
@@ -31,6 +34,7 @@
 #define INITIAL_BUFFER_SIZE 32768
 #define MAX_MANIFEST_SIZE 50 * 1024
 #define DEFAULT_MANIFEST_SIZE 8 * 1024
+#define PREFETCH_READ_SIZE 65536
 
 struct fragment {
     int64_t url_offset;
@@ -69,6 +73,51 @@ struct timeline {
     int64_t duration;
 };
 
+struct representation;
+
+enum PrefetchState {
+    PREFETCH_EMPTY,
+    PREFETCH_LOADING,
+    PREFETCH_DONE,
+    PREFETCH_FAILED
+};
+
+enum RefreshState {
+    REFRESH_IDLE,
+    REFRESH_RUNNING,
+    REFRESH_DONE
+};
+
+/*
+ * A fragment downloaded ahead of the playback position into memory.
+ * The state and the data pointer are owned by the demuxer thread, the
+ * downloading thread only appends to data and moves LOADING to DONE or
+ * FAILED. len, data_size and state are protected by the representation's
+ * prefetch_mutex. Fragments are matched by url and offset, since a
+ * manifest refresh may renumber them.
+ */
+struct prefetch_slot {
+    struct representation *pls;
+    enum PrefetchState state;
+    int64_t seq_no;
+    char *url;
+    int64_t url_offset;
+    int64_t size;
+    AVDictionary *opts;
+    atomic_int abort_request;
+    int error;
+    uint8_t *data;
+    size_t data_size;
+    size_t len;
+    size_t read_pos;
+    int64_t start_time;
+    int64_t end_time;
+#if HAVE_THREADS
+    pthread_t thread;
+#endif
+    int thread_started;
+};
+
 /*
  * Each playlist has its own demuxer. If it is currently active,
  * it has an opened AVIOContext too, and potentially an AVPacket
@@ -120,6 +169,17 @@ struct representation {
     uint32_t init_sec_buf_read_offset;
     int64_t cur_timestamp;
     int is_restart_needed;
+
+    /* Fragments following cur_seq_no that are being downloaded in the
+     * background, and the one currently read instead of input. */
+    struct prefetch_slot *prefetch;
+    int n_prefetch;
+    int64_t prefetch_bytes;
+    struct prefetch_slot *input_slot;
+#if HAVE_THREADS
+    pthread_mutex_t prefetch_mutex;
+    pthread_cond_t prefetch_cond;
+#endif
 };
 
 typedef struct DASHContext {
@@ -160,6 +220,22 @@ typedef struct DASHContext {
     int is_init_section_common_video;
     int is_init_section_common_audio;
 
+    int prefetch_fragments;
+    int64_t prefetch_max_size;
+    int live_refresh_async;
+
+    /* Live manifest refresh running in the background. The worker owns
+     * the refresh_* fields until it sets refresh_state to REFRESH_DONE. */
+    atomic_int refresh_state;
+    atomic_int refresh_abort;
+    AVDictionary *refresh_opts;
+    char *refresh_url;
+    char *refresh_data;
+    int refresh_error;
+    int64_t last_refresh_time;
+#if HAVE_THREADS
+    pthread_t refresh_thread;
+#endif
 } DASHContext;
 
 static int ishttp(char *url)
@@ -317,6 +393,464 @@ finish:
     return num;
 }
 
+#if HAVE_THREADS
+static int prefetch_interrupt_cb(void *opaque)
+{
+    struct prefetch_slot *slot = opaque;
+
+    return atomic_load(&slot->abort_request) ||
+           ff_check_interrupt(&slot->pls->parent->interrupt_callback);
+}
+
+/* the earliest fragment in the pool must never wait for memory, the
+ * demuxer is about to read from it */
+static int prefetch_may_grow(struct representation *pls, struct prefetch_slot *slot)
+{
+    DASHContext *c = pls->parent->priv_data;
+    int i;
+
+    if (pls->prefetch_bytes < c->prefetch_max_size)
+        return 1;
+    for (i = 0; i < pls->n_prefetch; i++) {
+        struct prefetch_slot *other = &pls->prefetch[i];
+        if (other->state != PREFETCH_EMPTY && other->seq_no < slot->seq_no)
+            return 0;
+    }
+    return 1;
+}
+
+static void *prefetch_worker(void *arg)
+{
+    struct prefetch_slot *slot = arg;
+    struct representation *pls = slot->pls;
+    AVFormatContext *s = pls->parent;
+    AVIOInterruptCB int_cb = { prefetch_interrupt_cb, slot };
+    AVIOContext *pb = NULL;
+    int64_t size;
+    int ret;
+
+    ret = ff_format_io_open_async(s, &pb, slot->url, AVIO_FLAG_READ, &slot->opts, &int_cb);
+    if (ret < 0)
+        goto end;
+
+    size = slot->size >= 0 ? slot->size : avio_size(pb);
+
+    while (1) {
+        uint8_t *dst;
+
+        pthread_mutex_lock(&pls->prefetch_mutex);
+        while (!atomic_load(&slot->abort_request) && !prefetch_may_grow(pls, slot))
+            pthread_cond_wait(&pls->prefetch_cond, &pls->prefetch_mutex);
+        if (atomic_load(&slot->abort_request)) {
+            pthread_mutex_unlock(&pls->prefetch_mutex);
+            ret = AVERROR_EXIT;
+            break;
+        }
+        if (slot->data_size - slot->len < PREFETCH_READ_SIZE) {
+            size_t new_size = FFMAX(slot->data_size * 2, slot->len + PREFETCH_READ_SIZE);
+            if (!slot->data_size && size > 0)
+                new_size = size + PREFETCH_READ_SIZE;
+            dst = av_realloc(slot->data, new_size);
+            if (!dst) {
+                pthread_mutex_unlock(&pls->prefetch_mutex);
+                ret = AVERROR(ENOMEM);
+                break;
+            }
+            slot->data      = dst;
+            slot->data_size = new_size;
+        }
+        dst = slot->data + slot->len;
+        pthread_mutex_unlock(&pls->prefetch_mutex);
+
+        /* only this thread moves data, the reader copies under the lock */
+        ret = avio_read(pb, dst, PREFETCH_READ_SIZE);
+        if (ret <= 0) {
+            /* a fragment cut short must not look complete */
+            if ((ret == AVERROR_EOF || !ret) && size > 0 && slot->len < size)
+                ret = AVERROR(EIO);
+            break;
+        }
+
+        pthread_mutex_lock(&pls->prefetch_mutex);
+        slot->len           += ret;
+        pls->prefetch_bytes += ret;
+        pthread_cond_broadcast(&pls->prefetch_cond);
+        pthread_mutex_unlock(&pls->prefetch_mutex);
+    }
+
+end:
+    ff_format_io_close(s, &pb);
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    slot->end_time = av_gettime_relative();
+    if (ret == AVERROR_EOF || ret == 0) {
+        slot->state = PREFETCH_DONE;
+    } else {
+        slot->state = PREFETCH_FAILED;
+        slot->error = ret;
+    }
+    pthread_cond_broadcast(&pls->prefetch_cond);
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+    return NULL;
+}
+
+/* Stop the download of a slot and give its memory back. Only called from
+ * the demuxer thread. */
+static void prefetch_release(struct representation *pls, struct prefetch_slot *slot)
+{
+    if (slot->state == PREFETCH_EMPTY)
+        return;
+
+    atomic_store(&slot->abort_request, 1);
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    pthread_cond_broadcast(&pls->prefetch_cond);
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+
+    if (slot->thread_started)
+        pthread_join(slot->thread, NULL);
+    slot->thread_started = 0;
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    pls->prefetch_bytes -= slot->len;
+    slot->state = PREFETCH_EMPTY;
+    pthread_cond_broadcast(&pls->prefetch_cond);
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+
+    if (pls->input_slot == slot)
+        pls->input_slot = NULL;
+    av_freep(&slot->data);
+    av_freep(&slot->url);
+    av_dict_free(&slot->opts);
+    slot->data_size = slot->len = slot->read_pos = 0;
+}
+
+/* Cancel every download outside of [first_seq, last_seq], except the
+ * fragment that is currently being read. */
+static void prefetch_flush(struct representation *pls, int64_t first_seq, int64_t last_seq)
+{
+    int i;
+
+    for (i = 0; i < pls->n_prefetch; i++) {
+        struct prefetch_slot *slot = &pls->prefetch[i];
+        if (slot->state != PREFETCH_EMPTY && slot != pls->input_slot &&
+            (slot->seq_no < first_seq || slot->seq_no > last_seq))
+            prefetch_release(pls, slot);
+    }
+}
+
+static void prefetch_uninit(struct representation *pls)
+{
+    int i;
+
+    if (!pls->prefetch)
+        return;
+    for (i = 0; i < pls->n_prefetch; i++)
+        prefetch_release(pls, &pls->prefetch[i]);
+    pthread_cond_destroy(&pls->prefetch_cond);
+    pthread_mutex_destroy(&pls->prefetch_mutex);
+    av_freep(&pls->prefetch);
+    pls->n_prefetch = 0;
+}
+
+static int prefetch_init(DASHContext *c, struct representation *pls)
+{
+    int ret;
+
+    pls->prefetch = av_mallocz_array(c->prefetch_fragments, sizeof(*pls->prefetch));
+    if (!pls->prefetch)
+        return AVERROR(ENOMEM);
+    if ((ret = pthread_mutex_init(&pls->prefetch_mutex, NULL))) {
+        av_freep(&pls->prefetch);
+        return AVERROR(ret);
+    }
+    if ((ret = pthread_cond_init(&pls->prefetch_cond, NULL))) {
+        pthread_mutex_destroy(&pls->prefetch_mutex);
+        av_freep(&pls->prefetch);
+        return AVERROR(ret);
+    }
+    pls->n_prefetch = c->prefetch_fragments;
+    return 0;
+}
+
+/* url == NULL looks for an unused slot */
+static struct prefetch_slot *prefetch_find(struct representation *pls,
+                                           const char *url, int64_t url_offset)
+{
+    struct prefetch_slot *slot = NULL;
+    int i;
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    for (i = 0; i < pls->n_prefetch && !slot; i++) {
+        struct prefetch_slot *cur = &pls->prefetch[i];
+        if (!url ? cur->state == PREFETCH_EMPTY :
+            cur->state != PREFETCH_EMPTY && cur->url_offset == url_offset &&
+            !strcmp(cur->url, url))
+            slot = cur;
+    }
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+    return slot;
+}
+
+/* takes ownership of url */
+static int prefetch_start(DASHContext *c, struct representation *pls,
+                          struct prefetch_slot *slot, int64_t seq_no,
+                          char *url, struct fragment *seg)
+{
+    int ret;
+
+    slot->pls        = pls;
+    slot->url        = url;
+    slot->url_offset = seg->url_offset;
+    slot->size       = seg->size;
+    slot->error      = 0;
+    av_dict_copy(&slot->opts, c->avio_opts, 0);
+    if (seg->size >= 0) {
+        av_dict_set_int(&slot->opts, "offset", seg->url_offset, 0);
+        av_dict_set_int(&slot->opts, "end_offset", seg->url_offset + seg->size, 0);
+    }
+    atomic_init(&slot->abort_request, 0);
+    slot->start_time = av_gettime_relative();
+    slot->end_time   = 0;
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    slot->seq_no = seq_no;
+    slot->state  = PREFETCH_LOADING;
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+
+    ret = pthread_create(&slot->thread, NULL, prefetch_worker, slot);
+    if (ret) {
+        pthread_mutex_lock(&pls->prefetch_mutex);
+        slot->state = PREFETCH_EMPTY;
+        pthread_mutex_unlock(&pls->prefetch_mutex);
+        av_freep(&slot->url);
+        av_dict_free(&slot->opts);
+        return AVERROR(ret);
+    }
+    slot->thread_started = 1;
+
+    av_log(pls->parent, AV_LOG_DEBUG, "Prefetching fragment %"PRId64" of playlist %d\n",
+           seq_no, pls->rep_idx);
+    return 0;
+}
+
+/* Hand over the download of url to the reader, if there is a usable one.
+ * A failed download is dropped even if it got some data, the fragment is
+ * then requested again. */
+static struct prefetch_slot *prefetch_take(struct representation *pls,
+                                           const char *url, int64_t url_offset)
+{
+    struct prefetch_slot *slot;
+    int failed;
+
+    if (!pls->prefetch || !(slot = prefetch_find(pls, url, url_offset)))
+        return NULL;
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    failed = slot->state == PREFETCH_FAILED;
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+
+    if (failed) {
+        av_log(pls->parent, AV_LOG_DEBUG, "Prefetch of fragment %"PRId64" of playlist %d failed: %s\n",
+               slot->seq_no, pls->rep_idx, av_err2str(slot->error));
+        prefetch_release(pls, slot);
+        return NULL;
+    }
+    slot->read_pos = 0;
+    return slot;
+}
+
+/* Wait a bit for the download threads, with prefetch_mutex held. */
+static int prefetch_wait(struct representation *pls)
+{
+    DASHContext *c = pls->parent->priv_data;
+    int64_t t = av_gettime() + 10000;
+    struct timespec tv = { .tv_sec  =  t / 1000000,
+                           .tv_nsec = (t % 1000000) * 1000 };
+
+    if (ff_check_interrupt(c->interrupt_callback))
+        return AVERROR_EXIT;
+    pthread_cond_timedwait(&pls->prefetch_cond, &pls->prefetch_mutex, &tv);
+    return 0;
+}
+
+static int prefetch_read(struct representation *pls, struct prefetch_slot *slot,
+                         uint8_t *buf, int buf_size)
+{
+    int ret;
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    while (slot->read_pos >= slot->len && slot->state == PREFETCH_LOADING) {
+        if ((ret = prefetch_wait(pls)) < 0) {
+            pthread_mutex_unlock(&pls->prefetch_mutex);
+            return ret;
+        }
+    }
+
+    if (slot->read_pos < slot->len) {
+        ret = FFMIN(buf_size, slot->len - slot->read_pos);
+        memcpy(buf, slot->data + slot->read_pos, ret);
+        slot->read_pos += ret;
+    } else {
+        ret = slot->state == PREFETCH_FAILED ? slot->error : AVERROR_EOF;
+        if (slot->state == PREFETCH_DONE)
+            av_log(pls->parent, AV_LOG_VERBOSE,
+                   "Read prefetched fragment %"PRId64" of playlist %d, %"SIZE_SPECIFIER" bytes in %"PRId64" ms\n",
+                   slot->seq_no, pls->rep_idx, slot->len,
+                   (slot->end_time - slot->start_time) / 1000);
+    }
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+    return ret;
+}
+
+/* Seek within the fragment being read, positions are relative to its
+ * first byte. Waits until the download got far enough. */
+static int64_t prefetch_seek(struct representation *pls, struct prefetch_slot *slot,
+                             int64_t offset, int whence)
+{
+    int64_t ret = 0;
+
+    whence &= ~AVSEEK_FORCE;
+    if (whence == SEEK_CUR) {
+        offset += slot->read_pos;
+        whence  = SEEK_SET;
+    }
+    if (whence != SEEK_SET && whence != SEEK_END && whence != AVSEEK_SIZE)
+        return AVERROR(EINVAL);
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    if (whence != SEEK_SET) {
+        int64_t size;
+
+        while (slot->size < 0 && slot->state == PREFETCH_LOADING && ret >= 0)
+            ret = prefetch_wait(pls);
+        size = slot->size >= 0 ? slot->size : slot->len;
+        if (whence == AVSEEK_SIZE) {
+            pthread_mutex_unlock(&pls->prefetch_mutex);
+            return ret < 0 ? ret : size;
+        }
+        offset += size;
+    }
+    while ((int64_t)slot->len < offset && slot->state == PREFETCH_LOADING && ret >= 0)
+        ret = prefetch_wait(pls);
+    if (ret >= 0) {
+        if (offset < 0)
+            ret = AVERROR(EINVAL);
+        else if (offset > (int64_t)slot->len)
+            ret = slot->state == PREFETCH_FAILED ? slot->error : AVERROR(EINVAL);
+        else
+            ret = slot->read_pos = offset;
+    }
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+
+    if (ret >= 0)
+        pls->cur_seg_offset = ret;
+    return ret;
+}
+
+static int refresh_interrupt_cb(void *opaque)
+{
+    AVFormatContext *s = opaque;
+    DASHContext *c = s->priv_data;
+
+    return atomic_load(&c->refresh_abort) ||
+           ff_check_interrupt(&s->interrupt_callback);
+}
+
+/* Fetch the manifest into memory, parse_manifest() runs on the demuxer
+ * thread once the data is there. */
+static void *refresh_worker(void *arg)
+{
+    AVFormatContext *s = arg;
+    DASHContext *c = s->priv_data;
+    AVIOInterruptCB int_cb = { refresh_interrupt_cb, s };
+    AVIOContext *in = NULL;
+    AVBPrint bp;
+    int ret;
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+    ret = ff_format_io_open_async(s, &in, s->url, AVIO_FLAG_READ, &c->refresh_opts, &int_cb);
+    if (ret >= 0) {
+        av_opt_get(in, "location", AV_OPT_SEARCH_CHILDREN, (uint8_t **)&c->refresh_url);
+        ret = avio_read_to_bprint(in, &bp, MAX_MANIFEST_SIZE);
+        if (ret >= 0 && !av_bprint_is_complete(&bp))
+            ret = AVERROR(ENOMEM);
+        ff_format_io_close(s, &in);
+    }
+    if (ret >= 0)
+        ret = av_bprint_finalize(&bp, &c->refresh_data);
+    else
+        av_bprint_finalize(&bp, NULL);
+    c->refresh_error = ret;
+
+    atomic_store(&c->refresh_state, REFRESH_DONE);
+    return NULL;
+}
+
+static int refresh_start(AVFormatContext *s)
+{
+    DASHContext *c = s->priv_data;
+    int ret;
+
+    if (!ff_format_io_open_is_async(s))
+        return AVERROR(ENOSYS);
+    av_dict_copy(&c->refresh_opts, c->avio_opts, 0);
+    atomic_store(&c->refresh_abort, 0);
+    atomic_store(&c->refresh_state, REFRESH_RUNNING);
+
+    ret = pthread_create(&c->refresh_thread, NULL, refresh_worker, s);
+    if (ret) {
+        atomic_store(&c->refresh_state, REFRESH_IDLE);
+        av_dict_free(&c->refresh_opts);
+        return AVERROR(ret);
+    }
+    return 0;
+}
+
+/* Wait for the worker and take over its result, only called when the
+ * state is not REFRESH_IDLE. */
+static void refresh_join(DASHContext *c)
+{
+    pthread_join(c->refresh_thread, NULL);
+    av_dict_free(&c->refresh_opts);
+    atomic_store(&c->refresh_state, REFRESH_IDLE);
+}
+
+static void refresh_cancel(DASHContext *c)
+{
+    if (atomic_load(&c->refresh_state) == REFRESH_IDLE)
+        return;
+    atomic_store(&c->refresh_abort, 1);
+    refresh_join(c);
+    av_freep(&c->refresh_data);
+    av_freep(&c->refresh_url);
+}
+#else
+static void prefetch_release(struct representation *pls, struct prefetch_slot *slot) { }
+static void prefetch_flush(struct representation *pls, int64_t first_seq, int64_t last_seq) { }
+static void prefetch_uninit(struct representation *pls) { }
+static struct prefetch_slot *prefetch_take(struct representation *pls,
+                                           const char *url, int64_t url_offset)
+{
+    return NULL;
+}
+static int prefetch_read(struct representation *pls, struct prefetch_slot *slot,
+                         uint8_t *buf, int buf_size)
+{
+    return AVERROR(ENOSYS);
+}
+static int64_t prefetch_seek(struct representation *pls, struct prefetch_slot *slot,
+                             int64_t offset, int whence)
+{
+    return AVERROR(ENOSYS);
+}
+static int refresh_start(AVFormatContext *s)
+{
+    return AVERROR(ENOSYS);
+}
+static void refresh_join(DASHContext *c) { }
+static void refresh_cancel(DASHContext *c) { }
+#endif
+
 static void free_fragment(struct fragment **seg)
 {
     if (!(*seg)) {
@@ -350,6 +884,7 @@ static void free_timelines_list(struct representation *pls)
 
 static void free_representation(struct representation *pls)
 {
+    prefetch_uninit(pls);
     free_fragment_list(pls);
     free_timelines_list(pls);
     free_fragment(&pls->cur_seg);
@@ -366,6 +901,15 @@ static void free_representation(struct representation *pls)
     av_freep(&pls);
 }
 
+/* close the fragment being read, whether it comes from the network or
+ * from the prefetcher */
+static void close_input(struct representation *pls)
+{
+    if (pls->input_slot)
+        prefetch_release(pls, pls->input_slot);
+    ff_format_io_close(pls->parent, &pls->input);
+}
+
 static void free_video_list(DASHContext *c)
 {
     int i;
@@ -1515,7 +2059,7 @@ static void move_segments(struct representation *rep_src, struct representation
 }
 
 
-static int refresh_manifest(AVFormatContext *s)
+static int refresh_manifest(AVFormatContext *s, const char *url, AVIOContext *in)
 {
     int ret = 0, i;
     DASHContext *c = s->priv_data;
@@ -1535,9 +2079,10 @@ static int refresh_manifest(AVFormatContext *s)
     c->audios = NULL;
     c->n_subtitles = 0;
     c->subtitles = NULL;
-    ret = parse_manifest(s, s->url, NULL);
+    ret = parse_manifest(s, url, in);
     if (ret)
         goto finish;
+    c->last_refresh_time = av_gettime_relative();
 
     if (c->n_videos != n_videos) {
         av_log(c, AV_LOG_ERROR,
@@ -1614,31 +2159,160 @@ finish:
     return ret;
 }
 
+/* a manifest in memory, read through an AVIOContext by parse_manifest() */
+struct manifest_buffer {
+    const uint8_t *data;
+    int size;
+    int pos;
+};
+
+static int read_manifest_buffer(void *opaque, uint8_t *buf, int buf_size)
+{
+    struct manifest_buffer *mb = opaque;
+    int len = FFMIN(buf_size, mb->size - mb->pos);
+
+    if (len <= 0)
+        return AVERROR_EOF;
+    memcpy(buf, mb->data + mb->pos, len);
+    mb->pos += len;
+    return len;
+}
+
+/* Parse the manifest fetched by refresh_worker() once it is there and start
+ * the next fetch when the update period has elapsed, or right away with
+ * wait set, in which case this returns only after the refresh. Returns 1
+ * if the manifest has been refreshed. */
+static int refresh_poll(AVFormatContext *s, int wait)
+{
+    DASHContext *c = s->priv_data;
+    int ret;
+
+    while (1) {
+        int state = atomic_load(&c->refresh_state);
+
+        if (state == REFRESH_DONE) {
+            refresh_join(c);
+            ret = c->refresh_error;
+            if (ret >= 0) {
+                struct manifest_buffer mb = { c->refresh_data, strlen(c->refresh_data), 0 };
+                uint8_t buf[INITIAL_BUFFER_SIZE];
+                AVIOContext in;
+                ffio_init_context(&in, buf, sizeof(buf), 0, &mb,
+                                  read_manifest_buffer, NULL, NULL);
+                ret = refresh_manifest(s, c->refresh_url ? c->refresh_url : s->url, &in);
+            }
+            av_freep(&c->refresh_data);
+            av_freep(&c->refresh_url);
+            if (ret < 0 && ret != AVERROR_EXIT)
+                av_log(s, AV_LOG_WARNING, "Failed to refresh the manifest\n");
+            return ret < 0 ? ret : 1;
+        }
+
+        if (state == REFRESH_IDLE) {
+            if (!wait && (!c->minimum_update_period ||
+                av_gettime_relative() - c->last_refresh_time < (int64_t)c->minimum_update_period * 1000000))
+                return 0;
+            if (refresh_start(s) < 0) {
+                /* no thread, refresh in place */
+                ret = refresh_manifest(s, s->url, NULL);
+                return ret < 0 ? ret : 1;
+            }
+        }
+
+        if (!wait)
+            return 0;
+        if (ff_check_interrupt(c->interrupt_callback))
+            return AVERROR_EXIT;
+        av_usleep(10 * 1000);
+    }
+}
+
+/* Refresh a live manifest. In the background with live_refresh_async,
+ * then wait says whether the caller cannot go on without the update. */
+static int update_manifest(AVFormatContext *s, int wait)
+{
+    DASHContext *c = s->priv_data;
+
+    if (c->live_refresh_async)
+        return refresh_poll(s, wait);
+    return refresh_manifest(s, s->url, NULL);
+}
+
+/* Build the fragment seq_no of a representation without a fragment list
+ * from its url template. */
+static struct fragment *get_template_fragment(struct representation *pls, int64_t seq_no)
+{
+    DASHContext *c = pls->parent->priv_data;
+    struct fragment *seg;
+    char *tmpfilename;
+
+    seg = av_mallocz(sizeof(struct fragment));
+    if (!seg)
+        return NULL;
+    tmpfilename = av_mallocz(c->max_url_size);
+    if (!tmpfilename) {
+        av_free(seg);
+        return NULL;
+    }
+    ff_dash_fill_tmpl_params(tmpfilename, c->max_url_size, pls->url_template, 0, seq_no, 0, get_segment_start_time_based_on_timeline(pls, seq_no));
+    seg->url = av_strireplace(pls->url_template, pls->url_template, tmpfilename);
+    if (!seg->url) {
+        av_log(pls->parent, AV_LOG_WARNING, "Unable to resolve template url '%s', try to use origin template\n", pls->url_template);
+        seg->url = av_strdup(pls->url_template);
+        if (!seg->url) {
+            av_log(pls->parent, AV_LOG_ERROR, "Cannot resolve template url '%s'\n", pls->url_template);
+            av_free(tmpfilename);
+            av_free(seg);
+            return NULL;
+        }
+    }
+    av_free(tmpfilename);
+    seg->size = -1;
+    return seg;
+}
+
+/* Copy of the fragment seq_no of a representation, NULL if it is not
+ * listed in the manifest. */
+static struct fragment *get_fragment(struct representation *pls, int64_t seq_no)
+{
+    struct fragment *seg = NULL;
+    struct fragment *seg_ptr = NULL;
+
+    if (!pls->n_fragments)
+        return pls->url_template ? get_template_fragment(pls, seq_no) : NULL;
+    if (seq_no < 0 || seq_no >= pls->n_fragments)
+        return NULL;
+
+    seg_ptr = pls->fragments[seq_no];
+    seg = av_mallocz(sizeof(struct fragment));
+    if (!seg) {
+        return NULL;
+    }
+    seg->url = av_strdup(seg_ptr->url);
+    if (!seg->url) {
+        av_free(seg);
+        return NULL;
+    }
+    seg->size = seg_ptr->size;
+    seg->url_offset = seg_ptr->url_offset;
+    return seg;
+}
+
 static struct fragment *get_current_fragment(struct representation *pls)
 {
     int64_t min_seq_no = 0;
     int64_t max_seq_no = 0;
-    struct fragment *seg = NULL;
-    struct fragment *seg_ptr = NULL;
     DASHContext *c = pls->parent->priv_data;
 
+    /* pick up a manifest refreshed in the background at fragment boundaries */
+    if (c->is_live && c->live_refresh_async)
+        refresh_poll(pls->parent, 0);
+
     while (( !ff_check_interrupt(c->interrupt_callback)&& pls->n_fragments > 0)) {
         if (pls->cur_seq_no < pls->n_fragments) {
-            seg_ptr = pls->fragments[pls->cur_seq_no];
-            seg = av_mallocz(sizeof(struct fragment));
-            if (!seg) {
-                return NULL;
-            }
-            seg->url = av_strdup(seg_ptr->url);
-            if (!seg->url) {
-                av_free(seg);
-                return NULL;
-            }
-            seg->size = seg_ptr->size;
-            seg->url_offset = seg_ptr->url_offset;
-            return seg;
+            return get_fragment(pls, pls->cur_seq_no);
         } else if (c->is_live) {
-            refresh_manifest(pls->parent);
+            update_manifest(pls->parent, 1);
         } else {
             break;
         }
@@ -1648,7 +2322,7 @@ static struct fragment *get_current_fragment(struct representation *pls)
         max_seq_no = calc_max_seg_no(pls, c);
 
         if (pls->timelines || pls->fragments) {
-            refresh_manifest(pls->parent);
+            update_manifest(pls->parent, pls->cur_seq_no > max_seq_no);
         }
         if (pls->cur_seq_no <= min_seq_no) {
             av_log(pls->parent, AV_LOG_VERBOSE, "old fragment: cur[%"PRId64"] min[%"PRId64"] max[%"PRId64"], playlist %d\n", (int64_t)pls->cur_seq_no, min_seq_no, max_seq_no, (int)pls->rep_idx);
@@ -1656,38 +2330,86 @@ static struct fragment *get_current_fragment(struct representation *pls)
         } else if (pls->cur_seq_no > max_seq_no) {
             av_log(pls->parent, AV_LOG_VERBOSE, "new fragment: min[%"PRId64"] max[%"PRId64"], playlist %d\n", min_seq_no, max_seq_no, (int)pls->rep_idx);
         }
-        seg = av_mallocz(sizeof(struct fragment));
-        if (!seg) {
-            return NULL;
+    } else if (pls->cur_seq_no > pls->last_seq_no) {
+        return NULL;
+    }
+
+    return get_template_fragment(pls, pls->cur_seq_no);
+}
+
+/* Last fragment that can be fetched ahead of the reader. */
+static int64_t prefetch_last_seq_no(DASHContext *c, struct representation *pls)
+{
+    if (pls->n_fragments)
+        return pls->n_fragments - 1;
+    if (!pls->url_template)
+        return -1;
+    if (!c->is_live)
+        return pls->last_seq_no;
+    if (pls->n_timelines)
+        return calc_max_seg_no(pls, c);
+    /* the newest one may still be being written */
+    return calc_max_seg_no(pls, c) - 1;
+}
+
+#if HAVE_THREADS
+/* Keep up to prefetch_fragments downloads running ahead of cur_seq_no,
+ * bounded by prefetch_max_size bytes. */
+static void prefetch_schedule(DASHContext *c, struct representation *pls)
+{
+    int64_t seq_no, last_seq_no;
+
+    if (c->prefetch_fragments <= 0)
+        return;
+    if (!pls->prefetch && prefetch_init(c, pls) < 0)
+        return;
+
+    last_seq_no = FFMIN(pls->cur_seq_no + pls->n_prefetch, prefetch_last_seq_no(c, pls));
+    prefetch_flush(pls, pls->cur_seq_no, pls->cur_seq_no + pls->n_prefetch);
+
+    for (seq_no = pls->cur_seq_no + 1; seq_no <= last_seq_no; seq_no++) {
+        struct prefetch_slot *slot;
+        struct fragment *seg;
+        char *url;
+        int64_t bytes;
+
+        if (!(seg = get_fragment(pls, seq_no)))
+            break;
+        url = av_mallocz(c->max_url_size);
+        if (!url) {
+            free_fragment(&seg);
+            break;
         }
-    } else if (pls->cur_seq_no <= pls->last_seq_no) {
-        seg = av_mallocz(sizeof(struct fragment));
-        if (!seg) {
-            return NULL;
+        ff_make_absolute_url(url, c->max_url_size, c->base_url, seg->url);
+        /* anything but http is left to open_input() */
+        if (!av_strstart(url, "http", NULL) || !ishttp(url)) {
+            av_free(url);
+            free_fragment(&seg);
+            break;
         }
-    }
-    if (seg) {
-        char *tmpfilename= av_mallocz(c->max_url_size);
-        if (!tmpfilename) {
-            return NULL;
+        if (prefetch_find(pls, url, seg->url_offset)) {
+            av_free(url);
+            free_fragment(&seg);
+            continue;
         }
-        ff_dash_fill_tmpl_params(tmpfilename, c->max_url_size, pls->url_template, 0, pls->cur_seq_no, 0, get_segment_start_time_based_on_timeline(pls, pls->cur_seq_no));
-        seg->url = av_strireplace(pls->url_template, pls->url_template, tmpfilename);
-        if (!seg->url) {
-            av_log(pls->parent, AV_LOG_WARNING, "Unable to resolve template url '%s', try to use origin template\n", pls->url_template);
-            seg->url = av_strdup(pls->url_template);
-            if (!seg->url) {
-                av_log(pls->parent, AV_LOG_ERROR, "Cannot resolve template url '%s'\n", pls->url_template);
-                av_free(tmpfilename);
-                return NULL;
-            }
+
+        pthread_mutex_lock(&pls->prefetch_mutex);
+        bytes = pls->prefetch_bytes;
+        pthread_mutex_unlock(&pls->prefetch_mutex);
+
+        slot = bytes < c->prefetch_max_size ? prefetch_find(pls, NULL, 0) : NULL;
+        if (!slot || prefetch_start(c, pls, slot, seq_no, url, seg) < 0) {
+            if (!slot)
+                av_free(url);
+            free_fragment(&seg);
+            break;
         }
-        av_free(tmpfilename);
-        seg->size = -1;
+        free_fragment(&seg);
     }
-
-    return seg;
 }
+#else
+static void prefetch_schedule(DASHContext *c, struct representation *pls) { }
+#endif
 
 static int read_from_url(struct representation *pls, struct fragment *seg,
                          uint8_t *buf, int buf_size)
@@ -1698,7 +2420,10 @@ static int read_from_url(struct representation *pls, struct fragment *seg,
     if (seg->size >= 0)
         buf_size = FFMIN(buf_size, pls->cur_seg_size - pls->cur_seg_offset);
 
-    ret = avio_read(pls->input, buf, buf_size);
+    if (pls->input_slot)
+        ret = prefetch_read(pls, pls->input_slot, buf, buf_size);
+    else
+        ret = avio_read(pls->input, buf, buf_size);
     if (ret > 0)
         pls->cur_seg_offset += ret;
 
@@ -1725,6 +2450,11 @@ static int open_input(DASHContext *c, struct representation *pls, struct fragmen
     }
 
     ff_make_absolute_url(url, c->max_url_size, c->base_url, seg->url);
+    if (seg != pls->init_section && (pls->input_slot = prefetch_take(pls, url, seg->url_offset))) {
+        av_log(pls->parent, AV_LOG_VERBOSE, "DASH prefetched url '%s', offset %"PRId64", playlist %d\n",
+               url, seg->url_offset, pls->rep_idx);
+        goto cleanup;
+    }
     av_log(pls->parent, AV_LOG_VERBOSE, "DASH request for url '%s', offset %"PRId64", playlist %d\n",
            url, seg->url_offset, pls->rep_idx);
     ret = open_url(pls->parent, &pls->input, url, c->avio_opts, opts, NULL);
@@ -1788,7 +2518,10 @@ static int64_t seek_data(void *opaque, int64_t offset, int whence)
 {
     struct representation *v = opaque;
     if (v->n_fragments && !v->init_sec_data_len) {
-        return avio_seek(v->input, offset, whence);
+        if (v->input_slot)
+            return prefetch_seek(v, v->input_slot, offset, whence);
+        if (v->input)
+            return avio_seek(v->input, offset, whence);
     }
 
     return AVERROR(ENOSYS);
@@ -1801,7 +2534,7 @@ static int read_data(void *opaque, uint8_t *buf, int buf_size)
     DASHContext *c = v->parent->priv_data;
 
 restart:
-    if (!v->input) {
+    if (!v->input && !v->input_slot) {
         free_fragment(&v->cur_seg);
         v->cur_seg = get_current_fragment(v);
         if (!v->cur_seg) {
@@ -1824,6 +2557,7 @@ restart:
             v->cur_seq_no++;
             goto restart;
         }
+        prefetch_schedule(c, v);
     }
 
     if (v->init_sec_buf_read_offset < v->init_sec_data_len) {
@@ -1861,7 +2595,8 @@ static int save_avio_options(AVFormatContext *s)
 {
     DASHContext *c = s->priv_data;
     const char *opts[] = {
-        "headers", "user_agent", "cookies", "http_proxy", "referer", "rw_timeout", "icy", NULL };
+        "headers", "user_agent", "cookies", "http_proxy", "referer", "rw_timeout", "icy",
+        "connection_pool", "connection_pool_idle_time", "connection_pool_max_per_host", NULL };
     const char **opt = opts;
     uint8_t *buf = NULL;
     int ret = 0;
@@ -2059,11 +2794,18 @@ static int dash_read_header(AVFormatContext *s)
 
     c->interrupt_callback = &s->interrupt_callback;
 
+    /* a custom io_open is only called on this thread */
+    if (c->prefetch_fragments > 0 && !ff_format_io_open_is_async(s)) {
+        av_log(s, AV_LOG_VERBOSE, "Not prefetching fragments with a custom io_open\n");
+        c->prefetch_fragments = 0;
+    }
+
     if ((ret = save_avio_options(s)) < 0)
         goto fail;
 
     if ((ret = parse_manifest(s, s->url, s->pb)) < 0)
         goto fail;
+    c->last_refresh_time = av_gettime_relative();
 
     /* If this isn't a live stream, fill the total duration of the
      * stream. */
@@ -2200,7 +2942,8 @@ static void recheck_discard_flags(AVFormatContext *s, struct representation **p,
             av_log(s, AV_LOG_INFO, "Now receiving stream_index %d\n", pls->stream_index);
         } else if (!needed && pls->ctx) {
             close_demux_for_component(pls);
-            ff_format_io_close(pls->parent, &pls->input);
+            close_input(pls);
+            prefetch_uninit(pls);
             av_log(s, AV_LOG_INFO, "No longer receiving stream_index %d\n", pls->stream_index);
         }
     }
@@ -2261,7 +3004,7 @@ static int dash_read_packet(AVFormatContext *s, AVPacket *pkt)
         if (cur->is_restart_needed) {
             cur->cur_seg_offset = 0;
             cur->init_sec_buf_read_offset = 0;
-            ff_format_io_close(cur->parent, &cur->input);
+            close_input(cur);
             ret = reopen_demux_for_component(s, cur);
             cur->is_restart_needed = 0;
         }
@@ -2272,6 +3015,7 @@ static int dash_read_packet(AVFormatContext *s, AVPacket *pkt)
 static int dash_close(AVFormatContext *s)
 {
     DASHContext *c = s->priv_data;
+    refresh_cancel(c);
     free_audio_list(c);
     free_video_list(c);
     av_dict_free(&c->avio_opts);
@@ -2299,7 +3043,7 @@ static int dash_seek(AVFormatContext *s, struct representation *pls, int64_t see
         return av_seek_frame(pls->ctx, -1, seek_pos_msec * 1000, flags);
     }
 
-    ff_format_io_close(pls->parent, &pls->input);
+    close_input(pls);
 
     // find the nearest fragment
     if (pls->n_timelines > 0 && pls->fragment_timescale > 0) {
@@ -2338,6 +3082,8 @@ set_seq_num:
     pls->cur_timestamp = 0;
     pls->cur_seg_offset = 0;
     pls->init_sec_buf_read_offset = 0;
+    /* keep the downloads that are still ahead of the new position */
+    prefetch_flush(pls, pls->cur_seq_no, dry_run ? -1 : pls->cur_seq_no + pls->n_prefetch);
     ret = dry_run ? 0 : reopen_demux_for_component(s, pls);
 
     return ret;
@@ -2397,6 +3143,12 @@ static const AVOption dash_options[] = {
         OFFSET(allowed_extensions), AV_OPT_TYPE_STRING,
         {.str = "aac,m4a,m4s,m4v,mov,mp4,webm,ts"},
         INT_MIN, INT_MAX, FLAGS},
+    {"prefetch_fragments", "Number of HTTP fragments of each representation to download ahead of the current one, 0 = disable",
+        OFFSET(prefetch_fragments), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 16, FLAGS},
+    {"prefetch_max_size", "Maximum number of bytes held by the fragment prefetcher of a representation",
+        OFFSET(prefetch_max_size), AV_OPT_TYPE_INT64, {.i64 = 32 * 1024 * 1024}, 0, INT64_MAX, FLAGS},
+    {"live_refresh_async", "Refresh the manifest of live streams in the background while reading the known fragments",
+        OFFSET(live_refresh_async), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, FLAGS},
     {NULL}
 };
 
@@ -141,12 +141,17 @@ static void add_keyframes_index(AVFormatContext *s)
     stream = s->streams[flv->last_keyframe_stream_index];
 
     if (stream->nb_index_entries == 0) {
-        for (i = 0; i < flv->keyframe_count; i++) {
+        AVIndexEntry *entries = av_calloc(flv->keyframe_count, sizeof(*entries));
+        for (i = 0; entries && i < flv->keyframe_count; i++) {
             av_log(s, AV_LOG_TRACE, "keyframe filepositions = %"PRId64" times = %"PRId64"\n",
                    flv->keyframe_filepositions[i], flv->keyframe_times[i] * 1000);
-            av_add_index_entry(stream, flv->keyframe_filepositions[i],
-                flv->keyframe_times[i] * 1000, 0, 0, AVINDEX_KEYFRAME);
+            entries[i].pos       = flv->keyframe_filepositions[i];
+            entries[i].timestamp = flv->keyframe_times[i] * 1000;
+            entries[i].flags     = AVINDEX_KEYFRAME;
         }
+        if (entries)
+            ff_add_index_entries(stream, entries, flv->keyframe_count);
+        av_free(entries);
     } else
         av_log(s, AV_LOG_WARNING, "Skipping duplicate index\n");
 
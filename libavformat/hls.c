@@ -26,13 +26,18 @@
  * http://tools.ietf.org/html/draft-pantos-http-live-streaming
  */
 
+#include <stdatomic.h>
+
 #include "libavformat/http.h"
 #include "libavutil/avstring.h"
+#include "libavutil/application.h"
 #include "libavutil/avassert.h"
+#include "libavutil/bprint.h"
 #include "libavutil/intreadwrite.h"
 #include "libavutil/mathematics.h"
 #include "libavutil/opt.h"
 #include "libavutil/dict.h"
+#include "libavutil/thread.h"
 #include "libavutil/time.h"
 #include "avformat.h"
 #include "internal.h"
@@ -41,6 +46,18 @@
 
 #define INITIAL_BUFFER_SIZE 32768
 
+#define PREFETCH_READ_SIZE 65536
+#define MAX_PLAYLIST_SIZE (16 * 1024 * 1024)
+
+/* bandwidth estimation for abr, the half lives are in seconds of media */
+#define ABR_FAST_HALF_LIFE 3.0
+#define ABR_SLOW_HALF_LIFE 9.0
+#define ABR_MIN_WEIGHT     2.0
+#define ABR_MIN_BYTES      16384
+/* fraction of the estimate a higher/lower variant may use */
+#define ABR_UP_FACTOR      0.7
+#define ABR_DOWN_FACTOR    0.9
+
 #define MAX_FIELD_LEN 64
 #define MAX_CHARACTERISTICS_LEN 512
 
@@ -78,6 +95,7 @@ struct segment {
 };
 
 struct rendition;
+struct playlist;
 
 enum PlaylistType {
     PLS_TYPE_UNSPECIFIED,
@@ -85,6 +103,51 @@ enum PlaylistType {
     PLS_TYPE_VOD
 };
 
+enum ReloadState {
+    RELOAD_IDLE,
+    RELOAD_RUNNING,
+    RELOAD_DONE
+};
+
+enum PrefetchState {
+    PREFETCH_EMPTY,
+    PREFETCH_LOADING,
+    PREFETCH_DONE,
+    PREFETCH_FAILED
+};
+
+/*
+ * A segment downloaded ahead of the playback position into memory.
+ * The state and the data pointer are owned by the demuxer thread, the
+ * downloading thread only appends to data and moves LOADING to DONE or
+ * FAILED. len, data_size and state are protected by the playlist's
+ * prefetch_mutex.
+ */
+struct prefetch_slot {
+    struct playlist *pls;
+    enum PrefetchState state;
+    int seq_no;
+    char *url;
+    int64_t size;
+    AVDictionary *opts;
+    char *cookies;
+    atomic_int abort_request;
+    int error;
+    uint8_t *data;
+    size_t data_size;
+    size_t len;
+    size_t read_pos;
+    int64_t start_time;
+    int64_t end_time;
+    /* the playlist's link_bytes when the download started and ended */
+    int64_t link_bytes_start;
+    int64_t link_bytes_end;
+#if HAVE_THREADS
+    pthread_t thread;
+#endif
+    int thread_started;
+};
+
 /*
  * Each playlist has its own demuxer. If it currently is active,
  * it has an open AVIOContext too, and potentially an AVPacket
@@ -109,6 +172,9 @@ struct playlist {
     AVStream **main_streams;
     int n_main_streams;
 
+    /* fast_start: the playlist is neither parsed nor opened until needed */
+    int deferred;
+
     int finished;
     enum PlaylistType type;
     int64_t target_duration;
@@ -122,6 +188,8 @@ struct playlist {
     int m3u8_hold_counters;
     int64_t cur_seg_offset;
     int64_t last_load_time;
+    int64_t seg_fetch_time; /* time spent waiting for the network on the current segment */
+    int64_t seg_link_bytes; /* link_bytes when the current segment was opened */
 
     /* Currently active Media Initialization Section */
     struct segment *cur_init_section;
@@ -160,6 +228,31 @@ struct playlist {
      * playlist, if any. */
     int n_init_sections;
     struct segment **init_sections;
+
+    /* Segments following cur_seq_no that are being downloaded in the
+     * background, and the one currently read instead of input. */
+    struct prefetch_slot *prefetch;
+    int n_prefetch;
+    int64_t prefetch_bytes;
+    int64_t link_bytes; /* received by all downloads and direct reads so far */
+    struct prefetch_slot *input_slot;
+#if HAVE_THREADS
+    pthread_mutex_t prefetch_mutex;
+    pthread_cond_t prefetch_cond;
+#endif
+
+    /* Live playlist refresh running in the background. The worker owns
+     * the reload_* fields until it sets reload_state to RELOAD_DONE. */
+    atomic_int reload_state;
+    atomic_int reload_abort;
+    AVDictionary *reload_opts;
+    char *reload_url;
+    char *reload_data;
+    char *reload_cookies;
+    int reload_error;
+#if HAVE_THREADS
+    pthread_t reload_thread;
+#endif
 };
 
 /*
@@ -177,8 +270,18 @@ struct rendition {
     int disposition;
 };
 
+/* exponentially weighted moving average, weighted by media duration */
+struct bw_estimate {
+    double half_life;
+    double estimate;
+    double weight;
+};
+
 struct variant {
     int bandwidth;
+    char codecs[MAX_CHARACTERISTICS_LEN];
+    int width;
+    int height;
 
     /* every variant contains at least the main Media Playlist in index 0 */
     int n_playlists;
@@ -215,8 +318,511 @@ typedef struct HLSContext {
     AVIOContext *playlist_pb;
     int hls_io_protocol_enable;
     char * hls_io_protocol;
+    int prefetch_segments;
+    int64_t prefetch_max_size;
+    int64_t prefetch_max_duration;
+    int live_reload_async;
+    int fast_start;
+    int abr;
+    int64_t app_ctx_intptr;
+    AVApplicationContext *app_ctx;
+
+    /* With abr, abr_out is the variant playlist whose streams carry the
+     * packets of whichever variant (abr_variant) is being read. */
+    struct playlist *abr_out;
+    int abr_variant;
+    struct bw_estimate abr_fast;
+    struct bw_estimate abr_slow;
 } HLSContext;
 
+#if HAVE_THREADS
+/* Options for a download thread. Instead of sharing the keep-alive
+ * connection of the demuxer thread, threads reuse connections through the
+ * http connection pool. */
+static void async_opts_init(HLSContext *c, AVDictionary **opts)
+{
+    av_dict_copy(opts, c->avio_opts, 0);
+    if (c->http_persistent)
+        av_dict_set(opts, "connection_pool", "1", 0);
+}
+
+/* Open url for a download thread through the same io_open as open_url(),
+ * new cookies are returned for the demuxer thread to take over. */
+static int open_url_async(AVFormatContext *s, AVIOContext **pb, const char *url,
+                          AVDictionary **opts, const AVIOInterruptCB *int_cb,
+                          char **cookies)
+{
+    int ret = ff_format_io_open_async(s, pb, url, AVIO_FLAG_READ, opts, int_cb);
+
+    if (ret >= 0 && !(s->flags & AVFMT_FLAG_CUSTOM_IO))
+        av_opt_get(*pb, "cookies", AV_OPT_SEARCH_CHILDREN, (uint8_t **)cookies);
+    return ret;
+}
+
+/* merge cookies reported by a download thread, like open_url() does */
+static void update_cookies(HLSContext *c, char **cookies)
+{
+    if (*cookies)
+        av_dict_set(&c->avio_opts, "cookies", *cookies, AV_DICT_DONT_STRDUP_VAL);
+    *cookies = NULL;
+}
+
+static int prefetch_interrupt_cb(void *opaque)
+{
+    struct prefetch_slot *slot = opaque;
+
+    return atomic_load(&slot->abort_request) ||
+           ff_check_interrupt(&slot->pls->parent->interrupt_callback);
+}
+
+/* the earliest segment in the pool must never wait for memory, the
+ * demuxer is about to read from it */
+static int prefetch_may_grow(struct playlist *pls, struct prefetch_slot *slot)
+{
+    HLSContext *c = pls->parent->priv_data;
+    int i;
+
+    if (pls->prefetch_bytes < c->prefetch_max_size)
+        return 1;
+    for (i = 0; i < pls->n_prefetch; i++) {
+        struct prefetch_slot *other = &pls->prefetch[i];
+        if (other->state != PREFETCH_EMPTY && other->seq_no < slot->seq_no)
+            return 0;
+    }
+    return 1;
+}
+
+static void *prefetch_worker(void *arg)
+{
+    struct prefetch_slot *slot = arg;
+    struct playlist *pls = slot->pls;
+    AVFormatContext *s = pls->parent;
+    AVIOInterruptCB int_cb = { prefetch_interrupt_cb, slot };
+    AVIOContext *pb = NULL;
+    int64_t size;
+    int ret;
+
+    ret = open_url_async(s, &pb, slot->url, &slot->opts, &int_cb, &slot->cookies);
+    if (ret < 0)
+        goto end;
+
+    size = slot->size >= 0 ? slot->size : avio_size(pb);
+
+    while (1) {
+        uint8_t *dst;
+
+        pthread_mutex_lock(&pls->prefetch_mutex);
+        while (!atomic_load(&slot->abort_request) && !prefetch_may_grow(pls, slot))
+            pthread_cond_wait(&pls->prefetch_cond, &pls->prefetch_mutex);
+        if (atomic_load(&slot->abort_request)) {
+            pthread_mutex_unlock(&pls->prefetch_mutex);
+            ret = AVERROR_EXIT;
+            break;
+        }
+        if (slot->data_size - slot->len < PREFETCH_READ_SIZE) {
+            size_t new_size = FFMAX(slot->data_size * 2, slot->len + PREFETCH_READ_SIZE);
+            if (!slot->data_size && size > 0)
+                new_size = size + PREFETCH_READ_SIZE;
+            dst = av_realloc(slot->data, new_size);
+            if (!dst) {
+                pthread_mutex_unlock(&pls->prefetch_mutex);
+                ret = AVERROR(ENOMEM);
+                break;
+            }
+            slot->data      = dst;
+            slot->data_size = new_size;
+        }
+        dst = slot->data + slot->len;
+        pthread_mutex_unlock(&pls->prefetch_mutex);
+
+        /* only this thread moves data, the reader copies under the lock */
+        ret = avio_read(pb, dst, PREFETCH_READ_SIZE);
+        if (ret <= 0)
+            break;
+
+        pthread_mutex_lock(&pls->prefetch_mutex);
+        slot->len           += ret;
+        pls->prefetch_bytes += ret;
+        pls->link_bytes     += ret;
+        pthread_cond_broadcast(&pls->prefetch_cond);
+        pthread_mutex_unlock(&pls->prefetch_mutex);
+    }
+
+end:
+    ff_format_io_close(s, &pb);
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    slot->end_time       = av_gettime_relative();
+    slot->link_bytes_end = pls->link_bytes;
+    if (ret == AVERROR_EOF || ret == 0) {
+        slot->state = PREFETCH_DONE;
+    } else {
+        slot->state = PREFETCH_FAILED;
+        slot->error = ret;
+    }
+    pthread_cond_broadcast(&pls->prefetch_cond);
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+    return NULL;
+}
+
+static int64_t link_bytes_add(struct playlist *pls, int64_t bytes)
+{
+    int64_t total;
+
+    if (!pls->prefetch)
+        return 0;
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    total = pls->link_bytes += bytes;
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+    return total;
+}
+
+/* Stop the download of a slot and give its memory back. Only called from
+ * the demuxer thread. */
+static void prefetch_release(struct playlist *pls, struct prefetch_slot *slot)
+{
+    if (slot->state == PREFETCH_EMPTY)
+        return;
+
+    atomic_store(&slot->abort_request, 1);
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    pthread_cond_broadcast(&pls->prefetch_cond);
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+
+    if (slot->thread_started)
+        pthread_join(slot->thread, NULL);
+    slot->thread_started = 0;
+    update_cookies(pls->parent->priv_data, &slot->cookies);
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    pls->prefetch_bytes -= slot->len;
+    slot->state = PREFETCH_EMPTY;
+    pthread_cond_broadcast(&pls->prefetch_cond);
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+
+    if (pls->input_slot == slot)
+        pls->input_slot = NULL;
+    av_freep(&slot->data);
+    av_freep(&slot->url);
+    av_dict_free(&slot->opts);
+    slot->data_size = slot->len = slot->read_pos = 0;
+}
+
+/* Cancel every download outside of [first_seq, last_seq], except the
+ * segment that is currently being read. */
+static void prefetch_flush(struct playlist *pls, int first_seq, int last_seq)
+{
+    int i;
+
+    for (i = 0; i < pls->n_prefetch; i++) {
+        struct prefetch_slot *slot = &pls->prefetch[i];
+        if (slot->state != PREFETCH_EMPTY && slot != pls->input_slot &&
+            (slot->seq_no < first_seq || slot->seq_no > last_seq))
+            prefetch_release(pls, slot);
+    }
+}
+
+static void prefetch_uninit(struct playlist *pls)
+{
+    int i;
+
+    if (!pls->prefetch)
+        return;
+    for (i = 0; i < pls->n_prefetch; i++)
+        prefetch_release(pls, &pls->prefetch[i]);
+    pthread_cond_destroy(&pls->prefetch_cond);
+    pthread_mutex_destroy(&pls->prefetch_mutex);
+    av_freep(&pls->prefetch);
+    pls->n_prefetch = 0;
+}
+
+static int prefetch_init(HLSContext *c, struct playlist *pls)
+{
+    int ret;
+
+    pls->prefetch = av_mallocz_array(c->prefetch_segments, sizeof(*pls->prefetch));
+    if (!pls->prefetch)
+        return AVERROR(ENOMEM);
+    if ((ret = pthread_mutex_init(&pls->prefetch_mutex, NULL))) {
+        av_freep(&pls->prefetch);
+        return AVERROR(ret);
+    }
+    if ((ret = pthread_cond_init(&pls->prefetch_cond, NULL))) {
+        pthread_mutex_destroy(&pls->prefetch_mutex);
+        av_freep(&pls->prefetch);
+        return AVERROR(ret);
+    }
+    pls->n_prefetch = c->prefetch_segments;
+    return 0;
+}
+
+/* seq_no < 0 looks for an unused slot */
+static struct prefetch_slot *prefetch_find(struct playlist *pls, int seq_no)
+{
+    struct prefetch_slot *slot = NULL;
+    int i;
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    for (i = 0; i < pls->n_prefetch && !slot; i++) {
+        struct prefetch_slot *cur = &pls->prefetch[i];
+        if (seq_no < 0 ? cur->state == PREFETCH_EMPTY :
+            cur->state != PREFETCH_EMPTY && cur->seq_no == seq_no)
+            slot = cur;
+    }
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+    return slot;
+}
+
+static int prefetch_start(HLSContext *c, struct playlist *pls,
+                          struct prefetch_slot *slot, int seq_no, struct segment *seg)
+{
+    int ret;
+
+    slot->pls    = pls;
+    slot->size   = seg->size;
+    slot->error  = 0;
+    slot->url    = av_strdup(seg->url);
+    if (!slot->url)
+        return AVERROR(ENOMEM);
+    async_opts_init(c, &slot->opts);
+    av_dict_set(&slot->opts, "seekable", "1", 0);
+    if (seg->size >= 0) {
+        av_dict_set_int(&slot->opts, "offset", seg->url_offset, 0);
+        av_dict_set_int(&slot->opts, "end_offset", seg->url_offset + seg->size, 0);
+    }
+    atomic_init(&slot->abort_request, 0);
+    slot->start_time = av_gettime_relative();
+    slot->end_time   = 0;
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    slot->seq_no = seq_no;
+    slot->state  = PREFETCH_LOADING;
+    slot->link_bytes_start = pls->link_bytes;
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+
+    ret = pthread_create(&slot->thread, NULL, prefetch_worker, slot);
+    if (ret) {
+        pthread_mutex_lock(&pls->prefetch_mutex);
+        slot->state = PREFETCH_EMPTY;
+        pthread_mutex_unlock(&pls->prefetch_mutex);
+        av_freep(&slot->url);
+        av_dict_free(&slot->opts);
+        return AVERROR(ret);
+    }
+    slot->thread_started = 1;
+
+    av_log(pls->parent, AV_LOG_DEBUG, "Prefetching segment %d of playlist %d\n",
+           seq_no, pls->index);
+    return 0;
+}
+
+/* Keep up to prefetch_segments downloads running ahead of cur_seq_no,
+ * bounded by prefetch_max_size bytes and prefetch_max_duration. */
+static void prefetch_schedule(HLSContext *c, struct playlist *pls)
+{
+    int64_t duration = 0;
+    int seq_no, last_seq_no;
+
+    if (c->prefetch_segments <= 0 || !pls->needed)
+        return;
+    if (!pls->prefetch && prefetch_init(c, pls) < 0)
+        return;
+
+    last_seq_no = pls->cur_seq_no + pls->n_prefetch;
+    prefetch_flush(pls, pls->cur_seq_no, last_seq_no);
+
+    for (seq_no = pls->cur_seq_no + 1; seq_no <= last_seq_no; seq_no++) {
+        struct prefetch_slot *slot;
+        struct segment *seg;
+        int64_t bytes;
+        int n = seq_no - pls->start_seq_no;
+
+        if (n < 0 || n >= pls->n_segments)
+            break;
+        seg = pls->segments[n];
+        duration += seg->duration;
+        if (c->prefetch_max_duration && duration > c->prefetch_max_duration)
+            break;
+        /* the key and any non-http input are handled by open_input() */
+        if (seg->key_type != KEY_NONE || !av_strstart(seg->url, "http", NULL))
+            break;
+        if (prefetch_find(pls, seq_no))
+            continue;
+
+        pthread_mutex_lock(&pls->prefetch_mutex);
+        bytes = pls->prefetch_bytes;
+        pthread_mutex_unlock(&pls->prefetch_mutex);
+        if (bytes >= c->prefetch_max_size)
+            break;
+
+        slot = prefetch_find(pls, -1);
+        if (!slot || prefetch_start(c, pls, slot, seq_no, seg) < 0)
+            break;
+    }
+}
+
+/* Hand over the download of seq_no to the reader, if there is a usable one. */
+static struct prefetch_slot *prefetch_take(struct playlist *pls, int seq_no)
+{
+    struct prefetch_slot *slot = prefetch_find(pls, seq_no);
+    int failed;
+
+    if (!slot)
+        return NULL;
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    failed = slot->state == PREFETCH_FAILED && !slot->len;
+    if (slot->state != PREFETCH_LOADING)
+        update_cookies(pls->parent->priv_data, &slot->cookies);
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+
+    if (failed) {
+        av_log(pls->parent, AV_LOG_DEBUG, "Prefetch of segment %d of playlist %d failed: %s\n",
+               seq_no, pls->index, av_err2str(slot->error));
+        prefetch_release(pls, slot);
+        return NULL;
+    }
+    slot->read_pos = 0;
+    return slot;
+}
+
+static int prefetch_read(struct playlist *pls, struct prefetch_slot *slot,
+                         uint8_t *buf, int buf_size)
+{
+    HLSContext *c = pls->parent->priv_data;
+    int ret;
+
+    pthread_mutex_lock(&pls->prefetch_mutex);
+    while (slot->read_pos >= slot->len && slot->state == PREFETCH_LOADING) {
+        int64_t t = av_gettime() + 10000;
+        struct timespec tv = { .tv_sec  =  t / 1000000,
+                               .tv_nsec = (t % 1000000) * 1000 };
+
+        if (ff_check_interrupt(c->interrupt_callback)) {
+            pthread_mutex_unlock(&pls->prefetch_mutex);
+            return AVERROR_EXIT;
+        }
+        pthread_cond_timedwait(&pls->prefetch_cond, &pls->prefetch_mutex, &tv);
+    }
+
+    if (slot->read_pos < slot->len) {
+        ret = FFMIN(buf_size, slot->len - slot->read_pos);
+        memcpy(buf, slot->data + slot->read_pos, ret);
+        slot->read_pos += ret;
+    } else {
+        ret = slot->state == PREFETCH_FAILED ? slot->error : AVERROR_EOF;
+        if (slot->state == PREFETCH_DONE)
+            av_log(pls->parent, AV_LOG_VERBOSE,
+                   "Read prefetched segment %d of playlist %d, %"SIZE_SPECIFIER" bytes in %"PRId64" ms\n",
+                   slot->seq_no, pls->index, slot->len,
+                   (slot->end_time - slot->start_time) / 1000);
+    }
+    pthread_mutex_unlock(&pls->prefetch_mutex);
+    return ret;
+}
+
+static int reload_interrupt_cb(void *opaque)
+{
+    struct playlist *pls = opaque;
+
+    return atomic_load(&pls->reload_abort) ||
+           ff_check_interrupt(&pls->parent->interrupt_callback);
+}
+
+/* Fetch the playlist into memory, parse_playlist() runs on the demuxer
+ * thread once the data is there. */
+static void *reload_worker(void *arg)
+{
+    struct playlist *pls = arg;
+    AVFormatContext *s = pls->parent;
+    AVIOInterruptCB int_cb = { reload_interrupt_cb, pls };
+    AVIOContext *in = NULL;
+    AVBPrint bp;
+    int ret;
+
+    av_bprint_init(&bp, 0, AV_BPRINT_SIZE_UNLIMITED);
+    ret = open_url_async(s, &in, pls->url, &pls->reload_opts, &int_cb, &pls->reload_cookies);
+    if (ret >= 0) {
+        av_opt_get(in, "location", AV_OPT_SEARCH_CHILDREN, (uint8_t **)&pls->reload_url);
+        ret = avio_read_to_bprint(in, &bp, MAX_PLAYLIST_SIZE);
+        if (ret >= 0 && !av_bprint_is_complete(&bp))
+            ret = AVERROR(ENOMEM);
+        ff_format_io_close(s, &in);
+    }
+    if (ret >= 0)
+        ret = av_bprint_finalize(&bp, &pls->reload_data);
+    else
+        av_bprint_finalize(&bp, NULL);
+    pls->reload_error = ret;
+
+    atomic_store(&pls->reload_state, RELOAD_DONE);
+    return NULL;
+}
+
+static int reload_start(HLSContext *c, struct playlist *pls)
+{
+    int ret;
+
+    if (!ff_format_io_open_is_async(pls->parent))
+        return AVERROR(ENOSYS);
+    async_opts_init(c, &pls->reload_opts);
+    atomic_store(&pls->reload_abort, 0);
+    atomic_store(&pls->reload_state, RELOAD_RUNNING);
+
+    ret = pthread_create(&pls->reload_thread, NULL, reload_worker, pls);
+    if (ret) {
+        atomic_store(&pls->reload_state, RELOAD_IDLE);
+        av_dict_free(&pls->reload_opts);
+        return AVERROR(ret);
+    }
+    return 0;
+}
+
+/* Wait for the worker and take over its result, only called when the
+ * state is not RELOAD_IDLE. */
+static void reload_join(struct playlist *pls)
+{
+    pthread_join(pls->reload_thread, NULL);
+    update_cookies(pls->parent->priv_data, &pls->reload_cookies);
+    av_dict_free(&pls->reload_opts);
+    atomic_store(&pls->reload_state, RELOAD_IDLE);
+}
+
+static void reload_cancel(struct playlist *pls)
+{
+    if (atomic_load(&pls->reload_state) == RELOAD_IDLE)
+        return;
+    atomic_store(&pls->reload_abort, 1);
+    reload_join(pls);
+    av_freep(&pls->reload_data);
+    av_freep(&pls->reload_url);
+}
+#else
+static void prefetch_release(struct playlist *pls, struct prefetch_slot *slot) { }
+static void prefetch_flush(struct playlist *pls, int first_seq, int last_seq) { }
+static void prefetch_uninit(struct playlist *pls) { }
+static void prefetch_schedule(HLSContext *c, struct playlist *pls) { }
+static struct prefetch_slot *prefetch_take(struct playlist *pls, int seq_no)
+{
+    return NULL;
+}
+static int prefetch_read(struct playlist *pls, struct prefetch_slot *slot,
+                         uint8_t *buf, int buf_size)
+{
+    return AVERROR(ENOSYS);
+}
+static int reload_start(HLSContext *c, struct playlist *pls)
+{
+    return AVERROR(ENOSYS);
+}
+static void reload_join(struct playlist *pls) { }
+static void reload_cancel(struct playlist *pls) { }
+static int64_t link_bytes_add(struct playlist *pls, int64_t bytes)
+{
+    return 0;
+}
+#endif
+
 static void free_segment_dynarray(struct segment **segments, int n_segments)
 {
     int i;
@@ -264,6 +870,8 @@ static void free_playlist_list(HLSContext *c)
         pls->input_read_done = 0;
         ff_format_io_close(c->ctx, &pls->input_next);
         pls->input_next_requested = 0;
+        prefetch_uninit(pls);
+        reload_cancel(pls);
         if (pls->ctx) {
             pls->ctx->pb = NULL;
             avformat_close_input(&pls->ctx);
@@ -326,6 +934,8 @@ static struct playlist *new_playlist(HLSContext *c, const char *url,
 
 struct variant_info {
     char bandwidth[20];
+    char codecs[MAX_CHARACTERISTICS_LEN];
+    char resolution[20];
     /* variant group ids: */
     char audio[MAX_FIELD_LEN];
     char video[MAX_FIELD_LEN];
@@ -348,6 +958,9 @@ static struct variant *new_variant(HLSContext *c, struct variant_info *info,
 
     if (info) {
         var->bandwidth = atoi(info->bandwidth);
+        av_strlcpy(var->codecs, info->codecs, sizeof(var->codecs));
+        if (sscanf(info->resolution, "%dx%d", &var->width, &var->height) != 2)
+            var->width = var->height = 0;
         strcpy(var->audio_group, info->audio);
         strcpy(var->video_group, info->video);
         strcpy(var->subtitles_group, info->subtitles);
@@ -364,6 +977,12 @@ static void handle_variant_args(struct variant_info *info, const char *key,
     if (!strncmp(key, "BANDWIDTH=", key_len)) {
         *dest     =        info->bandwidth;
         *dest_len = sizeof(info->bandwidth);
+    } else if (!strncmp(key, "CODECS=", key_len)) {
+        *dest     =        info->codecs;
+        *dest_len = sizeof(info->codecs);
+    } else if (!strncmp(key, "RESOLUTION=", key_len)) {
+        *dest     =        info->resolution;
+        *dest_len = sizeof(info->resolution);
     } else if (!strncmp(key, "AUDIO=", key_len)) {
         *dest     =        info->audio;
         *dest_len = sizeof(info->audio);
@@ -1017,6 +1636,37 @@ fail:
     return ret;
 }
 
+/* Parse the playlist fetched by reload_worker() once it is there and start
+ * the next fetch when reload_interval has elapsed. Returns 1 if the segment
+ * list has been refreshed. */
+static int reload_poll(HLSContext *c, struct playlist *pls, int64_t reload_interval)
+{
+    int ret;
+
+    if (atomic_load(&pls->reload_state) == RELOAD_DONE) {
+        reload_join(pls);
+        ret = pls->reload_error;
+        if (ret >= 0) {
+            AVIOContext in;
+            ffio_init_context(&in, (unsigned char *)pls->reload_data, strlen(pls->reload_data),
+                              0, NULL, NULL, NULL, NULL);
+            ret = parse_playlist(c, pls->reload_url ? pls->reload_url : pls->url, pls, &in);
+        }
+        av_freep(&pls->reload_data);
+        av_freep(&pls->reload_url);
+        return ret < 0 ? ret : 1;
+    }
+
+    if (atomic_load(&pls->reload_state) == RELOAD_IDLE &&
+        av_gettime_relative() - pls->last_load_time >= reload_interval &&
+        reload_start(c, pls) < 0) {
+        /* no thread, refresh in place */
+        ret = parse_playlist(c, pls->url, pls, NULL);
+        return ret < 0 ? ret : 1;
+    }
+    return 0;
+}
+
 static struct segment *current_segment(struct playlist *pls)
 {
     return pls->segments[pls->cur_seq_no - pls->start_seq_no];
@@ -1039,7 +1689,15 @@ static int read_from_url(struct playlist *pls, struct segment *seg,
     if (seg->size >= 0)
         buf_size = FFMIN(buf_size, seg->size - pls->cur_seg_offset);
 
-    ret = avio_read(pls->input, buf, buf_size);
+    if (pls->input_slot) {
+        ret = prefetch_read(pls, pls->input_slot, buf, buf_size);
+    } else {
+        int64_t start = av_gettime_relative();
+        ret = avio_read(pls->input, buf, buf_size);
+        pls->seg_fetch_time += av_gettime_relative() - start;
+        if (ret > 0)
+            link_bytes_add(pls, ret);
+    }
     if (ret > 0)
         pls->cur_seg_offset += ret;
 
@@ -1395,13 +2053,42 @@ static int64_t default_reload_interval(struct playlist *pls)
                           pls->target_duration;
 }
 
-static int playlist_needed(struct playlist *pls)
+/* hls_read_header() creates the program of each variant with its index as id */
+static AVProgram *variant_program(AVFormatContext *s, int variant)
+{
+    int i;
+
+    for (i = 0; i < s->nb_programs; i++)
+        if (s->programs[i]->id == variant)
+            return s->programs[i];
+    return NULL;
+}
+
+static int playlist_streams_needed(struct playlist *pls)
 {
     AVFormatContext *s = pls->parent;
+    HLSContext *c = s->priv_data;
     int i, j;
     int stream_needed = 0;
     int first_st;
 
+    /* A playlist fast_start did not open has no streams yet, it is needed
+     * once one of the programs (variants) it is part of is enabled. */
+    if (pls->deferred) {
+        for (i = 0; i < c->n_variants; i++) {
+            for (j = 0; j < c->variants[i]->n_playlists; j++) {
+                AVProgram *program;
+
+                if (c->variants[i]->playlists[j] != pls)
+                    continue;
+                program = variant_program(s, i);
+                if (program && program->discard < AVDISCARD_ALL)
+                    return 1;
+            }
+        }
+        return 0;
+    }
+
     /* If there is no context or streams yet, the playlist is needed */
     if (!pls->ctx || !pls->n_main_streams)
         return 1;
@@ -1441,6 +2128,250 @@ static int playlist_needed(struct playlist *pls)
     return 0;
 }
 
+static int find_timestamp_in_playlist(HLSContext *c, struct playlist *pls,
+                                      int64_t timestamp, int *seq_no);
+static int open_playlist_demuxer(AVFormatContext *s, struct playlist *pls);
+
+/* Fetch the media playlist of a playlist fast_start skipped. */
+static int load_deferred_playlist(HLSContext *c, struct playlist *pls)
+{
+    int ret;
+
+    if (pls->n_segments > 0)
+        return 0;
+    if ((ret = parse_playlist(c, pls->url, pls, NULL)) < 0) {
+        av_log(c->ctx, AV_LOG_WARNING, "Failed to load playlist %s\n", pls->url);
+        return ret;
+    }
+    if (pls->n_segments == 0) {
+        av_log(c->ctx, AV_LOG_WARNING, "Empty playlist %s\n", pls->url);
+        return AVERROR_INVALIDDATA;
+    }
+    return 0;
+}
+
+static void bw_estimate_add(struct bw_estimate *e, double weight, double value)
+{
+    double alpha = pow(0.5, weight / e->half_life);
+
+    e->estimate = value * (1 - alpha) + e->estimate * alpha;
+    e->weight  += weight;
+}
+
+static double bw_estimate_get(const struct bw_estimate *e)
+{
+    /* remove the bias towards the initial zero */
+    double zero_factor = 1 - pow(0.5, e->weight / e->half_life);
+    return zero_factor > 0 ? e->estimate / zero_factor : 0;
+}
+
+static int abr_variant_index(HLSContext *c, struct playlist *pls)
+{
+    int i;
+
+    for (i = 0; i < c->n_variants; i++)
+        if (c->variants[i]->playlists[0] == pls)
+            return i;
+    return -1;
+}
+
+static struct playlist *abr_playlist(HLSContext *c)
+{
+    return c->variants[c->abr_variant]->playlists[0];
+}
+
+static int playlist_needed(struct playlist *pls)
+{
+    HLSContext *c = pls->parent->priv_data;
+
+    /* with abr only the variant being read is needed, as long as the
+     * caller wants the streams its packets are returned on */
+    if (c->abr_out && abr_variant_index(c, pls) >= 0)
+        return pls == abr_playlist(c) && playlist_streams_needed(c->abr_out);
+    return playlist_streams_needed(pls);
+}
+
+/* Index of the stream of to with the same type and rank as the stream
+ * index of from, or -1. */
+static int abr_map_stream(struct playlist *from, int index, struct playlist *to)
+{
+    enum AVMediaType type = from->ctx->streams[index]->codecpar->codec_type;
+    int i, nth = 0;
+
+    for (i = 0; i < index; i++)
+        nth += from->ctx->streams[i]->codecpar->codec_type == type;
+    for (i = 0; i < to->ctx->nb_streams && i < to->n_main_streams; i++)
+        if (to->ctx->streams[i]->codecpar->codec_type == type && !nth--)
+            return i;
+    return -1;
+}
+
+/* The first variant the caller did not discard presents the output. */
+static void abr_init(HLSContext *c)
+{
+    int i;
+
+    if (!c->abr || c->n_variants < 2)
+        return;
+    for (i = 0; i < c->n_variants; i++) {
+        if (c->variants[i]->bandwidth <= 0) {
+            av_log(c->ctx, AV_LOG_WARNING,
+                   "Variant %d does not declare its bandwidth, abr disabled\n", i);
+            return;
+        }
+    }
+    for (i = 0; i < c->n_variants; i++) {
+        struct playlist *pls = c->variants[i]->playlists[0];
+        if (pls->ctx && pls->n_main_streams && playlist_streams_needed(pls)) {
+            c->abr_out     = pls;
+            c->abr_variant = i;
+            break;
+        }
+    }
+    c->abr_fast.half_life = ABR_FAST_HALF_LIFE;
+    c->abr_slow.half_life = ABR_SLOW_HALF_LIFE;
+}
+
+/* Feed the throughput of the segment that was just read to the estimate. */
+static void abr_segment_done(HLSContext *c, struct playlist *pls, struct segment *seg)
+{
+    int64_t bytes = pls->cur_seg_offset;
+    int64_t time  = pls->seg_fetch_time;
+
+    /* The download of a prefetched segment has finished once it is read.
+     * Concurrent downloads share the link, so count what all of them
+     * received while this one was running. */
+    if (pls->input_slot) {
+        bytes = pls->input_slot->link_bytes_end - pls->input_slot->link_bytes_start;
+        time  = pls->input_slot->end_time - pls->input_slot->start_time;
+    } else if (link_bytes_add(pls, 0) - pls->seg_link_bytes > bytes) {
+        /* the time spent reading is no measure of the link while
+         * downloads ran next to it */
+        return;
+    }
+    if (bytes < ABR_MIN_BYTES || time <= 0)
+        return;
+
+    bw_estimate_add(&c->abr_fast, seg->duration / (double)AV_TIME_BASE,
+                    bytes * 8.0 * AV_TIME_BASE / time);
+    bw_estimate_add(&c->abr_slow, seg->duration / (double)AV_TIME_BASE,
+                    bytes * 8.0 * AV_TIME_BASE / time);
+}
+
+/* Highest variant that fits into the estimate, moving up needs more
+ * headroom than staying or moving down. */
+static int abr_select_variant(HLSContext *c, double bandwidth)
+{
+    int cur_bandwidth = c->variants[c->abr_variant]->bandwidth;
+    int i, best = -1, lowest = -1;
+
+    if (c->abr_fast.weight < ABR_MIN_WEIGHT)
+        return c->abr_variant;
+
+    for (i = 0; i < c->n_variants; i++) {
+        struct playlist *pls = c->variants[i]->playlists[0];
+        int bw = c->variants[i]->bandwidth;
+        double limit = bandwidth * (bw > cur_bandwidth ? ABR_UP_FACTOR : ABR_DOWN_FACTOR);
+
+        if ((!pls->ctx && !pls->deferred) || pls->broken)
+            continue;
+        if (lowest < 0 || bw < c->variants[lowest]->bandwidth)
+            lowest = i;
+        if (bw <= limit && (best < 0 || bw > c->variants[best]->bandwidth))
+            best = i;
+    }
+    if (best < 0)
+        best = lowest;
+    return best < 0 ? c->abr_variant : best;
+}
+
+/* Continue with variant index at the segment following the one that was
+ * just read. The previous variant is drained by hls_read_packet(). */
+static int abr_switch(HLSContext *c, int index, double bandwidth)
+{
+    struct playlist *from = abr_playlist(c);
+    struct playlist *pls  = c->variants[index]->playlists[0];
+    AVAppHlsVariantSwitch event = { sizeof(event) };
+    int seq_no = from->cur_seq_no;
+    int ret;
+
+    if (pls->deferred && (ret = load_deferred_playlist(c, pls)) < 0) {
+        pls->broken = 1;
+        return ret;
+    }
+
+    if (from->finished && pls->finished) {
+        /* VOD variants need not share sequence numbers, align on the
+         * middle of the next segment */
+        int64_t timestamp = c->first_timestamp == AV_NOPTS_VALUE ? 0 : c->first_timestamp;
+        int i, n = from->cur_seq_no - from->start_seq_no;
+
+        for (i = 0; i < n && i < from->n_segments; i++)
+            timestamp += from->segments[i]->duration;
+        if (n < from->n_segments)
+            timestamp += from->segments[n]->duration / 2;
+        find_timestamp_in_playlist(c, pls, timestamp, &seq_no);
+    }
+
+    av_log(c->ctx, AV_LOG_INFO,
+           "Switching from variant %d (%d bps) to variant %d (%d bps) at segment %d, estimated %.0f bps\n",
+           c->abr_variant, c->variants[c->abr_variant]->bandwidth,
+           index, c->variants[index]->bandwidth, seq_no, bandwidth);
+
+    event.from_variant        = c->abr_variant;
+    event.to_variant          = index;
+    event.from_bandwidth      = c->variants[c->abr_variant]->bandwidth;
+    event.to_bandwidth        = c->variants[index]->bandwidth;
+    event.estimated_bandwidth = bandwidth;
+    event.seq_no              = seq_no;
+
+    if (pls->deferred) {
+        int from_index = c->abr_variant;
+
+        /* the probe reads from the new variant, so it has to be current */
+        c->abr_variant = index;
+        pls->cur_seq_no = seq_no;
+        pls->needed = 1;
+        if ((ret = open_playlist_demuxer(c->ctx, pls)) < 0) {
+            av_log(c->ctx, AV_LOG_WARNING, "Failed to open variant %d\n", index);
+            c->abr_variant = from_index;
+            pls->needed = 0;
+            pls->broken = 1;
+            return ret;
+        }
+        av_application_on_hls_variant_switch(c->app_ctx, &event);
+        return 0;
+    }
+
+    c->abr_variant = index;
+
+    ff_format_io_close(pls->parent, &pls->input);
+    pls->input_read_done = 0;
+    ff_format_io_close(pls->parent, &pls->input_next);
+    pls->input_next_requested = 0;
+    prefetch_uninit(pls);
+    av_packet_unref(&pls->pkt);
+    pls->pb.eof_reached = 0;
+    pls->pb.buf_end = pls->pb.buf_ptr = pls->pb.buffer;
+    pls->pb.pos = 0;
+    ff_read_frame_flush(pls->ctx);
+    pls->seek_timestamp = AV_NOPTS_VALUE;
+    pls->cur_seq_no = seq_no;
+    pls->needed = 1;
+
+    av_application_on_hls_variant_switch(c->app_ctx, &event);
+    return 0;
+}
+
+static void abr_update(HLSContext *c)
+{
+    double bandwidth = FFMIN(bw_estimate_get(&c->abr_fast), bw_estimate_get(&c->abr_slow));
+    int index = abr_select_variant(c, bandwidth);
+
+    if (index != c->abr_variant)
+        abr_switch(c, index, bandwidth);
+}
+
 static int read_data(void *opaque, uint8_t *buf, int buf_size)
 {
     struct playlist *v = opaque;
@@ -1454,9 +2385,13 @@ restart:
     if (!v->needed)
         return AVERROR_EOF;
 
-    if (!v->input || (c->http_persistent && v->input_read_done)) {
+    if ((!v->input && !v->input_slot) || (c->http_persistent && v->input_read_done)) {
         int64_t reload_interval;
 
+        /* A variant abr switched away from ends with its current segment. */
+        if (c->abr_out && v != abr_playlist(c) && abr_variant_index(c, v) >= 0)
+            return AVERROR_EOF;
+
         /* Check that the playlist is still needed before opening a new
          * segment. */
         v->needed = playlist_needed(v);
@@ -1475,7 +2410,17 @@ reload:
         reload_count++;
         if (reload_count > c->max_reload)
             return AVERROR_EOF;
-        if (!v->finished &&
+        if (!v->finished && c->live_reload_async) {
+            /* keep reading the known segments while the refresh is running */
+            if ((ret = reload_poll(c, v, reload_interval)) < 0) {
+                if (ret != AVERROR_EXIT)
+                    av_log(v->parent, AV_LOG_WARNING, "Failed to reload playlist %d\n",
+                           v->index);
+                return ret;
+            }
+            if (ret > 0)
+                reload_interval = v->target_duration / 2;
+        } else if (!v->finished &&
             av_gettime_relative() - v->last_load_time >= reload_interval) {
             if ((ret = parse_playlist(c, v->url, v, NULL)) < 0) {
                 if (ret != AVERROR_EXIT)
@@ -1508,16 +2453,19 @@ reload:
         if (v->cur_seq_no >= v->start_seq_no + v->n_segments) {
             if (v->finished)
                 return AVERROR_EOF;
-            while (av_gettime_relative() - v->last_load_time < reload_interval) {
+            while (av_gettime_relative() - v->last_load_time < reload_interval ||
+                   atomic_load(&v->reload_state) == RELOAD_RUNNING) {
                 if (ff_check_interrupt(c->interrupt_callback))
                     return AVERROR_EXIT;
-                av_usleep(100*1000);
+                av_usleep(c->live_reload_async ? 10*1000 : 100*1000);
             }
             /* Enough time has elapsed since the last reload */
             goto reload;
         }
 
         v->input_read_done = 0;
+        v->seg_fetch_time = 0;
+        v->seg_link_bytes = link_bytes_add(v, 0);
         seg = current_segment(v);
 
         /* load/update Media Initialization Section, if any */
@@ -1530,8 +2478,13 @@ reload:
             v->cur_seg_offset = 0;
             v->input_next_requested = 0;
             ret = 0;
+        } else if ((v->input_slot = prefetch_take(v, v->cur_seq_no))) {
+            v->cur_seg_offset = 0;
+            ret = 0;
         } else {
+            int64_t start = av_gettime_relative();
             ret = open_input(c, v, seg, &v->input);
+            v->seg_fetch_time += av_gettime_relative() - start;
         }
         if (ret < 0) {
             if (ff_check_interrupt(c->interrupt_callback))
@@ -1549,9 +2502,10 @@ reload:
             goto reload;
         }
         just_opened = 1;
+        prefetch_schedule(c, v);
     }
 
-    if (c->http_multiple == -1) {
+    if (c->http_multiple == -1 && v->input) {
         uint8_t *http_version_opt = NULL;
         int r = av_opt_get(v->input, "http_version", AV_OPT_SEARCH_CHILDREN, &http_version_opt);
         if (r >= 0) {
@@ -1561,7 +2515,7 @@ reload:
     }
 
     seg = next_segment(v);
-    if (c->http_multiple == 1 && !v->input_next_requested &&
+    if (c->http_multiple == 1 && !v->input_next_requested && !c->prefetch_segments && !c->abr &&
         seg && seg->key_type == KEY_NONE && av_strstart(seg->url, "http", NULL)) {
         ret = open_input(c, v, seg, &v->input_next);
         if (ret < 0) {
@@ -1594,7 +2548,13 @@ reload:
 
         return ret;
     }
-    if (c->http_persistent &&
+    if (c->abr_out && v == abr_playlist(c))
+        abr_segment_done(c, v, seg);
+    if (v->input_slot) {
+        prefetch_release(v, v->input_slot);
+        /* a kept-alive connection stays idle for the next open_input() */
+        v->input_read_done = !!v->input;
+    } else if (c->http_persistent &&
         seg->key_type == KEY_NONE && av_strstart(seg->url, "http", NULL)) {
         v->input_read_done = 1;
     } else {
@@ -1604,6 +2564,9 @@ reload:
 
     c->cur_seq_no = v->cur_seq_no;
 
+    if (c->abr_out && v == abr_playlist(c))
+        abr_update(c);
+
     goto restart;
 }
 
@@ -1732,7 +2695,8 @@ static int save_avio_options(AVFormatContext *s)
 {
     HLSContext *c = s->priv_data;
     static const char * const opts[] = {
-        "headers", "http_proxy", "user_agent", "cookies", "referer", "rw_timeout", "icy", NULL };
+        "headers", "http_proxy", "user_agent", "cookies", "referer", "rw_timeout", "icy",
+        "connection_pool", "connection_pool_idle_time", "connection_pool_max_per_host", NULL };
     const char * const * opt = opts;
     uint8_t *buf;
     int ret = 0;
@@ -1839,7 +2803,8 @@ static void update_noheader_flag(AVFormatContext *s)
     for (i = 0; i < c->n_playlists; i++) {
         struct playlist *pls = c->playlists[i];
 
-        if (pls->has_noheader_flag) {
+        /* streams of a playlist fast_start skipped appear once it is opened */
+        if (pls->has_noheader_flag || (pls->deferred && !pls->broken)) {
             flag_needed = 1;
             break;
         }
@@ -1851,6 +2816,184 @@ static void update_noheader_flag(AVFormatContext *s)
         s->ctx_flags &= ~AVFMTCTX_NOHEADER;
 }
 
+/* Whether pls is presented by the first variant, which fast_start opens. */
+static int playlist_in_start_variant(HLSContext *c, struct playlist *pls)
+{
+    struct variant *var = c->variants[0];
+    int i;
+
+    if (var->playlists[0] == pls)
+        return 1;
+    for (i = 0; i < c->n_renditions; i++) {
+        struct rendition *rend = c->renditions[i];
+        const char *group = rend->type == AVMEDIA_TYPE_AUDIO    ? var->audio_group :
+                            rend->type == AVMEDIA_TYPE_VIDEO    ? var->video_group :
+                            rend->type == AVMEDIA_TYPE_SUBTITLE ? var->subtitles_group : "";
+        if (rend->playlist == pls && group[0] && !strcmp(rend->group_id, group))
+            return 1;
+    }
+    return 0;
+}
+
+static const struct {
+    const char *prefix;
+    enum AVCodecID codec_id;
+} variant_codec_tags[] = {
+    { "avc1",        AV_CODEC_ID_H264 },
+    { "avc3",        AV_CODEC_ID_H264 },
+    { "hvc1",        AV_CODEC_ID_HEVC },
+    { "hev1",        AV_CODEC_ID_HEVC },
+    { "vp09",        AV_CODEC_ID_VP9  },
+    { "av01",        AV_CODEC_ID_AV1  },
+    { "mp4a.40.34",  AV_CODEC_ID_MP3  },
+    { "mp4a.6b",     AV_CODEC_ID_MP3  },
+    { "mp4a",        AV_CODEC_ID_AAC  },
+    { "ac-3",        AV_CODEC_ID_AC3  },
+    { "ec-3",        AV_CODEC_ID_EAC3 },
+    { "opus",        AV_CODEC_ID_OPUS },
+    { "fLaC",        AV_CODEC_ID_FLAC },
+};
+
+/* Codec of the given type named by a CODECS attribute. */
+static enum AVCodecID variant_codec_id(const char *codecs, enum AVMediaType type)
+{
+    while (*codecs) {
+        size_t len = strcspn(codecs, ",");
+        const char *tag = codecs + strspn(codecs, " ");
+        int i;
+
+        for (i = 0; i < FF_ARRAY_ELEMS(variant_codec_tags); i++) {
+            enum AVCodecID id = variant_codec_tags[i].codec_id;
+            if (av_strstart(tag, variant_codec_tags[i].prefix, NULL)) {
+                if (avcodec_get_type(id) == type)
+                    return id;
+                break;
+            }
+        }
+        codecs += len + !!codecs[len];
+    }
+    return AV_CODEC_ID_NONE;
+}
+
+/* Fill in what the subdemuxer could not tell from the start of the first
+ * segment with the CODECS and RESOLUTION attributes of the variants. */
+static void set_stream_info_from_variant(AVFormatContext *s, struct playlist *pls)
+{
+    HLSContext *c = s->priv_data;
+    int i, j;
+
+    for (i = 0; i < c->n_variants; i++) {
+        struct variant *var = c->variants[i];
+
+        if (var->playlists[0] != pls)
+            continue;
+        for (j = 0; j < pls->n_main_streams; j++) {
+            AVCodecParameters *par = pls->main_streams[j]->codecpar;
+
+            if (par->codec_id == AV_CODEC_ID_NONE && var->codecs[0])
+                par->codec_id = variant_codec_id(var->codecs, par->codec_type);
+            if (par->codec_type == AVMEDIA_TYPE_VIDEO && !par->width && !par->height &&
+                var->width > 0 && var->height > 0) {
+                par->width  = var->width;
+                par->height = var->height;
+            }
+        }
+        break;
+    }
+}
+
+/* Open the subdemuxer of a playlist whose segments are known and
+ * create the main streams for it. */
+static int open_playlist_demuxer(AVFormatContext *s, struct playlist *pls)
+{
+    ff_const59 AVInputFormat *in_fmt = NULL;
+    char *url;
+    int ret;
+
+    if (!pls->ctx && !(pls->ctx = avformat_alloc_context()))
+        return AVERROR(ENOMEM);
+
+    pls->read_buffer = av_malloc(INITIAL_BUFFER_SIZE);
+    if (!pls->read_buffer){
+        avformat_free_context(pls->ctx);
+        pls->ctx = NULL;
+        return AVERROR(ENOMEM);
+    }
+    ffio_init_context(&pls->pb, pls->read_buffer, INITIAL_BUFFER_SIZE, 0, pls,
+                      read_data, NULL, NULL);
+    pls->ctx->probesize = s->probesize > 0 ? s->probesize : 1024 * 4;
+    pls->ctx->max_analyze_duration = s->max_analyze_duration > 0 ? s->max_analyze_duration : 4 * AV_TIME_BASE;
+    url = av_strdup(pls->segments[0]->url);
+    ret = av_probe_input_buffer(&pls->pb, &in_fmt, url, NULL, 0, 0);
+    av_free(url);
+    if (ret < 0) {
+        /* Free the ctx - it isn't initialized properly at this point,
+         * so avformat_close_input shouldn't be called. If
+         * avformat_open_input fails below, it frees and zeros the
+         * context, so it doesn't need any special treatment like this. */
+        av_log(s, AV_LOG_ERROR, "Error when loading first segment '%s'\n", pls->segments[0]->url);
+        avformat_free_context(pls->ctx);
+        pls->ctx = NULL;
+        return ret;
+    }
+    pls->ctx->pb       = &pls->pb;
+    pls->ctx->io_open  = nested_io_open;
+    pls->ctx->flags   |= s->flags & ~AVFMT_FLAG_CUSTOM_IO;
+
+    if ((ret = ff_copy_whiteblacklists(pls->ctx, s)) < 0)
+        return ret;
+
+    ret = avformat_open_input(&pls->ctx, pls->segments[0]->url, in_fmt, NULL);
+    if (ret < 0)
+        return ret;
+
+    if (pls->id3_deferred_extra && pls->ctx->nb_streams == 1) {
+        ff_id3v2_parse_apic(pls->ctx, pls->id3_deferred_extra);
+        avformat_queue_attached_pictures(pls->ctx);
+        ff_id3v2_parse_priv(pls->ctx, pls->id3_deferred_extra);
+        ff_id3v2_free_extra_meta(&pls->id3_deferred_extra);
+    }
+
+    if (pls->is_id3_timestamped == -1)
+        av_log(s, AV_LOG_WARNING, "No expected HTTP requests have been made\n");
+
+    /*
+     * For ID3 timestamped raw audio streams we need to detect the packet
+     * durations to calculate timestamps in fill_timing_for_id3_timestamped_stream(),
+     * but for other streams we can rely on our user calling avformat_find_stream_info()
+     * on us if they want to.
+     */
+    if (pls->is_id3_timestamped || (pls->n_renditions > 0 && pls->renditions[0]->type == AVMEDIA_TYPE_AUDIO)) {
+        ret = avformat_find_stream_info(pls->ctx, NULL);
+        if (ret < 0)
+            return ret;
+    }
+
+    pls->has_noheader_flag = !!(pls->ctx->ctx_flags & AVFMTCTX_NOHEADER);
+
+    /* Create new AVStreams for each stream in this playlist */
+    ret = update_streams_from_subdemuxer(s, pls);
+    if (ret < 0)
+        return ret;
+
+    /*
+     * Copy any metadata from playlist to main streams, but do not set
+     * event flags.
+     */
+    if (pls->n_main_streams)
+        av_dict_copy(&pls->main_streams[0]->metadata, pls->ctx->metadata, 0);
+
+    add_metadata_from_renditions(s, pls, AVMEDIA_TYPE_AUDIO);
+    add_metadata_from_renditions(s, pls, AVMEDIA_TYPE_VIDEO);
+    add_metadata_from_renditions(s, pls, AVMEDIA_TYPE_SUBTITLE);
+
+    set_stream_info_from_variant(s, pls);
+
+    pls->deferred = 0;
+    update_noheader_flag(s);
+    return 0;
+}
+
 static int hls_close(AVFormatContext *s)
 {
     HLSContext *c = s->priv_data;
@@ -1873,11 +3016,18 @@ static int hls_read_header(AVFormatContext *s)
 
     c->ctx                = s;
     c->interrupt_callback = &s->interrupt_callback;
+    c->app_ctx            = (AVApplicationContext *)(intptr_t)c->app_ctx_intptr;
 
     c->first_packet = 1;
     c->first_timestamp = AV_NOPTS_VALUE;
     c->cur_timestamp = AV_NOPTS_VALUE;
 
+    /* a custom io_open is only called on this thread */
+    if (c->prefetch_segments > 0 && !ff_format_io_open_is_async(s)) {
+        av_log(s, AV_LOG_VERBOSE, "Not prefetching segments with a custom io_open\n");
+        c->prefetch_segments = 0;
+    }
+
     if ((ret = save_avio_options(s)) < 0)
         goto fail;
 
@@ -1899,6 +3049,10 @@ static int hls_read_header(AVFormatContext *s)
     if (c->n_playlists > 1 || c->playlists[0]->n_segments == 0) {
         for (i = 0; i < c->n_playlists; i++) {
             struct playlist *pls = c->playlists[i];
+            if (c->fast_start && c->n_variants > 1 && !playlist_in_start_variant(c, pls)) {
+                pls->deferred = 1;
+                continue;
+            }
             pls->m3u8_hold_counters = 0;
             if ((ret = parse_playlist(c, pls->url, pls, NULL)) < 0) {
                 av_log(s, AV_LOG_WARNING, "parse_playlist error %s [%s]\n", av_err2str(ret), pls->url);
@@ -1911,7 +3065,8 @@ static int hls_read_header(AVFormatContext *s)
     }
 
     for (i = 0; i < c->n_variants; i++) {
-        if (c->variants[i]->playlists[0]->n_segments == 0) {
+        if (!c->variants[i]->playlists[0]->deferred &&
+            c->variants[i]->playlists[0]->n_segments == 0) {
             av_log(s, AV_LOG_WARNING, "Empty segment [%s]\n", c->variants[i]->playlists[0]->url);
             c->variants[i]->playlists[0]->broken = 1;
         }
@@ -1947,6 +3102,16 @@ static int hls_read_header(AVFormatContext *s)
         if (!program)
             goto fail;
         av_dict_set_int(&program->metadata, "variant_bitrate", v->bandwidth, 0);
+        if (v->codecs[0])
+            av_dict_set(&program->metadata, "variant_codecs", v->codecs, 0);
+        if (v->width > 0 && v->height > 0) {
+            char resolution[32];
+            snprintf(resolution, sizeof(resolution), "%dx%d", v->width, v->height);
+            av_dict_set(&program->metadata, "variant_resolution", resolution, 0);
+        }
+        /* variants fast_start skipped are opened once enabled */
+        if (v->playlists[0]->deferred)
+            program->discard = AVDISCARD_ALL;
     }
 
     /* Select the starting segments */
@@ -1963,8 +3128,12 @@ static int hls_read_header(AVFormatContext *s)
     /* Open the demuxer for each playlist */
     for (i = 0; i < c->n_playlists; i++) {
         struct playlist *pls = c->playlists[i];
-        char *url;
-        ff_const59 AVInputFormat *in_fmt = NULL;
+
+        if (pls->deferred) {
+            pls->index  = i;
+            pls->parent = s;
+            continue;
+        }
 
         if (!(pls->ctx = avformat_alloc_context())) {
             ret = AVERROR(ENOMEM);
@@ -1990,80 +3159,8 @@ static int hls_read_header(AVFormatContext *s)
             pls->cur_seq_no = highest_cur_seq_no;
         }
 
-        pls->read_buffer = av_malloc(INITIAL_BUFFER_SIZE);
-        if (!pls->read_buffer){
-            ret = AVERROR(ENOMEM);
-            avformat_free_context(pls->ctx);
-            pls->ctx = NULL;
-            goto fail;
-        }
-        ffio_init_context(&pls->pb, pls->read_buffer, INITIAL_BUFFER_SIZE, 0, pls,
-                          read_data, NULL, NULL);
-        pls->ctx->probesize = s->probesize > 0 ? s->probesize : 1024 * 4;
-        pls->ctx->max_analyze_duration = s->max_analyze_duration > 0 ? s->max_analyze_duration : 4 * AV_TIME_BASE;
-        url = av_strdup(pls->segments[0]->url);
-        ret = av_probe_input_buffer(&pls->pb, &in_fmt, url, NULL, 0, 0);
-        av_free(url);
-        if (ret < 0) {
-            /* Free the ctx - it isn't initialized properly at this point,
-             * so avformat_close_input shouldn't be called. If
-             * avformat_open_input fails below, it frees and zeros the
-             * context, so it doesn't need any special treatment like this. */
-            av_log(s, AV_LOG_ERROR, "Error when loading first segment '%s'\n", pls->segments[0]->url);
-            avformat_free_context(pls->ctx);
-            pls->ctx = NULL;
-            goto fail;
-        }
-        pls->ctx->pb       = &pls->pb;
-        pls->ctx->io_open  = nested_io_open;
-        pls->ctx->flags   |= s->flags & ~AVFMT_FLAG_CUSTOM_IO;
-
-        if ((ret = ff_copy_whiteblacklists(pls->ctx, s)) < 0)
-            goto fail;
-
-        ret = avformat_open_input(&pls->ctx, pls->segments[0]->url, in_fmt, NULL);
-        if (ret < 0)
-            goto fail;
-
-        if (pls->id3_deferred_extra && pls->ctx->nb_streams == 1) {
-            ff_id3v2_parse_apic(pls->ctx, pls->id3_deferred_extra);
-            avformat_queue_attached_pictures(pls->ctx);
-            ff_id3v2_parse_priv(pls->ctx, pls->id3_deferred_extra);
-            ff_id3v2_free_extra_meta(&pls->id3_deferred_extra);
-        }
-
-        if (pls->is_id3_timestamped == -1)
-            av_log(s, AV_LOG_WARNING, "No expected HTTP requests have been made\n");
-
-        /*
-         * For ID3 timestamped raw audio streams we need to detect the packet
-         * durations to calculate timestamps in fill_timing_for_id3_timestamped_stream(),
-         * but for other streams we can rely on our user calling avformat_find_stream_info()
-         * on us if they want to.
-         */
-        if (pls->is_id3_timestamped || (pls->n_renditions > 0 && pls->renditions[0]->type == AVMEDIA_TYPE_AUDIO)) {
-            ret = avformat_find_stream_info(pls->ctx, NULL);
-            if (ret < 0)
-                goto fail;
-        }
-
-        pls->has_noheader_flag = !!(pls->ctx->ctx_flags & AVFMTCTX_NOHEADER);
-
-        /* Create new AVStreams for each stream in this playlist */
-        ret = update_streams_from_subdemuxer(s, pls);
-        if (ret < 0)
+        if ((ret = open_playlist_demuxer(s, pls)) < 0)
             goto fail;
-
-        /*
-         * Copy any metadata from playlist to main streams, but do not set
-         * event flags.
-         */
-        if (pls->n_main_streams)
-            av_dict_copy(&pls->main_streams[0]->metadata, pls->ctx->metadata, 0);
-
-        add_metadata_from_renditions(s, pls, AVMEDIA_TYPE_AUDIO);
-        add_metadata_from_renditions(s, pls, AVMEDIA_TYPE_VIDEO);
-        add_metadata_from_renditions(s, pls, AVMEDIA_TYPE_SUBTITLE);
     }
 
     update_noheader_flag(s);
@@ -2080,6 +3177,9 @@ static int recheck_discard_flags(AVFormatContext *s, int first)
     int i, changed = 0;
     int cur_needed;
 
+    if (first)
+        abr_init(c);
+
     /* Check if any new streams are needed */
     for (i = 0; i < c->n_playlists; i++) {
         struct playlist *pls = c->playlists[i];
@@ -2090,6 +3190,10 @@ static int recheck_discard_flags(AVFormatContext *s, int first)
             continue;
         }
         if (cur_needed && !pls->needed) {
+            if (pls->deferred && load_deferred_playlist(c, pls) < 0) {
+                pls->broken = 1;
+                continue;
+            }
             pls->needed = 1;
             changed = 1;
             pls->cur_seq_no = select_cur_seq_no(c, pls);
@@ -2100,12 +3204,20 @@ static int recheck_discard_flags(AVFormatContext *s, int first)
                 pls->seek_flags = AVSEEK_FLAG_ANY;
                 pls->seek_stream_index = -1;
             }
+            if (pls->deferred && open_playlist_demuxer(s, pls) < 0) {
+                av_log(s, AV_LOG_WARNING, "Failed to open playlist %d\n", i);
+                pls->needed = 0;
+                pls->broken = 1;
+                continue;
+            }
             av_log(s, AV_LOG_INFO, "Now receiving playlist %d, segment %d\n", i, pls->cur_seq_no);
         } else if (first && !cur_needed && pls->needed) {
             ff_format_io_close(pls->parent, &pls->input);
             pls->input_read_done = 0;
             ff_format_io_close(pls->parent, &pls->input_next);
             pls->input_next_requested = 0;
+            prefetch_uninit(pls);
+            reload_cancel(pls);
             pls->needed = 0;
             changed = 1;
             av_log(s, AV_LOG_INFO, "No longer receiving playlist %d\n", i);
@@ -2180,6 +3292,15 @@ static int hls_read_packet(AVFormatContext *s, AVPacket *pkt)
                                pls->index);
                     }
 
+                    if (c->abr_out && abr_variant_index(c, pls) >= 0 && !playlist_needed(pls)) {
+                        /* the variant abr switched away from is drained */
+                        ff_format_io_close(pls->parent, &pls->input);
+                        pls->input_read_done = 0;
+                        prefetch_uninit(pls);
+                        reload_cancel(pls);
+                        pls->needed = 0;
+                    }
+
                     if (!avio_feof(&pls->pb) && ret != AVERROR_EOF)
                         return ret;
                     reset_packet(&pls->pkt);
@@ -2277,6 +3398,17 @@ static int hls_read_packet(AVFormatContext *s, AVPacket *pkt)
         ist = pls->ctx->streams[pls->pkt.stream_index];
         st = pls->main_streams[pls->pkt.stream_index];
 
+        /* packets of the variant abr picked go out on the streams of the
+         * variant the caller selected */
+        if (c->abr_out && pls != c->abr_out && abr_variant_index(c, pls) >= 0) {
+            int index = abr_map_stream(pls, pls->pkt.stream_index, c->abr_out);
+            if (index < 0) {
+                av_packet_unref(&pls->pkt);
+                return FFERROR_REDO;
+            }
+            st = c->abr_out->main_streams[index];
+        }
+
         av_packet_move_ref(pkt, &pls->pkt);
         pkt->stream_index = st->index;
 
@@ -2293,6 +3425,8 @@ static int hls_read_packet(AVFormatContext *s, AVPacket *pkt)
                 return ret;
             }
         }
+        if (av_cmp_q(ist->time_base, st->time_base))
+            av_packet_rescale_ts(pkt, ist->time_base, st->time_base);
 
         return 0;
     }
@@ -2337,6 +3471,12 @@ static int hls_read_seek(AVFormatContext *s, int stream_index,
             }
         }
     }
+    /* with abr the stream may be presented on behalf of another variant */
+    if (seek_pls && c->abr_out && seek_pls == c->abr_out && seek_pls != abr_playlist(c)) {
+        stream_subdemuxer_index = abr_map_stream(seek_pls, stream_subdemuxer_index,
+                                                 abr_playlist(c));
+        seek_pls = abr_playlist(c);
+    }
     /* check if the timestamp is valid for the playlist with the
      * specified stream index */
     if (!seek_pls || !find_timestamp_in_playlist(c, seek_pls, seek_timestamp, &seq_no))
@@ -2349,6 +3489,8 @@ static int hls_read_seek(AVFormatContext *s, int stream_index,
     for (i = 0; i < c->n_playlists; i++) {
         /* Reset reading */
         struct playlist *pls = c->playlists[i];
+        if (pls->deferred)
+            continue;
         ff_format_io_close(pls->parent, &pls->input);
         pls->input_read_done = 0;
         ff_format_io_close(pls->parent, &pls->input_next);
@@ -2374,6 +3516,15 @@ static int hls_read_seek(AVFormatContext *s, int stream_index,
             pls->seek_stream_index = -1;
             pls->seek_flags |= AVSEEK_FLAG_ANY;
         }
+
+        /* a variant that is still being drained after an abr switch */
+        if (c->abr_out && abr_variant_index(c, pls) >= 0 && !playlist_needed(pls))
+            pls->needed = 0;
+
+        /* keep the downloads that are still ahead of the new position */
+        if (pls->input_slot)
+            prefetch_release(pls, pls->input_slot);
+        prefetch_flush(pls, pls->cur_seq_no, pls->cur_seq_no + pls->n_prefetch);
     }
 
     c->cur_timestamp = seek_timestamp;
@@ -2413,6 +3564,20 @@ static const AVOption hls_options[] = {
         OFFSET(http_multiple), AV_OPT_TYPE_BOOL, {.i64 = -1}, -1, 1, FLAGS},
     {"http_seekable", "Use HTTP partial requests, 0 = disable, 1 = enable, -1 = auto",
         OFFSET(http_seekable), AV_OPT_TYPE_BOOL, { .i64 = -1}, -1, 1, FLAGS},
+    {"prefetch_segments", "Number of HTTP segments to download ahead of the current one, 0 = disable",
+        OFFSET(prefetch_segments), AV_OPT_TYPE_INT, {.i64 = 0}, 0, 16, FLAGS},
+    {"prefetch_max_size", "Maximum number of bytes held by the segment prefetcher of a playlist",
+        OFFSET(prefetch_max_size), AV_OPT_TYPE_INT64, {.i64 = 32 * 1024 * 1024}, 0, INT64_MAX, FLAGS},
+    {"prefetch_max_duration", "Maximum duration of the segments prefetched ahead of the current one, 0 = unlimited",
+        OFFSET(prefetch_max_duration), AV_OPT_TYPE_DURATION, {.i64 = 30000000}, 0, INT64_MAX, FLAGS},
+    {"live_reload_async", "Refresh live playlists in the background while reading the known segments",
+        OFFSET(live_reload_async), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, FLAGS},
+    {"abr", "Switch between variants according to the measured segment download throughput",
+        OFFSET(abr), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, FLAGS},
+    {"fast_start", "Only open the first variant, open the others when they are enabled",
+        OFFSET(fast_start), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1, FLAGS},
+    {"ijkapplication", "AVApplicationContext",
+        OFFSET(app_ctx_intptr), AV_OPT_TYPE_INT64, {.i64 = 0}, INT64_MIN, INT64_MAX, FLAGS},
     {NULL}
 };
 
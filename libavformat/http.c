@@ -28,14 +28,18 @@
 #include "libavutil/avassert.h"
 #include "libavutil/avstring.h"
 #include "libavutil/bprint.h"
+#include "libavutil/lfg.h"
 #include "libavutil/opt.h"
 #include "libavutil/time.h"
 #include "libavutil/parseutils.h"
+#include "libavutil/random_seed.h"
 #include "libavutil/application.h"
 
 #include "avformat.h"
 #include "http.h"
 #include "httpauth.h"
+#include "httpparallel.h"
+#include "httppool.h"
 #include "internal.h"
 #include "network.h"
 #include "os_support.h"
@@ -76,6 +80,8 @@ typedef struct HTTPContext {
     char *http_proxy;
     char *headers;
     char *mime_type;
+    char *etag;
+    char *last_modified;
     char *http_version;
     char *user_agent;
     char *referer;
@@ -122,6 +128,10 @@ typedef struct HTTPContext {
     int reconnect_at_eof;
     int reconnect_streamed;
     int reconnect_delay_max;
+    int reconnect_backoff;
+    double reconnect_jitter;
+    AVLFG reconnect_lfg;
+    int reconnect_lfg_seeded;
     int listen;
     char *resource;
     int reply_code;
@@ -131,6 +141,17 @@ typedef struct HTTPContext {
     char *tcp_hook;
     int64_t app_ctx_intptr;
     AVApplicationContext *app_ctx;
+    int connection_pool;
+    int pool_idle_time;
+    int pool_max_per_host;
+    /* lower protocol URL hd was opened with and, for tls, the options
+     * deciding whether it may be reused, empty if it is not pooled */
+    char pool_key[1024];
+    int parallel_connections;
+    int parallel_piece_size;
+    /* downloads everything from parallel_split on, hd is only read up to it */
+    HTTPParallel *parallel;
+    uint64_t parallel_split;
 } HTTPContext;
 
 #define OFFSET(x) offsetof(HTTPContext, x)
@@ -152,12 +173,15 @@ static const AVOption options[] = {
     { "multiple_requests", "use persistent connections", OFFSET(multiple_requests), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, D | E },
     { "post_data", "set custom HTTP post data", OFFSET(post_data), AV_OPT_TYPE_BINARY, .flags = D | E },
     { "mime_type", "export the MIME type", OFFSET(mime_type), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
+    { "etag", "export the ETag of the resource", OFFSET(etag), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
+    { "last_modified", "export the Last-Modified date of the resource", OFFSET(last_modified), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
     { "http_version", "export the http response version", OFFSET(http_version), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
     { "cookies", "set cookies to be sent in applicable future requests, use newline delimited Set-Cookie HTTP field value syntax", OFFSET(cookies), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, D },
     { "icy", "request ICY metadata", OFFSET(icy), AV_OPT_TYPE_BOOL, { .i64 = 1 }, 0, 1, D },
     { "icy_metadata_headers", "return ICY metadata headers", OFFSET(icy_metadata_headers), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_EXPORT },
     { "icy_metadata_packet", "return current ICY metadata packet", OFFSET(icy_metadata_packet), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, AV_OPT_FLAG_EXPORT },
     { "metadata", "metadata read from the bitstream", OFFSET(metadata), AV_OPT_TYPE_DICT, {0}, 0, 0, AV_OPT_FLAG_EXPORT },
+    { "chained_options", "export the options passed on to the underlying protocols", OFFSET(chained_options), AV_OPT_TYPE_DICT, {0}, 0, 0, AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_READONLY },
     { "auth_type", "HTTP authentication type", OFFSET(auth_state.auth_type), AV_OPT_TYPE_INT, { .i64 = HTTP_AUTH_NONE }, HTTP_AUTH_NONE, HTTP_AUTH_BASIC, D | E, "auth_type"},
     { "none", "No auth method set, autodetect", 0, AV_OPT_TYPE_CONST, { .i64 = HTTP_AUTH_NONE }, 0, 0, D | E, "auth_type"},
     { "basic", "HTTP basic authentication", 0, AV_OPT_TYPE_CONST, { .i64 = HTTP_AUTH_BASIC }, 0, 0, D | E, "auth_type"},
@@ -170,11 +194,18 @@ static const AVOption options[] = {
     { "reconnect_at_eof", "auto reconnect at EOF", OFFSET(reconnect_at_eof), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, D },
     { "reconnect_streamed", "auto reconnect streamed / non seekable streams", OFFSET(reconnect_streamed), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, D },
     { "reconnect_delay_max", "max reconnect delay in seconds after which to give up", OFFSET(reconnect_delay_max), AV_OPT_TYPE_INT, { .i64 = 120 }, 0, UINT_MAX/1000/1000, D },
+    { "reconnect_backoff", "delay in milliseconds before the second reconnect attempt, doubled for every further one", OFFSET(reconnect_backoff), AV_OPT_TYPE_INT, { .i64 = 100 }, 1, INT_MAX / 1000, D },
+    { "reconnect_jitter", "fraction of the reconnect delay that is randomized", OFFSET(reconnect_jitter), AV_OPT_TYPE_DOUBLE, { .dbl = 0.5 }, 0, 1, D },
     { "listen", "listen on HTTP", OFFSET(listen), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 2, D | E },
     { "resource", "The resource requested by a client", OFFSET(resource), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, E },
     { "reply_code", "The http status code to return to a client", OFFSET(reply_code), AV_OPT_TYPE_INT, { .i64 = 200}, INT_MIN, 599, E},
     { "http-tcp-hook", "hook protocol on tcp", OFFSET(tcp_hook), AV_OPT_TYPE_STRING, { .str = "tcp" }, 0, 0, D | E },
     { "ijkapplication", "AVApplicationContext", OFFSET(app_ctx_intptr), AV_OPT_TYPE_INT64, { .i64 = 0 }, INT64_MIN, INT64_MAX, .flags = D },
+    { "connection_pool", "share idle persistent connections with other http contexts", OFFSET(connection_pool), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, D },
+    { "connection_pool_idle_time", "seconds an idle connection stays in the pool", OFFSET(pool_idle_time), AV_OPT_TYPE_INT, { .i64 = 30 }, 0, INT_MAX / 1000000, D },
+    { "connection_pool_max_per_host", "maximum number of idle pooled connections per server", OFFSET(pool_max_per_host), AV_OPT_TYPE_INT, { .i64 = 4 }, 0, 32, D },
+    { "parallel_connections", "maximum number of connections downloading ranges of the resource in parallel, 0 disables", OFFSET(parallel_connections), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 16, D },
+    { "parallel_piece_size", "size of the range fetched by one parallel request", OFFSET(parallel_piece_size), AV_OPT_TYPE_INT, { .i64 = 1024 * 1024 }, 64 * 1024, 64 * 1024 * 1024, D },
     { NULL }
 };
 
@@ -194,6 +225,36 @@ void ff_http_init_auth_state(URLContext *dest, const URLContext *src)
            sizeof(HTTPAuthState));
 }
 
+/* Whether the server closed a pooled connection before answering the
+ * request, which then is safe to send again on a new connection. Any
+ * response, including an error status, is final. */
+static int pooled_cnx_closed(HTTPContext *s, int err)
+{
+    if (s->line_count)
+        return 0;
+    return err == AVERROR_EOF || err == AVERROR(ECONNRESET) ||
+           err == AVERROR(EPIPE);
+}
+
+/* Key of the pool connections to url are kept under. A tls connection is
+ * only reused with the same verification and client certificate it was
+ * opened with, like a cached tls session. Returns 0 if the key does not
+ * fit, the connection is then not pooled. */
+static int http_pool_key(char *key, int size, const char *url, int tls,
+                         AVDictionary *options)
+{
+    static const char *const tls_opts[] = {
+        "tls_verify", "ca_file", "cafile", "cert_file", "key_file", "verifyhost", NULL
+    };
+    int i, len = av_strlcpy(key, url, size);
+
+    for (i = 0; tls && tls_opts[i] && len < size; i++) {
+        AVDictionaryEntry *e = av_dict_get(options, tls_opts[i], NULL, 0);
+        len += snprintf(key + len, size - len, " %s=%s", tls_opts[i], e ? e->value : "");
+    }
+    return len < size;
+}
+
 static int http_open_cnx_internal(URLContext *h, AVDictionary **options)
 {
     const char *path, *proxy_path, *lower_proto = "tcp", *local_path;
@@ -205,6 +266,8 @@ static int http_open_cnx_internal(URLContext *h, AVDictionary **options)
     int port, use_proxy, err, location_changed = 0;
     char prev_location[4096];
     HTTPContext *s = h->priv_data;
+    uint64_t off = s->off;
+    int reused = 0;
 
     lower_proto = s->tcp_hook;
 
@@ -251,6 +314,19 @@ static int http_open_cnx_internal(URLContext *h, AVDictionary **options)
 
     ff_url_join(buf, sizeof(buf), lower_proto, NULL, hostname, port, NULL);
 
+    if (!s->hd && s->connection_pool) {
+        if (http_pool_key(s->pool_key, sizeof(s->pool_key), buf,
+                          !strcmp(lower_proto, "tls"), options ? *options : NULL)) {
+            s->hd  = ff_http_pool_get(s->pool_key, &h->interrupt_callback, s->app_ctx_intptr);
+            reused = !!s->hd;
+            if (reused)
+                av_log(h, AV_LOG_DEBUG, "Reusing pooled connection to %s\n", buf);
+        } else {
+            s->pool_key[0] = '\0';
+        }
+    }
+
+redo:
     if (!s->hd) {
         av_dict_set_int(options, "ijkapplication", (int64_t)(intptr_t)s->app_ctx, 0);
         err = ffurl_open_whitelist(&s->hd, buf, AVIO_FLAG_READ_WRITE,
@@ -261,8 +337,17 @@ static int http_open_cnx_internal(URLContext *h, AVDictionary **options)
     }
 
     av_strlcpy(prev_location, s->location, sizeof(prev_location));
+    s->line_count = 0;
     err = http_connect(h, path, local_path, hoststr,
                        auth, proxyauth, &location_changed);
+    if (reused && pooled_cnx_closed(s, err)) {
+        /* the server may have timed out the idle connection in the meantime */
+        av_log(h, AV_LOG_DEBUG, "Pooled connection failed, opening a new one\n");
+        ffurl_closep(&s->hd);
+        s->off = off;
+        reused = 0;
+        goto redo;
+    }
     if (err < 0)
         return err;
 
@@ -563,6 +648,58 @@ fail:
     return ret;
 }
 
+/* Hand everything after the first piece of the response over to parallel
+ * range requests, the current connection keeps serving the first piece. */
+static void http_parallel_start(URLContext *h)
+{
+    static const char *const inherited[] = {
+        "headers", "user_agent", "referer", "cookies", "http_proxy",
+        "http-tcp-hook", NULL
+    };
+    HTTPContext *s = h->priv_data;
+    AVDictionary *opts = NULL;
+    uint64_t end = s->end_off ? FFMIN(s->end_off, s->filesize) : s->filesize;
+    uint64_t split = s->off + s->parallel_piece_size;
+    uint8_t *val;
+    int i, ret;
+
+    if (s->parallel_connections < 2 || !s->hd || h->is_streamed ||
+        (h->flags & AVIO_FLAG_WRITE) || s->icy_metaint ||
+        (s->http_code != 200 && s->http_code != 206) ||
+        s->chunksize != UINT64_MAX ||
+        s->filesize == UINT64_MAX || s->filesize == 2147483647)
+        return;
+#if CONFIG_ZLIB
+    if (s->compressed)
+        return;
+#endif /* CONFIG_ZLIB */
+    /* a single piece is served faster by the open connection */
+    if (split >= end || end - split < s->parallel_piece_size)
+        return;
+
+    av_dict_copy(&opts, s->chained_options, 0);
+    for (i = 0; inherited[i]; i++) {
+        if (av_opt_get(s, inherited[i], 0, &val) >= 0 && val && *val)
+            av_dict_set(&opts, inherited[i], val, AV_DICT_DONT_STRDUP_VAL);
+        else
+            av_freep(&val);
+    }
+    av_dict_set(&opts, "seekable", "1", 0);
+    av_dict_set(&opts, "multiple_requests", "1", 0);
+    av_dict_set(&opts, "icy", "0", 0);
+    av_dict_set(&opts, "parallel_connections", "0", 0);
+
+    ret = ff_http_parallel_start(&s->parallel, h, s->location, opts, split, end,
+                                 s->parallel_connections, s->parallel_piece_size);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        av_log(h, AV_LOG_WARNING, "Cannot start parallel download: %s\n",
+               av_err2str(ret));
+        return;
+    }
+    s->parallel_split = split;
+}
+
 static int http_open(URLContext *h, const char *uri, int flags,
                      AVDictionary **options)
 {
@@ -600,11 +737,16 @@ static int http_open(URLContext *h, const char *uri, int flags,
     if (s->listen) {
         return http_listen(h, uri, flags, options);
     }
+    /* pooled connections have to be kept alive by the server */
+    if (s->connection_pool)
+        s->multiple_requests = 1;
     av_application_will_http_open(s->app_ctx, (void*)h, uri);
     ret = http_open_cnx(h, options);
     av_application_did_http_open(s->app_ctx, (void*)h, uri, ret, s->http_code, s->filesize);
     if (ret < 0)
         av_dict_free(&s->chained_options);
+    else
+        http_parallel_start(h);
     return ret;
 }
 
@@ -632,44 +774,46 @@ fail:
     return ret;
 }
 
-static int http_getc(HTTPContext *s)
+static int http_fill_buffer(HTTPContext *s)
 {
-    int len;
-    if (s->buf_ptr >= s->buf_end) {
-        len = ffurl_read(s->hd, s->buffer, BUFFER_SIZE);
-        if (len < 0) {
-            return len;
-        } else if (len == 0) {
-            return AVERROR_EOF;
-        } else {
-            s->buf_ptr = s->buffer;
-            s->buf_end = s->buffer + len;
-        }
-    }
-    return *s->buf_ptr++;
+    int len = ffurl_read(s->hd, s->buffer, BUFFER_SIZE);
+    if (len < 0)
+        return len;
+    else if (len == 0)
+        return AVERROR_EOF;
+    s->buf_ptr = s->buffer;
+    s->buf_end = s->buffer + len;
+    return 0;
 }
 
 static int http_get_line(HTTPContext *s, char *line, int line_size)
 {
-    int ch;
-    char *q;
+    char *q = line;
 
-    q = line;
+    /* lines are looked for with memchr() instead of byte by byte, headers
+     * and chunk sizes mostly come in a single buffer */
     for (;;) {
-        ch = http_getc(s);
-        if (ch < 0)
-            return ch;
-        if (ch == '\n') {
+        uint8_t *nl;
+        int len, ret;
+
+        if (s->buf_ptr >= s->buf_end && (ret = http_fill_buffer(s)) < 0)
+            return ret;
+        nl  = memchr(s->buf_ptr, '\n', s->buf_end - s->buf_ptr);
+        len = (nl ? nl : s->buf_end) - s->buf_ptr;
+        if (len > line_size - 1 - (q - line))
+            len = line_size - 1 - (q - line);
+        memcpy(q, s->buf_ptr, len);
+        q += len;
+        if (nl) {
+            s->buf_ptr = nl + 1;
             /* process line */
             if (q > line && q[-1] == '\r')
                 q--;
             *q = '\0';
 
             return 0;
-        } else {
-            if ((q - line) < line_size - 1)
-                *q++ = ch;
         }
+        s->buf_ptr = s->buf_end;
     }
 }
 
@@ -1050,6 +1194,12 @@ static int process_line(URLContext *h, char *line, int line_count,
         } else if (!av_strcasecmp(tag, "Content-Type")) {
             av_free(s->mime_type);
             s->mime_type = av_strdup(p);
+        } else if (!av_strcasecmp(tag, "ETag")) {
+            av_free(s->etag);
+            s->etag = av_strdup(p);
+        } else if (!av_strcasecmp(tag, "Last-Modified")) {
+            av_free(s->last_modified);
+            s->last_modified = av_strdup(p);
         } else if (!av_strcasecmp(tag, "Set-Cookie")) {
             if (parse_cookie(s, p, &s->cookie_dict))
                 av_log(h, AV_LOG_WARNING, "Unable to parse '%s'\n", p);
@@ -1456,6 +1606,21 @@ static int http_buf_read(URLContext *h, uint8_t *buf, int size)
             len = size;
         memcpy(buf, s->buf_ptr, len);
         s->buf_ptr += len;
+        /* The rest of a large read comes straight from the connection,
+         * as far as it is there already, instead of in another call. */
+        if (size - len >= BUFFER_SIZE && s->hd) {
+            int64_t unread = s->filesize - s->off - len;
+            int ret, n = size - len;
+            if (s->filesize > 0 && s->filesize != UINT64_MAX && s->filesize != 2147483647 && n > unread)
+                n = FFMAX(unread, 0);
+            if (n > 0) {
+                s->hd->flags |= AVIO_FLAG_NONBLOCK;
+                ret = ffurl_read(s->hd, buf + len, n);
+                s->hd->flags &= ~AVIO_FLAG_NONBLOCK;
+                if (ret > 0)
+                    len += ret;
+            }
+        }
     } else {
         uint64_t target_end = s->end_off ? s->end_off : s->filesize;
         if ((!s->willclose || s->chunksize == UINT64_MAX) && s->off >= target_end)
@@ -1522,12 +1687,99 @@ static int http_buf_read_compressed(URLContext *h, uint8_t *buf, int size)
 
 static int64_t http_seek_internal(URLContext *h, int64_t off, int whence, int force_reconnect);
 
+/* Delay in microseconds before the given reconnect attempt, -1 to give up.
+ * The first attempt is immediate, the following ones back off
+ * exponentially, randomized so that clients dropped together do not come
+ * back together. */
+static int64_t http_reconnect_delay(HTTPContext *s, int attempt)
+{
+    int64_t delay;
+    double jitter;
+
+    if (!attempt)
+        return 0;
+    if (attempt > 40)
+        return -1;
+    delay = (int64_t)s->reconnect_backoff * 1000 << (attempt - 1);
+    if (delay > s->reconnect_delay_max * 1000000LL)
+        return -1;
+
+    if (!s->reconnect_lfg_seeded) {
+        av_lfg_init(&s->reconnect_lfg, av_get_random_seed());
+        s->reconnect_lfg_seeded = 1;
+    }
+    jitter = s->reconnect_jitter * av_lfg_get(&s->reconnect_lfg) / UINT_MAX;
+    return delay - (int64_t)(delay * jitter);
+}
+
+/* Resume the response at target on a new, possibly pooled connection.
+ * The broken connection is kept if that fails. */
+static int http_reconnect(URLContext *h, uint64_t target, int attempt)
+{
+    HTTPContext *s = h->priv_data;
+    URLContext *old_hd = s->hd;
+    uint64_t old_off = s->off;
+    AVDictionary *options = NULL;
+    int ret;
+
+    av_application_will_http_reconnect(s->app_ctx, (void*)h, s->location, target, attempt);
+    s->hd  = NULL;
+    s->off = target;
+    ret = http_open_cnx(h, &options);
+    av_dict_free(&options);
+    av_application_did_http_reconnect(s->app_ctx, (void*)h, s->location, target, ret,
+                                      s->http_code, attempt, old_off - target);
+    if (ret < 0) {
+        s->buf_ptr = s->buf_end = s->buffer;
+        s->hd      = old_hd;
+        s->off     = old_off;
+        return ret;
+    }
+    ffurl_closep(&old_hd);
+    return 0;
+}
+
+static int http_read_stream(URLContext *h, uint8_t *buf, int size);
+
+static int http_read_parallel(URLContext *h, uint8_t *buf, int size)
+{
+    HTTPContext *s = h->priv_data;
+    int64_t seek_ret;
+    int ret;
+
+    /* the rest of the response on hd is fetched by the pieces */
+    if (s->hd)
+        ffurl_closep(&s->hd);
+
+    ret = ff_http_parallel_read(s->parallel, s->off, buf, size);
+    if (ret > 0) {
+        s->off += ret;
+        return ret;
+    }
+    if (ret == AVERROR_EOF || ret == AVERROR_EXIT)
+        return ret;
+
+    av_log(h, AV_LOG_WARNING, "Parallel download failed at %"PRIu64": %s, "
+           "continuing on a single connection\n", s->off, av_err2str(ret));
+    ff_http_parallel_stop(&s->parallel);
+    seek_ret = http_seek_internal(h, s->off, SEEK_SET, 1);
+    if (seek_ret < 0)
+        return seek_ret;
+    return http_read_stream(h, buf, size);
+}
+
 static int http_read_stream(URLContext *h, uint8_t *buf, int size)
 {
     HTTPContext *s = h->priv_data;
     int err, new_location, read_ret;
-    int64_t seek_ret;
-    int reconnect_delay = 0;
+    int attempt = 0;
+    int64_t delay;
+
+    if (s->parallel) {
+        if (s->off >= s->parallel_split)
+            return http_read_parallel(h, buf, size);
+        size = FFMIN(size, s->parallel_split - s->off);
+    }
 
     if (!s->hd)
         return AVERROR_EOF;
@@ -1556,16 +1808,23 @@ static int http_read_stream(URLContext *h, uint8_t *buf, int size)
             !(s->reconnect_at_eof && read_ret == AVERROR_EOF))
             break;
 
-        if (reconnect_delay > s->reconnect_delay_max)
+        delay = http_reconnect_delay(s, attempt);
+        if (delay < 0)
             return AVERROR(EIO);
 
-        av_log(h, AV_LOG_WARNING, "Will reconnect at %"PRIu64" in %d second(s), error=%s.\n", s->off, reconnect_delay, av_err2str(read_ret));
-        err = ff_network_sleep_interruptible(1000U*1000*reconnect_delay, &h->interrupt_callback);
-        if (err != AVERROR(ETIMEDOUT))
+        av_log(h, AV_LOG_WARNING, "Will reconnect at %"PRIu64" in %"PRId64" ms, error=%s.\n", target, delay / 1000, av_err2str(read_ret));
+        if (delay) {
+            err = ff_network_sleep_interruptible(delay, &h->interrupt_callback);
+            if (err != AVERROR(ETIMEDOUT))
+                return err;
+        }
+        err = http_reconnect(h, target, ++attempt);
+        if (err == AVERROR_EXIT)
             return err;
-        reconnect_delay = 1 + 2*reconnect_delay;
-        seek_ret = http_seek_internal(h, target, SEEK_SET, 1);
-        if (seek_ret >= 0 && seek_ret != target) {
+        /* try again after the next delay, read_ret still tells why */
+        if (err < 0)
+            continue;
+        if (s->off != target) {
             av_log(h, AV_LOG_ERROR, "Failed to reconnect at %"PRIu64".\n", target);
             return read_ret;
         }
@@ -1728,11 +1987,29 @@ static int http_shutdown(URLContext *h, int flags)
     return ret;
 }
 
+/* Whether the response was read completely and the server keeps the
+ * connection open for another request. */
+static int http_connection_idle(URLContext *h)
+{
+    HTTPContext *s = h->priv_data;
+    uint64_t target_end = s->end_off ? s->end_off : s->filesize;
+
+    if (!s->connection_pool || !s->pool_key[0] || s->willclose ||
+        (h->flags & AVIO_FLAG_WRITE) || s->buf_ptr != s->buf_end ||
+        (s->http_code != 200 && s->http_code != 206))
+        return 0;
+    if (s->chunksize != UINT64_MAX)
+        return s->chunkend;
+    return s->filesize != UINT64_MAX && s->off >= target_end;
+}
+
 static int http_close(URLContext *h)
 {
     int ret = 0;
     HTTPContext *s = h->priv_data;
 
+    ff_http_parallel_stop(&s->parallel);
+
 #if CONFIG_ZLIB
     inflateEnd(&s->inflate_stream);
     av_freep(&s->inflate_buffer);
@@ -1742,6 +2019,11 @@ static int http_close(URLContext *h)
         /* Close the write direction by sending the end of chunked encoding. */
         ret = http_shutdown(h, h->flags);
 
+    if (s->hd && http_connection_idle(h)) {
+        ff_http_pool_put(s->pool_key, s->hd, s->pool_idle_time * 1000000LL,
+                         s->pool_max_per_host);
+        s->hd = NULL;
+    }
     if (s->hd)
         ffurl_closep(&s->hd);
     av_dict_free(&s->chained_options);
@@ -1806,6 +2088,11 @@ static int64_t http_seek_internal(URLContext *h, int64_t off, int whence, int fo
     av_application_did_http_seek(s->app_ctx, (void*)h, s->location, off, ret, s->http_code);
     av_dict_free(&options);
     ffurl_close(old_hd);
+    /* reconnects keep reading up to the pieces that are already loading */
+    if (!force_reconnect) {
+        ff_http_parallel_stop(&s->parallel);
+        http_parallel_start(h);
+    }
     return off;
 }
 
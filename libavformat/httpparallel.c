@@ -0,0 +1,393 @@
+/*
+ * HTTP parallel range download
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "config.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/common.h"
+#include "libavutil/mem.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+
+#include "http.h"
+#include "httpparallel.h"
+
+#if HAVE_THREADS
+
+#define PARALLEL_READ_SIZE (64 * 1024)
+/* connections in use before the first throughput measurement */
+#define PARALLEL_INITIAL_CONNECTIONS 2
+/* memory for pieces, large pieces allow fewer of them and of connections */
+#define PARALLEL_MAX_BUFFER (64 * 1024 * 1024)
+
+enum PieceState {
+    PIECE_FREE,
+    PIECE_LOADING,
+    PIECE_DONE,
+    PIECE_FAILED,
+};
+
+typedef struct HTTPPiece {
+    int64_t start;
+    int64_t end;
+    uint8_t *data;
+    /* bytes in data, only grows while the piece is loading */
+    int64_t len;
+    enum PieceState state;
+    int error;
+} HTTPPiece;
+
+struct HTTPParallel {
+    URLContext *parent;
+    char *url;
+    AVDictionary *opts;
+    int64_t end;
+    int piece_size;
+
+    pthread_t *threads;
+    int nb_threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    atomic_int abort_request;
+
+    HTTPPiece *pieces;
+    int nb_pieces;
+    /* start of the next piece handed out to a connection */
+    int64_t next_start;
+    int max_connections;
+    /* connections allowed to load a piece at the same time */
+    int active;
+    /* connections loading a piece right now */
+    int loading;
+
+    /* throughput of the current measurement period, only the time in which
+     * at least one piece was loading counts */
+    int64_t epoch_bytes;
+    int64_t epoch_busy;
+    int64_t busy_start;
+    int epoch_pieces;
+    double epoch_rate;
+    int last_step;
+};
+
+static int parallel_interrupt_cb(void *opaque)
+{
+    HTTPParallel *p = opaque;
+
+    return atomic_load(&p->abort_request) ||
+           ff_check_interrupt(&p->parent->interrupt_callback);
+}
+
+/* Change the number of connections once every active connection loaded a
+ * piece: keep going in the direction that improved the throughput by more
+ * than 10% and step back from one that made it worse by as much. */
+static void parallel_adapt(HTTPParallel *p, int64_t now)
+{
+    int64_t busy = p->epoch_busy + (p->loading ? now - p->busy_start : 0);
+    double rate = p->epoch_bytes * 1000000.0 / FFMAX(busy, 1);
+    int active = p->active;
+
+    if (rate > p->epoch_rate * 1.1)
+        active += p->last_step >= 0 ? 1 : -1;
+    else if (rate < p->epoch_rate * 0.9)
+        active -= p->last_step;
+    active = av_clip(active, 1, p->max_connections);
+
+    if (active != p->active)
+        av_log(p->parent, AV_LOG_VERBOSE,
+               "Parallel download at %.0f kbit/s, using %d connection(s)\n",
+               rate * 8 / 1000, active);
+
+    p->last_step    = active - p->active;
+    p->active       = active;
+    p->epoch_rate   = rate;
+    p->epoch_bytes  = 0;
+    p->epoch_busy   = 0;
+    p->epoch_pieces = 0;
+    p->busy_start   = now;
+}
+
+/* must be called with the mutex held */
+static HTTPPiece *parallel_claim(HTTPParallel *p)
+{
+    HTTPPiece *piece = NULL;
+    int i;
+
+    if (p->loading >= p->active || p->next_start >= p->end)
+        return NULL;
+    for (i = 0; i < p->nb_pieces && !piece; i++)
+        if (p->pieces[i].state == PIECE_FREE)
+            piece = &p->pieces[i];
+    if (!piece)
+        return NULL;
+
+    piece->start  = p->next_start;
+    piece->end    = FFMIN(p->next_start + p->piece_size, p->end);
+    piece->len    = 0;
+    piece->state  = PIECE_LOADING;
+    piece->error  = 0;
+    p->next_start = piece->end;
+    if (!p->loading++)
+        p->busy_start = av_gettime_relative();
+    return piece;
+}
+
+/* must be called with the mutex held */
+static void parallel_finish(HTTPParallel *p, HTTPPiece *piece, int ret)
+{
+    int64_t now = av_gettime_relative();
+
+    piece->state = ret < 0 ? PIECE_FAILED : PIECE_DONE;
+    piece->error = ret;
+    if (!--p->loading)
+        p->epoch_busy += now - p->busy_start;
+    if (ret >= 0 && ++p->epoch_pieces >= p->active)
+        parallel_adapt(p, now);
+    pthread_cond_broadcast(&p->cond);
+}
+
+/* Load the rest of a piece, reusing the connection of the previous piece
+ * if the server kept it open. */
+static int parallel_fetch(HTTPParallel *p, URLContext **hd,
+                          const AVIOInterruptCB *int_cb, HTTPPiece *piece)
+{
+    AVDictionary *opts = NULL;
+    int64_t off = piece->start + piece->len;
+    int ret = 0;
+
+    if (!piece->data && !(piece->data = av_malloc(p->piece_size)))
+        return AVERROR(ENOMEM);
+
+    av_dict_copy(&opts, p->opts, 0);
+    av_dict_set_int(&opts, "offset", off, 0);
+    av_dict_set_int(&opts, "end_offset", piece->end, 0);
+    if (*hd && ff_http_do_new_request2(*hd, p->url, &opts) < 0)
+        ffurl_closep(hd);
+    if (!*hd)
+        ret = ffurl_open_whitelist(hd, p->url, AVIO_FLAG_READ, int_cb, &opts,
+                                   p->parent->protocol_whitelist,
+                                   p->parent->protocol_blacklist, p->parent);
+    av_dict_free(&opts);
+    if (ret < 0)
+        return ret;
+
+    /* a server ignoring the range sends the resource from its start */
+    if (ffurl_seek(*hd, 0, SEEK_CUR) != off) {
+        av_log(p->parent, AV_LOG_WARNING,
+               "Range request for %"PRId64" was not honored\n", off);
+        return AVERROR(EIO);
+    }
+
+    while (off < piece->end) {
+        ret = ffurl_read(*hd, piece->data + (off - piece->start),
+                         FFMIN(piece->end - off, PARALLEL_READ_SIZE));
+        if (ret == AVERROR_EOF || !ret)
+            return AVERROR(EIO);
+        if (ret < 0)
+            return ret;
+        off += ret;
+
+        /* only this thread writes to the piece, the reader copies what is
+         * below len under the lock */
+        pthread_mutex_lock(&p->mutex);
+        piece->len     += ret;
+        p->epoch_bytes += ret;
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->mutex);
+    }
+    return 0;
+}
+
+static void *parallel_worker(void *arg)
+{
+    HTTPParallel *p = arg;
+    AVIOInterruptCB int_cb = { parallel_interrupt_cb, p };
+    URLContext *hd = NULL;
+    HTTPPiece *piece;
+    int ret;
+
+    pthread_mutex_lock(&p->mutex);
+    while (!atomic_load(&p->abort_request)) {
+        if (!(piece = parallel_claim(p))) {
+            pthread_cond_wait(&p->cond, &p->mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&p->mutex);
+
+        ret = parallel_fetch(p, &hd, &int_cb, piece);
+        if (ret < 0 && ret != AVERROR(ENOMEM) && !atomic_load(&p->abort_request)) {
+            /* once more on a fresh connection, the kept alive one may have
+             * been closed by the server */
+            ffurl_closep(&hd);
+            ret = parallel_fetch(p, &hd, &int_cb, piece);
+        }
+        if (ret < 0)
+            ffurl_closep(&hd);
+
+        pthread_mutex_lock(&p->mutex);
+        parallel_finish(p, piece, ret);
+    }
+    pthread_mutex_unlock(&p->mutex);
+
+    ffurl_closep(&hd);
+    return NULL;
+}
+
+int ff_http_parallel_start(HTTPParallel **pp, URLContext *parent,
+                           const char *url, AVDictionary *opts,
+                           int64_t start, int64_t end,
+                           int max_connections, int piece_size)
+{
+    HTTPParallel *p;
+    int ret;
+
+    p = av_mallocz(sizeof(*p));
+    if (!p)
+        return AVERROR(ENOMEM);
+    p->parent          = parent;
+    p->end             = end;
+    p->next_start      = start;
+    p->piece_size      = piece_size;
+    p->nb_pieces       = av_clip(PARALLEL_MAX_BUFFER / piece_size, 1, 2 * max_connections);
+    max_connections    = FFMIN(max_connections, p->nb_pieces);
+    p->max_connections = max_connections;
+    p->active          = FFMIN(PARALLEL_INITIAL_CONNECTIONS, max_connections);
+    atomic_init(&p->abort_request, 0);
+
+    p->url     = av_strdup(url);
+    p->pieces  = av_mallocz_array(p->nb_pieces, sizeof(*p->pieces));
+    p->threads = av_mallocz_array(max_connections, sizeof(*p->threads));
+    if (!p->url || !p->pieces || !p->threads ||
+        av_dict_copy(&p->opts, opts, 0) < 0) {
+        av_dict_free(&p->opts);
+        av_freep(&p->threads);
+        av_freep(&p->pieces);
+        av_freep(&p->url);
+        av_freep(&p);
+        return AVERROR(ENOMEM);
+    }
+
+    pthread_mutex_init(&p->mutex, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    for (p->nb_threads = 0; p->nb_threads < max_connections; p->nb_threads++) {
+        ret = pthread_create(&p->threads[p->nb_threads], NULL, parallel_worker, p);
+        if (ret) {
+            ff_http_parallel_stop(&p);
+            return AVERROR(ret);
+        }
+    }
+
+    *pp = p;
+    return 0;
+}
+
+int ff_http_parallel_read(HTTPParallel *p, int64_t pos, uint8_t *buf, int size)
+{
+    HTTPPiece *piece;
+    int i, ret = 0;
+
+    if (pos >= p->end)
+        return AVERROR_EOF;
+
+    pthread_mutex_lock(&p->mutex);
+    /* make room for the pieces after the ones already read */
+    for (i = 0; i < p->nb_pieces; i++) {
+        piece = &p->pieces[i];
+        if (piece->state != PIECE_FREE && piece->state != PIECE_LOADING &&
+            piece->end <= pos)
+            piece->state = PIECE_FREE;
+    }
+    pthread_cond_broadcast(&p->cond);
+
+    while (!ret) {
+        piece = NULL;
+        for (i = 0; i < p->nb_pieces && !piece; i++)
+            if (p->pieces[i].state != PIECE_FREE &&
+                p->pieces[i].start <= pos && pos < p->pieces[i].end)
+                piece = &p->pieces[i];
+
+        if (piece && piece->start + piece->len > pos) {
+            ret = FFMIN(piece->start + piece->len - pos, size);
+            memcpy(buf, piece->data + (pos - piece->start), ret);
+        } else if (piece && piece->state == PIECE_FAILED) {
+            ret = piece->error;
+        } else if (ff_check_interrupt(&p->parent->interrupt_callback)) {
+            ret = AVERROR_EXIT;
+        } else {
+            /* the interrupt callback does not signal, poll it */
+            int64_t t = av_gettime() + 10000;
+            struct timespec tv = { .tv_sec  =  t / 1000000,
+                                   .tv_nsec = (t % 1000000) * 1000 };
+            pthread_cond_timedwait(&p->cond, &p->mutex, &tv);
+        }
+    }
+    pthread_mutex_unlock(&p->mutex);
+    return ret;
+}
+
+void ff_http_parallel_stop(HTTPParallel **pp)
+{
+    HTTPParallel *p = *pp;
+    int i;
+
+    if (!p)
+        return;
+
+    atomic_store(&p->abort_request, 1);
+    pthread_mutex_lock(&p->mutex);
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->mutex);
+    for (i = 0; i < p->nb_threads; i++)
+        pthread_join(p->threads[i], NULL);
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->mutex);
+
+    for (i = 0; i < p->nb_pieces; i++)
+        av_freep(&p->pieces[i].data);
+    av_freep(&p->pieces);
+    av_freep(&p->threads);
+    av_dict_free(&p->opts);
+    av_freep(&p->url);
+    av_freep(pp);
+}
+
+#else /* HAVE_THREADS */
+
+int ff_http_parallel_start(HTTPParallel **pp, URLContext *parent,
+                           const char *url, AVDictionary *opts,
+                           int64_t start, int64_t end,
+                           int max_connections, int piece_size)
+{
+    return AVERROR(ENOSYS);
+}
+
+int ff_http_parallel_read(HTTPParallel *p, int64_t pos, uint8_t *buf, int size)
+{
+    return AVERROR_EOF;
+}
+
+void ff_http_parallel_stop(HTTPParallel **pp)
+{
+}
+
+#endif /* HAVE_THREADS */
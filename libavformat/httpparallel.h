@@ -0,0 +1,75 @@
+/*
+ * HTTP parallel range download
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVFORMAT_HTTPPARALLEL_H
+#define AVFORMAT_HTTPPARALLEL_H
+
+#include <stdint.h>
+
+#include "libavutil/dict.h"
+
+#include "url.h"
+
+typedef struct HTTPParallel HTTPParallel;
+
+/**
+ * Start fetching the byte range [start, end) of url in pieces, each piece
+ * with its own range request, over up to max_connections connections.
+ *
+ * The number of connections in use is adapted to the measured throughput.
+ * At most two pieces per connection and 64 MiB in total are kept ahead
+ * of the reader, fewer connections are used if that leaves less than one
+ * piece each.
+ *
+ * @param pp              the new downloader is stored here
+ * @param parent          http context the pieces are fetched for, its
+ *                        interrupt callback and protocol lists are used
+ * @param url             url of the resource, after redirects
+ * @param opts            options for opening the pieces
+ * @param start           first byte to fetch
+ * @param end             byte after the last one to fetch
+ * @param max_connections maximum number of concurrent requests
+ * @param piece_size      size of a piece in bytes
+ * @return 0 on success, a negative AVERROR on failure
+ */
+int ff_http_parallel_start(HTTPParallel **pp, URLContext *parent,
+                           const char *url, AVDictionary *opts,
+                           int64_t start, int64_t end,
+                           int max_connections, int piece_size);
+
+/**
+ * Read the bytes at pos, waiting for them to be downloaded if needed.
+ *
+ * pos must not go backwards between calls, everything before it is
+ * dropped.
+ *
+ * @return the number of bytes read, AVERROR_EOF at the end of the range,
+ *         AVERROR_EXIT if the interrupt callback of the parent asked to
+ *         stop, or the error the download of the piece holding pos failed
+ *         with
+ */
+int ff_http_parallel_read(HTTPParallel *p, int64_t pos, uint8_t *buf, int size);
+
+/**
+ * Abort all downloads and free the downloader.
+ */
+void ff_http_parallel_stop(HTTPParallel **pp);
+
+#endif /* AVFORMAT_HTTPPARALLEL_H */
@@ -0,0 +1,162 @@
+/*
+ * HTTP connection pool
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/opt.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+
+#include "httppool.h"
+#include "network.h"
+
+/* bounds the number of sockets kept open by the process */
+#define POOL_MAX_CONNECTIONS 32
+
+typedef struct PooledConnection {
+    char key[1024];
+    URLContext *hd;
+    int64_t expires;
+} PooledConnection;
+
+static AVMutex pool_lock = AV_MUTEX_INITIALIZER;
+static PooledConnection pool[POOL_MAX_CONNECTIONS];
+static int pool_size;
+
+/* Bind hd and the connections it is layered on (tls over tcp) to a new
+ * user, so that nothing points at the previous one anymore. */
+static void pool_bind(URLContext *hd, const AVIOInterruptCB *int_cb, int64_t app_ctx)
+{
+    void *child = NULL;
+
+    hd->interrupt_callback = *int_cb;
+    if (!hd->priv_data || !hd->prot->priv_data_class)
+        return;
+    av_opt_set_int(hd->priv_data, "ijkapplication", app_ctx, 0);
+    while ((child = av_opt_child_next(hd->priv_data, child)))
+        if (*(const AVClass **)child == &ffurl_context_class)
+            pool_bind(child, int_cb, app_ctx);
+}
+
+/* An idle connection has nothing to read, readable means the peer closed
+ * it or sent something unexpected. */
+static int pool_alive(URLContext *hd)
+{
+    struct pollfd p = { ffurl_get_file_handle(hd), POLLIN, 0 };
+
+    if (p.fd < 0)
+        return 1;
+    return poll(&p, 1, 0) == 0;
+}
+
+static URLContext *pool_remove(int index)
+{
+    URLContext *hd = pool[index].hd;
+
+    memmove(&pool[index], &pool[index + 1],
+            (pool_size - index - 1) * sizeof(*pool));
+    pool_size--;
+    return hd;
+}
+
+/* must be called with pool_lock held, closing is left to the caller */
+static void pool_expire(int64_t now, URLContext **closing, int *nb_closing)
+{
+    int i;
+
+    for (i = pool_size - 1; i >= 0; i--)
+        if (pool[i].expires <= now)
+            closing[(*nb_closing)++] = pool_remove(i);
+}
+
+static void pool_close(URLContext **closing, int nb_closing)
+{
+    int i;
+
+    for (i = 0; i < nb_closing; i++)
+        ffurl_closep(&closing[i]);
+}
+
+URLContext *ff_http_pool_get(const char *key, const AVIOInterruptCB *int_cb,
+                             int64_t app_ctx)
+{
+    URLContext *closing[POOL_MAX_CONNECTIONS];
+    URLContext *hd = NULL;
+    int i, nb_closing = 0;
+
+    ff_mutex_lock(&pool_lock);
+    pool_expire(av_gettime_relative(), closing, &nb_closing);
+    /* most recently used first, it is the least likely to be timed out
+     * by the server */
+    for (i = pool_size - 1; i >= 0 && !hd; i--) {
+        if (strcmp(pool[i].key, key))
+            continue;
+        hd = pool_remove(i);
+        if (!pool_alive(hd)) {
+            closing[nb_closing++] = hd;
+            hd = NULL;
+        }
+    }
+    ff_mutex_unlock(&pool_lock);
+
+    pool_close(closing, nb_closing);
+    if (hd)
+        pool_bind(hd, int_cb, app_ctx);
+    return hd;
+}
+
+void ff_http_pool_put(const char *key, URLContext *hd, int64_t max_idle,
+                      int max_per_host)
+{
+    static const AVIOInterruptCB no_int_cb = { 0 };
+    URLContext *closing[POOL_MAX_CONNECTIONS + 1];
+    int64_t now = av_gettime_relative();
+    int i, n = 0, nb_closing = 0;
+
+    if (max_idle <= 0 || max_per_host <= 0 || strlen(key) >= sizeof(pool->key)) {
+        ffurl_closep(&hd);
+        return;
+    }
+    pool_bind(hd, &no_int_cb, 0);
+
+    ff_mutex_lock(&pool_lock);
+    pool_expire(now, closing, &nb_closing);
+    for (i = 0; i < pool_size; i++)
+        n += !strcmp(pool[i].key, key);
+    for (i = 0; i < pool_size && n >= max_per_host; ) {
+        if (!strcmp(pool[i].key, key)) {
+            closing[nb_closing++] = pool_remove(i);
+            n--;
+        } else {
+            i++;
+        }
+    }
+    if (pool_size == POOL_MAX_CONNECTIONS)
+        closing[nb_closing++] = pool_remove(0);
+
+    av_strlcpy(pool[pool_size].key, key, sizeof(pool->key));
+    pool[pool_size].hd      = hd;
+    pool[pool_size].expires = now + max_idle;
+    pool_size++;
+    ff_mutex_unlock(&pool_lock);
+
+    pool_close(closing, nb_closing);
+}
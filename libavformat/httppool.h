@@ -0,0 +1,59 @@
+/*
+ * HTTP connection pool
+ *
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef AVFORMAT_HTTPPOOL_H
+#define AVFORMAT_HTTPPOOL_H
+
+#include <stdint.h>
+
+#include "url.h"
+
+/**
+ * Take an idle connection out of the process wide pool.
+ *
+ * Connections that expired or that the peer closed are dropped on the way.
+ * The returned connection and the connections it is layered on are bound
+ * to the given interrupt callback and application context.
+ *
+ * @param key     lower protocol URL the connection was opened with,
+ *                identifying scheme, host, port and proxy
+ * @param int_cb  interrupt callback of the new user
+ * @param app_ctx AVApplicationContext of the new user, as an integer
+ * @return an open connection, or NULL if there is none for key
+ */
+URLContext *ff_http_pool_get(const char *key, const AVIOInterruptCB *int_cb,
+                             int64_t app_ctx);
+
+/**
+ * Hand a connection that is idle between requests over to the pool.
+ *
+ * The oldest idle connection for the key is closed if there are
+ * max_per_host already.
+ *
+ * @param key          lower protocol URL the connection was opened with
+ * @param hd           connection, owned by the pool afterwards
+ * @param max_idle     time in microseconds after which the connection
+ *                     is closed if it was not taken again
+ * @param max_per_host maximum number of idle connections for key
+ */
+void ff_http_pool_put(const char *key, URLContext *hd, int64_t max_idle,
+                      int max_per_host);
+
+#endif /* AVFORMAT_HTTPPOOL_H */
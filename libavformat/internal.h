@@ -386,8 +386,30 @@ int ff_add_index_entry(AVIndexEntry **index_entries,
                        unsigned int *index_entries_allocated_size,
                        int64_t pos, int64_t timestamp, int size, int distance, int flags);
 
+/**
+ * Add nb_entries entries to the index of st, with the same result as calling
+ * av_add_index_entry() for each of them. The index is grown once up front,
+ * so adding entries with increasing timestamps costs no reallocation.
+ *
+ * Entries are added in order up to the first one that is rejected.
+ *
+ * @return 0 on success, a negative AVERROR code if the index could not grow
+ *         or an entry was rejected
+ */
+int ff_add_index_entries(AVStream *st, const AVIndexEntry *entries, int nb_entries);
+
 void ff_configure_buffers_for_index(AVFormatContext *s, int64_t time_tolerance);
 
+/**
+ * Same as ff_configure_buffers_for_index(), for demuxers that do not keep
+ * their whole index in AVStream.index_entries.
+ *
+ * @param get_entry returns the index-th entry of the stream index, or NULL
+ *                  past its end
+ */
+void ff_configure_buffers_for_index_cb(AVFormatContext *s, int64_t time_tolerance,
+                                       const AVIndexEntry *(*get_entry)(AVStream *st, int index));
+
 /**
  * Add a new chapter.
  *
@@ -648,6 +670,28 @@ int ff_format_output_open(AVFormatContext *s, const char *url, AVDictionary **op
  */
 void ff_format_io_close(AVFormatContext *s, AVIOContext **pb);
 
+/**
+ * Return whether ff_format_io_open_async() may be called from a thread other
+ * than the one driving s. This is only the case with the default io_open
+ * callback, custom ones are not required to be thread-safe and would not
+ * honor the interrupt callback of the download.
+ */
+int ff_format_io_open_is_async(AVFormatContext *s);
+
+/**
+ * Open url through AVFormatContext.io_open for a download that can be
+ * stopped with int_cb, e.g. one running in the background.
+ *
+ * With the default callback the url is opened with int_cb instead of
+ * s->interrupt_callback, so that the caller can stop it. A custom callback
+ * is called as is, so the download must then run on the thread driving s,
+ * see ff_format_io_open_is_async(). Close the result with
+ * ff_format_io_close().
+ */
+int ff_format_io_open_async(AVFormatContext *s, AVIOContext **pb, const char *url,
+                            int flags, AVDictionary **options,
+                            const AVIOInterruptCB *int_cb);
+
 /**
  * Utility function to check if the file uses http or https protocol
  *
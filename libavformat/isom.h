@@ -155,6 +155,59 @@ typedef struct MOVIndexRange {
     int64_t end;
 } MOVIndexRange;
 
+typedef struct MOVTimeRun {
+    unsigned int first_sample;  ///< first sample covered by the stts entry
+    int64_t first_dts;          ///< dts of that sample, excluding the index dts offset
+} MOVTimeRun;
+
+typedef struct MOVChunkRun {
+    unsigned int first_sample;  ///< first sample of the run
+    unsigned int first_chunk;   ///< 0-based index into chunk_offsets
+    unsigned int nb_chunks;
+    unsigned int samples_per_chunk;
+} MOVChunkRun;
+
+enum MOVKeyframeMode {
+    MOV_KEYFRAMES_LIST,         ///< keyframes listed in stss
+    MOV_KEYFRAMES_ALL,
+    MOV_KEYFRAMES_FIRST,        ///< only the first sample is a keyframe
+    MOV_KEYFRAMES_NONE,
+};
+
+/**
+ * Position of the last sample decoded from a compact index, so that walking
+ * the samples in order costs O(1) per sample.
+ */
+typedef struct MOVSampleCursor {
+    unsigned int sample;
+    unsigned int time_run;
+    unsigned int chunk_run;
+    unsigned int chunk;         ///< 0-based index into chunk_offsets
+    unsigned int chunk_sample;  ///< index of the sample inside its chunk
+    unsigned int keyframe;      ///< index of the first keyframe >= sample
+    int64_t pos;
+    int64_t dts;                ///< excluding the index dts offset
+} MOVSampleCursor;
+
+/**
+ * Sample index decoded on demand from stts/stsc/stsz/stss instead of being
+ * expanded into AVStream.index_entries.
+ */
+typedef struct MOVCompactIndex {
+    unsigned int nb_samples;
+    unsigned int nb_discard;    ///< leading samples flagged AVINDEX_DISCARD_FRAME
+    int64_t dts_offset;         ///< added to every dts, includes the edit list shift
+    MOVTimeRun *time_runs;      ///< one per stts entry
+    unsigned int nb_time_runs;
+    MOVChunkRun *chunk_runs;
+    unsigned int nb_chunk_runs;
+    enum MOVKeyframeMode keyframe_mode;
+    unsigned int nb_keyframes;  ///< usable (increasing) prefix of keyframes
+    int key_off;                ///< 1 if stss sample numbers are 1-based
+    MOVSampleCursor cursor;
+    AVIndexEntry entry;         ///< last entry returned to the caller
+} MOVCompactIndex;
+
 typedef struct MOVStreamContext {
     AVIOContext *pb;
     int pb_is_copied;
@@ -193,6 +246,7 @@ typedef struct MOVStreamContext {
     int64_t current_index;
     MOVIndexRange* index_ranges;
     MOVIndexRange* current_index_range;
+    MOVCompactIndex *compact_index; ///< set when index_entries is not populated
     unsigned int bytes_per_frame;
     unsigned int samples_per_frame;
     int dv_audio_container;
@@ -327,6 +381,7 @@ typedef struct MOVContext {
     int use_absolute_path;
     int ignore_editlist;
     int advanced_editlist;
+    int compact_index;
     int ignore_chapters;
     int seek_individually;
     int64_t next_root_atom; ///< offset of the next root atom
@@ -335,6 +390,12 @@ typedef struct MOVContext {
     int *bitrates;          ///< bitrates read before streams creation
     int bitrates_count;
     int moov_retry;
+    int moov_prefetch;
+    int moov_prefetch_mdat_size;
+    int moov_prefetched;    ///< 'moov' was fetched ahead of the 'mdat' it follows
+    uint8_t *mdat_head;     ///< start of the 'mdat' read while prefetching the 'moov'
+    int64_t mdat_head_pos;
+    int mdat_head_size;
     int use_mfra_for;
     int has_looked_for_mfra;
     MOVFragmentIndex frag_index;
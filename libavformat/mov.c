@@ -45,6 +45,7 @@
 #include "libavutil/sha.h"
 #include "libavutil/spherical.h"
 #include "libavutil/stereo3d.h"
+#include "libavutil/thread.h"
 #include "libavutil/timecode.h"
 #include "libavutil/dovi_meta.h"
 #include "libavcodec/ac3tab.h"
@@ -976,12 +977,243 @@ static int mov_read_pasp(MOVContext *c, AVIOContext *pb, MOVAtom atom)
     return 0;
 }
 
+/* Largest trailing moov fetched in one piece, bigger ones are read in place. */
+#define MOV_PREFETCH_MOOV_MAX (256 << 20)
+
+typedef struct MOVMoovPrefetch {
+    AVFormatContext *fc;
+    AVDictionary *opts;
+    int64_t offset;         ///< offset of the moov atom header
+    int64_t size;           ///< bytes from the moov header to the end of the file
+    uint8_t *data;          ///< moov payload
+    int64_t data_size;
+    int ret;
+} MOVMoovPrefetch;
+
+/* Fetch the moov that ends the file with a single range request. Gives up
+ * unless the tail of the file is exactly one moov atom. */
+static void *mov_prefetch_moov_worker(void *arg)
+{
+    MOVMoovPrefetch *p = arg;
+    AVFormatContext *s = p->fc;
+    AVIOContext *pb = NULL;
+    int64_t size;
+    int header_size = 8;
+    int ret;
+
+    ret = ff_format_io_open_async(s, &pb, s->url, AVIO_FLAG_READ, &p->opts,
+                                  &s->interrupt_callback);
+    if (ret < 0)
+        goto end;
+
+    size = avio_rb32(pb);
+    if (avio_rl32(pb) != MKTAG('m','o','o','v')) {
+        ret = AVERROR_INVALIDDATA;
+        goto end;
+    }
+    if (size == 1) {
+        size = avio_rb64(pb);
+        header_size += 8;
+    }
+    if (pb->error || avio_feof(pb)) {
+        ret = pb->error ? pb->error : AVERROR_EOF;
+        goto end;
+    }
+    if (size != p->size) {
+        ret = AVERROR_INVALIDDATA;
+        goto end;
+    }
+
+    p->data_size = size - header_size;
+    p->data = av_malloc(p->data_size);
+    if (!p->data) {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    ret = ffio_read_size(pb, p->data, p->data_size);
+
+end:
+    ff_format_io_close(s, &pb);
+    p->ret = ret;
+    return NULL;
+}
+
+/**
+ * Copy the options the protocol of s->pb was opened with: all of its own
+ * settable options and those it passed on to the protocols below it, such
+ * as the tls and tcp ones.
+ */
+static int mov_prefetch_copy_options(AVFormatContext *s, AVDictionary **opts)
+{
+    const AVOption *o = NULL;
+    void *proto = NULL;
+    uint8_t *buf;
+    int ret;
+
+    if (!av_opt_find2(s->pb, "chained_options", NULL, 0, AV_OPT_SEARCH_CHILDREN, &proto))
+        return 0;
+    if ((ret = av_opt_get_dict_val(proto, "chained_options", 0, opts)) < 0)
+        return ret;
+    while ((o = av_opt_next(proto, o))) {
+        if (o->type == AV_OPT_TYPE_CONST || !(o->flags & AV_OPT_FLAG_DECODING_PARAM) ||
+            o->flags & (AV_OPT_FLAG_READONLY | AV_OPT_FLAG_EXPORT | AV_OPT_FLAG_DEPRECATED) ||
+            !strcmp(o->name, "location"))
+            continue;
+        if (av_opt_get(proto, o->name, AV_OPT_ALLOW_NULL, &buf) < 0 || !buf)
+            continue;
+        if ((ret = av_dict_set(opts, o->name, buf, AV_DICT_DONT_STRDUP_VAL)) < 0)
+            return ret;
+    }
+    return 0;
+}
+
+static int mov_prefetch_moov_init(MOVContext *c, MOVMoovPrefetch *p, int64_t offset, int64_t size)
+{
+    int ret;
+
+    memset(p, 0, sizeof(*p));
+    p->fc     = c->fc;
+    p->offset = offset;
+    p->size   = size;
+    if ((ret = mov_prefetch_copy_options(c->fc, &p->opts)) < 0 ||
+        (ret = av_dict_set_int(&p->opts, "offset", offset, 0)) < 0 ||
+        (ret = av_dict_set_int(&p->opts, "end_offset", offset + size, 0)) < 0)
+        return ret;
+    return 0;
+}
+
+static void mov_read_mdat_head(MOVContext *c, AVIOContext *pb, int size)
+{
+    if (size <= 0 || !(c->mdat_head = av_malloc(size)))
+        return;
+    c->mdat_head_pos = avio_tell(pb);
+    while (c->mdat_head_size < size) {
+        int n = avio_read(pb, c->mdat_head + c->mdat_head_size, size - c->mdat_head_size);
+        if (n <= 0)
+            break;
+        c->mdat_head_size += n;
+    }
+}
+
+/**
+ * Called on a top level 'mdat' seen before the 'moov'. When the input is a
+ * progressive http download ending with the 'moov', fetch that atom over a
+ * second connection while the head of the 'mdat' is read on this one, then
+ * parse the 'moov' from memory. The first samples are served from the kept
+ * head and the rest follows on the same connection, so playback starts
+ * without seeking back.
+ */
+static int mov_prefetch_moov(MOVContext *c, AVIOContext *pb, MOVAtom atom)
+{
+    AVFormatContext *s = c->fc;
+    MOVMoovPrefetch p;
+    const char *proto;
+    int64_t start = avio_tell(pb);
+    int64_t file_size = avio_size(pb);
+    int64_t moov_offset = start + atom.size;
+    int head_size = FFMIN(atom.size, c->moov_prefetch_mdat_size);
+#if HAVE_THREADS
+    pthread_t thread;
+    int thread_ret;
+#endif
+    int ret;
+
+    if (c->atom_depth != 1 || c->mdat_head || pb != s->pb || (s->flags & AVFMT_FLAG_CUSTOM_IO) ||
+        !(pb->seekable & AVIO_SEEKABLE_NORMAL) || atom.size <= 0 ||
+        file_size - moov_offset < 8 || file_size - moov_offset > MOV_PREFETCH_MOOV_MAX)
+        return 0;
+    proto = avio_find_protocol_name(s->url);
+    if (!proto || (strcmp(proto, "http") && strcmp(proto, "https")))
+        return 0;
+
+    /* a small mdat is kept whole and the moov read after it on this connection */
+    if (atom.size <= c->moov_prefetch_mdat_size) {
+        mov_read_mdat_head(c, pb, atom.size);
+        return 0;
+    }
+
+    if ((ret = mov_prefetch_moov_init(c, &p, moov_offset, file_size - moov_offset)) < 0)
+        goto end;
+
+#if HAVE_THREADS
+    /* a custom io_open is only called on this thread */
+    thread_ret = ff_format_io_open_is_async(s) ?
+                 pthread_create(&thread, NULL, mov_prefetch_moov_worker, &p) : ENOSYS;
+    if (thread_ret)
+        mov_prefetch_moov_worker(&p);
+#else
+    mov_prefetch_moov_worker(&p);
+#endif
+
+    /* read the first samples in the meantime */
+    mov_read_mdat_head(c, pb, head_size);
+#if HAVE_THREADS
+    if (!thread_ret)
+        pthread_join(thread, NULL);
+#endif
+
+    if (p.ret < 0) {
+        av_log(s, AV_LOG_VERBOSE, "Could not prefetch the moov atom at %"PRId64": %s\n",
+               p.offset, av_err2str(p.ret));
+        ret = 0;
+    } else {
+        AVIOContext ctx;
+        MOVAtom moov = { MKTAG('m','o','o','v'), p.data_size };
+
+        av_log(s, AV_LOG_VERBOSE, "Prefetched %"PRId64" bytes moov atom at %"PRId64"\n",
+               p.size, p.offset);
+        if ((ret = ffio_init_context(&ctx, p.data, p.data_size, 0, NULL, NULL, NULL, NULL)) < 0)
+            goto end;
+        ctx.seekable = AVIO_SEEKABLE_NORMAL;
+        if ((ret = mov_read_default(c, &ctx, moov)) < 0)
+            goto end;
+        c->found_moov = 1;
+        c->moov_prefetched = 1;
+    }
+
+end:
+    av_dict_free(&p.opts);
+    av_free(p.data);
+    return ret;
+}
+
+/* Number of bytes of the sample at pos that are held in the 'mdat' head. */
+static int mov_mdat_head_bytes(MOVContext *c, int64_t pos, int size)
+{
+    int64_t end = c->mdat_head_pos + c->mdat_head_size;
+
+    if (pos < c->mdat_head_pos || pos >= end)
+        return 0;
+    return FFMIN(size, end - pos);
+}
+
+static int mov_get_mdat_head_packet(MOVContext *c, AVIOContext *pb, AVPacket *pkt,
+                                    int64_t pos, int size, int head)
+{
+    int ret;
+
+    if ((ret = av_new_packet(pkt, size)) < 0)
+        return ret;
+    memcpy(pkt->data, c->mdat_head + (pos - c->mdat_head_pos), head);
+    if (size > head) {
+        ret = avio_read(pb, pkt->data + head, size - head);
+        if (ret < size - head) {
+            av_shrink_packet(pkt, head + FFMAX(ret, 0));
+            pkt->flags |= AV_PKT_FLAG_CORRUPT;
+        }
+    }
+    pkt->pos = pos;
+    return pkt->size;
+}
+
 /* this atom contains actual media data */
 static int mov_read_mdat(MOVContext *c, AVIOContext *pb, MOVAtom atom)
 {
     if (atom.size == 0) /* wrong one (MP4) */
         return 0;
     c->found_mdat=1;
+    if (!c->found_moov && c->moov_prefetch)
+        return mov_prefetch_moov(c, pb, atom);
     return 0; /* now go for moov */
 }
 
@@ -3362,6 +3594,616 @@ static int64_t add_ctts_entry(MOVStts** ctts_data, unsigned int* ctts_count, uns
     return *ctts_count;
 }
 
+static void mov_free_compact_index(MOVStreamContext *sc)
+{
+    if (!sc->compact_index)
+        return;
+    av_freep(&sc->compact_index->time_runs);
+    av_freep(&sc->compact_index->chunk_runs);
+    av_freep(&sc->compact_index);
+}
+
+static unsigned int mov_compact_time_run(const MOVCompactIndex *ci, unsigned int sample)
+{
+    unsigned int a = 0, b = ci->nb_time_runs;
+
+    while (b - a > 1) {
+        unsigned int m = (a + b) >> 1;
+        if (ci->time_runs[m].first_sample <= sample)
+            a = m;
+        else
+            b = m;
+    }
+    return a;
+}
+
+static unsigned int mov_compact_chunk_run(const MOVCompactIndex *ci, unsigned int sample)
+{
+    unsigned int a = 0, b = ci->nb_chunk_runs;
+
+    while (b - a > 1) {
+        unsigned int m = (a + b) >> 1;
+        if (ci->chunk_runs[m].first_sample <= sample)
+            a = m;
+        else
+            b = m;
+    }
+    return a;
+}
+
+static int64_t mov_compact_dts(const MOVStreamContext *sc, const MOVCompactIndex *ci,
+                               unsigned int sample)
+{
+    unsigned int run = mov_compact_time_run(ci, sample);
+
+    return ci->dts_offset + ci->time_runs[run].first_dts +
+           (int64_t)(sample - ci->time_runs[run].first_sample) * sc->stts_data[run].duration;
+}
+
+/* First sample with a dts above timestamp, nb_samples if there is none. */
+static unsigned int mov_compact_first_sample_after(const MOVStreamContext *sc, const MOVCompactIndex *ci,
+                                                   int64_t timestamp)
+{
+    unsigned int a = 0, b = ci->nb_samples;
+
+    while (a < b) {
+        unsigned int m = (a + b) >> 1;
+        if (mov_compact_dts(sc, ci, m) <= timestamp)
+            a = m + 1;
+        else
+            b = m;
+    }
+    return a;
+}
+
+static unsigned int mov_compact_sample_size(const MOVStreamContext *sc, unsigned int sample)
+{
+    return sc->stsz_sample_size > 0 ? sc->stsz_sample_size : sc->sample_sizes[sample];
+}
+
+/* Index of the first listed keyframe that is at or after sample. */
+static unsigned int mov_compact_keyframe_index(const MOVStreamContext *sc, const MOVCompactIndex *ci,
+                                               unsigned int sample)
+{
+    unsigned int a = 0, b = ci->nb_keyframes;
+    uint64_t target = (uint64_t)sample + ci->key_off;
+
+    while (a < b) {
+        unsigned int m = (a + b) >> 1;
+        if ((unsigned)sc->keyframes[m] < target)
+            a = m + 1;
+        else
+            b = m;
+    }
+    return a;
+}
+
+/* Last keyframe at or before sample, -1 if there is none. */
+static int mov_compact_prev_keyframe(const MOVStreamContext *sc, const MOVCompactIndex *ci, int sample)
+{
+    unsigned int k;
+
+    if (sample < 0)
+        return -1;
+    switch (ci->keyframe_mode) {
+    case MOV_KEYFRAMES_ALL:
+        return sample;
+    case MOV_KEYFRAMES_FIRST:
+        return 0;
+    case MOV_KEYFRAMES_LIST:
+        k = mov_compact_keyframe_index(sc, ci, sample + 1);
+        return k ? (unsigned)sc->keyframes[k - 1] - ci->key_off : -1;
+    }
+    return -1;
+}
+
+/* First keyframe at or after sample, nb_samples if there is none. */
+static int mov_compact_next_keyframe(const MOVStreamContext *sc, const MOVCompactIndex *ci, int sample)
+{
+    unsigned int k;
+
+    if (sample >= ci->nb_samples)
+        return ci->nb_samples;
+    switch (ci->keyframe_mode) {
+    case MOV_KEYFRAMES_ALL:
+        return sample;
+    case MOV_KEYFRAMES_FIRST:
+        return sample ? ci->nb_samples : 0;
+    case MOV_KEYFRAMES_LIST:
+        k = mov_compact_keyframe_index(sc, ci, sample);
+        if (k < ci->nb_keyframes &&
+            (unsigned)sc->keyframes[k] - ci->key_off < ci->nb_samples)
+            return (unsigned)sc->keyframes[k] - ci->key_off;
+    }
+    return ci->nb_samples;
+}
+
+static void mov_compact_cursor_seek(const MOVStreamContext *sc, MOVCompactIndex *ci,
+                                    unsigned int sample)
+{
+    MOVSampleCursor *c = &ci->cursor;
+    const MOVChunkRun *run;
+    unsigned int i, offset;
+
+    c->sample   = sample;
+    c->time_run = mov_compact_time_run(ci, sample);
+    c->dts      = ci->time_runs[c->time_run].first_dts +
+                  (int64_t)(sample - ci->time_runs[c->time_run].first_sample) *
+                  sc->stts_data[c->time_run].duration;
+
+    c->chunk_run    = mov_compact_chunk_run(ci, sample);
+    run             = &ci->chunk_runs[c->chunk_run];
+    offset          = sample - run->first_sample;
+    c->chunk        = run->first_chunk + offset / run->samples_per_chunk;
+    c->chunk_sample = offset % run->samples_per_chunk;
+    c->pos          = sc->chunk_offsets[c->chunk];
+    if (sc->stsz_sample_size > 0)
+        c->pos += (int64_t)c->chunk_sample * sc->stsz_sample_size;
+    else
+        for (i = sample - c->chunk_sample; i < sample; i++)
+            c->pos += (unsigned)sc->sample_sizes[i];
+
+    if (ci->keyframe_mode == MOV_KEYFRAMES_LIST)
+        c->keyframe = mov_compact_keyframe_index(sc, ci, sample);
+}
+
+static void mov_compact_cursor_next(const MOVStreamContext *sc, MOVCompactIndex *ci)
+{
+    MOVSampleCursor *c = &ci->cursor;
+
+    c->dts += sc->stts_data[c->time_run].duration;
+    c->pos += mov_compact_sample_size(sc, c->sample);
+    c->sample++;
+    if (c->time_run + 1 < ci->nb_time_runs &&
+        c->sample == ci->time_runs[c->time_run + 1].first_sample)
+        c->time_run++;
+
+    if (++c->chunk_sample == ci->chunk_runs[c->chunk_run].samples_per_chunk) {
+        const MOVChunkRun *run = &ci->chunk_runs[c->chunk_run];
+        c->chunk_sample = 0;
+        if (++c->chunk == run->first_chunk + run->nb_chunks &&
+            ++c->chunk_run < ci->nb_chunk_runs)
+            c->chunk = ci->chunk_runs[c->chunk_run].first_chunk;
+        if (c->chunk_run < ci->nb_chunk_runs)
+            c->pos = sc->chunk_offsets[c->chunk];
+    }
+
+    if (ci->keyframe_mode == MOV_KEYFRAMES_LIST && c->keyframe < ci->nb_keyframes &&
+        (unsigned)sc->keyframes[c->keyframe] < c->sample + ci->key_off)
+        c->keyframe++;
+}
+
+/**
+ * Decode one entry of a compact index. The returned entry stays valid until
+ * the next call for the same stream.
+ */
+static AVIndexEntry *mov_compact_index_entry(MOVStreamContext *sc, unsigned int sample)
+{
+    MOVCompactIndex *ci = sc->compact_index;
+    MOVSampleCursor *c = &ci->cursor;
+    AVIndexEntry *e = &ci->entry;
+    int keyframe = 0;
+
+    if (sample == c->sample + 1)
+        mov_compact_cursor_next(sc, ci);
+    else if (sample != c->sample)
+        mov_compact_cursor_seek(sc, ci, sample);
+
+    switch (ci->keyframe_mode) {
+    case MOV_KEYFRAMES_LIST:
+        keyframe = c->keyframe < ci->nb_keyframes &&
+                   (unsigned)sc->keyframes[c->keyframe] == sample + ci->key_off;
+        break;
+    case MOV_KEYFRAMES_ALL:
+        keyframe = 1;
+        break;
+    case MOV_KEYFRAMES_FIRST:
+        keyframe = !sample;
+        break;
+    }
+
+    e->pos       = c->pos;
+    e->timestamp = ci->dts_offset + c->dts;
+    e->size      = mov_compact_sample_size(sc, sample);
+    e->flags     = keyframe ? AVINDEX_KEYFRAME : 0;
+    if (sample < ci->nb_discard)
+        e->flags |= AVINDEX_DISCARD_FRAME;
+    if (keyframe || ci->keyframe_mode == MOV_KEYFRAMES_ALL)
+        e->min_distance = 0;
+    else if (ci->keyframe_mode == MOV_KEYFRAMES_LIST && c->keyframe)
+        e->min_distance = sample - ((unsigned)sc->keyframes[c->keyframe - 1] - ci->key_off);
+    else
+        e->min_distance = sample;
+    return e;
+}
+
+static int mov_index_nb_entries(AVStream *st)
+{
+    MOVStreamContext *sc = st->priv_data;
+
+    return sc->compact_index ? sc->compact_index->nb_samples : st->nb_index_entries;
+}
+
+static AVIndexEntry *mov_index_entry(AVStream *st, int sample)
+{
+    MOVStreamContext *sc = st->priv_data;
+
+    if (sc->compact_index)
+        return mov_compact_index_entry(sc, sample);
+    return &st->index_entries[sample];
+}
+
+static const AVIndexEntry *mov_get_index_entry(AVStream *st, int sample)
+{
+    return sample < mov_index_nb_entries(st) ? mov_index_entry(st, sample) : NULL;
+}
+
+static int64_t mov_index_timestamp(AVStream *st, int sample)
+{
+    MOVStreamContext *sc = st->priv_data;
+
+    if (sc->compact_index)
+        return mov_compact_dts(sc, sc->compact_index, sample);
+    return st->index_entries[sample].timestamp;
+}
+
+/**
+ * Same as av_index_search_timestamp(), also for streams with a compact index.
+ */
+static int mov_index_search_timestamp(AVStream *st, int64_t wanted_timestamp, int flags)
+{
+    MOVStreamContext *sc = st->priv_data;
+    MOVCompactIndex *ci = sc->compact_index;
+    int a, b, m;
+
+    if (!ci)
+        return av_index_search_timestamp(st, wanted_timestamp, flags);
+
+    a = -1;
+    b = ci->nb_samples;
+    if (b && mov_compact_dts(sc, ci, b - 1) < wanted_timestamp)
+        a = b - 1;
+
+    while (b - a > 1) {
+        int64_t timestamp;
+        m = (a + b) >> 1;
+
+        // Search for the next non-discarded packet.
+        while (m < ci->nb_discard && m < b && m < ci->nb_samples - 1) {
+            m++;
+            if (m == b && mov_compact_dts(sc, ci, m) >= wanted_timestamp) {
+                m = b - 1;
+                break;
+            }
+        }
+
+        timestamp = mov_compact_dts(sc, ci, m);
+        if (timestamp >= wanted_timestamp)
+            b = m;
+        if (timestamp <= wanted_timestamp)
+            a = m;
+    }
+    m = (flags & AVSEEK_FLAG_BACKWARD) ? a : b;
+
+    if (!(flags & AVSEEK_FLAG_ANY))
+        m = (flags & AVSEEK_FLAG_BACKWARD) ? mov_compact_prev_keyframe(sc, ci, m) :
+                                             mov_compact_next_keyframe(sc, ci, m);
+
+    if (m == ci->nb_samples)
+        return -1;
+    return m;
+}
+
+/**
+ * Group the chunks into runs of equal sample count, following the stsc
+ * lookup of mov_build_index(). Only counts the runs if runs is NULL.
+ */
+static int mov_compact_chunk_runs(const MOVStreamContext *sc, MOVChunkRun *runs,
+                                  unsigned int *nb_runs, uint64_t *nb_samples)
+{
+    unsigned int i, stsc_index = 0, n = 0, last_chunk = 0;
+    int last_count = 0;
+    uint64_t total = 0;
+
+    for (i = 0; i < sc->chunk_count; i++) {
+        int count;
+
+        while (mov_stsc_index_valid(stsc_index, sc->stsc_count) &&
+               i + 1 == sc->stsc_data[stsc_index + 1].first)
+            stsc_index++;
+        count = sc->stsc_data[stsc_index].count;
+        if (count < 0)
+            return AVERROR_INVALIDDATA;
+        /* samples of other sample descriptions are skipped by mov_build_index() */
+        if (sc->pseudo_stream_id != -1 &&
+            sc->stsc_data[stsc_index].id - 1 != sc->pseudo_stream_id)
+            return AVERROR_PATCHWELCOME;
+        if (!count)
+            continue;
+        if (!n || i != last_chunk + 1 || count != last_count) {
+            if (runs) {
+                runs[n].first_sample      = total;
+                runs[n].first_chunk       = i;
+                runs[n].nb_chunks         = 0;
+                runs[n].samples_per_chunk = count;
+            }
+            n++;
+        }
+        if (runs)
+            runs[n - 1].nb_chunks++;
+        last_chunk = i;
+        last_count = count;
+        total     += count;
+    }
+    *nb_runs    = n;
+    *nb_samples = total;
+    return 0;
+}
+
+/**
+ * Check that mov_fix_index() would keep every sample of the single edit and
+ * only shift the timestamps, which the compact index can express.
+ */
+static int mov_compact_edit_is_shift(MOVStreamContext *sc, AVStream *st,
+                                     int64_t media_time, int64_t duration)
+{
+    MOVCompactIndex *ci = sc->compact_index;
+    int64_t end = media_time + duration;
+    unsigned int i, ctts_index = 0, ctts_sample = 0;
+    int later_keyframe = 0;
+
+    if (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+        /* the decoder delay lookup lands on the first sample, the samples
+         * before the edit are only trimmed and the edit covers the last one */
+        int64_t last_dts = mov_compact_dts(sc, ci, ci->nb_samples - 1);
+        return !sc->ctts_data && ci->keyframe_mode == MOV_KEYFRAMES_ALL &&
+               (!media_time || st->codecpar->codec_id != AV_CODEC_ID_VORBIS) &&
+               (ci->nb_samples == 1 ||
+                mov_compact_dts(sc, ci, 1) > FFMAX(media_time - sc->time_scale, 0)) &&
+               last_dts >= media_time && last_dts < end;
+    }
+
+    for (i = 0; i < ci->nb_samples; i++) {
+        const AVIndexEntry *e = mov_compact_index_entry(sc, i);
+        int64_t cts = e->timestamp + sc->dts_shift;
+        int keyframe = e->flags & AVINDEX_KEYFRAME;
+
+        if (sc->ctts_data && ctts_index < sc->ctts_count) {
+            cts += sc->ctts_data[ctts_index].duration;
+            if (++ctts_sample == sc->ctts_data[ctts_index].count) {
+                ctts_index++;
+                ctts_sample = 0;
+            }
+        }
+        /* every sample is presented within the edit, starting with the first */
+        if (cts < media_time || cts >= end)
+            return 0;
+        if (!i && (cts != media_time || !keyframe))
+            return 0;
+        /* the edit start lookup lands on the first sample */
+        if (i && keyframe && !later_keyframe) {
+            if (e->timestamp <= media_time - sc->dts_shift)
+                return 0;
+            later_keyframe = 1;
+        }
+        /* no keyframe ends the edit early */
+        if (keyframe && i + 1 < ci->nb_samples &&
+            cts + sc->stts_data[ci->cursor.time_run].duration >= end)
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * Set up a compact index for st instead of expanding the sample tables into
+ * st->index_entries. Only done for the layouts that mov_build_index() and
+ * mov_fix_index() turn into one plain entry per sample, so the packets are
+ * the same either way.
+ *
+ * @return 0 on success, a negative value if the full index has to be built
+ */
+static int mov_build_compact_index(MOVContext *mov, AVStream *st, int64_t first_dts)
+{
+    MOVStreamContext *sc = st->priv_data;
+    MOVCompactIndex *ci;
+    int64_t media_time = 0, edit_duration = 0, dts = 0;
+    uint64_t nb_samples, first_sample = 0, stream_size = 0;
+    unsigned int i, nb_chunk_runs;
+    int has_edit = 0, ret;
+
+    if (!mov->compact_index || st->nb_index_entries ||
+        !sc->sample_count || !sc->chunk_count || !sc->stsc_count || !sc->stts_count ||
+        sc->stps_count || (sc->rap_group_count && sc->rap_group))
+        return AVERROR(ENOSYS);
+    if (st->codecpar->codec_type != AVMEDIA_TYPE_VIDEO &&
+        (st->codecpar->codec_type != AVMEDIA_TYPE_AUDIO ||
+         (sc->stts_count == 1 && sc->stts_data[0].duration == 1)))
+        return AVERROR(ENOSYS);
+    if (sc->stsz_sample_size > 0 ? sc->sample_size > 0 && sc->sample_size != sc->stsz_sample_size
+                                 : !sc->sample_sizes)
+        return AVERROR(ENOSYS);
+
+    if (!mov->ignore_editlist && mov->advanced_editlist && sc->elst_data && sc->elst_count) {
+        if (sc->elst_count != 1 || mov->time_scale <= 0)
+            return AVERROR(ENOSYS);
+        get_edit_list_entry(mov, sc, 0, &media_time, &edit_duration, mov->time_scale);
+        if (media_time < 0)
+            return AVERROR(ENOSYS);
+        has_edit = 1;
+    }
+
+    if ((ret = mov_compact_chunk_runs(sc, NULL, &nb_chunk_runs, &nb_samples)) < 0)
+        return ret;
+    if (!nb_samples || nb_samples > sc->sample_count || nb_samples > INT_MAX)
+        return AVERROR(ENOSYS);
+
+    if (sc->stsz_sample_size > 0) {
+        if (sc->stsz_sample_size > 0x3FFFFFFF)
+            return AVERROR(ENOSYS);
+        stream_size = nb_samples * sc->stsz_sample_size;
+    } else {
+        for (i = 0; i < nb_samples; i++) {
+            if ((unsigned)sc->sample_sizes[i] > 0x3FFFFFFF)
+                return AVERROR(ENOSYS);
+            stream_size += (unsigned)sc->sample_sizes[i];
+        }
+    }
+
+    ci = av_mallocz(sizeof(*ci));
+    if (!ci)
+        return AVERROR(ENOMEM);
+    sc->compact_index = ci;
+    ci->nb_samples = nb_samples;
+    ci->dts_offset = first_dts;
+
+    ci->chunk_runs = av_malloc_array(nb_chunk_runs, sizeof(*ci->chunk_runs));
+    ci->time_runs  = av_malloc_array(sc->stts_count, sizeof(*ci->time_runs));
+    if (!ci->chunk_runs || !ci->time_runs) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+    mov_compact_chunk_runs(sc, ci->chunk_runs, &ci->nb_chunk_runs, &nb_samples);
+
+    /* an stts entry that is last or empty is never left, see mov_build_index() */
+    for (i = 0; i < sc->stts_count && first_sample < nb_samples; i++) {
+        if (sc->stts_data[i].duration < 0) {
+            ret = AVERROR(ENOSYS);
+            goto fail;
+        }
+        ci->time_runs[ci->nb_time_runs].first_sample = first_sample;
+        ci->time_runs[ci->nb_time_runs].first_dts    = dts;
+        ci->nb_time_runs++;
+        if (!sc->stts_data[i].count)
+            break;
+        first_sample += sc->stts_data[i].count;
+        dts          += (int64_t)sc->stts_data[i].count * sc->stts_data[i].duration;
+    }
+
+    if (sc->keyframe_absent) {
+        ci->keyframe_mode = st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO ?
+                            MOV_KEYFRAMES_ALL : MOV_KEYFRAMES_FIRST;
+    } else if (!sc->keyframe_count) {
+        ci->keyframe_mode = MOV_KEYFRAMES_ALL;
+    } else {
+        /* the stss walk of mov_build_index() stops at the first entry that
+         * does not increase */
+        ci->keyframe_mode = MOV_KEYFRAMES_LIST;
+        ci->key_off       = sc->keyframes[0] > 0;
+        for (ci->nb_keyframes = 1; ci->nb_keyframes < sc->keyframe_count; ci->nb_keyframes++)
+            if ((unsigned)sc->keyframes[ci->nb_keyframes] <= (unsigned)sc->keyframes[ci->nb_keyframes - 1])
+                break;
+    }
+
+    mov_compact_cursor_seek(sc, ci, 0);
+
+    if (has_edit && !mov_compact_edit_is_shift(sc, st, media_time, edit_duration)) {
+        ret = AVERROR(ENOSYS);
+        goto fail;
+    }
+
+    if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+        for (i = 0; i < FFMIN(ci->nb_samples, 99); i++)
+            ff_rfps_add_frame(mov->fc, st, mov_compact_dts(sc, ci, i));
+
+    if (st->duration > 0)
+        st->codecpar->bit_rate = stream_size * 8 * sc->time_scale / st->duration;
+
+    if (has_edit) {
+        /* what mov_fix_index() sets up for an edit that keeps all samples */
+        if (st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+            /* the samples that end before the edit are discarded, the one
+             * that straddles it is trimmed */
+            unsigned int first = mov_compact_first_sample_after(sc, ci, media_time - 1);
+            unsigned int after = mov_compact_first_sample_after(sc, ci, media_time);
+            ci->nb_discard        = after ? after - 1 : 0;
+            ci->dts_offset       -= media_time;
+            st->skip_samples      = media_time;
+            sc->min_corrected_pts = mov_compact_dts(sc, ci, first);
+        } else {
+            if (media_time > 0) {
+                av_log(mov->fc, AV_LOG_DEBUG, "Offset DTS by %"PRId64" to make first pts zero.\n", media_time);
+                ci->dts_offset -= media_time;
+            }
+            sc->min_corrected_pts = media_time;
+        }
+        st->start_time        = 0;
+        st->duration          = FFMIN(st->duration, edit_duration);
+        sc->start_pad         = st->skip_samples;
+    }
+
+    av_log(mov->fc, AV_LOG_DEBUG, "stream %d: compact index of %u samples, %u time runs, %u chunk runs\n",
+           st->index, ci->nb_samples, ci->nb_time_runs, ci->nb_chunk_runs);
+    return 0;
+fail:
+    mov_free_compact_index(sc);
+    return ret;
+}
+
+/* Expand ctts entries such that we have a 1-1 mapping with samples */
+static int mov_expand_ctts(MOVStreamContext *sc)
+{
+    MOVStts *ctts_data_old = sc->ctts_data;
+    unsigned int ctts_count_old = sc->ctts_count;
+    unsigned int i, j;
+
+    if (sc->sample_count >= UINT_MAX / sizeof(*sc->ctts_data))
+        return AVERROR_INVALIDDATA;
+    sc->ctts_count = 0;
+    sc->ctts_allocated_size = 0;
+    sc->ctts_data = av_fast_realloc(NULL, &sc->ctts_allocated_size,
+                            sc->sample_count * sizeof(*sc->ctts_data));
+    if (!sc->ctts_data) {
+        av_free(ctts_data_old);
+        return AVERROR(ENOMEM);
+    }
+
+    memset((uint8_t*)(sc->ctts_data), 0, sc->ctts_allocated_size);
+
+    for (i = 0; i < ctts_count_old &&
+                sc->ctts_count < sc->sample_count; i++)
+        for (j = 0; j < ctts_data_old[i].count &&
+                    sc->ctts_count < sc->sample_count; j++)
+            add_ctts_entry(&sc->ctts_data, &sc->ctts_count,
+                           &sc->ctts_allocated_size, 1,
+                           ctts_data_old[i].duration);
+    av_free(ctts_data_old);
+    return 0;
+}
+
+/**
+ * Turn a compact index back into st->index_entries, for the code that edits
+ * the index in place.
+ */
+static int mov_expand_compact_index(AVStream *st)
+{
+    MOVStreamContext *sc = st->priv_data;
+    MOVCompactIndex *ci = sc->compact_index;
+    unsigned int i;
+    int ret;
+
+    if (!ci)
+        return 0;
+
+    if ((ret = av_reallocp_array(&st->index_entries, ci->nb_samples,
+                                 sizeof(*st->index_entries))) < 0) {
+        st->nb_index_entries = 0;
+        return ret;
+    }
+    st->index_entries_allocated_size = ci->nb_samples * sizeof(*st->index_entries);
+    for (i = 0; i < ci->nb_samples; i++)
+        st->index_entries[i] = *mov_compact_index_entry(sc, i);
+    st->nb_index_entries = ci->nb_samples;
+    mov_free_compact_index(sc);
+
+    if (sc->ctts_data) {
+        if ((ret = mov_expand_ctts(sc)) < 0)
+            return ret;
+        sc->ctts_index  = FFMIN(sc->current_sample, sc->ctts_count);
+        sc->ctts_sample = 0;
+    }
+    return 0;
+}
+
 #define MAX_REORDER_DELAY 16
 static void mov_estimate_video_delay(MOVContext *c, AVStream* st) {
     MOVStreamContext *msc = st->priv_data;
@@ -3378,14 +4220,14 @@ static void mov_estimate_video_delay(MOVContext *c, AVStream* st) {
     if (st->codecpar->video_delay <= 0 && msc->ctts_data &&
         st->codecpar->codec_id == AV_CODEC_ID_H264) {
         st->codecpar->video_delay = 0;
-        for(ind = 0; ind < st->nb_index_entries && ctts_ind < msc->ctts_count; ++ind) {
+        for(ind = 0; ind < mov_index_nb_entries(st) && ctts_ind < msc->ctts_count; ++ind) {
             // Point j to the last elem of the buffer and insert the current pts there.
             j = buf_start;
             buf_start = (buf_start + 1);
             if (buf_start == MAX_REORDER_DELAY + 1)
                 buf_start = 0;
 
-            pts_buf[j] = st->index_entries[ind].timestamp + msc->ctts_data[ctts_ind].duration;
+            pts_buf[j] = mov_index_timestamp(st, ind) + msc->ctts_data[ctts_ind].duration;
 
             // The timestamps that are already in the sorted buffer, and are greater than the
             // current pts, are exactly the timestamps that need to be buffered to output PTS
@@ -3785,8 +4627,6 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
     unsigned int stps_index = 0;
     unsigned int i, j;
     uint64_t stream_size = 0;
-    MOVStts *ctts_data_old = sc->ctts_data;
-    unsigned int ctts_count_old = sc->ctts_count;
 
     if (sc->elst_count) {
         int i, edit_start_index = 0, multiple_edits = 0;
@@ -3828,8 +4668,10 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
     }
 
     /* only use old uncompressed audio chunk demuxing when stts specifies it */
-    if (!(st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO &&
-          sc->stts_count == 1 && sc->stts_data[0].duration == 1)) {
+    if (mov_build_compact_index(mov, st, current_dts - sc->dts_shift) >= 0) {
+        /* the samples are decoded from the sample tables when demuxed */
+    } else if (!(st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO &&
+                 sc->stts_count == 1 && sc->stts_data[0].duration == 1)) {
         unsigned int current_sample = 0;
         unsigned int stts_sample = 0;
         unsigned int sample_size;
@@ -3856,30 +4698,8 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
         }
         st->index_entries_allocated_size = (st->nb_index_entries + sc->sample_count) * sizeof(*st->index_entries);
 
-        if (ctts_data_old) {
-            // Expand ctts entries such that we have a 1-1 mapping with samples
-            if (sc->sample_count >= UINT_MAX / sizeof(*sc->ctts_data))
-                return;
-            sc->ctts_count = 0;
-            sc->ctts_allocated_size = 0;
-            sc->ctts_data = av_fast_realloc(NULL, &sc->ctts_allocated_size,
-                                    sc->sample_count * sizeof(*sc->ctts_data));
-            if (!sc->ctts_data) {
-                av_free(ctts_data_old);
-                return;
-            }
-
-            memset((uint8_t*)(sc->ctts_data), 0, sc->ctts_allocated_size);
-
-            for (i = 0; i < ctts_count_old &&
-                        sc->ctts_count < sc->sample_count; i++)
-                for (j = 0; j < ctts_data_old[i].count &&
-                            sc->ctts_count < sc->sample_count; j++)
-                    add_ctts_entry(&sc->ctts_data, &sc->ctts_count,
-                                   &sc->ctts_allocated_size, 1,
-                                   ctts_data_old[i].duration);
-            av_free(ctts_data_old);
-        }
+        if (sc->ctts_data && mov_expand_ctts(sc) < 0)
+            return;
 
         for (i = 0; i < sc->chunk_count; i++) {
             int64_t next_offset = i+1 < sc->chunk_count ? sc->chunk_offsets[i+1] : INT64_MAX;
@@ -4086,14 +4906,14 @@ static void mov_build_index(MOVContext *mov, AVStream *st)
         }
     }
 
-    if (!mov->ignore_editlist && mov->advanced_editlist) {
+    if (!sc->compact_index && !mov->ignore_editlist && mov->advanced_editlist) {
         // Fix index according to edit lists.
         mov_fix_index(mov, st);
     }
 
     // Update start time of the stream.
-    if (st->start_time == AV_NOPTS_VALUE && st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && st->nb_index_entries > 0) {
-        st->start_time = st->index_entries[0].timestamp + sc->dts_shift;
+    if (st->start_time == AV_NOPTS_VALUE && st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO && mov_index_nb_entries(st) > 0) {
+        st->start_time = mov_index_timestamp(st, 0) + sc->dts_shift;
         if (sc->ctts_data) {
             st->start_time += sc->ctts_data[0].duration;
         }
@@ -4330,11 +5150,13 @@ static int mov_read_trak(MOVContext *c, AVIOContext *pb, MOVAtom atom)
         && sc->time_scale == st->codecpar->sample_rate) {
             st->need_parsing = AVSTREAM_PARSE_FULL;
     }
-    /* Do not need those anymore. */
-    av_freep(&sc->chunk_offsets);
-    av_freep(&sc->sample_sizes);
-    av_freep(&sc->keyframes);
-    av_freep(&sc->stts_data);
+    /* Do not need those anymore, unless the index is decoded from them. */
+    if (!sc->compact_index) {
+        av_freep(&sc->chunk_offsets);
+        av_freep(&sc->sample_sizes);
+        av_freep(&sc->keyframes);
+        av_freep(&sc->stts_data);
+    }
     av_freep(&sc->stps_data);
     av_freep(&sc->elst_data);
     av_freep(&sc->rap_group);
@@ -4758,7 +5580,7 @@ static int mov_read_trun(MOVContext *c, AVIOContext *pb, MOVAtom atom)
     int64_t dts, pts = AV_NOPTS_VALUE;
     int data_offset = 0;
     unsigned entries, first_sample_flags = frag->flags;
-    int flags, distance, i;
+    int flags, distance, i, ret;
     int64_t prev_dts = AV_NOPTS_VALUE;
     int next_frag_index = -1, index_entry_pos;
     size_t requested_size;
@@ -4785,6 +5607,10 @@ static int mov_read_trun(MOVContext *c, AVIOContext *pb, MOVAtom atom)
     if (sc->pseudo_stream_id+1 != frag->stsd_id && sc->pseudo_stream_id != -1)
         return 0;
 
+    // Fragment samples are inserted into index_entries directly.
+    if ((ret = mov_expand_compact_index(st)) < 0)
+        return ret;
+
     // Find the next frag_index index that has a valid index_entry for
     // the current track_id.
     //
@@ -7046,7 +7872,7 @@ static int mov_read_default(MOVContext *c, AVIOContext *pb, MOVAtom atom)
             }
             if (c->found_moov && c->found_mdat &&
                 ((!(pb->seekable & AVIO_SEEKABLE_NORMAL) || c->fc->flags & AVFMT_FLAG_IGNIDX || c->frag_index.complete) ||
-                 start_pos + a.size == avio_size(pb))) {
+                 start_pos + a.size == avio_size(pb) || c->moov_prefetched)) {
                 if (!(pb->seekable & AVIO_SEEKABLE_NORMAL) || c->fc->flags & AVFMT_FLAG_IGNIDX || c->frag_index.complete)
                     c->next_root_atom = start_pos + a.size;
                 c->atom_depth --;
@@ -7184,10 +8010,10 @@ static void mov_read_chapters(AVFormatContext *s)
 
         if (st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
             st->disposition |= AV_DISPOSITION_ATTACHED_PIC | AV_DISPOSITION_TIMED_THUMBNAILS;
-            if (st->nb_index_entries) {
+            if (mov_index_nb_entries(st)) {
                 // Retrieve the first frame, if possible
                 AVPacket pkt;
-                AVIndexEntry *sample = &st->index_entries[0];
+                AVIndexEntry *sample = mov_index_entry(st, 0);
                 if (avio_seek(sc->pb, sample->pos, SEEK_SET) != sample->pos) {
                     av_log(s, AV_LOG_ERROR, "Failed to retrieve first frame\n");
                     goto finish;
@@ -7373,6 +8199,7 @@ static int mov_read_close(AVFormatContext *s)
         av_freep(&sc->rap_group);
         av_freep(&sc->display_matrix);
         av_freep(&sc->index_ranges);
+        mov_free_compact_index(sc);
 
         if (sc->extradata)
             for (j = 0; j < sc->stsd_count; j++)
@@ -7403,6 +8230,7 @@ static int mov_read_close(AVFormatContext *s)
 
     av_freep(&mov->trex_data);
     av_freep(&mov->bitrates);
+    av_freep(&mov->mdat_head);
 
     for (i = 0; i < mov->frag_index.nb_items; i++) {
         MOVFragmentStreamInfo *frag = mov->frag_index.item[i].stream_info;
@@ -7752,7 +8580,7 @@ static int mov_read_header(AVFormatContext *s)
             break;
         }
     }
-    ff_configure_buffers_for_index(s, AV_TIME_BASE);
+    ff_configure_buffers_for_index_cb(s, AV_TIME_BASE, mov_get_index_entry);
 
     for (i = 0; i < mov->frag_index.nb_items; i++)
         if (mov->frag_index.item[i].moof_offset <= mov->fragment.moof_offset)
@@ -7772,8 +8600,8 @@ static AVIndexEntry *mov_find_next_sample(AVFormatContext *s, AVStream **st)
     for (i = 0; i < s->nb_streams; i++) {
         AVStream *avst = s->streams[i];
         MOVStreamContext *msc = avst->priv_data;
-        if (msc->pb && msc->current_sample < avst->nb_index_entries) {
-            AVIndexEntry *current_sample = &avst->index_entries[msc->current_sample];
+        if (msc->pb && msc->current_sample < mov_index_nb_entries(avst)) {
+            AVIndexEntry *current_sample = mov_index_entry(avst, msc->current_sample);
             int64_t dts = av_rescale(current_sample->timestamp, AV_TIME_BASE, msc->time_scale);
             av_log(s, AV_LOG_TRACE, "stream %d, sample %d, dts %"PRId64"\n", i, msc->current_sample, dts);
             if (!sample || (!(s->pb->seekable & AVIO_SEEKABLE_NORMAL) && current_sample->pos < sample->pos) ||
@@ -7885,8 +8713,12 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
     }
 
     if (st->discard != AVDISCARD_ALL) {
-        int64_t ret64 = avio_seek(sc->pb, sample->pos, SEEK_SET);
-        if (ret64 != sample->pos) {
+        /* the part of the sample in the prefetched mdat head is copied, the
+         * rest is read from where the head ends */
+        int head = sc->pb == s->pb ? mov_mdat_head_bytes(mov, sample->pos, sample->size) : 0;
+        int64_t pos = sample->pos + head;
+        int64_t ret64 = head == sample->size ? pos : avio_seek(sc->pb, pos, SEEK_SET);
+        if (ret64 != pos) {
             av_log(mov->fc, AV_LOG_ERROR, "stream %d, offset 0x%"PRIx64": partial file\n",
                    sc->ffindex, sample->pos);
             if (should_retry(sc->pb, ret64)) {
@@ -7900,7 +8732,10 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
             goto retry;
         }
 
-        ret = av_get_packet(sc->pb, pkt, sample->size);
+        if (head)
+            ret = mov_get_mdat_head_packet(mov, sc->pb, pkt, sample->pos, sample->size, head);
+        else
+            ret = av_get_packet(sc->pb, pkt, sample->size);
         if (ret < 0) {
             if (should_retry(sc->pb, ret)) {
                 mov_current_sample_dec(sc);
@@ -7952,8 +8787,8 @@ static int mov_read_packet(AVFormatContext *s, AVPacket *pkt)
             sc->ctts_sample = 0;
         }
     } else {
-        int64_t next_dts = (sc->current_sample < st->nb_index_entries) ?
-            st->index_entries[sc->current_sample].timestamp : st->duration;
+        int64_t next_dts = (sc->current_sample < mov_index_nb_entries(st)) ?
+            mov_index_timestamp(st, sc->current_sample) : st->duration;
 
         if (next_dts >= pkt->dts)
             pkt->duration = next_dts - pkt->dts;
@@ -8032,9 +8867,9 @@ static int mov_seek_stream(AVFormatContext *s, AVStream *st, int64_t timestamp,
     if (ret < 0)
         return ret;
 
-    sample = av_index_search_timestamp(st, timestamp, flags);
+    sample = mov_index_search_timestamp(st, timestamp, flags);
     av_log(s, AV_LOG_TRACE, "stream %d, timestamp %"PRId64", sample %d\n", st->index, timestamp, sample);
-    if (sample < 0 && st->nb_index_entries && timestamp < st->index_entries[0].timestamp)
+    if (sample < 0 && mov_index_nb_entries(st) && timestamp < mov_index_timestamp(st, 0))
         sample = 0;
     if (sample < 0) /* not sure what to do */
         return AVERROR_INVALIDDATA;
@@ -8089,7 +8924,7 @@ static int mov_read_seek(AVFormatContext *s, int stream_index, int64_t sample_ti
 
     if (mc->seek_individually) {
         /* adjust seek timestamp to found sample timestamp */
-        int64_t seek_timestamp = st->index_entries[sample].timestamp;
+        int64_t seek_timestamp = mov_index_timestamp(st, sample);
 
         for (i = 0; i < s->nb_streams; i++) {
             int64_t timestamp;
@@ -8141,8 +8976,20 @@ static const AVOption mov_options[] = {
         "Modify the AVIndex according to the editlists. Use this option to decode in the order specified by the edits.",
         OFFSET(advanced_editlist), AV_OPT_TYPE_BOOL, {.i64 = 1},
         0, 1, FLAGS},
+    {"compact_index",
+        "Decode the sample index from the sample tables on demand instead of expanding it, to save memory on long files.",
+        OFFSET(compact_index), AV_OPT_TYPE_BOOL, {.i64 = 0},
+        0, 1, FLAGS},
     {"ignore_chapters", "", OFFSET(ignore_chapters), AV_OPT_TYPE_BOOL, {.i64 = 0},
         0, 1, FLAGS},
+    {"moov_prefetch",
+        "Fetch a moov placed after the mdat of an http input in one request, concurrently with the start of the mdat.",
+        OFFSET(moov_prefetch), AV_OPT_TYPE_BOOL, {.i64 = 1},
+        0, 1, FLAGS},
+    {"moov_prefetch_mdat_size",
+        "Bytes at the start of the mdat read and kept while the moov is prefetched.",
+        OFFSET(moov_prefetch_mdat_size), AV_OPT_TYPE_INT, {.i64 = 256 << 10},
+        0, INT_MAX, FLAGS},
     {"use_mfra_for",
         "use mfra for fragment timestamps",
         OFFSET(use_mfra_for), AV_OPT_TYPE_INT, {.i64 = FF_MOV_FLAG_MFRA_AUTO},
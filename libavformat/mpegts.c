@@ -48,6 +48,9 @@
 
 #define MAX_PES_PAYLOAD 200 * 1024
 
+/* largest PES packet of unknown length gathered whole with pes_gather */
+#define MAX_PES_GATHER_SIZE (16 << 20)
+
 #define MAX_MP4_DESCR_COUNT 16
 
 #define MOD_UNLIKELY(modulus, dividend, divisor, prev_dividend)                \
@@ -153,6 +156,7 @@ struct MpegTSContext {
 
     int resync_size;
     int merge_pmt_versions;
+    int pes_gather;
 
     /******************************************/
     /* private mpegts data */
@@ -189,6 +193,8 @@ static const AVOption options[] = {
      {.i64 = 0}, 0, 1, 0 },
     {"skip_clear", "skip clearing programs", offsetof(MpegTSContext, skip_clear), AV_OPT_TYPE_BOOL,
      {.i64 = 0}, 0, 1, 0 },
+    {"pes_gather", "gather PES packets of unknown length whole in pooled chunks instead of splitting them", offsetof(MpegTSContext, pes_gather), AV_OPT_TYPE_BOOL,
+     {.i64 = 0}, 0, 1, AV_OPT_FLAG_DECODING_PARAM },
     { NULL },
 };
 
@@ -253,6 +259,11 @@ typedef struct PESContext {
     int64_t ts_packet_pos; /**< position of first TS packet of this PES packet */
     uint8_t header[MAX_PES_HEADER_SIZE];
     AVBufferRef *buffer;
+    /* with pes_gather, the filled buffers preceding the current one */
+    AVBufferRef **chunks;
+    int nb_chunks;
+    int chunks_size;    /**< payload bytes held in chunks */
+    int gather_hint;    /**< size of the last PES packet of unknown length */
     SLConfigDescr sl;
     int merged_st;
 } PESContext;
@@ -548,6 +559,16 @@ static MpegTSFilter *mpegts_open_pcr_filter(MpegTSContext *ts, unsigned int pid)
     return mpegts_open_filter(ts, pid, MPEGTS_PCR);
 }
 
+static void pes_free_chunks(PESContext *pes)
+{
+    int i;
+
+    for (i = 0; i < pes->nb_chunks; i++)
+        av_buffer_unref(&pes->chunks[i]);
+    pes->nb_chunks   = 0;
+    pes->chunks_size = 0;
+}
+
 static void mpegts_close_filter(MpegTSContext *ts, MpegTSFilter *filter)
 {
     int pid;
@@ -558,6 +579,8 @@ static void mpegts_close_filter(MpegTSContext *ts, MpegTSFilter *filter)
     else if (filter->type == MPEGTS_PES) {
         PESContext *pes = filter->u.pes_filter.opaque;
         av_buffer_unref(&pes->buffer);
+        pes_free_chunks(pes);
+        av_freep(&pes->chunks);
         /* referenced private data will be freed later in
          * avformat_close_input (pes->st->priv_data == pes) */
         if (!pes->st || pes->merged_st) {
@@ -580,16 +603,21 @@ static int analyze(const uint8_t *buf, int size, int packet_size,
     memset(stat, 0, packet_size * sizeof(*stat));
 
     for (i = 0; i < size - 3; i++) {
-        if (buf[i] == 0x47) {
-            int pid = AV_RB16(buf+1) & 0x1FFF;
-            int asc = buf[i + 3] & 0x30;
-            if (!probe || pid == 0x1FFF || asc) {
-                int x = i % packet_size;
-                stat[x]++;
-                stat_all++;
-                if (stat[x] > best_score) {
-                    best_score = stat[x];
-                }
+        /* memchr() is vectorized by the C library */
+        const uint8_t *sync = memchr(buf + i, 0x47, size - 3 - i);
+        int pid, asc;
+
+        if (!sync)
+            break;
+        i   = sync - buf;
+        pid = AV_RB16(buf+1) & 0x1FFF;
+        asc = buf[i + 3] & 0x30;
+        if (!probe || pid == 0x1FFF || asc) {
+            int x = i % packet_size;
+            stat[x]++;
+            stat_all++;
+            if (stat[x] > best_score) {
+                best_score = stat[x];
             }
         }
     }
@@ -974,6 +1002,7 @@ static void reset_pes_packet_state(PESContext *pes)
     pes->data_index = 0;
     pes->flags      = 0;
     av_buffer_unref(&pes->buffer);
+    pes_free_chunks(pes);
 }
 
 static void new_data_packet(const uint8_t *buffer, int len, AVPacket *pkt)
@@ -983,9 +1012,40 @@ static void new_data_packet(const uint8_t *buffer, int len, AVPacket *pkt)
     pkt->size = len;
 }
 
+static AVBufferRef *buffer_pool_get(MpegTSContext *ts, int size);
+
+/* Copy the gathered chunks and the current buffer into a single one. */
+static int pes_merge_chunks(PESContext *pes)
+{
+    AVBufferRef *buf = buffer_pool_get(pes->ts, pes->data_index);
+    uint8_t *dst;
+    int i;
+
+    if (!buf)
+        return AVERROR(ENOMEM);
+    dst = buf->data;
+    for (i = 0; i < pes->nb_chunks; i++) {
+        int size = pes->chunks[i]->size - AV_INPUT_BUFFER_PADDING_SIZE;
+        memcpy(dst, pes->chunks[i]->data, size);
+        dst += size;
+    }
+    memcpy(dst, pes->buffer->data, pes->data_index - pes->chunks_size);
+    pes_free_chunks(pes);
+    av_buffer_unref(&pes->buffer);
+    pes->buffer = buf;
+    return 0;
+}
+
 static int new_pes_packet(PESContext *pes, AVPacket *pkt)
 {
     uint8_t *sd;
+    int ret;
+
+    if (pes->ts->pes_gather && pes->total_size == MAX_PES_PAYLOAD) {
+        pes->gather_hint = pes->data_index;
+        if (pes->nb_chunks && (ret = pes_merge_chunks(pes)) < 0)
+            return ret;
+    }
 
     av_init_packet(pkt);
 
@@ -1104,6 +1164,11 @@ static int read_sl_header(PESContext *pes, SLConfigDescr *sl,
 static AVBufferRef *buffer_pool_get(MpegTSContext *ts, int size)
 {
     int index = av_log2(size + AV_INPUT_BUFFER_PADDING_SIZE);
+    /* Gathered buffers larger than MAX_PES_PAYLOAD are allocated to size and
+     * freed with their packet. Pooled by powers of two they could be twice
+     * as large as needed and would stay allocated until the demuxer closes. */
+    if (size > MAX_PES_PAYLOAD)
+        return av_buffer_alloc(size + AV_INPUT_BUFFER_PADDING_SIZE);
     if (!ts->pools[index]) {
         int pool_size = FFMIN(MAX_PES_PAYLOAD + AV_INPUT_BUFFER_PADDING_SIZE, 2 << index);
         ts->pools[index] = av_buffer_pool_init(pool_size, NULL);
@@ -1113,6 +1178,46 @@ static AVBufferRef *buffer_pool_get(MpegTSContext *ts, int size)
     return av_buffer_pool_get(ts->pools[index]);
 }
 
+/* Size of the buffer a PES packet starts in. With pes_gather, a packet of
+ * unknown length starts in one fitting the previous packet of the PID. */
+static int pes_buffer_size(PESContext *pes)
+{
+    if (!pes->ts->pes_gather || pes->total_size != MAX_PES_PAYLOAD || !pes->gather_hint)
+        return pes->total_size;
+    return av_clip(pes->gather_hint + (pes->gather_hint >> 3), 4096, MAX_PES_GATHER_SIZE);
+}
+
+/* Append payload of a PES packet of unknown length. A full buffer is moved
+ * to the chunk list and a new one as large as the payload so far is started,
+ * so that a packet is copied once more at most, when it is emitted. */
+static int pes_gather_data(PESContext *pes, const uint8_t *p, int size)
+{
+    while (size > 0) {
+        int used = pes->data_index - pes->chunks_size;
+        int room = pes->buffer->size - AV_INPUT_BUFFER_PADDING_SIZE - used;
+        int len, ret;
+
+        if (room <= 0) {
+            AVBufferRef *buf = buffer_pool_get(pes->ts, FFMIN(pes->data_index, MAX_PES_GATHER_SIZE));
+            if (!buf)
+                return AVERROR(ENOMEM);
+            if ((ret = av_dynarray_add_nofree(&pes->chunks, &pes->nb_chunks, pes->buffer)) < 0) {
+                av_buffer_unref(&buf);
+                return ret;
+            }
+            pes->chunks_size = pes->data_index;
+            pes->buffer      = buf;
+            continue;
+        }
+        len = FFMIN(room, size);
+        memcpy(pes->buffer->data + used, p, len);
+        pes->data_index += len;
+        p               += len;
+        size            -= len;
+    }
+    return 0;
+}
+
 /* return non zero if a packet could be constructed */
 static int mpegts_push_data(MpegTSFilter *filter,
                             const uint8_t *buf, int buf_size, int is_start,
@@ -1187,7 +1292,7 @@ static int mpegts_push_data(MpegTSFilter *filter,
                         pes->total_size = MAX_PES_PAYLOAD;
 
                     /* allocate pes buffer */
-                    pes->buffer = buffer_pool_get(ts, pes->total_size);
+                    pes->buffer = buffer_pool_get(ts, pes_buffer_size(pes));
                     if (!pes->buffer)
                         return AVERROR(ENOMEM);
 
@@ -1353,7 +1458,20 @@ skip:
             }
             break;
         case MPEGTS_PAYLOAD:
-            if (pes->buffer) {
+            if (pes->buffer && ts->pes_gather && pes->total_size == MAX_PES_PAYLOAD) {
+                if (pes->data_index > 0 &&
+                    pes->data_index + buf_size > MAX_PES_GATHER_SIZE) {
+                    ret = new_pes_packet(pes, ts->pkt);
+                    if (ret < 0)
+                        return ret;
+                    pes->buffer = buffer_pool_get(ts, pes_buffer_size(pes));
+                    if (!pes->buffer)
+                        return AVERROR(ENOMEM);
+                    ts->stop_parse = 1;
+                }
+                if ((ret = pes_gather_data(pes, p, buf_size)) < 0)
+                    return ret;
+            } else if (pes->buffer) {
                 if (pes->data_index > 0 &&
                     pes->data_index + buf_size > pes->total_size) {
                     ret = new_pes_packet(pes, ts->pkt);
@@ -2840,7 +2958,7 @@ static int mpegts_resync(AVFormatContext *s, int seekback, const uint8_t *curren
 {
     MpegTSContext *ts = s->priv_data;
     AVIOContext *pb = s->pb;
-    int c, i;
+    int i, len;
     uint64_t pos = avio_tell(pb);
     int64_t back = FFMIN(seekback, pos);
 
@@ -2852,13 +2970,23 @@ static int mpegts_resync(AVFormatContext *s, int seekback, const uint8_t *curren
 
     avio_seek(pb, -back, SEEK_CUR);
 
-    for (i = 0; i < ts->resync_size; i++) {
-        c = avio_r8(pb);
-        if (avio_feof(pb))
-            return AVERROR_EOF;
-        if (c == 0x47) {
+    for (i = 0; i < ts->resync_size; i += len) {
+        const uint8_t *sync;
+
+        /* scan what is buffered at once, refill through avio_r8() */
+        len = FFMIN(pb->buf_end - pb->buf_ptr, ts->resync_size - i);
+        if (len <= 0) {
+            avio_r8(pb);
+            if (avio_feof(pb))
+                return AVERROR_EOF;
+            pb->buf_ptr--;
+            len = 0;
+            continue;
+        }
+        sync = memchr(pb->buf_ptr, 0x47, len);
+        if (sync) {
             int new_packet_size, ret;
-            avio_seek(pb, -1, SEEK_CUR);
+            pb->buf_ptr = (uint8_t *)sync;
             pos = avio_tell(pb);
             ret = ffio_ensure_seekback(pb, PROBE_PACKET_MAX_BUF);
             if (ret < 0)
@@ -2871,6 +2999,7 @@ static int mpegts_resync(AVFormatContext *s, int seekback, const uint8_t *curren
             avio_seek(pb, pos, SEEK_SET);
             return 0;
         }
+        pb->buf_ptr += len;
     }
     av_log(s, AV_LOG_ERROR,
            "max resync size reached, could not find sync byte\n");
@@ -2915,10 +3044,11 @@ static void finished_reading_packet(AVFormatContext *s, int raw_packet_size)
 static int handle_packets(MpegTSContext *ts, int64_t nb_packets)
 {
     AVFormatContext *s = ts->stream;
+    AVIOContext *pb = s->pb;
     uint8_t packet[TS_PACKET_SIZE + AV_INPUT_BUFFER_PADDING_SIZE];
     const uint8_t *data;
     int64_t packet_num;
-    int ret = 0;
+    int nb, ret = 0;
 
     if (avio_tell(s->pb) != ts->last_pos) {
         int i;
@@ -2929,6 +3059,7 @@ static int handle_packets(MpegTSContext *ts, int64_t nb_packets)
                 if (ts->pids[i]->type == MPEGTS_PES) {
                     PESContext *pes = ts->pids[i]->u.pes_filter.opaque;
                     av_buffer_unref(&pes->buffer);
+                    pes_free_chunks(pes);
                     pes->data_index = 0;
                     pes->state = MPEGTS_SKIP; /* skip until pes header */
                 } else if (ts->pids[i]->type == MPEGTS_SECTION) {
@@ -2953,6 +3084,31 @@ static int handle_packets(MpegTSContext *ts, int64_t nb_packets)
         if (ts->stop_parse > 0)
             break;
 
+        /* Handle the packets already in the read buffer in place, without
+         * going through the AVIOContext for each of them. The sync byte is
+         * checked as they are reached, as a complete PES often ends the run
+         * after a few packets. Anything else takes the read_packet() path. */
+        nb = (pb->buf_end - pb->buf_ptr) / ts->raw_packet_size;
+        if (nb_packets != 0)
+            nb = FFMIN(nb, nb_packets - packet_num);
+        if (nb > 0 && pb->buf_ptr[0] == 0x47) {
+            int64_t pos = avio_tell(pb) + TS_PACKET_SIZE;
+            int i;
+
+            for (i = 0;; i++) {
+                data = pb->buf_ptr;
+                pb->buf_ptr += ts->raw_packet_size;
+                ret = handle_packet(ts, data, pos);
+                if (ret != 0 || ts->stop_parse > 0 || i == nb - 1 || pb->buf_ptr[0] != 0x47)
+                    break;
+                pos += ts->raw_packet_size;
+                packet_num++;
+            }
+            if (ret != 0)
+                break;
+            continue;
+        }
+
         ret = read_packet(s, packet, ts->raw_packet_size, &data);
         if (ret != 0)
             break;
@@ -124,6 +124,37 @@ FF_ENABLE_DEPRECATION_WARNINGS
     return ffio_open_whitelist(pb, url, flags, &s->interrupt_callback, options, s->protocol_whitelist, s->protocol_blacklist);
 }
 
+int ff_format_io_open_is_async(AVFormatContext *s)
+{
+#if FF_API_OLD_OPEN_CALLBACKS
+FF_DISABLE_DEPRECATION_WARNINGS
+    if (s->open_cb)
+        return 0;
+FF_ENABLE_DEPRECATION_WARNINGS
+#endif
+    return s->io_open == io_open_default;
+}
+
+int ff_format_io_open_async(AVFormatContext *s, AVIOContext **pb, const char *url,
+                            int flags, AVDictionary **options,
+                            const AVIOInterruptCB *int_cb)
+{
+    if (s->io_open != io_open_default)
+        return s->io_open(s, pb, url, flags, options);
+
+    av_log(s, AV_LOG_DEBUG, "Opening \'%s\' for %s in the background\n", url,
+           flags & AVIO_FLAG_WRITE ? "writing" : "reading");
+
+#if FF_API_OLD_OPEN_CALLBACKS
+FF_DISABLE_DEPRECATION_WARNINGS
+    if (s->open_cb)
+        return s->open_cb(s, pb, url, flags, int_cb, options);
+FF_ENABLE_DEPRECATION_WARNINGS
+#endif
+
+    return ffio_open_whitelist(pb, url, flags, int_cb, options, s->protocol_whitelist, s->protocol_blacklist);
+}
+
 static void io_close_default(AVFormatContext *s, AVIOContext *pb)
 {
     avio_close(pb);
@@ -20,6 +20,8 @@
  */
 #include "avformat.h"
 #include "libavutil/avassert.h"
+#include "libavutil/avstring.h"
+#include "libavutil/dns_cache.h"
 #include "libavutil/parseutils.h"
 #include "libavutil/opt.h"
 #include "libavutil/time.h"
@@ -32,6 +34,9 @@
 #if HAVE_POLL_H
 #include <poll.h>
 #endif
+#if HAVE_PTHREADS
+#include <pthread.h>
+#endif
 
 typedef struct TCPContext {
     const AVClass *class;
@@ -48,6 +53,17 @@ typedef struct TCPContext {
 #endif /* !HAVE_WINSOCK2_H */
     int64_t app_ctx_intptr;
     AVApplicationContext *app_ctx;
+    int64_t addrinfo_timeout;
+    int64_t dns_cache_timeout;
+    int64_t dns_cache_error_timeout;
+    char *dns_hosts;
+    int tcp_quickack;
+    int tcp_notsent_lowat;
+    int tcp_user_timeout;
+    int busy_poll;
+    int tcp_info_interval;
+    int64_t tcp_info_next;
+    int64_t connect_time;
 } TCPContext;
 
 #define OFFSET(x) offsetof(TCPContext, x)
@@ -64,6 +80,15 @@ static const AVOption options[] = {
     { "tcp_mss",     "Maximum segment size for outgoing TCP packets",          OFFSET(tcp_mss),     AV_OPT_TYPE_INT, { .i64 = -1 },         -1, INT_MAX, .flags = D|E },
 #endif /* !HAVE_WINSOCK2_H */
     { "ijkapplication",   "AVApplicationContext",                              OFFSET(app_ctx_intptr),   AV_OPT_TYPE_INT64, { .i64 = 0 }, INT64_MIN, INT64_MAX, .flags = D },
+    { "addrinfo_timeout", "Host name resolution timeout (in microseconds), -1 for the open timeout, 0 to resolve in the calling thread", OFFSET(addrinfo_timeout), AV_OPT_TYPE_INT64, { .i64 = -1 }, -1, INT64_MAX, .flags = D|E },
+    { "dns_cache_timeout", "Time resolved addresses are cached (in microseconds), 0 disables caching", OFFSET(dns_cache_timeout), AV_OPT_TYPE_INT64, { .i64 = 60000000 }, 0, INT64_MAX, .flags = D|E },
+    { "dns_cache_error_timeout", "Time unknown host names are cached (in microseconds), 0 disables caching", OFFSET(dns_cache_error_timeout), AV_OPT_TYPE_INT64, { .i64 = 5000000 }, 0, INT64_MAX, .flags = D|E },
+    { "dns_hosts", "Put addresses into the dns cache, host=address[|address...][,host=...]", OFFSET(dns_hosts), AV_OPT_TYPE_STRING, { .str = NULL }, 0, 0, .flags = D|E },
+    { "tcp_quickack", "Use TCP_QUICKACK to acknowledge received data right away", OFFSET(tcp_quickack), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, .flags = D|E },
+    { "tcp_notsent_lowat", "Limit of unsent bytes in the socket send buffer (TCP_NOTSENT_LOWAT)", OFFSET(tcp_notsent_lowat), AV_OPT_TYPE_INT, { .i64 = -1 }, -1, INT_MAX, .flags = D|E },
+    { "tcp_user_timeout", "Time transmitted data may stay unacknowledged before the connection is dropped (in milliseconds, TCP_USER_TIMEOUT)", OFFSET(tcp_user_timeout), AV_OPT_TYPE_INT, { .i64 = -1 }, -1, INT_MAX, .flags = D|E },
+    { "busy_poll", "Time to busy poll the device queue on reads (in microseconds, SO_BUSY_POLL)", OFFSET(busy_poll), AV_OPT_TYPE_INT, { .i64 = -1 }, -1, INT_MAX, .flags = D|E },
+    { "tcp_info_interval", "Interval at which TCP_INFO is reported to the application (in milliseconds), 0 disables it", OFFSET(tcp_info_interval), AV_OPT_TYPE_INT, { .i64 = 0 }, 0, INT_MAX, .flags = D|E },
     { NULL }
 };
 
@@ -101,6 +126,371 @@ static void customize_fd(void *ctx, int fd)
         }
     }
 #endif /* !HAVE_WINSOCK2_H */
+#ifdef TCP_QUICKACK
+    if (s->tcp_quickack > 0) {
+        if (setsockopt (fd, IPPROTO_TCP, TCP_QUICKACK, &s->tcp_quickack, sizeof (s->tcp_quickack))) {
+            ff_log_net_error(ctx, AV_LOG_WARNING, "setsockopt(TCP_QUICKACK)");
+        }
+    }
+#endif /* TCP_QUICKACK */
+#ifdef TCP_NOTSENT_LOWAT
+    if (s->tcp_notsent_lowat >= 0) {
+        if (setsockopt (fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &s->tcp_notsent_lowat, sizeof (s->tcp_notsent_lowat))) {
+            ff_log_net_error(ctx, AV_LOG_WARNING, "setsockopt(TCP_NOTSENT_LOWAT)");
+        }
+    }
+#endif /* TCP_NOTSENT_LOWAT */
+#ifdef TCP_USER_TIMEOUT
+    if (s->tcp_user_timeout >= 0) {
+        if (setsockopt (fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &s->tcp_user_timeout, sizeof (s->tcp_user_timeout))) {
+            ff_log_net_error(ctx, AV_LOG_WARNING, "setsockopt(TCP_USER_TIMEOUT)");
+        }
+    }
+#endif /* TCP_USER_TIMEOUT */
+#ifdef SO_BUSY_POLL
+    if (s->busy_poll >= 0) {
+        if (setsockopt (fd, SOL_SOCKET, SO_BUSY_POLL, &s->busy_poll, sizeof (s->busy_poll))) {
+            ff_log_net_error(ctx, AV_LOG_WARNING, "setsockopt(SO_BUSY_POLL)");
+        }
+    }
+#endif /* SO_BUSY_POLL */
+}
+
+#if defined(__linux__) && defined(TCP_INFO)
+/* Layout of the kernel's struct tcp_info up to tcpi_delivery_rate, the one
+ * of the C library may end earlier. Older kernels fill in less of it. */
+typedef struct TCPKernelInfo {
+    uint8_t  state, ca_state, retransmits, probes, backoff, options, wscale, flags;
+    uint32_t rto, ato, snd_mss, rcv_mss;
+    uint32_t unacked, sacked, lost, retrans, fackets;
+    uint32_t last_data_sent, last_ack_sent, last_data_recv, last_ack_recv;
+    uint32_t pmtu, rcv_ssthresh, rtt, rttvar, snd_ssthresh, snd_cwnd, advmss, reordering;
+    uint32_t rcv_rtt, rcv_space;
+    uint32_t total_retrans;
+    uint64_t pacing_rate, max_pacing_rate, bytes_acked, bytes_received;
+    uint32_t segs_out, segs_in;
+    uint32_t notsent_bytes, min_rtt, data_segs_in, data_segs_out;
+    uint64_t delivery_rate;
+} TCPKernelInfo;
+
+#define TCP_INFO_HAS(len, field) ((len) >= offsetof(TCPKernelInfo, field) + sizeof(((TCPKernelInfo *)0)->field))
+
+static void tcp_report_info(URLContext *h)
+{
+    TCPContext *s = h->priv_data;
+    AVAppTcpInfo info = { 0 };
+    TCPKernelInfo ti = { 0 };
+    socklen_t len = sizeof(ti);
+
+    if (getsockopt(s->fd, IPPROTO_TCP, TCP_INFO, &ti, &len) ||
+        !TCP_INFO_HAS(len, total_retrans))
+        return;
+
+    info.size           = sizeof(info);
+    info.obj            = h;
+    info.rtt            = ti.rtt;
+    info.rtt_var        = ti.rttvar;
+    info.min_rtt        = TCP_INFO_HAS(len, min_rtt) ? ti.min_rtt : -1;
+    info.cwnd           = ti.snd_cwnd;
+    info.snd_mss        = ti.snd_mss;
+    info.rcv_mss        = ti.rcv_mss;
+    info.retransmits    = ti.total_retrans;
+    info.lost           = ti.lost;
+    info.delivery_rate  = TCP_INFO_HAS(len, delivery_rate) ? ti.delivery_rate : -1;
+    info.bytes_received = TCP_INFO_HAS(len, bytes_received) ? ti.bytes_received : -1;
+    info.elapsed        = av_gettime_relative() - s->connect_time;
+    av_application_on_tcp_info(s->app_ctx, &info);
+}
+#else
+static void tcp_report_info(URLContext *h)
+{
+}
+#endif /* __linux__ && TCP_INFO */
+
+#if HAVE_PTHREADS
+/* getaddrinfo() cannot be interrupted, so it runs in a detached thread
+ * which frees the request if the caller gave up waiting for it. */
+typedef struct TCPAddrinfoRequest {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int refs;
+    int finished;
+    char *hostname;
+    char servname[10];
+    struct addrinfo hints;
+    struct addrinfo *res;
+    int ret;
+} TCPAddrinfoRequest;
+
+static void addrinfo_request_unref(TCPAddrinfoRequest *req)
+{
+    int refs;
+
+    pthread_mutex_lock(&req->mutex);
+    refs = --req->refs;
+    pthread_mutex_unlock(&req->mutex);
+    if (refs)
+        return;
+    if (req->res)
+        freeaddrinfo(req->res);
+    pthread_cond_destroy(&req->cond);
+    pthread_mutex_destroy(&req->mutex);
+    av_freep(&req->hostname);
+    av_free(req);
+}
+
+static void *addrinfo_worker(void *arg)
+{
+    TCPAddrinfoRequest *req = arg;
+    struct addrinfo *res = NULL;
+    int ret = getaddrinfo(req->hostname, req->servname, &req->hints, &res);
+
+    pthread_mutex_lock(&req->mutex);
+    req->ret      = ret;
+    req->res      = res;
+    req->finished = 1;
+    pthread_cond_signal(&req->cond);
+    pthread_mutex_unlock(&req->mutex);
+    addrinfo_request_unref(req);
+    return NULL;
+}
+
+/* Returns 0 or AVERROR, the getaddrinfo() result is in *gai_ret. */
+static int getaddrinfo_nonblock(const char *hostname, const char *servname,
+                                const struct addrinfo *hints, struct addrinfo **res,
+                                int *gai_ret, int64_t timeout,
+                                AVIOInterruptCB *int_cb)
+{
+    TCPAddrinfoRequest *req;
+    pthread_t thread;
+    int64_t deadline = av_gettime_relative() + timeout;
+    int ret = 0;
+
+    req = av_mallocz(sizeof(*req));
+    if (!req)
+        return AVERROR(ENOMEM);
+    req->hostname = av_strdup(hostname);
+    if (!req->hostname) {
+        av_free(req);
+        return AVERROR(ENOMEM);
+    }
+    av_strlcpy(req->servname, servname, sizeof(req->servname));
+    req->hints = *hints;
+    req->refs  = 2;
+    pthread_mutex_init(&req->mutex, NULL);
+    pthread_cond_init(&req->cond, NULL);
+
+    if (pthread_create(&thread, NULL, addrinfo_worker, req)) {
+        req->refs = 1;
+        addrinfo_request_unref(req);
+        *gai_ret = getaddrinfo(hostname, servname, hints, res);
+        return 0;
+    }
+    pthread_detach(thread);
+
+    pthread_mutex_lock(&req->mutex);
+    while (!req->finished) {
+        int64_t now = av_gettime_relative(), t;
+        struct timespec tv;
+
+        if (ff_check_interrupt(int_cb)) {
+            ret = AVERROR_EXIT;
+            break;
+        }
+        if (now >= deadline) {
+            ret = AVERROR(ETIMEDOUT);
+            break;
+        }
+        t = av_gettime() + FFMIN(deadline - now, 100000);
+        tv.tv_sec  =  t / 1000000;
+        tv.tv_nsec = (t % 1000000) * 1000;
+        pthread_cond_timedwait(&req->cond, &req->mutex, &tv);
+    }
+    if (req->finished) {
+        *gai_ret = req->ret;
+        *res     = req->res;
+        req->res = NULL;
+    }
+    pthread_mutex_unlock(&req->mutex);
+    addrinfo_request_unref(req);
+    return ret;
+}
+#endif /* HAVE_PTHREADS */
+
+/* Copy of a cached address list with the port of this connection, one
+ * allocation that is released with av_free(). */
+static struct addrinfo *dup_cached_addrinfo(const struct addrinfo *cached, int port)
+{
+    const struct addrinfo *cur;
+    struct addrinfo *res, *ai;
+    uint8_t *addr;
+    size_t size = 0;
+    int n = 0;
+
+    for (cur = cached; cur; cur = cur->ai_next, n++)
+        size += cur->ai_addrlen;
+    if (!n || !(res = av_malloc(n * sizeof(*res) + size)))
+        return NULL;
+    addr = (uint8_t *)(res + n);
+    for (cur = cached, ai = res; cur; cur = cur->ai_next, ai++) {
+        *ai = *cur;
+        ai->ai_canonname = NULL;
+        ai->ai_addr      = (struct sockaddr *)addr;
+        ai->ai_next      = cur->ai_next ? ai + 1 : NULL;
+        memcpy(addr, cur->ai_addr, cur->ai_addrlen);
+        addr += cur->ai_addrlen;
+        if (ai->ai_family == AF_INET)
+            ((struct sockaddr_in *)ai->ai_addr)->sin_port = htons(port);
+#if HAVE_STRUCT_SOCKADDR_IN6
+        else if (ai->ai_family == AF_INET6)
+            ((struct sockaddr_in6 *)ai->ai_addr)->sin6_port = htons(port);
+#endif
+    }
+    return res;
+}
+
+/* Put the addresses of dns_hosts, "host=address[|address...][,...]",
+ * into the dns cache. */
+static void add_dns_hosts(URLContext *h, const char *dns_hosts, int64_t ttl)
+{
+    struct addrinfo hints = { 0 };
+    char *hosts = av_strdup(dns_hosts), *entry, *saveptr = NULL;
+
+    if (!hosts)
+        return;
+    hints.ai_flags    = AI_NUMERICHOST;
+    hints.ai_socktype = SOCK_STREAM;
+    for (entry = av_strtok(hosts, ",", &saveptr); entry;
+         entry = av_strtok(NULL, ",", &saveptr)) {
+        struct addrinfo *lists[16], *tail;
+        char *addr, *saveptr2 = NULL, *host = entry;
+        int i, n = 0;
+
+        if (!(addr = strchr(entry, '=')))
+            continue;
+        *addr++ = '\0';
+        for (addr = av_strtok(addr, "|", &saveptr2); addr && n < FF_ARRAY_ELEMS(lists);
+             addr = av_strtok(NULL, "|", &saveptr2)) {
+            if (getaddrinfo(addr, NULL, &hints, &lists[n])) {
+                av_log(h, AV_LOG_WARNING, "Invalid address %s for %s in dns_hosts\n", addr, host);
+                continue;
+            }
+            n++;
+        }
+        if (!n)
+            continue;
+        /* link the lists for the cache to copy them in one go */
+        for (i = 0; i < n - 1; i++) {
+            for (tail = lists[i]; tail->ai_next; tail = tail->ai_next);
+            tail->ai_next = lists[i + 1];
+        }
+        remove_dns_cache_entry(host);
+        add_dns_cache_entry(host, lists[0], ttl / 1000);
+        for (i = 0; i < n - 1; i++) {
+            for (tail = lists[i]; tail->ai_next != lists[i + 1]; tail = tail->ai_next);
+            tail->ai_next = NULL;
+        }
+        for (i = 0; i < n; i++)
+            freeaddrinfo(lists[i]);
+    }
+    av_free(hosts);
+}
+
+#if HAVE_PTHREADS
+static pthread_mutex_t dns_hosts_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+/* the dns_hosts last put into the cache and when its entries expire */
+static char *dns_hosts_seeded;
+static int64_t dns_hosts_expiry;
+
+/* Add dns_hosts to the dns cache unless its entries still are there. */
+static void seed_dns_cache(URLContext *h, const char *dns_hosts, int64_t ttl)
+{
+    int64_t now = av_gettime_relative();
+
+#if HAVE_PTHREADS
+    pthread_mutex_lock(&dns_hosts_mutex);
+#endif
+    if (!dns_hosts_seeded || strcmp(dns_hosts_seeded, dns_hosts) ||
+        now >= dns_hosts_expiry) {
+        av_free(dns_hosts_seeded);
+        dns_hosts_seeded = av_strdup(dns_hosts);
+        dns_hosts_expiry = now + ttl;
+        add_dns_hosts(h, dns_hosts, ttl);
+    }
+#if HAVE_PTHREADS
+    pthread_mutex_unlock(&dns_hosts_mutex);
+#endif
+}
+
+/* Resolve hostname for a connection through the dns cache. *cached tells
+ * whether *res has to be released with av_free() instead of freeaddrinfo(). */
+static int tcp_resolve(URLContext *h, char *hostname, int port,
+                       const struct addrinfo *hints, struct addrinfo **res, int *cached)
+{
+    TCPContext *s = h->priv_data;
+    AVAppDnsStatistic statistic = { sizeof(statistic) };
+    struct addrinfo numeric_hints = *hints;
+    DnsCacheEntry *entry;
+    char portstr[10];
+    int64_t start = av_gettime_relative();
+    int64_t timeout = s->addrinfo_timeout < 0 ? s->open_timeout : s->addrinfo_timeout;
+    int ret = 0, gai_ret = 0;
+
+    *cached = 0;
+    snprintf(portstr, sizeof(portstr), "%d", port);
+
+    /* addresses need neither the resolver nor the cache */
+    numeric_hints.ai_flags |= AI_NUMERICHOST;
+    if (!getaddrinfo(hostname, portstr, &numeric_hints, res))
+        return 0;
+
+    if (s->dns_hosts)
+        seed_dns_cache(h, s->dns_hosts, s->dns_cache_timeout > 0 ? s->dns_cache_timeout : INT_MAX * 1000LL);
+
+    entry = get_dns_cache_reference(hostname);
+    if (entry) {
+        statistic.cache_hit = 1;
+        if (entry->res) {
+            *res    = dup_cached_addrinfo(entry->res, port);
+            *cached = 1;
+            if (!*res)
+                ret = AVERROR(ENOMEM);
+        } else {
+            gai_ret = entry->error;
+        }
+        release_dns_cache_reference(hostname, &entry);
+    } else {
+#if HAVE_PTHREADS
+        if (timeout > 0)
+            ret = getaddrinfo_nonblock(hostname, portstr, hints, res, &gai_ret,
+                                       timeout, &h->interrupt_callback);
+        else
+#endif
+            gai_ret = getaddrinfo(hostname, portstr, hints, res);
+
+        if (!ret && !gai_ret && s->dns_cache_timeout > 0)
+            add_dns_cache_entry(hostname, *res, s->dns_cache_timeout / 1000);
+        /* only cache answers, not the failure to get one */
+        else if (!ret && gai_ret == EAI_NONAME && s->dns_cache_error_timeout > 0)
+            add_dns_cache_error_entry(hostname, gai_ret, s->dns_cache_error_timeout / 1000);
+    }
+
+    if (ret == AVERROR(ETIMEDOUT))
+        av_log(h, AV_LOG_ERROR, "Timeout resolving hostname %s\n", hostname);
+    else if (!ret && gai_ret) {
+        av_log(h, AV_LOG_ERROR,
+               "Failed to resolve hostname %s: %s%s\n",
+               hostname, gai_strerror(gai_ret), statistic.cache_hit ? " (cached)" : "");
+        ret = AVERROR(EIO);
+    }
+
+    av_strlcpy(statistic.hostname, hostname, sizeof(statistic.hostname));
+    statistic.error   = ret;
+    statistic.elapsed = av_gettime_relative() - start;
+    get_dns_cache_statistic(&statistic.hit_count, &statistic.miss_count);
+    av_application_on_dns_statistic(s->app_ctx, &statistic);
+    return ret;
 }
 
 /* return non zero if error */
@@ -111,7 +501,7 @@ static int tcp_open(URLContext *h, const char *uri, int flags)
     TCPContext *s = h->priv_data;
     const char *p;
     char buf[256];
-    int ret;
+    int ret, ai_cached = 0;
     char hostname[1024],proto[1024],path[1024];
     char portstr[10];
     AVAppTcpIOControl control = {0};
@@ -151,15 +541,20 @@ static int tcp_open(URLContext *h, const char *uri, int flags)
     snprintf(portstr, sizeof(portstr), "%d", port);
     if (s->listen)
         hints.ai_flags |= AI_PASSIVE;
-    if (!hostname[0])
-        ret = getaddrinfo(NULL, portstr, &hints, &ai);
-    else
-        ret = getaddrinfo(hostname, portstr, &hints, &ai);
-    if (ret) {
-        av_log(h, AV_LOG_ERROR,
-               "Failed to resolve hostname %s: %s\n",
-               hostname, gai_strerror(ret));
-        return AVERROR(EIO);
+    if (hostname[0] && !s->listen) {
+        if ((ret = tcp_resolve(h, hostname, port, &hints, &ai, &ai_cached)) < 0)
+            return ret;
+    } else {
+        if (!hostname[0])
+            ret = getaddrinfo(NULL, portstr, &hints, &ai);
+        else
+            ret = getaddrinfo(hostname, portstr, &hints, &ai);
+        if (ret) {
+            av_log(h, AV_LOG_ERROR,
+                   "Failed to resolve hostname %s: %s\n",
+                   hostname, gai_strerror(ret));
+            return AVERROR(EIO);
+        }
     }
 
     cur_ai = ai;
@@ -222,14 +617,21 @@ static int tcp_open(URLContext *h, const char *uri, int flags)
 
     h->is_streamed = 1;
     s->fd = fd;
+    s->connect_time = av_gettime_relative();
 
-    freeaddrinfo(ai);
+    if (ai_cached)
+        av_free(ai);
+    else
+        freeaddrinfo(ai);
     return 0;
 
  fail1:
     if (fd >= 0)
         closesocket(fd);
-    freeaddrinfo(ai);
+    if (ai_cached)
+        av_free(ai);
+    else
+        freeaddrinfo(ai);
     return ret;
 }
 
@@ -262,8 +664,23 @@ static int tcp_read(URLContext *h, uint8_t *buf, int size)
             return ret;
     }
     ret = recv(s->fd, buf, size, 0);
-    if (ret > 0)
+    if (ret > 0) {
+        /* the http connection pool rebinds idle connections to their next user */
+        s->app_ctx = (AVApplicationContext *)(intptr_t)s->app_ctx_intptr;
         av_application_did_io_tcp_read(s->app_ctx, (void*)h, ret);
+#ifdef TCP_QUICKACK
+        /* the kernel leaves quickack mode on its own, ask for it again */
+        if (s->tcp_quickack > 0)
+            setsockopt(s->fd, IPPROTO_TCP, TCP_QUICKACK, &s->tcp_quickack, sizeof(s->tcp_quickack));
+#endif /* TCP_QUICKACK */
+        if (s->tcp_info_interval > 0 && s->app_ctx) {
+            int64_t now = av_gettime_relative();
+            if (now >= s->tcp_info_next) {
+                s->tcp_info_next = now + s->tcp_info_interval * 1000LL;
+                tcp_report_info(h);
+            }
+        }
+    }
     if (ret == 0)
         return AVERROR_EOF;
     return ret < 0 ? ff_neterrno() : ret;
@@ -302,6 +719,11 @@ static int tcp_shutdown(URLContext *h, int flags)
 static int tcp_close(URLContext *h)
 {
     TCPContext *s = h->priv_data;
+    /* the final counters of the connection, for its current user: an
+     * idle pooled connection has none, its last one may be gone */
+    s->app_ctx = (AVApplicationContext *)(intptr_t)s->app_ctx_intptr;
+    if (s->tcp_info_interval > 0 && s->app_ctx && s->connect_time)
+        tcp_report_info(h);
     closesocket(s->fd);
     return 0;
 }
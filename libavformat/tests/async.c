@@ -0,0 +1,213 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Reads a generated file through async:file: and checks the content, then
+ * prints the throughput and how often the reader or the buffering thread had
+ * to block. Run it against "file:" with -d to get the direct read baseline,
+ * -a enables the adaptive read size, -s the spill file behind a small buffer
+ * and -S the same with a spill file too small for the input, which has to be
+ * recycled.
+ *
+ * usage: async [-d] [-a] [-s|-S] [size in MiB] [read size in bytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/internal.h"
+#include "libavutil/mem.h"
+#include "libavutil/opt.h"
+#include "libavutil/time.h"
+#include "libavformat/url.h"
+#include "httpserver.h"
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#define TEST_SEEK_BACK  (64 * 1024 + 13)
+#define TEST_SEEKS      64
+
+static int check_data(const uint8_t *buf, int size, int64_t pos)
+{
+    int i;
+
+    for (i = 0; i < size; i++) {
+        if (buf[i] != test_byte(pos + i)) {
+            printf("read-mismatch: actual %d, expecting %d, at %"PRId64"\n",
+                   buf[i], test_byte(pos + i), pos + i);
+            return AVERROR_INVALIDDATA;
+        }
+    }
+    return 0;
+}
+
+/* read from pos to the end of the file, checking the content */
+static int64_t read_to_end(URLContext *h, uint8_t *buf, int read_size, int64_t pos)
+{
+    int ret;
+
+    while (1) {
+        ret = ffurl_read(h, buf, read_size);
+        if (ret == AVERROR_EOF || ret == 0)
+            break;
+        if (ret < 0) {
+            printf("read-error: %s at %"PRId64"\n", av_err2str(ret), pos);
+            return ret;
+        }
+        if (check_data(buf, ret, pos) < 0)
+            return AVERROR_INVALIDDATA;
+        pos += ret;
+    }
+    return pos;
+}
+
+static int write_test_file(int fd, int64_t size)
+{
+    uint8_t buf[4096];
+    int64_t pos = 0;
+    int i;
+
+    while (pos < size) {
+        int len = FFMIN(sizeof(buf), size - pos);
+        for (i = 0; i < len; i++)
+            buf[i] = test_byte(pos + i);
+        if (write(fd, buf, len) != len)
+            return AVERROR(errno);
+        pos += len;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    URLContext *h = NULL;
+    AVDictionary *opts = NULL;
+    char *filename = NULL;
+    char url[1024];
+    uint8_t *buf = NULL;
+    int64_t size = 64 * 1024 * 1024;
+    int64_t pos = 0, wakeups = -1, start, elapsed;
+    int read_size = 32768, direct = 0;
+    uint32_t seed = 1;
+    int fd, i, ret;
+
+    for (; argc > 1 && argv[1][0] == '-'; argc--, argv++) {
+        if (!strcmp(argv[1], "-d"))
+            direct = 1;
+        else if (!strcmp(argv[1], "-a"))
+            av_dict_set(&opts, "async_adaptive", "1", 0);
+        else if (!strcmp(argv[1], "-s") || !strcmp(argv[1], "-S")) {
+            av_dict_set(&opts, "async_spill", "1", 0);
+            av_dict_set(&opts, "async_buffer_size", "262144", 0);
+            av_dict_set(&opts, "async_read_back_size", "262144", 0);
+            if (argv[1][1] == 'S')
+                av_dict_set(&opts, "async_spill_size", "1048576", 0);
+        }
+    }
+    if (argc > 1)
+        size = strtol(argv[1], NULL, 0) * 1024 * 1024;
+    if (argc > 2)
+        read_size = strtol(argv[2], NULL, 0);
+    if (size <= TEST_SEEK_BACK || read_size <= 0) {
+        av_dict_free(&opts);
+        return 1;
+    }
+
+    fd = avpriv_tempfile("async-test", &filename, 0, NULL);
+    if (fd < 0) {
+        av_dict_free(&opts);
+        return 1;
+    }
+    ret = write_test_file(fd, size);
+    close(fd);
+    if (ret < 0)
+        goto fail;
+
+    buf = av_malloc(read_size);
+    if (!buf) {
+        ret = AVERROR(ENOMEM);
+        goto fail;
+    }
+
+    snprintf(url, sizeof(url), "%sfile:%s", direct ? "" : "async:", filename);
+    ret = ffurl_open_whitelist(&h, url, AVIO_FLAG_READ, NULL, &opts, NULL, NULL, NULL);
+    if (ret < 0) {
+        printf("open: %s\n", av_err2str(ret));
+        goto fail;
+    }
+
+    start = av_gettime_relative();
+    pos = read_to_end(h, buf, read_size, 0);
+    elapsed = FFMAX(av_gettime_relative() - start, 1);
+
+    if (pos != size) {
+        printf("read: %"PRId64", expecting %"PRId64"\n", pos, size);
+        ret = AVERROR_INVALIDDATA;
+        goto fail;
+    }
+
+    /* short seek backwards is served from the read-back window */
+    pos = ffurl_seek(h, size - TEST_SEEK_BACK, SEEK_SET);
+    ret = ffurl_read_complete(h, buf, FFMIN(read_size, TEST_SEEK_BACK));
+    if (pos != size - TEST_SEEK_BACK || ret <= 0 || check_data(buf, ret, pos) < 0) {
+        printf("seek-back: %"PRId64" %d\n", pos, ret);
+        ret = AVERROR_INVALIDDATA;
+        goto fail;
+    }
+
+    /* long seek restarts the inner protocol or hits the spill file */
+    pos = ffurl_seek(h, 1, SEEK_SET);
+    if (pos != 1 || read_to_end(h, buf, read_size, pos) != size) {
+        printf("seek: %"PRId64"\n", pos);
+        ret = AVERROR_INVALIDDATA;
+        goto fail;
+    }
+
+    /* scattered seeks, served from the ring, the spill file or the inner
+     * protocol depending on the distance */
+    for (i = 0; i < TEST_SEEKS; i++) {
+        seed = seed * 1664525 + 1013904223;
+        pos  = ffurl_seek(h, seed % (uint32_t)size, SEEK_SET);
+        ret  = ffurl_read_complete(h, buf, read_size);
+        if (pos < 0 || ret < 0 || (ret == 0 && pos != size) ||
+            check_data(buf, ret, pos) < 0) {
+            printf("seek %d: %"PRId64" %d\n", i, pos, ret);
+            ret = AVERROR_INVALIDDATA;
+            goto fail;
+        }
+    }
+
+    if (!direct)
+        av_opt_get_int(h->priv_data, "wakeup_count", 0, &wakeups);
+    printf("%s: %"PRId64" bytes in %"PRId64" us, %.1f MB/s, wakeups %"PRId64"\n",
+           direct ? "file" : "async", size, elapsed,
+           size / (double)elapsed, wakeups);
+    ret = 0;
+
+fail:
+    ffurl_closep(&h);
+    av_dict_free(&opts);
+    av_free(buf);
+    if (filename)
+        unlink(filename);
+    av_free(filename);
+    return ret < 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Replays a seek-heavy access trace over cache:file: on a generated file,
+ * checks the content and prints the throughput together with the cache
+ * statistics. -d replays the same trace over file: directly.
+ *
+ * usage: cache [-d] [size in MiB] [number of operations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/internal.h"
+#include "libavutil/lfg.h"
+#include "libavutil/mem.h"
+#include "libavutil/opt.h"
+#include "libavutil/time.h"
+#include "libavformat/url.h"
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#define MAX_READ_SIZE 32768
+
+static int check_data(const uint8_t *buf, int size, int64_t pos)
+{
+    int i;
+
+    for (i = 0; i < size; i++) {
+        if (buf[i] != ((pos + i) * 7 & 0xFF)) {
+            printf("read-mismatch: actual %d, expecting %d, at %"PRId64"\n",
+                   buf[i], (int)((pos + i) * 7 & 0xFF), pos + i);
+            return AVERROR_INVALIDDATA;
+        }
+    }
+    return 0;
+}
+
+static int write_test_file(int fd, int64_t size)
+{
+    uint8_t buf[4096];
+    int64_t pos = 0;
+    int i;
+
+    for (i = 0; i < sizeof(buf); i++)
+        buf[i] = i * 7 & 0xFF;
+
+    while (pos < size) {
+        int len = FFMIN(sizeof(buf), size - pos);
+        if (write(fd, buf, len) != len)
+            return AVERROR(errno);
+        pos += len;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    URLContext *h = NULL;
+    AVLFG lfg;
+    char *filename = NULL;
+    char url[1024];
+    uint8_t buf[MAX_READ_SIZE];
+    int64_t size = 64 * 1024 * 1024;
+    int64_t pos = 0, bytes = 0, hits = 0, misses = 0, start, elapsed;
+    int ops = 100000, direct = 0, extents = 0;
+    int fd, ret, i;
+
+    if (argc > 1 && !strcmp(argv[1], "-d")) {
+        direct = 1;
+        argc--;
+        argv++;
+    }
+    if (argc > 1)
+        size = strtol(argv[1], NULL, 0) * 1024 * 1024;
+    if (argc > 2)
+        ops = strtol(argv[2], NULL, 0);
+    if (size <= 0 || ops <= 0)
+        return 1;
+
+    fd = avpriv_tempfile("cache-test", &filename, 0, NULL);
+    if (fd < 0)
+        return 1;
+    ret = write_test_file(fd, size);
+    close(fd);
+    if (ret < 0)
+        goto fail;
+
+    snprintf(url, sizeof(url), "%sfile:%s", direct ? "" : "cache:", filename);
+    ret = ffurl_open_whitelist(&h, url, AVIO_FLAG_READ, NULL, NULL, NULL, NULL, NULL);
+    if (ret < 0) {
+        printf("open: %s\n", av_err2str(ret));
+        goto fail;
+    }
+
+    /* mostly short forward reads, a quarter of them after a random seek,
+     * biased towards a few hot regions like repeated scrubbing does */
+    av_lfg_init(&lfg, 0xCAC4E);
+    start = av_gettime_relative();
+    for (i = 0; i < ops; i++) {
+        int len = av_lfg_get(&lfg) % MAX_READ_SIZE + 1;
+
+        if (av_lfg_get(&lfg) % 4 == 0) {
+            int64_t target = (av_lfg_get(&lfg) % 16) * (size / 16) +
+                             av_lfg_get(&lfg) % (size / 16);
+            pos = ffurl_seek(h, target, SEEK_SET);
+            if (pos != target) {
+                printf("seek: %"PRId64", expecting %"PRId64"\n", pos, target);
+                ret = AVERROR_INVALIDDATA;
+                goto fail;
+            }
+        }
+
+        ret = ffurl_read(h, buf, len);
+        if (ret == AVERROR_EOF || ret == 0)
+            continue;
+        if (ret < 0) {
+            printf("read-error: %s at %"PRId64"\n", av_err2str(ret), pos);
+            goto fail;
+        }
+        if (check_data(buf, ret, pos) < 0) {
+            ret = AVERROR_INVALIDDATA;
+            goto fail;
+        }
+        pos   += ret;
+        bytes += ret;
+    }
+    elapsed = FFMAX(av_gettime_relative() - start, 1);
+
+    if (!direct) {
+        int64_t v;
+        av_opt_get_int(h->priv_data, "cache_hits",    0, &hits);
+        av_opt_get_int(h->priv_data, "cache_misses",  0, &misses);
+        av_opt_get_int(h->priv_data, "cache_extents", 0, &v);
+        extents = v;
+    }
+    printf("%s: %d ops, %"PRId64" bytes in %"PRId64" us, %.1f MB/s, "
+           "hits %"PRId64", misses %"PRId64", extents %d\n",
+           direct ? "file" : "cache", ops, bytes, elapsed, bytes / (double)elapsed,
+           hits, misses, extents);
+    ret = 0;
+
+fail:
+    ffurl_closep(&h);
+    if (filename)
+        unlink(filename);
+    av_free(filename);
+    return ret < 0;
+}
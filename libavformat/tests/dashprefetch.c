@@ -0,0 +1,223 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Reads a DASH presentation of ADTS fragments from a http server running in
+ * the same process, with and without prefetch_fragments, and checks that
+ * the packets carry the fragments unchanged. The "cut" presentation closes
+ * the connection in the middle of the first download of its second
+ * fragment, which must then be requested again instead of being read
+ * short.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/adler32.h"
+#include "libavutil/avstring.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+#include "libavformat/avformat.h"
+#include "libavformat/url.h"
+#include "httpserver.h"
+
+#define NB_FRAGMENTS  6
+#define NB_FRAMES     400
+#define MAX_FRAME     (7 + 2 + 255 + 9)
+#define CUT_FRAGMENT  1
+
+static TestHTTPServer server;
+static atomic_int cut_requests;
+
+static uint8_t fragments[NB_FRAGMENTS][NB_FRAMES * MAX_FRAME];
+static int fragment_size[NB_FRAGMENTS];
+static char manifest[4096];
+
+/* Silent AAC LC frames at 44100 Hz, stereo. Each one starts with a data
+ * stream element of random bytes, so that all frames differ. */
+static void make_fragments(void)
+{
+    static const uint8_t silence[] = { 0x21, 0x00, 0x49, 0x90, 0x02, 0x19, 0x00, 0x23, 0x80 };
+    int i, j, k;
+
+    for (i = 0; i < NB_FRAGMENTS; i++) {
+        uint8_t *p = fragments[i];
+        for (j = 0; j < NB_FRAMES; j++) {
+            int n    = i * NB_FRAMES + j;
+            int data = 16 + n * 37 % 192;
+            int len  = 7 + 2 + data + sizeof(silence);
+            p[0] = 0xFF;
+            p[1] = 0xF1;
+            p[2] = 1 << 6 | 4 << 2;
+            p[3] = 2 << 6 | len >> 11;
+            p[4] = len >> 3;
+            p[5] = (len & 7) << 5 | 0x1F;
+            p[6] = 0xFC;
+            p[7] = 4 << 5 | 1;      /* DSE, byte aligned */
+            p[8] = data;
+            for (k = 0; k < data; k++)
+                p[9 + k] = test_byte((int64_t)n * MAX_FRAME + k);
+            memcpy(p + 9 + data, silence, sizeof(silence));
+            p += len;
+        }
+        fragment_size[i] = p - fragments[i];
+    }
+}
+
+static void make_manifest(void)
+{
+    int i, len;
+
+    len = snprintf(manifest, sizeof(manifest),
+                   "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+                   "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" type=\"static\"\n"
+                   "profiles=\"urn:mpeg:dash:profile:isoff-on-demand:2011\" "
+                   "mediaPresentationDuration=\"PT%dS\" minBufferTime=\"PT1S\">\n"
+                   "<Period id=\"0\" start=\"PT0S\"><AdaptationSet contentType=\"audio\">\n"
+                   "<Representation id=\"a\" bandwidth=\"100000\" mimeType=\"audio/aac\">\n"
+                   "<SegmentList duration=\"1\" timescale=\"1\">\n",
+                   NB_FRAGMENTS);
+    for (i = 0; i < NB_FRAGMENTS; i++)
+        len += snprintf(manifest + len, sizeof(manifest) - len,
+                        "<SegmentURL media=\"%d.aac\"/>\n", i);
+    snprintf(manifest + len, sizeof(manifest) - len,
+             "</SegmentList></Representation></AdaptationSet></Period></MPD>\n");
+}
+
+/* Answer one request, "/<dir>/index.mpd" is the manifest and
+ * "/<dir>/<n>.aac" fragment n. */
+static void *client_thread(void *arg)
+{
+    URLContext *c = arg;
+    char line[1024], path[256] = "";
+    const uint8_t *data = NULL;
+    int size = 0, cut, n = -1;
+    char *dir, *name;
+
+    if (test_http_read_line(c, line, sizeof(line)) < 0)
+        goto end;
+    sscanf(line, "GET %255s", path);
+    while (test_http_read_line(c, line, sizeof(line)) > 0);
+
+    dir  = path + 1;
+    name = strchr(dir, '/');
+    if (name)
+        *name++ = '\0';
+    if (name && !strcmp(name, "index.mpd")) {
+        data = (const uint8_t *)manifest;
+        size = strlen(manifest);
+    } else if (name && sscanf(name, "%d.aac", &n) == 1 && n >= 0 && n < NB_FRAGMENTS) {
+        data = fragments[n];
+        size = fragment_size[n];
+    }
+    cut = !strcmp(dir, "cut") && n == CUT_FRAGMENT &&
+          atomic_fetch_add(&cut_requests, 1) == 0;
+
+    snprintf(line, sizeof(line),
+             "HTTP/1.1 %s\r\nContent-Length: %d\r\nConnection: close\r\n\r\n",
+             data ? "200 OK" : "404 Not Found", size);
+    if (ffurl_write(c, line, strlen(line)) < 0)
+        goto end;
+    /* let the download of the cut fragment fail before it is read */
+    if (!strcmp(dir, "cut") && n == CUT_FRAGMENT - 1)
+        av_usleep(200000);
+    if (size)
+        ffurl_write(c, data, cut ? size / 2 : size);
+end:
+    ffurl_closep(&c);
+    return NULL;
+}
+
+static pthread_t main_thread;
+static int foreign_opens;
+
+/* a custom io_open must only be called on the demuxer thread */
+static int test_io_open(AVFormatContext *s, AVIOContext **pb, const char *url,
+                        int flags, AVDictionary **opts)
+{
+    if (!pthread_equal(pthread_self(), main_thread))
+        foreign_opens++;
+    return avio_open2(pb, url, flags, &s->interrupt_callback, opts);
+}
+
+static int run_test(const char *dir, int prefetch, int custom_io)
+{
+    AVFormatContext *ic = avformat_alloc_context();
+    AVDictionary *opts = NULL;
+    AVPacket pkt;
+    unsigned long crc = 1, expected = 1;
+    char url[64];
+    int i, ret, packets = 0;
+
+    for (i = 0; i < NB_FRAGMENTS; i++)
+        expected = av_adler32_update(expected, fragments[i], fragment_size[i]);
+
+    if (!ic)
+        return AVERROR(ENOMEM);
+    if (custom_io)
+        ic->io_open = test_io_open;
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/%s/index.mpd", server.port, dir);
+    av_dict_set_int(&opts, "prefetch_fragments", prefetch, 0);
+    ret = avformat_open_input(&ic, url, NULL, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        printf("%s, prefetch %d: open failed: %s\n", dir, prefetch, av_err2str(ret));
+        return ret;
+    }
+    while ((ret = av_read_frame(ic, &pkt)) >= 0) {
+        crc = av_adler32_update(crc, pkt.data, pkt.size);
+        packets++;
+        av_packet_unref(&pkt);
+    }
+    avformat_close_input(&ic);
+
+    printf("%s, prefetch %d%s: %d packets, data %s\n", dir, prefetch,
+           custom_io ? ", custom io_open" : "", packets,
+           crc == expected ? "ok" : "mismatch");
+    return crc == expected ? 0 : AVERROR_INVALIDDATA;
+}
+
+int main(void)
+{
+    int ret;
+
+    make_fragments();
+    make_manifest();
+
+    if (test_http_server_start(&server, client_thread) < 0)
+        return 1;
+
+    main_thread = pthread_self();
+    ret = run_test("plain", 0, 0);
+    if (ret >= 0)
+        ret = run_test("plain", 2, 0);
+    if (ret >= 0)
+        ret = run_test("cut", 2, 0);
+    if (ret >= 0)
+        printf("cut fragment requests: %d\n", atomic_load(&cut_requests));
+    if (ret >= 0)
+        ret = run_test("plain", 2, 1);
+    if (ret >= 0)
+        printf("opens on other threads: %d\n", foreign_opens);
+
+    test_http_server_stop(&server);
+
+    return ret < 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Reads a resource with parallel_connections from a range server running
+ * in the same process, then checks that a read waiting for a stalled piece
+ * gives up once the interrupt callback asks to.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/time.h"
+#include "libavformat/url.h"
+#include "httpserver.h"
+
+#define FILE_SIZE  (1024 * 1024 + 4321)
+#define PIECE_SIZE (64 * 1024)
+
+static TestHTTPServer server;
+static atomic_int range_requests;
+
+/* Answer the requests of one connection, "/stall" stops sending anything
+ * but the first piece. */
+static void *client_thread(void *arg)
+{
+    URLContext *c = arg;
+    char line[1024], path[256] = "";
+    uint8_t buf[4096];
+
+    for (;;) {
+        int64_t start = 0, end = FILE_SIZE - 1, pos;
+        int ranged = 0;
+
+        if (test_http_read_line(c, line, sizeof(line)) < 0)
+            break;
+        sscanf(line, "GET %255s", path);
+        while (test_http_read_line(c, line, sizeof(line)) > 0) {
+            const char *p;
+            if (av_stristart(line, "Range: bytes=", &p)) {
+                ranged = 1;
+                start = strtoll(p, (char **)&p, 10);
+                if (*p == '-' && p[1])
+                    end = strtoll(p + 1, NULL, 10);
+            }
+        }
+        if (ranged && start > 0)
+            atomic_fetch_add(&range_requests, 1);
+
+        snprintf(line, sizeof(line),
+                 "HTTP/1.1 %s\r\nContent-Length: %"PRId64"\r\n"
+                 "Content-Range: bytes %"PRId64"-%"PRId64"/%d\r\n"
+                 "Accept-Ranges: bytes\r\n\r\n",
+                 ranged ? "206 Partial Content" : "200 OK",
+                 end - start + 1, start, end, FILE_SIZE);
+        if (ffurl_write(c, line, strlen(line)) < 0)
+            break;
+        if (!strcmp(path, "/stall") && start > 0) {
+            while (!atomic_load(&server.stop))
+                av_usleep(10000);
+            break;
+        }
+        for (pos = start; pos <= end; ) {
+            int i, n = FFMIN(sizeof(buf), end + 1 - pos);
+            for (i = 0; i < n; i++)
+                buf[i] = test_byte(pos + i);
+            if (ffurl_write(c, buf, n) < 0)
+                goto end;
+            pos += n;
+        }
+    }
+end:
+    ffurl_closep(&c);
+    return NULL;
+}
+
+static int open_url(URLContext **h, const char *path, const AVIOInterruptCB *int_cb)
+{
+    AVDictionary *opts = NULL;
+    char url[64];
+    int ret;
+
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d%s", server.port, path);
+    av_dict_set(&opts, "parallel_connections", "4", 0);
+    av_dict_set_int(&opts, "parallel_piece_size", PIECE_SIZE, 0);
+    ret = ffurl_open_whitelist(h, url, AVIO_FLAG_READ, int_cb, &opts,
+                               NULL, NULL, NULL);
+    av_dict_free(&opts);
+    return ret;
+}
+
+static int check_read(URLContext *h, int64_t pos, int size)
+{
+    uint8_t buf[8192];
+    int i, ret;
+
+    while (size > 0) {
+        ret = ffurl_read(h, buf, FFMIN(size, sizeof(buf)));
+        if (ret <= 0)
+            return ret ? ret : AVERROR_EOF;
+        for (i = 0; i < ret; i++) {
+            if (buf[i] != test_byte(pos + i)) {
+                printf("mismatch at %"PRId64"\n", pos + i);
+                return AVERROR_INVALIDDATA;
+            }
+        }
+        pos  += ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+static int test_read(void)
+{
+    static const int64_t seeks[] = { 3 * PIECE_SIZE + 17, PIECE_SIZE - 5,
+                                     FILE_SIZE - 1000, 7 * PIECE_SIZE };
+    URLContext *h = NULL;
+    int i, ret;
+
+    if ((ret = open_url(&h, "/file", NULL)) < 0)
+        return ret;
+    ret = check_read(h, 0, FILE_SIZE);
+    printf("sequential read: %s\n", ret < 0 ? av_err2str(ret) : "ok");
+    for (i = 0; i < FF_ARRAY_ELEMS(seeks) && ret >= 0; i++) {
+        if ((ret = ffurl_seek(h, seeks[i], SEEK_SET)) >= 0)
+            ret = check_read(h, seeks[i], FFMIN(FILE_SIZE - seeks[i], 3 * PIECE_SIZE));
+        printf("read at %"PRId64": %s\n", seeks[i], ret < 0 ? av_err2str(ret) : "ok");
+    }
+    ffurl_closep(&h);
+    printf("range requests made: %s\n", atomic_load(&range_requests) > 1 ? "yes" : "no");
+    return ret;
+}
+
+/* the download threads call the interrupt callback as well */
+typedef struct Deadline {
+    atomic_int armed;
+    int64_t time;
+} Deadline;
+
+static int deadline_cb(void *opaque)
+{
+    Deadline *d = opaque;
+
+    return atomic_load(&d->armed) && av_gettime_relative() > d->time;
+}
+
+static int test_interrupt(void)
+{
+    Deadline deadline = { 0 };
+    AVIOInterruptCB int_cb = { deadline_cb, &deadline };
+    URLContext *h = NULL;
+    int ret;
+
+    if ((ret = open_url(&h, "/stall", &int_cb)) < 0)
+        return ret;
+    if ((ret = check_read(h, 0, PIECE_SIZE)) >= 0) {
+        deadline.time = av_gettime_relative() + 200000;
+        atomic_store(&deadline.armed, 1);
+        ret = check_read(h, PIECE_SIZE, PIECE_SIZE);
+    }
+    printf("stalled read: %s\n", av_err2str(ret));
+    ffurl_closep(&h);
+    return ret == AVERROR_EXIT ? 0 : AVERROR_BUG;
+}
+
+int main(void)
+{
+    int ret;
+
+    if (test_http_server_start(&server, client_thread) < 0)
+        return 1;
+
+    ret = test_read();
+    if (ret >= 0)
+        ret = test_interrupt();
+
+    test_http_server_stop(&server);
+
+    return ret < 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Reads a live stream from a http server running in the same process. The
+ * server ends every response after a part of the stream and refuses the
+ * first reconnect, the reader must go on reconnecting until it gets the
+ * rest. All requests after the last part are refused as well, until the
+ * reader gives up after reconnect_delay_max.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libavformat/url.h"
+#include "httpserver.h"
+
+#define PART_SIZE 10000
+#define NB_PARTS  3
+
+static TestHTTPServer server;
+static atomic_int requests;
+
+/* Answer one request with the next part of the stream, the second one,
+ * which is the first reconnect, with an error. */
+static void *client_thread(void *arg)
+{
+    URLContext *c = arg;
+    char line[1024];
+    uint8_t buf[PART_SIZE];
+    int i, n, part;
+
+    if (test_http_read_line(c, line, sizeof(line)) < 0)
+        goto end;
+    while (test_http_read_line(c, line, sizeof(line)) > 0);
+
+    n    = atomic_fetch_add(&requests, 1);
+    part = n > 1 ? n - 1 : n;
+    if (n == 1 || part >= NB_PARTS) {
+        snprintf(line, sizeof(line),
+                 "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n"
+                 "Connection: close\r\n\r\n");
+        ffurl_write(c, line, strlen(line));
+        goto end;
+    }
+    snprintf(line, sizeof(line), "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n");
+    if (ffurl_write(c, line, strlen(line)) < 0)
+        goto end;
+    for (i = 0; i < PART_SIZE; i++)
+        buf[i] = test_byte((int64_t)part * PART_SIZE + i);
+    ffurl_write(c, buf, PART_SIZE);
+end:
+    ffurl_closep(&c);
+    return NULL;
+}
+
+static int run_test(void)
+{
+    URLContext *h = NULL;
+    AVDictionary *opts = NULL;
+    uint8_t buf[4096];
+    char url[64];
+    int64_t pos = 0;
+    int i, ret;
+
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/live", server.port);
+    av_dict_set(&opts, "reconnect_streamed", "1", 0);
+    av_dict_set(&opts, "reconnect_at_eof", "1", 0);
+    av_dict_set(&opts, "reconnect_backoff", "10", 0);
+    av_dict_set(&opts, "reconnect_delay_max", "1", 0);
+    ret = ffurl_open_whitelist(&h, url, AVIO_FLAG_READ, NULL, &opts,
+                               NULL, NULL, NULL);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        printf("open failed: %s\n", av_err2str(ret));
+        return ret;
+    }
+    while ((ret = ffurl_read(h, buf, sizeof(buf))) > 0) {
+        for (i = 0; i < ret; i++) {
+            if (buf[i] != test_byte(pos + i)) {
+                printf("mismatch at %"PRId64"\n", pos + i);
+                ffurl_closep(&h);
+                return AVERROR_INVALIDDATA;
+            }
+        }
+        pos += ret;
+    }
+    ffurl_closep(&h);
+
+    printf("read %"PRId64" of %d bytes: %s\n", pos, NB_PARTS * PART_SIZE,
+           ret == AVERROR_EOF ? "EOF" : av_err2str(ret));
+    printf("requests: %d\n", atomic_load(&requests));
+    return pos == NB_PARTS * PART_SIZE ? 0 : AVERROR_INVALIDDATA;
+}
+
+int main(void)
+{
+    int ret;
+
+    if (test_http_server_start(&server, client_thread) < 0)
+        return 1;
+
+    ret = run_test();
+
+    test_http_server_stop(&server);
+
+    return ret < 0;
+}
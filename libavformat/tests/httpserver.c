@@ -0,0 +1,134 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "libavutil/error.h"
+#include "libavformat/network.h"
+#include "httpserver.h"
+
+int test_free_port(void)
+{
+    struct sockaddr_in addr = { 0 };
+    socklen_t addrlen = sizeof(addr);
+    int fd, ret;
+
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((fd = ff_socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return ff_neterrno();
+    /* binding to port 0 makes the system pick one */
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        getsockname(fd, (struct sockaddr *)&addr, &addrlen))
+        ret = ff_neterrno();
+    else
+        ret = ntohs(addr.sin_port);
+    closesocket(fd);
+    return ret;
+}
+
+int test_http_read_line(URLContext *c, char *line, int size)
+{
+    int len = 0;
+    uint8_t ch;
+
+    while (ffurl_read_complete(c, &ch, 1) == 1) {
+        if (ch == '\n') {
+            if (len && line[len - 1] == '\r')
+                len--;
+            line[len] = '\0';
+            return len;
+        }
+        if (len < size - 1)
+            line[len++] = ch;
+    }
+    return -1;
+}
+
+static void *server_thread(void *arg)
+{
+    TestHTTPServer *s = arg;
+
+    while (s->nb_clients < TEST_HTTP_MAX_CLIENTS) {
+        URLContext *c = NULL;
+
+        if (ffurl_accept(s->listen, &c) < 0)
+            break;
+        /* marks c connected, so that closing it closes the socket */
+        ffurl_handshake(c);
+        if (atomic_load(&s->stop)) {
+            ffurl_closep(&c);
+            break;
+        }
+        if (pthread_create(&s->clients[s->nb_clients], NULL, s->client_thread, c)) {
+            ffurl_closep(&c);
+            break;
+        }
+        s->nb_clients++;
+    }
+    return NULL;
+}
+
+int test_http_server_start(TestHTTPServer *s, void *(*client_thread)(void *c))
+{
+    char url[64];
+    int ret, tries;
+
+    s->client_thread = client_thread;
+    atomic_init(&s->stop, 0);
+    s->nb_clients = 0;
+    /* someone else may take the port before we listen on it */
+    for (tries = 0; tries < 10; tries++) {
+        if ((s->port = test_free_port()) < 0)
+            return s->port;
+        snprintf(url, sizeof(url), "tcp://127.0.0.1:%d?listen=2", s->port);
+        ret = ffurl_open_whitelist(&s->listen, url, AVIO_FLAG_READ_WRITE, NULL,
+                                   NULL, NULL, NULL, NULL);
+        if (ret != AVERROR(EADDRINUSE))
+            break;
+    }
+    if (ret < 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", url, av_err2str(ret));
+        return ret;
+    }
+    if ((ret = pthread_create(&s->thread, NULL, server_thread, s))) {
+        fprintf(stderr, "pthread_create failed: %s.\n", strerror(ret));
+        ffurl_closep(&s->listen);
+        return AVERROR(ret);
+    }
+    return 0;
+}
+
+void test_http_server_stop(TestHTTPServer *s)
+{
+    URLContext *wake = NULL;
+    char url[64];
+    int i;
+
+    atomic_store(&s->stop, 1);
+    /* ffurl_accept() does not return on its own */
+    snprintf(url, sizeof(url), "tcp://127.0.0.1:%d", s->port);
+    if (ffurl_open_whitelist(&wake, url, AVIO_FLAG_READ_WRITE, NULL,
+                             NULL, NULL, NULL, NULL) >= 0)
+        ffurl_closep(&wake);
+    pthread_join(s->thread, NULL);
+    for (i = 0; i < s->nb_clients; i++)
+        pthread_join(s->clients[i], NULL);
+    ffurl_closep(&s->listen);
+}
@@ -0,0 +1,81 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * A http server for the tests, running in the same process. Every accepted
+ * connection is handed to a thread of its own, the tests answer the
+ * requests themselves.
+ */
+
+#ifndef AVFORMAT_TESTS_HTTPSERVER_H
+#define AVFORMAT_TESTS_HTTPSERVER_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "libavutil/thread.h"
+#include "libavformat/url.h"
+
+#define TEST_HTTP_MAX_CLIENTS 64
+
+typedef struct TestHTTPServer {
+    /* called on a new thread with the URLContext of each connection, which
+     * it must close */
+    void *(*client_thread)(void *c);
+    int port;
+    /* set once the server is stopping */
+    atomic_int stop;
+
+    URLContext *listen;
+    pthread_t thread;
+    pthread_t clients[TEST_HTTP_MAX_CLIENTS];
+    int nb_clients;
+} TestHTTPServer;
+
+/**
+ * Start listening on 127.0.0.1, on a port the system chooses, and accept
+ * connections on a thread.
+ */
+int test_http_server_start(TestHTTPServer *s, void *(*client_thread)(void *c));
+
+/**
+ * Stop accepting connections and wait for the client threads to return.
+ */
+void test_http_server_stop(TestHTTPServer *s);
+
+/**
+ * Read a line of a request, without its line ending.
+ *
+ * @return the length of the line, -1 once the connection is closed
+ */
+int test_http_read_line(URLContext *c, char *line, int size);
+
+/**
+ * @return a free port on 127.0.0.1, or a negative AVERROR
+ */
+int test_free_port(void);
+
+/* Test data with no short period, so that data read from the wrong offset
+ * does not match. */
+static inline uint8_t test_byte(int64_t pos)
+{
+    uint64_t x = (uint64_t)pos * 0x9E3779B97F4A7C15ULL;
+    return (x ^ (x >> 29)) >> 56;
+}
+
+#endif /* AVFORMAT_TESTS_HTTPSERVER_H */
@@ -0,0 +1,172 @@
+/*
+ * This file is part of FFmpeg.
+ *
+ * FFmpeg is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * FFmpeg is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with FFmpeg; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Opens a file ending with its moov atom from a http server running in the
+ * same process, and checks that the connection prefetching the moov is
+ * opened through the io_open callback with the options of the input.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libavutil/avstring.h"
+#include "libavutil/intreadwrite.h"
+#include "libavformat/avformat.h"
+#include "libavformat/url.h"
+#include "httpserver.h"
+
+#define MDAT_SIZE   (64 * 1024)
+
+static TestHTTPServer server;
+
+static uint8_t file[28 + MDAT_SIZE + 8 + 108];
+static int moov_offset;
+
+static int nb_opens;
+static char prefetch_offset[32], prefetch_headers[64], prefetch_tls_verify[8];
+
+/* ftyp, an mdat of zeros and a moov holding only a mvhd */
+static void make_file(void)
+{
+    uint8_t *p = file;
+
+    AV_WB32(p, 20);
+    memcpy(p + 4, "ftypisom\0\0\0\0isom", 16);
+    p += 20;
+    AV_WB32(p, 8 + MDAT_SIZE);
+    memcpy(p + 4, "mdat", 4);
+    p += 8 + MDAT_SIZE;
+
+    moov_offset = p - file;
+    AV_WB32(p, 8 + 108);
+    memcpy(p + 4, "moov", 4);
+    p += 8;
+    AV_WB32(p, 108);
+    memcpy(p + 4, "mvhd", 4);
+    AV_WB32(p + 20, 1000);          /* time scale */
+    AV_WB32(p + 24, 1000);          /* duration */
+    AV_WB32(p + 28, 0x10000);       /* rate */
+    AV_WB16(p + 32, 0x100);         /* volume */
+    AV_WB32(p + 44, 0x10000);       /* matrix */
+    AV_WB32(p + 60, 0x10000);
+    AV_WB32(p + 76, 0x40000000);
+    AV_WB32(p + 104, 1);            /* next track id */
+}
+
+/* Answer one request for the file, ranges included. */
+static void *client_thread(void *arg)
+{
+    URLContext *c = arg;
+    char line[1024];
+    int64_t start = 0, end = sizeof(file) - 1;
+    int ranged = 0;
+
+    if (test_http_read_line(c, line, sizeof(line)) < 0)
+        goto end;
+    while (test_http_read_line(c, line, sizeof(line)) > 0) {
+        const char *p;
+        if (av_stristart(line, "Range: bytes=", &p)) {
+            ranged = 1;
+            start = strtoll(p, (char **)&p, 10);
+            if (*p == '-' && p[1])
+                end = FFMIN(strtoll(p + 1, NULL, 10), end);
+        }
+    }
+    if (start > end)
+        goto end;
+
+    snprintf(line, sizeof(line),
+             "HTTP/1.1 %s\r\nContent-Length: %"PRId64"\r\n"
+             "Content-Range: bytes %"PRId64"-%"PRId64"/%d\r\n"
+             "Accept-Ranges: bytes\r\nConnection: close\r\n\r\n",
+             ranged ? "206 Partial Content" : "200 OK",
+             end - start + 1, start, end, (int)sizeof(file));
+    if (ffurl_write(c, line, strlen(line)) >= 0)
+        ffurl_write(c, file + start, end - start + 1);
+end:
+    ffurl_closep(&c);
+    return NULL;
+}
+
+static void copy_option(char *dst, int size, AVDictionary *opts, const char *key)
+{
+    AVDictionaryEntry *e = av_dict_get(opts, key, NULL, 0);
+
+    av_strlcpy(dst, e ? e->value : "(none)", size);
+}
+
+static int test_io_open(AVFormatContext *s, AVIOContext **pb, const char *url,
+                        int flags, AVDictionary **opts)
+{
+    /* the first open is the input itself */
+    if (nb_opens++ == 1) {
+        copy_option(prefetch_offset,     sizeof(prefetch_offset),     *opts, "offset");
+        copy_option(prefetch_headers,    sizeof(prefetch_headers),    *opts, "headers");
+        copy_option(prefetch_tls_verify, sizeof(prefetch_tls_verify), *opts, "tls_verify");
+    }
+    return avio_open2(pb, url, flags, &s->interrupt_callback, opts);
+}
+
+static int run_test(void)
+{
+    AVFormatContext *ic = avformat_alloc_context();
+    AVDictionary *opts = NULL;
+    char url[64];
+    int ret;
+
+    if (!ic)
+        return AVERROR(ENOMEM);
+    ic->io_open = test_io_open;
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/file.mov", server.port);
+    av_dict_set(&opts, "headers", "X-Test: 1\r\n", 0);
+    av_dict_set(&opts, "tls_verify", "1", 0);
+    av_dict_set(&opts, "moov_prefetch_mdat_size", "4096", 0);
+    ret = avformat_open_input(&ic, url, av_find_input_format("mov"), &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        printf("open failed: %s\n", av_err2str(ret));
+        return ret;
+    }
+    avformat_close_input(&ic);
+
+    printf("opens: %d\n", nb_opens);
+    printf("prefetch offset: %s\n",
+           atoi(prefetch_offset) == moov_offset ? "moov" : prefetch_offset);
+    printf("prefetch headers: %s\n",
+           strcmp(prefetch_headers, "X-Test: 1\r\n") ? prefetch_headers : "X-Test: 1");
+    printf("prefetch tls_verify: %s\n", prefetch_tls_verify);
+    return 0;
+}
+
+int main(void)
+{
+    int ret;
+
+    make_file();
+
+    if (test_http_server_start(&server, client_thread) < 0)
+        return 1;
+
+    ret = run_test();
+
+    test_http_server_stop(&server);
+
+    return ret < 0;
+}
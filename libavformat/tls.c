@@ -25,9 +25,25 @@
 #include "os_support.h"
 #include "url.h"
 #include "tls.h"
+#include "libavutil/application.h"
 #include "libavutil/avstring.h"
 #include "libavutil/opt.h"
 #include "libavutil/parseutils.h"
+#include "libavutil/thread.h"
+#include "libavutil/time.h"
+
+#define TLS_SESSION_CACHE_SIZE 64
+
+typedef struct TLSSessionEntry {
+    char key[1024];
+    uint8_t *data;
+    int size;
+    int64_t last_use;
+} TLSSessionEntry;
+
+static AVMutex session_lock = AV_MUTEX_INITIALIZER;
+static TLSSessionEntry sessions[TLS_SESSION_CACHE_SIZE];
+static int64_t session_handshakes, session_offered, session_resumed;
 
 static void set_options(TLSShared *c, const char *uri)
 {
@@ -89,6 +105,22 @@ int ff_tls_open_underlying(TLSShared *c, URLContext *parent, const char *uri, AV
     if (!c->host && !(c->host = av_strdup(c->underlying_host)))
         return AVERROR(ENOMEM);
 
+    /* Sessions belong to the server name that was verified and are only
+     * resumed with the same verification and client certificate, a
+     * resumed session skips both. Keys that do not fit are not cached. */
+    if (c->session_cache && !c->listen) {
+        snprintf(c->session_server, sizeof(c->session_server), "%s:%d", c->host, port);
+        if (snprintf(c->session_key, sizeof(c->session_key), "%s verify=%d ca=%s cert=%s key=%s",
+                     c->session_server, c->verify, c->ca_file ? c->ca_file : "",
+                     c->cert_file ? c->cert_file : "",
+                     c->key_file ? c->key_file : "") >= sizeof(c->session_key))
+            c->session_key[0] = '\0';
+    }
+
+    /* consumed by the tls options, but meant for tcp as well */
+    if (c->app_ctx_intptr)
+        av_dict_set_int(options, "ijkapplication", c->app_ctx_intptr, 0);
+
     proxy_path = getenv("http_proxy");
     use_proxy = !ff_http_match_no_proxy(getenv("no_proxy"), c->underlying_host) &&
                 proxy_path && av_strstart(proxy_path, "http://", NULL);
@@ -108,3 +140,84 @@ int ff_tls_open_underlying(TLSShared *c, URLContext *parent, const char *uri, AV
                                 &parent->interrupt_callback, options,
                                 parent->protocol_whitelist, parent->protocol_blacklist, parent);
 }
+
+static TLSSessionEntry *session_find(const char *key)
+{
+    int i;
+
+    for (i = 0; i < TLS_SESSION_CACHE_SIZE; i++)
+        if (sessions[i].data && !strcmp(sessions[i].key, key))
+            return &sessions[i];
+    return NULL;
+}
+
+int ff_tls_session_get(TLSShared *c, uint8_t **data, int *size)
+{
+    TLSSessionEntry *entry;
+    int ret = AVERROR(ENOENT);
+
+    if (!c->session_key[0])
+        return ret;
+
+    ff_mutex_lock(&session_lock);
+    if ((entry = session_find(c->session_key))) {
+        *data = av_memdup(entry->data, entry->size);
+        *size = entry->size;
+        entry->last_use = av_gettime_relative();
+        ret = *data ? 0 : AVERROR(ENOMEM);
+    }
+    ff_mutex_unlock(&session_lock);
+    return ret;
+}
+
+void ff_tls_session_put(TLSShared *c, const uint8_t *data, int size)
+{
+    TLSSessionEntry *entry;
+    uint8_t *copy;
+    int i;
+
+    if (!c->session_key[0] || size <= 0 || !(copy = av_memdup(data, size)))
+        return;
+
+    ff_mutex_lock(&session_lock);
+    if (!(entry = session_find(c->session_key))) {
+        /* the least recently used entry makes room */
+        entry = &sessions[0];
+        for (i = 1; i < TLS_SESSION_CACHE_SIZE && entry->data; i++)
+            if (!sessions[i].data || sessions[i].last_use < entry->last_use)
+                entry = &sessions[i];
+        av_strlcpy(entry->key, c->session_key, sizeof(entry->key));
+    }
+    av_free(entry->data);
+    entry->data     = copy;
+    entry->size     = size;
+    entry->last_use = av_gettime_relative();
+    ff_mutex_unlock(&session_lock);
+}
+
+void ff_tls_session_report(TLSShared *c, void *log_ctx, int offered, int resumed)
+{
+    AVAppTlsSessionStatistic statistic = { sizeof(statistic) };
+
+    if (!c->session_key[0])
+        return;
+
+    ff_mutex_lock(&session_lock);
+    session_handshakes++;
+    session_offered += offered;
+    session_resumed += resumed > 0;
+    statistic.handshake_count = session_handshakes;
+    statistic.offered_count   = session_offered;
+    statistic.resumed_count   = session_resumed;
+    ff_mutex_unlock(&session_lock);
+
+    av_log(log_ctx, AV_LOG_VERBOSE, "%s handshake with %s, %"PRId64" of %"PRId64" sessions resumed\n",
+           resumed > 0 ? "Abbreviated" : "Full", c->session_server,
+           statistic.resumed_count, statistic.handshake_count);
+
+    av_strlcpy(statistic.server, c->session_server, sizeof(statistic.server));
+    statistic.offered = offered;
+    statistic.resumed = resumed;
+    av_application_on_tls_session_statistic((AVApplicationContext *)(intptr_t)c->app_ctx_intptr,
+                                            &statistic);
+}
@@ -39,6 +39,14 @@ typedef struct TLSShared {
     int numerichost;
 
     URLContext *tcp;
+
+    int session_cache;
+    /* host:port sessions are cached for */
+    char session_server[256];
+    /* the server and the options that decide whether a session may be
+     * resumed, empty if sessions are not cached */
+    char session_key[1024];
+    int64_t app_ctx_intptr;
 } TLSShared;
 
 #define TLS_OPTFL (AV_OPT_FLAG_DECODING_PARAM | AV_OPT_FLAG_ENCODING_PARAM)
@@ -49,10 +57,34 @@ typedef struct TLSShared {
     {"cert_file",  "Certificate file",                    offsetof(pstruct, options_field . cert_file), AV_OPT_TYPE_STRING, .flags = TLS_OPTFL }, \
     {"key_file",   "Private key file",                    offsetof(pstruct, options_field . key_file),  AV_OPT_TYPE_STRING, .flags = TLS_OPTFL }, \
     {"listen",     "Listen for incoming connections",     offsetof(pstruct, options_field . listen),    AV_OPT_TYPE_INT, { .i64 = 0 }, 0, 1, .flags = TLS_OPTFL }, \
-    {"verifyhost", "Verify against a specific hostname",  offsetof(pstruct, options_field . host),      AV_OPT_TYPE_STRING, .flags = TLS_OPTFL }
+    {"verifyhost", "Verify against a specific hostname",  offsetof(pstruct, options_field . host),      AV_OPT_TYPE_STRING, .flags = TLS_OPTFL }, \
+    {"tls_session_cache", "Resume sessions of earlier connections to the same server", offsetof(pstruct, options_field . session_cache), AV_OPT_TYPE_BOOL, { .i64 = 1 }, 0, 1, .flags = TLS_OPTFL }, \
+    {"ijkapplication", "AVApplicationContext",            offsetof(pstruct, options_field . app_ctx_intptr), AV_OPT_TYPE_INT64, { .i64 = 0 }, INT64_MIN, INT64_MAX, .flags = AV_OPT_FLAG_DECODING_PARAM }
 
 int ff_tls_open_underlying(TLSShared *c, URLContext *parent, const char *uri, AVDictionary **options);
 
+/**
+ * Get a copy of the serialized session last stored for the server of c.
+ *
+ * @return 0 on success, AVERROR(ENOENT) if there is none
+ */
+int ff_tls_session_get(TLSShared *c, uint8_t **data, int *size);
+
+/**
+ * Store a serialized session for the server of c in the process wide
+ * session cache, replacing the previous one.
+ */
+void ff_tls_session_put(TLSShared *c, const uint8_t *data, int size);
+
+/**
+ * Account a completed client handshake in the cache statistics and report
+ * them to the application.
+ *
+ * @param offered whether a cached session was offered to the server
+ * @param resumed whether the server resumed it, -1 if the backend cannot tell
+ */
+void ff_tls_session_report(TLSShared *c, void *log_ctx, int offered, int resumed);
+
 void ff_gnutls_init(void);
 void ff_gnutls_deinit(void);
 
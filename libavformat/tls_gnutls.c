@@ -141,7 +141,7 @@ static int tls_open(URLContext *h, const char *uri, int flags, AVDictionary **op
 {
     TLSContext *p = h->priv_data;
     TLSShared *c = &p->tls_shared;
-    int ret;
+    int ret, offered = 0;
 
     ff_gnutls_init();
 
@@ -181,6 +181,14 @@ static int tls_open(URLContext *h, const char *uri, int flags, AVDictionary **op
     gnutls_transport_set_push_function(p->session, gnutls_url_push);
     gnutls_transport_set_ptr(p->session, c->tcp);
     gnutls_priority_set_direct(p->session, "NORMAL", NULL);
+    if (c->session_key[0]) {
+        uint8_t *data;
+        int size;
+        if (ff_tls_session_get(c, &data, &size) >= 0) {
+            offered = gnutls_session_set_data(p->session, data, size) >= 0;
+            av_free(data);
+        }
+    }
     do {
         if (ff_check_interrupt(&h->interrupt_callback)) {
             ret = AVERROR_EXIT;
@@ -226,6 +234,15 @@ static int tls_open(URLContext *h, const char *uri, int flags, AVDictionary **op
             goto fail;
         }
     }
+    /* cache the session only once the peer passed verification */
+    if (c->session_key[0]) {
+        gnutls_datum_t session;
+        ff_tls_session_report(c, h, offered, gnutls_session_is_resumed(p->session));
+        if (gnutls_session_get_data2(p->session, &session) >= 0) {
+            ff_tls_session_put(c, session.data, session.size);
+            gnutls_free(session.data);
+        }
+    }
 
     return 0;
 fail:
@@ -269,6 +286,12 @@ static int tls_get_file_handle(URLContext *h)
     return ffurl_get_file_handle(c->tls_shared.tcp);
 }
 
+static void *tls_child_next(void *obj, void *prev)
+{
+    TLSContext *c = obj;
+    return prev ? NULL : c->tls_shared.tcp;
+}
+
 static const AVOption options[] = {
     TLS_COMMON_OPTIONS(TLSContext, tls_shared),
     { NULL }
@@ -279,6 +302,7 @@ static const AVClass tls_class = {
     .item_name  = av_default_item_name,
     .option     = options,
     .version    = LIBAVUTIL_VERSION_INT,
+    .child_next = tls_child_next,
 };
 
 const URLProtocol ff_tls_protocol = {
@@ -181,6 +181,12 @@ static int tls_get_file_handle(URLContext *h)
     return ffurl_get_file_handle(c->tls_shared.tcp);
 }
 
+static void *tls_child_next(void *obj, void *prev)
+{
+    TLSContext *c = obj;
+    return prev ? NULL : c->tls_shared.tcp;
+}
+
 static const AVOption options[] = {
     TLS_COMMON_OPTIONS(TLSContext, tls_shared),
     { NULL }
@@ -191,6 +197,7 @@ static const AVClass tls_class = {
     .item_name  = av_default_item_name,
     .option     = options,
     .version    = LIBAVUTIL_VERSION_INT,
+    .child_next = tls_child_next,
 };
 
 const URLProtocol ff_tls_protocol = {
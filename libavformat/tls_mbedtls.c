@@ -26,6 +26,7 @@
 #include <mbedtls/net_sockets.h>
 #include <mbedtls/platform.h>
 #include <mbedtls/ssl.h>
+#include <mbedtls/version.h>
 #include <mbedtls/x509_crt.h>
 
 #include "avformat.h"
@@ -159,12 +160,47 @@ static void parse_options(TLSContext *tls_ctxc, const char *uri)
         tls_ctxc->priv_key_pw = av_strdup(buf);
 }
 
+#if MBEDTLS_VERSION_NUMBER >= 0x02130000
+/* Offer the session cached for the server, returns whether there was one. */
+static int tls_set_cached_session(TLSContext *tls_ctx)
+{
+    mbedtls_ssl_session session;
+    uint8_t *data;
+    int size, ret = 0;
+
+    if (ff_tls_session_get(&tls_ctx->tls_shared, &data, &size) < 0)
+        return 0;
+    mbedtls_ssl_session_init(&session);
+    if (!mbedtls_ssl_session_load(&session, data, size))
+        ret = !mbedtls_ssl_set_session(&tls_ctx->ssl_context, &session);
+    mbedtls_ssl_session_free(&session);
+    av_free(data);
+    return ret;
+}
+
+static void tls_store_session(TLSContext *tls_ctx)
+{
+    mbedtls_ssl_session session;
+    uint8_t *data = NULL;
+    size_t size = 0;
+
+    mbedtls_ssl_session_init(&session);
+    if (!mbedtls_ssl_get_session(&tls_ctx->ssl_context, &session) &&
+        mbedtls_ssl_session_save(&session, NULL, 0, &size) == MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL &&
+        (data = av_malloc(size)) &&
+        !mbedtls_ssl_session_save(&session, data, size, &size))
+        ff_tls_session_put(&tls_ctx->tls_shared, data, size);
+    av_free(data);
+    mbedtls_ssl_session_free(&session);
+}
+#endif
+
 static int tls_open(URLContext *h, const char *uri, int flags, AVDictionary **options)
 {
     TLSContext *tls_ctx = h->priv_data;
     TLSShared *shr = &tls_ctx->tls_shared;
     uint32_t verify_res_flags;
-    int ret;
+    int ret, offered = 0;
 
     // parse additional options
     parse_options(tls_ctx, uri);
@@ -248,6 +284,11 @@ static int tls_open(URLContext *h, const char *uri, int flags, AVDictionary **op
     // set I/O functions to use FFmpeg internal code for transport layer
     mbedtls_ssl_set_bio(&tls_ctx->ssl_context, shr->tcp, mbedtls_send, mbedtls_recv, NULL);
 
+#if MBEDTLS_VERSION_NUMBER >= 0x02130000
+    if (shr->session_key[0])
+        offered = tls_set_cached_session(tls_ctx);
+#endif
+
     // ssl handshake
     while ((ret = mbedtls_ssl_handshake(&tls_ctx->ssl_context)) != 0) {
         if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
@@ -268,6 +309,13 @@ static int tls_open(URLContext *h, const char *uri, int flags, AVDictionary **op
         }
     }
 
+#if MBEDTLS_VERSION_NUMBER >= 0x02130000
+    if (shr->session_key[0])
+        tls_store_session(tls_ctx);
+#endif
+    // mbedtls does not tell whether the session was resumed
+    ff_tls_session_report(shr, h, offered, -1);
+
     return 0;
 
 fail:
@@ -326,6 +374,12 @@ static int tls_get_file_handle(URLContext *h)
     return ffurl_get_file_handle(c->tls_shared.tcp);
 }
 
+static void *tls_child_next(void *obj, void *prev)
+{
+    TLSContext *c = obj;
+    return prev ? NULL : c->tls_shared.tcp;
+}
+
 static const AVOption options[] = {
     TLS_COMMON_OPTIONS(TLSContext, tls_shared), \
     {"key_password", "Password for the private key file", OFFSET(priv_key_pw),  AV_OPT_TYPE_STRING, .flags = TLS_OPTFL }, \
@@ -337,6 +391,7 @@ static const AVClass tls_class = {
     .item_name  = av_default_item_name,
     .option     = options,
     .version    = LIBAVUTIL_VERSION_INT,
+    .child_next = tls_child_next,
 };
 
 const URLProtocol ff_tls_protocol = {
@@ -232,12 +232,48 @@ static BIO_METHOD url_bio_method = {
 };
 #endif
 
+/* Called for every session the server issues, with TLS 1.3 possibly
+ * after the handshake. */
+static int tls_new_session(SSL *ssl, SSL_SESSION *session)
+{
+    TLSContext *p = SSL_get_app_data(ssl);
+    int size = i2d_SSL_SESSION(session, NULL);
+    uint8_t *data, *ptr;
+
+    if (size > 0 && (data = ptr = av_malloc(size))) {
+        if (i2d_SSL_SESSION(session, &ptr) == size)
+            ff_tls_session_put(&p->tls_shared, data, size);
+        av_free(data);
+    }
+    /* the session is not kept */
+    return 0;
+}
+
+/* Offer the session cached for the server, returns whether there was one. */
+static int tls_set_cached_session(TLSContext *p)
+{
+    SSL_SESSION *session;
+    const unsigned char *ptr;
+    uint8_t *data;
+    int size, ret = 0;
+
+    if (ff_tls_session_get(&p->tls_shared, &data, &size) < 0)
+        return 0;
+    ptr = data;
+    if ((session = d2i_SSL_SESSION(NULL, &ptr, size))) {
+        ret = SSL_set_session(p->ssl, session) == 1;
+        SSL_SESSION_free(session);
+    }
+    av_free(data);
+    return ret;
+}
+
 static int tls_open(URLContext *h, const char *uri, int flags, AVDictionary **options)
 {
     TLSContext *p = h->priv_data;
     TLSShared *c = &p->tls_shared;
     BIO *bio;
-    int ret;
+    int ret, offered = 0;
 
     if ((ret = ff_openssl_init()) < 0)
         return ret;
@@ -276,12 +312,19 @@ static int tls_open(URLContext *h, const char *uri, int flags, AVDictionary **op
     // the requested hostname.
     if (c->verify)
         SSL_CTX_set_verify(p->ctx, SSL_VERIFY_PEER|SSL_VERIFY_FAIL_IF_NO_PEER_CERT, NULL);
+    if (c->session_key[0]) {
+        SSL_CTX_set_session_cache_mode(p->ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(p->ctx, tls_new_session);
+    }
     p->ssl = SSL_new(p->ctx);
     if (!p->ssl) {
         av_log(h, AV_LOG_ERROR, "%s\n", ERR_error_string(ERR_get_error(), NULL));
         ret = AVERROR(EIO);
         goto fail;
     }
+    SSL_set_app_data(p->ssl, p);
+    if (c->session_key[0])
+        offered = tls_set_cached_session(p);
 #if OPENSSL_VERSION_NUMBER >= 0x1010000fL
     p->url_bio_method = BIO_meth_new(BIO_TYPE_SOURCE_SINK, "urlprotocol bio");
     BIO_meth_set_write(p->url_bio_method, url_bio_bwrite);
@@ -308,6 +351,8 @@ static int tls_open(URLContext *h, const char *uri, int flags, AVDictionary **op
         ret = print_tls_error(h, ret);
         goto fail;
     }
+    if (!c->listen)
+        ff_tls_session_report(c, h, offered, SSL_session_reused(p->ssl));
 
     return 0;
 fail:
@@ -351,6 +396,12 @@ static int tls_get_file_handle(URLContext *h)
     return ffurl_get_file_handle(c->tls_shared.tcp);
 }
 
+static void *tls_child_next(void *obj, void *prev)
+{
+    TLSContext *c = obj;
+    return prev ? NULL : c->tls_shared.tcp;
+}
+
 static const AVOption options[] = {
     TLS_COMMON_OPTIONS(TLSContext, tls_shared),
     { NULL }
@@ -361,6 +412,7 @@ static const AVClass tls_class = {
     .item_name  = av_default_item_name,
     .option     = options,
     .version    = LIBAVUTIL_VERSION_INT,
+    .child_next = tls_child_next,
 };
 
 const URLProtocol ff_tls_protocol = {
@@ -26,6 +26,7 @@
 
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE     /* Needed for using struct ip_mreq with recent glibc */
+#define _GNU_SOURCE     /* Needed for recvmmsg() */
 
 #include "avformat.h"
 #include "avio_internal.h"
@@ -79,6 +80,11 @@
 #define UDP_RX_BUF_SIZE 393216
 #define UDP_MAX_PKT_SIZE 65536
 #define UDP_HEADER_SIZE 8
+#define UDP_MAX_RECV_BATCH 64
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
 
 typedef struct UDPContext {
     const AVClass *class;
@@ -109,6 +115,13 @@ typedef struct UDPContext {
     pthread_cond_t cond;
     int thread_started;
 #endif
+    int recv_batch;
+    int gro;
+    /* recv_batch buffers of UDP_MAX_PKT_SIZE for the receiving thread */
+    uint8_t *batch_buf;
+    int64_t packet_count;
+    int64_t overrun_count;
+    int64_t drop_count;
     uint8_t tmp[UDP_MAX_PKT_SIZE+4];
     int remaining_in_dg;
     char *localaddr;
@@ -138,6 +151,11 @@ static const AVOption options[] = {
     { "connect",        "set if connect() should be called on socket",     OFFSET(is_connected),   AV_OPT_TYPE_BOOL,   { .i64 =  0 },     0, 1,       .flags = D|E },
     { "fifo_size",      "set the UDP receiving circular buffer size, expressed as a number of packets with size of 188 bytes", OFFSET(circular_buffer_size), AV_OPT_TYPE_INT, {.i64 = 7*4096}, 0, INT_MAX, D },
     { "overrun_nonfatal", "survive in case of UDP receiving circular buffer overrun", OFFSET(overrun_nonfatal), AV_OPT_TYPE_BOOL, {.i64 = 0}, 0, 1,    D },
+    { "recv_batch",     "maximum number of datagrams received with one system call into the circular buffer", OFFSET(recv_batch), AV_OPT_TYPE_INT, { .i64 = 1 }, 1, UDP_MAX_RECV_BATCH, D },
+    { "gro",            "let the kernel coalesce received datagrams (UDP_GRO)", OFFSET(gro), AV_OPT_TYPE_BOOL, { .i64 = 0 }, 0, 1, D },
+    { "packet_count",   "number of datagrams put into the circular buffer", OFFSET(packet_count), AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT64_MAX, .flags = D | AV_OPT_FLAG_READONLY | AV_OPT_FLAG_EXPORT },
+    { "overrun_count",  "number of datagrams dropped because the circular buffer was full", OFFSET(overrun_count), AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT64_MAX, .flags = D | AV_OPT_FLAG_READONLY | AV_OPT_FLAG_EXPORT },
+    { "drop_count",     "number of datagrams dropped by the kernel because the socket buffer was full", OFFSET(drop_count), AV_OPT_TYPE_INT64, { .i64 = 0 }, 0, INT64_MAX, .flags = D | AV_OPT_FLAG_READONLY | AV_OPT_FLAG_EXPORT },
     { "timeout",        "set raise error timeout (only in read mode)",     OFFSET(timeout),        AV_OPT_TYPE_INT,    { .i64 = 0 },      0, INT_MAX, D },
     { "sources",        "Source list",                                     OFFSET(sources),        AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
     { "block",          "Block list",                                      OFFSET(block),          AV_OPT_TYPE_STRING, { .str = NULL },               .flags = D|E },
@@ -460,6 +478,109 @@ static int udp_get_file_handle(URLContext *h)
 }
 
 #if HAVE_PTHREAD_CANCEL
+/* Must be called with the mutex held. Returns 0 when the datagram was
+ * stored or dropped, a negative error if the overrun is fatal. */
+static int circular_buffer_put(URLContext *h, const uint8_t *data, int len)
+{
+    UDPContext *s = h->priv_data;
+    uint8_t hdr[4];
+
+    if (av_fifo_space(s->fifo) < len + 4) {
+        /* No Space left */
+        if (s->overrun_nonfatal) {
+            if (!(s->overrun_count++ % 1000))
+                av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
+                        "Surviving due to overrun_nonfatal option\n");
+            return 0;
+        }
+        av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
+                "To avoid, increase fifo_size URL option. "
+                "To survive in such case, use overrun_nonfatal option\n");
+        return AVERROR(EIO);
+    }
+    AV_WL32(hdr, len);
+    av_fifo_generic_write(s->fifo, hdr, 4, NULL);
+    av_fifo_generic_write(s->fifo, (void *)data, len, NULL);
+    s->packet_count++;
+    return 0;
+}
+
+#if HAVE_RECVMMSG
+/* Receive up to recv_batch datagrams per system call and store them under
+ * a single lock. With GRO a datagram may hold several ones of the size
+ * given in its control message, they are split again. */
+static void circular_buffer_rx_batch(URLContext *h, int *old_cancelstate)
+{
+    UDPContext *s = h->priv_data;
+    struct mmsghdr msgs[UDP_MAX_RECV_BATCH];
+    struct iovec iov[UDP_MAX_RECV_BATCH];
+    struct sockaddr_storage addrs[UDP_MAX_RECV_BATCH];
+    union {
+        char buf[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(uint32_t))];
+        struct cmsghdr align;
+    } control[UDP_MAX_RECV_BATCH];
+    int i, n;
+
+    while (1) {
+        for (i = 0; i < s->recv_batch; i++) {
+            iov[i].iov_base = s->batch_buf + (size_t)i * UDP_MAX_PKT_SIZE;
+            iov[i].iov_len  = UDP_MAX_PKT_SIZE;
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name       = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen    = sizeof(addrs[i]);
+            msgs[i].msg_hdr.msg_iov        = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen     = 1;
+            msgs[i].msg_hdr.msg_control    = control[i].buf;
+            msgs[i].msg_hdr.msg_controllen = sizeof(control[i].buf);
+        }
+
+        pthread_mutex_unlock(&s->mutex);
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, old_cancelstate);
+        /* block for the first datagram only, then take what is queued */
+        n = recvmmsg(s->udp_fd, msgs, s->recv_batch, MSG_WAITFORONE, NULL);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, old_cancelstate);
+        pthread_mutex_lock(&s->mutex);
+        if (n < 0) {
+            if (ff_neterrno() != AVERROR(EAGAIN) && ff_neterrno() != AVERROR(EINTR)) {
+                s->circular_buffer_error = ff_neterrno();
+                return;
+            }
+            continue;
+        }
+
+        for (i = 0; i < n; i++) {
+            const uint8_t *data = iov[i].iov_base;
+            struct cmsghdr *cmsg;
+            int len = msgs[i].msg_len, seg = len;
+
+            for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg;
+                 cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+#ifdef UDP_GRO
+                if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+                    memcpy(&seg, CMSG_DATA(cmsg), sizeof(seg));
+#endif
+#ifdef SO_RXQ_OVFL
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+                    uint32_t drops;
+                    memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+                    s->drop_count = drops;
+                }
+#endif
+            }
+            if (ff_ip_check_source_lists(&addrs[i], &s->filters))
+                continue;
+            if (seg <= 0)
+                seg = len;
+            for (; len > 0; data += seg, len -= seg) {
+                if ((s->circular_buffer_error = circular_buffer_put(h, data, FFMIN(seg, len))) < 0)
+                    return;
+            }
+        }
+        pthread_cond_signal(&s->cond);
+    }
+}
+#endif /* HAVE_RECVMMSG */
+
 static void *circular_buffer_task_rx( void *_URLContext)
 {
     URLContext *h = _URLContext;
@@ -473,6 +594,12 @@ static void *circular_buffer_task_rx( void *_URLContext)
         s->circular_buffer_error = AVERROR(EIO);
         goto end;
     }
+#if HAVE_RECVMMSG
+    if (s->batch_buf) {
+        circular_buffer_rx_batch(h, &old_cancelstate);
+        goto end;
+    }
+#endif
     while(1) {
         int len;
         struct sockaddr_storage addr;
@@ -495,23 +622,8 @@ static void *circular_buffer_task_rx( void *_URLContext)
         }
         if (ff_ip_check_source_lists(&addr, &s->filters))
             continue;
-        AV_WL32(s->tmp, len);
-
-        if(av_fifo_space(s->fifo) < len + 4) {
-            /* No Space left */
-            if (s->overrun_nonfatal) {
-                av_log(h, AV_LOG_WARNING, "Circular buffer overrun. "
-                        "Surviving due to overrun_nonfatal option\n");
-                continue;
-            } else {
-                av_log(h, AV_LOG_ERROR, "Circular buffer overrun. "
-                        "To avoid, increase fifo_size URL option. "
-                        "To survive in such case, use overrun_nonfatal option\n");
-                s->circular_buffer_error = AVERROR(EIO);
-                goto end;
-            }
-        }
-        av_fifo_generic_write(s->fifo, s->tmp, len+4, NULL);
+        if ((s->circular_buffer_error = circular_buffer_put(h, s->tmp+4, len)) < 0)
+            goto end;
         pthread_cond_signal(&s->cond);
     }
 
@@ -694,6 +806,10 @@ static int udp_open(URLContext *h, const char *uri, int flags)
         if (av_find_info_tag(buf, sizeof(buf), "dscp", p)) {
             dscp = strtol(buf, NULL, 10);
         }
+        if (av_find_info_tag(buf, sizeof(buf), "recv_batch", p))
+            s->recv_batch = av_clip(strtol(buf, NULL, 10), 1, UDP_MAX_RECV_BATCH);
+        if (av_find_info_tag(buf, sizeof(buf), "gro", p))
+            s->gro = strtol(buf, NULL, 10);
         if (av_find_info_tag(buf, sizeof(buf), "fifo_size", p)) {
             s->circular_buffer_size = strtol(buf, NULL, 10);
             if (!HAVE_PTHREAD_CANCEL)
@@ -893,6 +1009,23 @@ static int udp_open(URLContext *h, const char *uri, int flags)
     if ((!is_output && s->circular_buffer_size) || (is_output && s->bitrate && s->circular_buffer_size)) {
         int ret;
 
+#if HAVE_RECVMMSG
+        if (!is_output && s->recv_batch > 1) {
+            int one = 1;
+            s->batch_buf = av_malloc((size_t)s->recv_batch * UDP_MAX_PKT_SIZE);
+            if (!s->batch_buf)
+                goto fail;
+#ifdef SO_RXQ_OVFL
+            if (setsockopt(udp_fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) < 0)
+                ff_log_net_error(h, AV_LOG_DEBUG, "setsockopt(SO_RXQ_OVFL)");
+#endif
+#ifdef UDP_GRO
+            if (s->gro && setsockopt(udp_fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) < 0)
+                ff_log_net_error(h, AV_LOG_WARNING, "setsockopt(UDP_GRO)");
+#endif
+        }
+#endif /* HAVE_RECVMMSG */
+
         /* start the task going */
         s->fifo = av_fifo_alloc(s->circular_buffer_size);
         ret = pthread_mutex_init(&s->mutex, NULL);
@@ -925,6 +1058,7 @@ static int udp_open(URLContext *h, const char *uri, int flags)
     if (udp_fd >= 0)
         closesocket(udp_fd);
     av_fifo_freep(&s->fifo);
+    av_freep(&s->batch_buf);
     ff_ip_reset_filters(&s->filters);
     return AVERROR(EIO);
 }
@@ -1094,6 +1228,7 @@ static int udp_close(URLContext *h)
 #endif
     closesocket(s->udp_fd);
     av_fifo_freep(&s->fifo);
+    av_freep(&s->batch_buf);
     ff_ip_reset_filters(&s->filters);
     return 0;
 }
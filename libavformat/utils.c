@@ -1983,6 +1983,41 @@ void ff_reduce_index(AVFormatContext *s, int stream_index)
     }
 }
 
+/**
+ * Make sure the index has room for nb_entries entries. The allocation is at
+ * least doubled when it has to grow, so that appending is amortized O(1).
+ * The doubled size is kept under the default allocation limit, and if it
+ * still cannot be allocated only the room needed is.
+ */
+static int reserve_index_entries(AVIndexEntry **index_entries,
+                                 unsigned int *index_entries_allocated_size,
+                                 unsigned int nb_entries)
+{
+    const size_t min_size_needed = (size_t)nb_entries * sizeof(AVIndexEntry);
+    const size_t doubled_size    = FFMIN(2 * (size_t)*index_entries_allocated_size,
+                                         INT_MAX);
+    unsigned int allocated_size  = *index_entries_allocated_size;
+    AVIndexEntry *entries        = NULL;
+
+    if (nb_entries >= UINT_MAX / sizeof(AVIndexEntry))
+        return -1;
+    if (min_size_needed <= allocated_size)
+        return 0;
+
+    if (doubled_size > min_size_needed)
+        entries = av_fast_realloc(*index_entries, &allocated_size, doubled_size);
+    if (!entries) {
+        allocated_size = *index_entries_allocated_size;
+        entries = av_fast_realloc(*index_entries, &allocated_size, min_size_needed);
+    }
+    if (!entries)
+        return -1;
+
+    *index_entries                = entries;
+    *index_entries_allocated_size = allocated_size;
+    return 0;
+}
+
 int ff_add_index_entry(AVIndexEntry **index_entries,
                        int *nb_index_entries,
                        unsigned int *index_entries_allocated_size,
@@ -1992,9 +2027,6 @@ int ff_add_index_entry(AVIndexEntry **index_entries,
     AVIndexEntry *entries, *ie;
     int index;
 
-    if ((unsigned) *nb_index_entries + 1 >= UINT_MAX / sizeof(AVIndexEntry))
-        return -1;
-
     if (timestamp == AV_NOPTS_VALUE)
         return AVERROR(EINVAL);
 
@@ -2004,17 +2036,18 @@ int ff_add_index_entry(AVIndexEntry **index_entries,
     if (is_relative(timestamp)) //FIXME this maintains previous behavior but we should shift by the correct offset once known
         timestamp -= RELATIVE_TS_BASE;
 
-    entries = av_fast_realloc(*index_entries,
-                              index_entries_allocated_size,
-                              (*nb_index_entries + 1) *
-                              sizeof(AVIndexEntry));
-    if (!entries)
+    if (reserve_index_entries(index_entries, index_entries_allocated_size,
+                              *nb_index_entries + 1) < 0)
         return -1;
 
-    *index_entries = entries;
+    entries = *index_entries;
 
-    index = ff_index_search_timestamp(*index_entries, *nb_index_entries,
-                                      timestamp, AVSEEK_FLAG_ANY);
+    // Demuxers mostly index while reading, so appending needs no search.
+    if (*nb_index_entries && entries[*nb_index_entries - 1].timestamp >= timestamp)
+        index = ff_index_search_timestamp(entries, *nb_index_entries,
+                                          timestamp, AVSEEK_FLAG_ANY);
+    else
+        index = -1;
 
     if (index < 0) {
         index = (*nb_index_entries)++;
@@ -2051,6 +2084,26 @@ int av_add_index_entry(AVStream *st, int64_t pos, int64_t timestamp,
                               timestamp, size, distance, flags);
 }
 
+int ff_add_index_entries(AVStream *st, const AVIndexEntry *entries, int nb_entries)
+{
+    int i;
+
+    if (nb_entries <= 0)
+        return 0;
+    if (reserve_index_entries(&st->index_entries, &st->index_entries_allocated_size,
+                              (unsigned)st->nb_index_entries + nb_entries) < 0)
+        return AVERROR(ENOMEM);
+
+    for (i = 0; i < nb_entries; i++) {
+        int ret = av_add_index_entry(st, entries[i].pos, entries[i].timestamp,
+                                     entries[i].size, entries[i].min_distance,
+                                     entries[i].flags);
+        if (ret < 0)
+            return ret;
+    }
+    return 0;
+}
+
 int ff_index_search_timestamp(const AVIndexEntry *entries, int nb_entries,
                               int64_t wanted_timestamp, int flags)
 {
@@ -2094,7 +2147,18 @@ int ff_index_search_timestamp(const AVIndexEntry *entries, int nb_entries,
     return m;
 }
 
+static const AVIndexEntry *get_index_entry(AVStream *st, int index)
+{
+    return index < st->nb_index_entries ? &st->index_entries[index] : NULL;
+}
+
 void ff_configure_buffers_for_index(AVFormatContext *s, int64_t time_tolerance)
+{
+    ff_configure_buffers_for_index_cb(s, time_tolerance, get_index_entry);
+}
+
+void ff_configure_buffers_for_index_cb(AVFormatContext *s, int64_t time_tolerance,
+                                       const AVIndexEntry *(*get_entry)(AVStream *st, int index))
 {
     int ist1, ist2;
     int64_t pos_delta = 0;
@@ -2118,18 +2182,17 @@ void ff_configure_buffers_for_index(AVFormatContext *s, int64_t time_tolerance)
         AVStream *st1 = s->streams[ist1];
         for (ist2 = 0; ist2 < s->nb_streams; ist2++) {
             AVStream *st2 = s->streams[ist2];
+            const AVIndexEntry *e1, *e2;
             int i1, i2;
 
             if (ist1 == ist2)
                 continue;
 
-            for (i1 = i2 = 0; i1 < st1->nb_index_entries; i1++) {
-                AVIndexEntry *e1 = &st1->index_entries[i1];
+            for (i1 = i2 = 0; (e1 = get_entry(st1, i1)); i1++) {
                 int64_t e1_pts = av_rescale_q(e1->timestamp, st1->time_base, AV_TIME_BASE_Q);
 
                 skip = FFMAX(skip, e1->size);
-                for (; i2 < st2->nb_index_entries; i2++) {
-                    AVIndexEntry *e2 = &st2->index_entries[i2];
+                for (; (e2 = get_entry(st2, i2)); i2++) {
                     int64_t e2_pts = av_rescale_q(e2->timestamp, st2->time_base, AV_TIME_BASE_Q);
                     if (e2_pts < e1_pts || e2_pts - (uint64_t)e1_pts < time_tolerance)
                         continue;
@@ -126,6 +126,39 @@ void av_application_did_http_seek(AVApplicationContext *h, void *obj, const char
     av_application_on_http_event(h, AVAPP_EVENT_DID_HTTP_SEEK, &event);
 }
 
+void av_application_will_http_reconnect(AVApplicationContext *h, void *obj, const char *url, int64_t offset, int retry)
+{
+    AVAppHttpEvent event = {0};
+
+    if (!h || !obj || !url)
+        return;
+
+    event.obj        = obj;
+    event.offset     = offset;
+    av_strlcpy(event.url, url, sizeof(event.url));
+    event.retry      = retry;
+
+    av_application_on_http_event(h, AVAPP_EVENT_WILL_HTTP_RECONNECT, &event);
+}
+
+void av_application_did_http_reconnect(AVApplicationContext *h, void *obj, const char *url, int64_t offset, int error, int http_code, int retry, int64_t bytes_lost)
+{
+    AVAppHttpEvent event = {0};
+
+    if (!h || !obj || !url)
+        return;
+
+    event.obj        = obj;
+    event.offset     = offset;
+    av_strlcpy(event.url, url, sizeof(event.url));
+    event.error      = error;
+    event.http_code  = http_code;
+    event.retry      = retry;
+    event.bytes_lost = bytes_lost;
+
+    av_application_on_http_event(h, AVAPP_EVENT_DID_HTTP_RECONNECT, &event);
+}
+
 void av_application_on_io_traffic(AVApplicationContext *h, AVAppIOTraffic *event)
 {
     if (h && h->func_on_app_event)
@@ -201,6 +234,30 @@ void av_application_on_async_read_speed(AVApplicationContext *h, AVAppAsyncReadS
         h->func_on_app_event(h, AVAPP_EVENT_ASYNC_READ_SPEED, (void *)speed, sizeof(AVAppAsyncReadSpeed));
 }
 
+void av_application_on_hls_variant_switch(AVApplicationContext *h, AVAppHlsVariantSwitch *event)
+{
+    if (h && h->func_on_app_event)
+        h->func_on_app_event(h, AVAPP_EVENT_HLS_VARIANT_SWITCH, (void *)event, sizeof(AVAppHlsVariantSwitch));
+}
+
+void av_application_on_dns_statistic(AVApplicationContext *h, AVAppDnsStatistic *statistic)
+{
+    if (h && h->func_on_app_event)
+        h->func_on_app_event(h, AVAPP_EVENT_DNS_STATISTIC, (void *)statistic, sizeof(AVAppDnsStatistic));
+}
+
+void av_application_on_tls_session_statistic(AVApplicationContext *h, AVAppTlsSessionStatistic *statistic)
+{
+    if (h && h->func_on_app_event)
+        h->func_on_app_event(h, AVAPP_EVENT_TLS_SESSION_STATISTIC, (void *)statistic, sizeof(AVAppTlsSessionStatistic));
+}
+
+void av_application_on_tcp_info(AVApplicationContext *h, AVAppTcpInfo *info)
+{
+    if (h && h->func_on_app_event)
+        h->func_on_app_event(h, AVAPP_EVENT_TCP_INFO, (void *)info, sizeof(AVAppTcpInfo));
+}
+
 void av_application_did_io_tcp_read(AVApplicationContext *h, void *obj, int bytes)
 {
     AVAppIOTraffic event = {0};
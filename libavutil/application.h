@@ -27,9 +27,15 @@
 #define AVAPP_EVENT_DID_HTTP_OPEN   2 //AVAppHttpEvent
 #define AVAPP_EVENT_WILL_HTTP_SEEK  3 //AVAppHttpEvent
 #define AVAPP_EVENT_DID_HTTP_SEEK   4 //AVAppHttpEvent
+#define AVAPP_EVENT_WILL_HTTP_RECONNECT 5 //AVAppHttpEvent
+#define AVAPP_EVENT_DID_HTTP_RECONNECT  6 //AVAppHttpEvent
 
 #define AVAPP_EVENT_ASYNC_STATISTIC     0x11000 //AVAppAsyncStatistic
 #define AVAPP_EVENT_ASYNC_READ_SPEED    0x11001 //AVAppAsyncReadSpeed
+#define AVAPP_EVENT_HLS_VARIANT_SWITCH  0x11002 //AVAppHlsVariantSwitch
+#define AVAPP_EVENT_DNS_STATISTIC       0x11003 //AVAppDnsStatistic
+#define AVAPP_EVENT_TLS_SESSION_STATISTIC 0x11004 //AVAppTlsSessionStatistic
+#define AVAPP_EVENT_TCP_INFO            0x11005 //AVAppTcpInfo
 #define AVAPP_EVENT_IO_TRAFFIC          0x12204 //AVAppIOTraffic
 
 #define AVAPP_CTRL_WILL_TCP_OPEN   0x20001 //AVAppTcpIOControl
@@ -72,6 +78,52 @@ typedef struct AVAppAsyncReadSpeed {
     int64_t elapsed_milli;
 } AVAppAsyncReadSpeed;
 
+typedef struct AVAppHlsVariantSwitch {
+    size_t  size;
+    int     from_variant;
+    int     to_variant;
+    int64_t from_bandwidth;
+    int64_t to_bandwidth;
+    int64_t estimated_bandwidth;
+    int     seq_no;
+} AVAppHlsVariantSwitch;
+
+typedef struct AVAppDnsStatistic {
+    size_t  size;
+    char    hostname[1024];
+    int     cache_hit;
+    int     error;
+    int64_t elapsed;        /* microseconds */
+    int64_t hit_count;      /* process wide */
+    int64_t miss_count;     /* process wide */
+} AVAppDnsStatistic;
+
+typedef struct AVAppTlsSessionStatistic {
+    size_t  size;
+    char    server[256];    /* host:port */
+    int     offered;        /* a cached session was offered */
+    int     resumed;        /* the server resumed it, -1 if unknown */
+    int64_t handshake_count;    /* process wide */
+    int64_t offered_count;      /* process wide */
+    int64_t resumed_count;      /* process wide */
+} AVAppTlsSessionStatistic;
+
+typedef struct AVAppTcpInfo {
+    size_t  size;
+    void   *obj;            /* tcp URLContext */
+    int64_t rtt;            /* smoothed round trip time, microseconds */
+    int64_t rtt_var;        /* microseconds */
+    int64_t min_rtt;        /* microseconds, -1 if unknown */
+    int     cwnd;           /* congestion window, segments */
+    int     snd_mss;
+    int     rcv_mss;
+    int     retransmits;    /* segments retransmitted since connecting */
+    int     lost;           /* segments currently considered lost */
+    int64_t delivery_rate;  /* bytes per second, -1 if unknown */
+    int64_t bytes_received; /* -1 if unknown */
+    int64_t elapsed;        /* microseconds since connecting */
+} AVAppTcpInfo;
+
 typedef struct AVAppHttpEvent
 {
     void    *obj;
@@ -80,6 +132,8 @@ typedef struct AVAppHttpEvent
     int      error;
     int      http_code;
     int64_t  filesize;
+    int      retry;         /* reconnect attempt, starting at 1 */
+    int64_t  bytes_lost;    /* bytes already read that are sent again */
 } AVAppHttpEvent;
 
 typedef struct AVAppIOTraffic
@@ -106,6 +160,8 @@ void av_application_will_http_open(AVApplicationContext *h, void *obj, const cha
 void av_application_did_http_open(AVApplicationContext *h, void *obj, const char *url, int error, int http_code, int64_t filesize);
 void av_application_will_http_seek(AVApplicationContext *h, void *obj, const char *url, int64_t offset);
 void av_application_did_http_seek(AVApplicationContext *h, void *obj, const char *url, int64_t offset, int error, int http_code);
+void av_application_will_http_reconnect(AVApplicationContext *h, void *obj, const char *url, int64_t offset, int retry);
+void av_application_did_http_reconnect(AVApplicationContext *h, void *obj, const char *url, int64_t offset, int error, int http_code, int retry, int64_t bytes_lost);
 
 void av_application_did_io_tcp_read(AVApplicationContext *h, void *obj, int bytes);
 
@@ -116,6 +172,10 @@ int av_application_on_tcp_did_open(AVApplicationContext *h, int error, int fd, A
 
 void av_application_on_async_statistic(AVApplicationContext *h, AVAppAsyncStatistic *statistic);
 void av_application_on_async_read_speed(AVApplicationContext *h, AVAppAsyncReadSpeed *speed);
+void av_application_on_hls_variant_switch(AVApplicationContext *h, AVAppHlsVariantSwitch *event);
+void av_application_on_dns_statistic(AVApplicationContext *h, AVAppDnsStatistic *statistic);
+void av_application_on_tls_session_statistic(AVApplicationContext *h, AVAppTlsSessionStatistic *statistic);
+void av_application_on_tcp_info(AVApplicationContext *h, AVAppTcpInfo *info);
 
 
 #endif /* AVUTIL_APPLICATION_H */
@@ -31,6 +31,8 @@ typedef struct DnsCacheContext {
     AVDictionary *dns_dictionary;
     pthread_mutex_t dns_dictionary_mutex;
     int initialized;
+    int64_t hit_count;
+    int64_t miss_count;
 } DnsCacheContext;
 
 static DnsCacheContext *context = NULL;
@@ -52,12 +54,41 @@ static void inner_init(void) {
 static void free_private_addrinfo(struct addrinfo **p_ai) {
     struct addrinfo *ai = *p_ai;
 
-    if (ai) {
-        if (ai->ai_addr) {
-            av_freep(&ai->ai_addr);
+    while (ai) {
+        struct addrinfo *next = ai->ai_next;
+        av_freep(&ai->ai_addr);
+        av_freep(&ai);
+        ai = next;
+    }
+    *p_ai = NULL;
+}
+
+static struct addrinfo *dup_private_addrinfo(struct addrinfo *cur_ai) {
+    struct addrinfo *res = NULL, **p_next = &res;
+
+    for (; cur_ai; cur_ai = cur_ai->ai_next) {
+        struct addrinfo *ai = (struct addrinfo *) av_mallocz(sizeof(struct addrinfo));
+        if (!ai) {
+            goto fail;
+        }
+        memcpy(ai, cur_ai, sizeof(struct addrinfo));
+        ai->ai_canonname = NULL;
+        ai->ai_next      = NULL;
+        *p_next          = ai;
+        p_next           = &ai->ai_next;
+
+        /* sockaddr is too small for IPv6 addresses */
+        ai->ai_addr = (struct sockaddr *) av_memdup(cur_ai->ai_addr, cur_ai->ai_addrlen);
+        if (!ai->ai_addr) {
+            goto fail;
         }
-        av_freep(p_ai);
     }
+
+    return res;
+
+fail:
+    free_private_addrinfo(&res);
+    return NULL;
 }
 
 static int inner_remove_dns_cache(char *hostname, DnsCacheEntry *dns_cache_entry) {
@@ -74,7 +105,7 @@ static int inner_remove_dns_cache(char *hostname, DnsCacheEntry *dns_cache_entry
     return 0;
 }
 
-static DnsCacheEntry *new_dns_cache_entry(char *hostname, struct addrinfo *cur_ai, int64_t timeout) {
+static DnsCacheEntry *new_dns_cache_entry(char *hostname, struct addrinfo *cur_ai, int error, int64_t timeout) {
     DnsCacheEntry *new_entry = NULL;
     int64_t cur_time         = av_gettime_relative();
 
@@ -87,24 +118,15 @@ static DnsCacheEntry *new_dns_cache_entry(char *hostname, struct addrinfo *cur_a
         goto fail;
     }
 
-    new_entry->res = (struct addrinfo *) av_mallocz(sizeof(struct addrinfo));
-    if (!new_entry->res) {
-        av_freep(&new_entry);
-        goto fail;
-    }
-
-    memcpy(new_entry->res, cur_ai, sizeof(struct addrinfo));
-
-    new_entry->res->ai_addr = (struct sockaddr *) av_mallocz(sizeof(struct sockaddr));
-    if (!new_entry->res->ai_addr) {
-        av_freep(&new_entry->res);
-        av_freep(&new_entry);
-        goto fail;
+    if (cur_ai) {
+        new_entry->res = dup_private_addrinfo(cur_ai);
+        if (!new_entry->res) {
+            av_freep(&new_entry);
+            goto fail;
+        }
     }
 
-    memcpy(new_entry->res->ai_addr, cur_ai->ai_addr, sizeof(struct sockaddr));
-    new_entry->res->ai_canonname = NULL;
-    new_entry->res->ai_next      = NULL;
+    new_entry->error             = error;
     new_entry->ref_count         = 0;
     new_entry->delete_flag       = 0;
     new_entry->expired_time      = cur_time + timeout * 1000;
@@ -144,6 +166,11 @@ DnsCacheEntry *get_dns_cache_reference(char *hostname) {
                 }
             }
         }
+        if (dns_cache_entry) {
+            context->hit_count++;
+        } else {
+            context->miss_count++;
+        }
         pthread_mutex_unlock(&context->dns_dictionary_mutex);
     }
 
@@ -192,7 +219,7 @@ int remove_dns_cache_entry(char *hostname) {
     return 0;
 }
 
-int add_dns_cache_entry(char *hostname, struct addrinfo *cur_ai, int64_t timeout) {
+static int inner_add_dns_cache_entry(char *hostname, struct addrinfo *cur_ai, int error, int64_t timeout) {
     DnsCacheEntry *new_entry = NULL;
     DnsCacheEntry *old_entry = NULL;
     AVDictionaryEntry *elem  = NULL;
@@ -201,8 +228,10 @@ int add_dns_cache_entry(char *hostname, struct addrinfo *cur_ai, int64_t timeout
         goto fail;
     }
 
-    if (cur_ai == NULL || cur_ai->ai_addr == NULL) {
-        goto fail;
+    if (!context || !context->initialized) {
+#if HAVE_PTHREADS
+        pthread_once(&key_once, inner_init);
+#endif
     }
 
     if (context && context->initialized) {
@@ -215,7 +244,7 @@ int add_dns_cache_entry(char *hostname, struct addrinfo *cur_ai, int64_t timeout
                 goto fail;
             }
         }
-        new_entry = new_dns_cache_entry(hostname, cur_ai, timeout);
+        new_entry = new_dns_cache_entry(hostname, cur_ai, error, timeout);
         if (new_entry) {
             av_dict_set_int(&context->dns_dictionary, hostname, (int64_t) (intptr_t) new_entry, 0);
         }
@@ -227,3 +256,31 @@ int add_dns_cache_entry(char *hostname, struct addrinfo *cur_ai, int64_t timeout
 fail:
     return -1;
 }
+
+int add_dns_cache_entry(char *hostname, struct addrinfo *cur_ai, int64_t timeout) {
+    if (cur_ai == NULL || cur_ai->ai_addr == NULL) {
+        return -1;
+    }
+
+    return inner_add_dns_cache_entry(hostname, cur_ai, 0, timeout);
+}
+
+int add_dns_cache_error_entry(char *hostname, int error, int64_t timeout) {
+    if (!error) {
+        return -1;
+    }
+
+    return inner_add_dns_cache_entry(hostname, NULL, error, timeout);
+}
+
+void get_dns_cache_statistic(int64_t *hit_count, int64_t *miss_count) {
+    *hit_count  = 0;
+    *miss_count = 0;
+
+    if (context && context->initialized) {
+        pthread_mutex_lock(&context->dns_dictionary_mutex);
+        *hit_count  = context->hit_count;
+        *miss_count = context->miss_count;
+        pthread_mutex_unlock(&context->dns_dictionary_mutex);
+    }
+}
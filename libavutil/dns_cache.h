@@ -27,12 +27,15 @@ typedef struct DnsCacheEntry {
     volatile int ref_count;
     volatile int delete_flag;
     int64_t expired_time;
-    struct addrinfo *res;  // construct by private function, not support ai_next and ai_canonname, can only be released using free_private_addrinfo
+    struct addrinfo *res;  // construct by private function, not support ai_canonname, can only be released using free_private_addrinfo
+    int error;             // getaddrinfo() error of a negative entry, res is NULL then
 } DnsCacheEntry;
 
 DnsCacheEntry *get_dns_cache_reference(char *hostname);
 int release_dns_cache_reference(char *hostname, DnsCacheEntry **p_entry);
 int remove_dns_cache_entry(char *hostname);
 int add_dns_cache_entry(char *hostname, struct addrinfo *cur_ai, int64_t timeout);
+int add_dns_cache_error_entry(char *hostname, int error, int64_t timeout);
+void get_dns_cache_statistic(int64_t *hit_count, int64_t *miss_count);
 
 #endif /* AVUTIL_DNS_CACHE_H */
@@ -0,0 +1,174 @@
+/*
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/**
+ * Index insertion test and micro-benchmark
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "libavutil/time.h"
+#include "libavformat/avformat.h"
+#include "libavformat/internal.h"
+
+static int check_index(AVStream *st, int nb_entries)
+{
+    int i;
+
+    if (st->nb_index_entries != nb_entries) {
+        fprintf(stderr, "expected %d entries, got %d\n", nb_entries, st->nb_index_entries);
+        return -1;
+    }
+    for (i = 0; i < st->nb_index_entries; i++) {
+        const AVIndexEntry *e = &st->index_entries[i];
+        if (i && e->timestamp <= e[-1].timestamp) {
+            fprintf(stderr, "entry %d is out of order\n", i);
+            return -1;
+        }
+        if (e->pos != e->timestamp * 10) {
+            fprintf(stderr, "entry %d has pos %"PRId64" for timestamp %"PRId64"\n",
+                    i, e->pos, e->timestamp);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+#if !CONFIG_SHARED
+/* ff_add_index_entries() must build the same index as av_add_index_entry()
+ * called for each entry, whatever the order of the timestamps. */
+static int check_batch(AVFormatContext *s, const int64_t *timestamps, int nb_entries)
+{
+    AVIndexEntry entries[16];
+    AVStream *ref = avformat_new_stream(s, NULL);
+    AVStream *st  = avformat_new_stream(s, NULL);
+    int i;
+
+    if (!ref || !st || nb_entries > FF_ARRAY_ELEMS(entries))
+        return -1;
+    for (i = 0; i < nb_entries; i++) {
+        AVIndexEntry e = { .pos = 100 * i, .timestamp = timestamps[i],
+                           .size = i, .min_distance = 0, .flags = i & 1 };
+        entries[i] = e;
+        if (av_add_index_entry(ref, e.pos, e.timestamp, e.size, 0, e.flags) < 0)
+            return -1;
+    }
+    if (ff_add_index_entries(st, entries, nb_entries) < 0)
+        return -1;
+    if (st->nb_index_entries != ref->nb_index_entries ||
+        memcmp(st->index_entries, ref->index_entries,
+               ref->nb_index_entries * sizeof(*ref->index_entries))) {
+        fprintf(stderr, "batch index differs from the one added entry by entry\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int test_batch(AVFormatContext *s)
+{
+    static const int64_t sorted[]     = { 0, 10, 20, 30, 40, 50 };
+    static const int64_t unsorted[]   = { 40, 0, 50, 20, 10, 30 };
+    static const int64_t duplicates[] = { 10, 0, 10, 20, 0, 20, 20 };
+    AVIndexEntry bad[2] = { { .timestamp = 0 }, { .timestamp = AV_NOPTS_VALUE } };
+    AVStream *st;
+
+    if (check_batch(s, sorted,     FF_ARRAY_ELEMS(sorted))   < 0 ||
+        check_batch(s, unsorted,   FF_ARRAY_ELEMS(unsorted)) < 0 ||
+        check_batch(s, duplicates, FF_ARRAY_ELEMS(duplicates)) < 0)
+        return -1;
+    /* the unsorted and duplicate batches come out in order, without repeats */
+    if (s->streams[3]->nb_index_entries != 6 || s->streams[5]->nb_index_entries != 3)
+        return -1;
+
+    /* a rejected entry is reported, the ones before it are kept */
+    st = avformat_new_stream(s, NULL);
+    if (!st || ff_add_index_entries(st, bad, 2) != AVERROR(EINVAL) ||
+        st->nb_index_entries != 1)
+        return -1;
+    return 0;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    AVFormatContext *s;
+    AVStream *st;
+    int nb_entries = 1000000, nb_inserts = 1000;
+    int64_t start, elapsed;
+    int i, ret = 1;
+
+    if (argc > 1)
+        nb_entries = atoi(argv[1]);
+    if (nb_entries <= 0)
+        return 1;
+    nb_inserts = FFMIN(nb_inserts, nb_entries);
+
+    s = avformat_alloc_context();
+    if (!s)
+        return 1;
+    st = avformat_new_stream(s, NULL);
+    if (!st)
+        goto end;
+
+    /* Even timestamps, appended as a demuxer does while reading. */
+    start = av_gettime_relative();
+    for (i = 0; i < nb_entries; i++)
+        if (av_add_index_entry(st, 20LL * i, 2LL * i, 0, 0, AVINDEX_KEYFRAME) != i)
+            goto end;
+    elapsed = av_gettime_relative() - start;
+    printf("append: %d entries, %.1f ns per entry\n",
+           nb_entries, elapsed * 1000.0 / nb_entries);
+    if (check_index(st, nb_entries) < 0)
+        goto end;
+
+    /* Adding an existing timestamp updates the entry in place. */
+    if (av_add_index_entry(st, 20, 2, 0, 0, 0) != 1 ||
+        st->nb_index_entries != nb_entries || st->index_entries[1].flags)
+        goto end;
+
+    /* Odd timestamps spread over the index, which have to be moved in. */
+    start = av_gettime_relative();
+    for (i = 0; i < nb_inserts; i++) {
+        int64_t ts = 2LL * (int)((int64_t)i * nb_entries / nb_inserts) + 1;
+        if (av_add_index_entry(st, ts * 10, ts, 0, 0, AVINDEX_KEYFRAME) < 0)
+            goto end;
+    }
+    elapsed = av_gettime_relative() - start;
+    printf("insert: %d entries, %.1f ns per entry\n",
+           nb_inserts, elapsed * 1000.0 / nb_inserts);
+    if (check_index(st, nb_entries + nb_inserts) < 0)
+        goto end;
+
+    if (av_index_search_timestamp(st, 2LL * (nb_entries - 1), 0) < 0 ||
+        av_index_search_timestamp(st, 2LL * nb_entries, 0) >= 0)
+        goto end;
+
+#if !CONFIG_SHARED
+    if (test_batch(s) < 0)
+        goto end;
+#endif
+
+    ret = 0;
+end:
+    avformat_free_context(s);
+    return ret;
+}
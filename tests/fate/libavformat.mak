@@ -1,6 +1,22 @@
-#FATE_LIBAVFORMAT-$(HAVE_PTHREADS) += fate-async
-#fate-async: libavformat/tests/async$(EXESUF)
-#fate-async: CMD = run libavformat/tests/async
+FATE_LIBAVFORMAT-$(call ALLYES, ASYNC_PROTOCOL FILE_PROTOCOL) += fate-async
+fate-async: libavformat/tests/async$(EXESUF)
+fate-async: CMD = run libavformat/tests/async$(EXESUF) 4
+fate-async: CMP = null
+
+FATE_LIBAVFORMAT-$(call ALLYES, ASYNC_PROTOCOL FILE_PROTOCOL) += fate-async-spill
+fate-async-spill: libavformat/tests/async$(EXESUF)
+fate-async-spill: CMD = run libavformat/tests/async$(EXESUF) -s 16
+fate-async-spill: CMP = null
+
+FATE_LIBAVFORMAT-$(call ALLYES, ASYNC_PROTOCOL FILE_PROTOCOL) += fate-async-spill-recycle
+fate-async-spill-recycle: libavformat/tests/async$(EXESUF)
+fate-async-spill-recycle: CMD = run libavformat/tests/async$(EXESUF) -S 16 1000
+fate-async-spill-recycle: CMP = null
+
+FATE_LIBAVFORMAT-$(call ALLYES, CACHE_PROTOCOL FILE_PROTOCOL) += fate-cache
+fate-cache: libavformat/tests/cache$(EXESUF)
+fate-cache: CMD = run libavformat/tests/cache$(EXESUF) 4 20000
+fate-cache: CMP = null
 
 FATE_LIBAVFORMAT-$(CONFIG_NETWORK) += fate-noproxy
 fate-noproxy: libavformat/tests/noproxy$(EXESUF)
@@ -14,6 +30,28 @@ FATE_LIBAVFORMAT-$(CONFIG_SRTP) += fate-srtp
 fate-srtp: libavformat/tests/srtp$(EXESUF)
 fate-srtp: CMD = run libavformat/tests/srtp$(EXESUF)
 
+FATE_LIBAVFORMAT_THREADS-$(call ALLYES, DASH_DEMUXER AAC_DEMUXER AAC_DECODER HTTP_PROTOCOL) += fate-dash-prefetch
+fate-dash-prefetch: libavformat/tests/dashprefetch$(EXESUF)
+fate-dash-prefetch: CMD = run libavformat/tests/dashprefetch$(EXESUF)
+
+FATE_LIBAVFORMAT_THREADS-$(CONFIG_HTTP_PROTOCOL) += fate-http-parallel
+fate-http-parallel: libavformat/tests/httpparallel$(EXESUF)
+fate-http-parallel: CMD = run libavformat/tests/httpparallel$(EXESUF)
+
+FATE_LIBAVFORMAT_THREADS-$(CONFIG_HTTP_PROTOCOL) += fate-http-reconnect
+fate-http-reconnect: libavformat/tests/httpreconnect$(EXESUF)
+fate-http-reconnect: CMD = run libavformat/tests/httpreconnect$(EXESUF)
+
+FATE_LIBAVFORMAT_THREADS-$(call ALLYES, MOV_DEMUXER HTTP_PROTOCOL) += fate-mov-moov-prefetch
+fate-mov-moov-prefetch: libavformat/tests/movprefetch$(EXESUF)
+fate-mov-moov-prefetch: CMD = run libavformat/tests/movprefetch$(EXESUF)
+
+FATE_LIBAVFORMAT_THREADS-$(CONFIG_TLS_PROTOCOL) += fate-tls-session
+fate-tls-session: libavformat/tests/tls$(EXESUF)
+fate-tls-session: CMD = run libavformat/tests/tls$(EXESUF) $(TARGET_PATH)/tests/data/fate/tls-session
+
+FATE_LIBAVFORMAT-$(HAVE_THREADS) += $(FATE_LIBAVFORMAT_THREADS-yes)
+
 FATE_LIBAVFORMAT-yes += fate-url
 fate-url: libavformat/tests/url$(EXESUF)
 fate-url: CMD = run libavformat/tests/url$(EXESUF)
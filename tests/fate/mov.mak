@@ -21,6 +21,7 @@ FATE_MOV = fate-mov-3elist \
 FATE_MOV_FFPROBE = fate-mov-neg-firstpts-discard \
                    fate-mov-neg-firstpts-discard-vorbis \
                    fate-mov-aac-2048-priming \
+                   fate-mov-aac-2048-priming-compact-index \
                    fate-mov-zombie \
                    fate-mov-init-nonkeyframe \
                    fate-mov-displaymatrix \
@@ -32,11 +33,18 @@ FATE_MOV_FFPROBE = fate-mov-neg-firstpts-discard \
 
 FATE_MOV_FASTSTART = fate-mov-faststart-4gb-overflow \
 
-FATE_SAMPLES_AVCONV += $(FATE_MOV)
+FATE_MOV_COMPACT_INDEX = fate-mov-1elist-noctts-compact-index \
+                         fate-mov-1elist-1ctts-compact-index \
+                         fate-mov-440hz-10ms-compact-index \
+
+FATE_SAMPLES_AVCONV += $(FATE_MOV) $(FATE_MOV_COMPACT_INDEX)
 FATE_SAMPLES_FFPROBE += $(FATE_MOV_FFPROBE)
 FATE_SAMPLES_FASTSTART += $(FATE_MOV_FASTSTART)
 
-fate-mov: $(FATE_MOV) $(FATE_MOV_FFPROBE) $(FATE_MOV_FASTSTART)
+FATE_MOV_COMPACT_INDEX_LAVF-$(call ENCDEC2, MPEG4, PCM_ALAW, MOV) += fate-mov-compact-index
+FATE_AVCONV += $(FATE_MOV_COMPACT_INDEX_LAVF-yes)
+
+fate-mov: $(FATE_MOV) $(FATE_MOV_FFPROBE) $(FATE_MOV_FASTSTART) $(FATE_MOV_COMPACT_INDEX) $(FATE_MOV_COMPACT_INDEX_LAVF-yes)
 
 # Make sure we handle edit lists correctly in normal cases.
 fate-mov-1elist-noctts: CMD = framemd5 -i $(TARGET_SAMPLES)/mov/mov-1elist-noctts.mov
@@ -119,6 +127,18 @@ fate-mov-guess-delay-1: CMD = run ffprobe$(PROGSSUF)$(EXESUF) -show_entries stre
 fate-mov-guess-delay-2: CMD = run ffprobe$(PROGSSUF)$(EXESUF) -show_entries stream=has_b_frames -select_streams v $(TARGET_SAMPLES)/h264/h264_3bf_pyramid_nobsrestriction.mp4
 fate-mov-guess-delay-3: CMD = run ffprobe$(PROGSSUF)$(EXESUF) -show_entries stream=has_b_frames -select_streams v $(TARGET_SAMPLES)/h264/h264_4bf_pyramid_nobsrestriction.mp4
 
+# The compact sample index must give the same packets as the full one.
+fate-mov-1elist-noctts-compact-index: CMD = framemd5 -compact_index 1 -i $(TARGET_SAMPLES)/mov/mov-1elist-noctts.mov
+fate-mov-1elist-noctts-compact-index: REF = $(SRC_PATH)/tests/ref/fate/mov-1elist-noctts
+fate-mov-1elist-1ctts-compact-index: CMD = framemd5 -compact_index 1 -i $(TARGET_SAMPLES)/mov/mov-1elist-1ctts.mov
+fate-mov-1elist-1ctts-compact-index: REF = $(SRC_PATH)/tests/ref/fate/mov-1elist-1ctts
+fate-mov-440hz-10ms-compact-index: CMD = framemd5 -compact_index 1 -i $(TARGET_SAMPLES)/mov/440hz-10ms.m4a
+fate-mov-440hz-10ms-compact-index: REF = $(SRC_PATH)/tests/ref/fate/mov-440hz-10ms
+fate-mov-aac-2048-priming-compact-index: CMD = run ffprobe$(PROGSSUF)$(EXESUF) -compact_index 1 -show_packets -print_format compact $(TARGET_SAMPLES)/mov/aac-2048-priming.mov
+fate-mov-aac-2048-priming-compact-index: REF = $(SRC_PATH)/tests/ref/fate/mov-aac-2048-priming
+fate-mov-compact-index: fate-lavf-mov
+fate-mov-compact-index: CMD = framecrc -compact_index 1 -i $(TARGET_PATH)/tests/data/lavf/lavf.mov -c copy
+
 fate-mov-faststart-4gb-overflow: CMD = run tools/qt-faststart$(EXESUF) $(TARGET_SAMPLES)/mov/faststart-4gb-overflow.mov $(TARGET_PATH)/faststart-4gb-overflow-output.mov > /dev/null ; do_md5sum faststart-4gb-overflow-output.mov | cut -d " " -f1 ; rm faststart-4gb-overflow-output.mov
 fate-mov-faststart-4gb-overflow: CMP = oneline
 fate-mov-faststart-4gb-overflow: REF = bc875921f151871e787c4b4023269b29
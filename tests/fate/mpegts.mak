@@ -22,4 +22,19 @@ fate-mpegts-probe-pmt-merge: CMD = run $(PROBE_CODEC_NAME_COMMAND) -merge_pmt_ve
 
 FATE_SAMPLES_FFPROBE += $(FATE_MPEGTS_PROBE-yes)
 
-fate-mpegts: $(FATE_MPEGTS_PROBE-yes)
+#
+# Test that pes_gather returns the same frames as the default path
+#
+FATE_MPEGTS_PES_GATHER-$(call ENCDEC2, MPEG2VIDEO, MP2, MPEGTS) += fate-mpegts-pes-gather
+fate-mpegts-pes-gather: fate-lavf-ts
+fate-mpegts-pes-gather: CMD = framecrc -pes_gather 1 -i $(TARGET_PATH)/tests/data/lavf/lavf.ts -c copy
+
+
+# frames above the 200 KiB the default path splits PES packets at
+FATE_MPEGTS_PES_GATHER-$(call ALLYES, IMAGE2_DEMUXER PGMYUV_DECODER SCALE_FILTER MPEG2VIDEO_ENCODER MPEGTS_MUXER MPEGTS_DEMUXER MPEGVIDEO_PARSER) += fate-mpegts-pes-gather-large
+fate-mpegts-pes-gather-large: $(VREF)
+fate-mpegts-pes-gather-large: CMD = ffmpeg -f image2 -c:v pgmyuv -i $(TARGET_PATH)/tests/vsynth1/%02d.pgm -frames 4 -s 1408x1152 -sws_flags +accurate_rnd+bitexact -c:v mpeg2video -qscale 1 -g 1 -flags +bitexact -fflags +bitexact -f mpegts -y $(TARGET_PATH)/tests/data/fate/mpegts-pes-gather-large.ts && framecrc -pes_gather 1 -i $(TARGET_PATH)/tests/data/fate/mpegts-pes-gather-large.ts -c copy
+
+FATE_AVCONV += $(FATE_MPEGTS_PES_GATHER-yes)
+
+fate-mpegts: $(FATE_MPEGTS_PROBE-yes) $(FATE_MPEGTS_PES_GATHER-yes)